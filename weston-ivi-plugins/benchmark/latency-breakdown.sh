@@ -0,0 +1,100 @@
+#!/bin/bash
+#
+# Copyright (C) 2017 Advanced Driver Information Technology GmbH, Advanced Driver Information Technology Corporation, Robert Bosch GmbH, Robert Bosch Car Multimedia GmbH, DENSO Corporation
+#
+# Permission is hereby granted, free of charge, to any person obtaining
+# a copy of this software and associated documentation files (the
+# "Software"), to deal in the Software without restriction, including
+# without limitation the rights to use, copy, modify, merge, publish,
+# distribute, sublicense, and/or sell copies of the Software, and to
+# permit persons to whom the Software is furnished to do so, subject to
+# the following conditions:
+#
+# The above copyright notice and this permission notice (including the
+# next paragraph) shall be included in all copies or substantial
+# portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+# EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+# MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+# NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+# BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+# ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+# CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+#
+# Per-stage latency from a waltham-receiver stats file (-s): capture,
+# encode, network, decode, present and total, as p50/p99 in microseconds.
+#
+# Capture times are on the transmitter's clock. Unless both sides share
+# the clock (--same-clock, e.g. loopback), frames are moved to the
+# receiver's clock with the offset the transmitter estimated (the
+# clock_offset_us column). Frames from before the first estimate fall back
+# to the smallest arrival - sent seen, which leaves out the best case
+# one-way delay from network and total.
+
+set -u
+
+SAME_CLOCK=0
+
+usage()
+{
+	echo "Usage: $0 [--same-clock] stats.csv"
+}
+
+while [ $# -gt 1 ]; do
+	case "$1" in
+	--same-clock) SAME_CLOCK=1 ;;
+	-h|--help) usage; exit 0 ;;
+	*) usage >&2; exit 1 ;;
+	esac
+	shift
+done
+
+if [ $# -ne 1 ] || [ ! -r "$1" ]; then
+	usage >&2
+	exit 1
+fi
+
+# columns: surface,frame,arrival_us,decode_us,size,tx_frame,capture_us,
+#          capture_dur_us,encode_dur_us,present_us,clock_offset_us
+awk -F, -v same="$SAME_CLOCK" '
+	FNR == 1 { next }
+	$6 < 0 || $3 < 0 || $4 < 0 { next }
+	FNR == NR {
+		d = $3 - ($7 + $8 + $9)
+		if (!n++ || d < offset)
+			offset = d
+		next
+	}
+	{
+		off = same ? 0 : $11 != "" ? $11 : offset
+		sent = $7 + $8 + $9
+		print "capture", $8
+		print "encode", $9
+		print "network", $3 - sent - off
+		print "decode", $4
+		print "present", $10 - $3 - $4
+		print "total", $10 - $7 - off
+	}' "$1" "$1" | sort -k1,1 -k2,2n |
+awk '
+	BEGIN { printf "{ " }
+	function rank(n, p,    i) {
+		i = int(n * p)
+		if (i < n * p)
+			i++
+		return i < 1 ? 1 : i
+	}
+	function flush() {
+		if (stage == "")
+			return
+		printf "%s\"%s\": { \"p50\": %d, \"p99\": %d }", sep, stage,
+			v[rank(n, 0.50)], v[rank(n, 0.99)]
+		sep = ", "
+	}
+	$1 != stage { flush(); stage = $1; n = 0 }
+	{ v[++n] = $2 }
+	END {
+		flush()
+		printf " }\n"
+	}'
@@ -0,0 +1,280 @@
+#!/bin/bash
+#
+# Copyright (C) 2017 Advanced Driver Information Technology GmbH, Advanced Driver Information Technology Corporation, Robert Bosch GmbH, Robert Bosch Car Multimedia GmbH, DENSO Corporation
+#
+# Permission is hereby granted, free of charge, to any person obtaining
+# a copy of this software and associated documentation files (the
+# "Software"), to deal in the Software without restriction, including
+# without limitation the rights to use, copy, modify, merge, publish,
+# distribute, sublicense, and/or sell copies of the Software, and to
+# permit persons to whom the Software is furnished to do so, subject to
+# the following conditions:
+#
+# The above copyright notice and this permission notice (including the
+# next paragraph) shall be included in all copies or substantial
+# portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+# EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+# MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+# NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+# BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+# ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+# CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+#
+# Loopback benchmark: headless weston with transmitter.so, an animated
+# client on the transmitter output and a headless waltham-receiver, once
+# per stream profile and region of interest setting. Writes one JSON
+# document with the results.
+#
+# See README.md in this directory for the requirements.
+
+set -u
+
+RECEIVER=waltham-receiver
+WESTON=weston
+TRANSMITTER=transmitter.so
+CLIENT=weston-simple-shm
+LAYER_ADD=layer-add-surfaces
+BREAKDOWN=$(dirname "$0")/latency-breakdown.sh
+PROFILES="jpeg h264"
+ROI=on
+SKIP=damage
+QUALITY=false
+PORT=34400
+WIDTH=1920
+HEIGHT=1080
+WARMUP=5
+DURATION=30
+OUTPUT=-
+
+usage()
+{
+	cat <<EOF
+Usage: $0 [options]
+Options:
+  --receiver path     waltham-receiver binary (Default: $RECEIVER)
+  --weston path       weston binary (Default: $WESTON)
+  --transmitter path  transmitter module (Default: $TRANSMITTER)
+  --client cmd        animated client (Default: $CLIENT)
+  --profiles list     stream profiles to run, jpeg, h264 and/or raw
+                      (Default: "$PROFILES")
+  --roi list          region of interest settings to run each profile
+                      with, on and/or off (Default: "$ROI")
+  --skip mode         skip-unchanged of the output (Default: $SKIP)
+  --quality           measure the Y-PSNR of the stream
+  --port number       waltham TCP port (Default: $PORT)
+  --size WxH          transmitter output size (Default: ${WIDTH}x${HEIGHT})
+  --warmup seconds    time before measuring (Default: $WARMUP)
+  --duration seconds  measuring time per profile (Default: $DURATION)
+  --output file       JSON results, - for stdout (Default: $OUTPUT)
+EOF
+}
+
+while [ $# -gt 0 ]; do
+	case "$1" in
+	--receiver) RECEIVER=$2; shift ;;
+	--weston) WESTON=$2; shift ;;
+	--transmitter) TRANSMITTER=$2; shift ;;
+	--client) CLIENT=$2; shift ;;
+	--profiles) PROFILES=$2; shift ;;
+	--roi) ROI=$2; shift ;;
+	--skip) SKIP=$2; shift ;;
+	--quality) QUALITY=true ;;
+	--port) PORT=$2; shift ;;
+	--size) WIDTH=${2%x*}; HEIGHT=${2#*x}; shift ;;
+	--warmup) WARMUP=$2; shift ;;
+	--duration) DURATION=$2; shift ;;
+	--output) OUTPUT=$2; shift ;;
+	-h|--help) usage; exit 0 ;;
+	*) usage >&2; exit 1 ;;
+	esac
+	shift
+done
+
+WORKDIR=$(mktemp -d /tmp/waltham-benchmark.XXXXXX)
+export XDG_RUNTIME_DIR=$WORKDIR
+chmod 0700 "$WORKDIR"
+SOCKET=waltham-benchmark
+OUTPUT_NAME="transmitter-127.0.0.1:$PORT-1"
+CLK_TCK=$(getconf CLK_TCK)
+PIDS=""
+
+cleanup()
+{
+	[ -n "$PIDS" ] && kill $PIDS 2>/dev/null
+	wait 2>/dev/null
+	PIDS=""
+}
+trap 'cleanup; rm -rf "$WORKDIR"' EXIT
+
+# utime + stime of a process, in clock ticks
+cpu_ticks()
+{
+	awk '{ sub(/^.*\) /, ""); print $12 + $13 }' "/proc/$1/stat" 2>/dev/null || echo 0
+}
+
+wait_for()
+{
+	local i
+	for i in $(seq 50); do
+		[ -e "$1" ] && return 0
+		sleep 0.1
+	done
+	echo "timeout waiting for $1" >&2
+	return 1
+}
+
+# frames, fps, decode latency percentiles, bandwidth and the per-stage
+# latency breakdown from the receiver's per-frame CSV. The receiver's
+# timestamps are CLOCK_MONOTONIC, which the shell cannot read, so the window
+# is the last $2 seconds of the file: the pipeline is stopped right after
+# the measuring time.
+summarize()
+{
+	local window=$WORKDIR/window.csv
+
+	awk -F, -v secs="$2" '
+		FNR == NR {
+			if (FNR > 1 && $3 > t1)
+				t1 = $3
+			next
+		}
+		FNR > 1 && $3 >= t1 - secs * 1000000' "$1" "$1" > "$window"
+
+	# nearest rank percentiles over the sorted decode times
+	awk -F, '$4 >= 0 { print $4 }' "$window" | sort -n |
+	awk -v secs="$2" -v frames="$(wc -l < "$window")" \
+	    -v bytes="$(awk -F, '$5 > 0 { b += $5 } END { print b + 0 }' "$window")" '
+		function rank(p,    i) {
+			i = int(NR * p)
+			if (i < NR * p)
+				i++
+			return i < 1 ? 1 : i
+		}
+		{ lat[NR] = $1 }
+		END {
+			p50 = NR ? lat[rank(0.50)] : -1
+			p99 = NR ? lat[rank(0.99)] : -1
+			printf "\"frames\": %d, \"fps\": %.2f, ", frames, frames / secs
+			printf "\"decode_latency_us\": { \"p50\": %d, \"p99\": %d }, ", p50, p99
+			printf "\"bandwidth_kbps\": %.1f, ", bytes * 8 / 1000 / secs
+		}'
+
+	# both ends run on this machine, so they share CLOCK_MONOTONIC
+	{ head -n 1 "$1"; cat "$window"; } > "$WORKDIR/trace.csv"
+	printf '"latency_us": %s' "$("$BREAKDOWN" --same-clock "$WORKDIR/trace.csv")"
+}
+
+# mean of the Y-PSNR lines the transmitter logged while measuring, one
+# every 5 s
+quality()
+{
+	grep -o 'Y-PSNR [0-9.]* dB over [0-9]* frames' "$1" |
+	tail -n "$(( $2 / 5 > 0 ? $2 / 5 : 1 ))" |
+	awk '{ sum += $2 * $5; n += $5 }
+	     END { printf "%.2f", n ? sum / n : -1 }'
+}
+
+run_profile()
+{
+	local profile=$1
+	local roi=$2
+	local run=$profile-roi-$roi
+	local stats=$WORKDIR/stats-$run.csv
+	local ini=$WORKDIR/weston-$run.ini
+	local rx_pid wst_pid cl_pid
+	local rx0 wst0 rx1 wst1
+
+	cat > "$ini" <<EOF
+[core]
+shell=ivi-shell.so
+modules=$TRANSMITTER
+
+[ivi-shell]
+ivi-module=ivi-controller.so
+
+[transmitter-output]
+output-name=transmitter_1
+server-address=127.0.0.1
+port=$PORT
+width=$WIDTH
+height=$HEIGHT
+roi=$([ "$roi" = on ] && echo true || echo false)
+skip-unchanged=$SKIP
+quality=$QUALITY
+transport=$([ "$profile" = raw ] && echo raw || echo video)
+EOF
+
+	"$RECEIVER" -p "$PORT" -H -c "$profile" -s "$stats" \
+		> "$WORKDIR/receiver-$run.log" 2>&1 &
+	rx_pid=$!
+	PIDS="$PIDS $rx_pid"
+	sleep 1
+
+	"$WESTON" --backend=headless-backend.so --use-pixman \
+		--width="$WIDTH" --height="$HEIGHT" \
+		--config="$ini" --socket="$SOCKET" \
+		--log="$WORKDIR/weston-$run.log" &
+	wst_pid=$!
+	PIDS="$PIDS $wst_pid"
+	wait_for "$XDG_RUNTIME_DIR/$SOCKET" || return 1
+
+	WAYLAND_DISPLAY=$SOCKET $CLIENT > /dev/null 2>&1 &
+	cl_pid=$!
+	PIDS="$PIDS $cl_pid"
+	sleep 1
+	WAYLAND_DISPLAY=$SOCKET $LAYER_ADD -d "$OUTPUT_NAME" -s 1 -l 1 \
+		> /dev/null 2>&1 &
+	PIDS="$PIDS $!"
+
+	sleep "$WARMUP"
+	rx0=$(cpu_ticks $rx_pid)
+	wst0=$(cpu_ticks $wst_pid)
+	sleep "$DURATION"
+	rx1=$(cpu_ticks $rx_pid)
+	wst1=$(cpu_ticks $wst_pid)
+
+	cleanup
+
+	# only the header if nothing got through
+	if [ "$(wc -l < "$stats")" -le 1 ]; then
+		echo "profile $profile, roi $roi: no frames received" >&2
+		printf '    { "profile": "%s", "roi": "%s", "frames": 0 }' \
+			"$profile" "$roi"
+		return 1
+	fi
+
+	printf '    { "profile": "%s", "roi": "%s", %s, ' "$profile" "$roi" \
+		"$(summarize "$stats" "$DURATION")"
+	[ "$QUALITY" = true ] &&
+		printf '"psnr_db": %s, ' \
+			"$(quality "$WORKDIR/weston-$run.log" "$DURATION")"
+	printf '"cpu_percent": { "weston": %.1f, "receiver": %.1f } }' \
+		"$(echo "$wst0 $wst1" | awk -v hz="$CLK_TCK" -v s="$DURATION" '{ print ($2 - $1) * 100 / hz / s }')" \
+		"$(echo "$rx0 $rx1" | awk -v hz="$CLK_TCK" -v s="$DURATION" '{ print ($2 - $1) * 100 / hz / s }')"
+}
+
+{
+	status=0
+	sep=""
+	printf '{\n  "date": "%s",\n  "host": "%s",\n' "$(date -u +%Y-%m-%dT%H:%M:%SZ)" "$(uname -nm)"
+	printf '  "size": "%dx%d",\n  "duration_s": %d,\n  "profiles": [\n' "$WIDTH" "$HEIGHT" "$DURATION"
+	for profile in $PROFILES; do
+		for roi in $ROI; do
+			printf '%s' "$sep"
+			run_profile "$profile" "$roi" || status=1
+			sep=$',\n'
+		done
+	done
+	printf '\n  ]\n}\n'
+} > "$WORKDIR/result.json"
+
+if [ "$OUTPUT" = "-" ]; then
+	cat "$WORKDIR/result.json"
+else
+	cp "$WORKDIR/result.json" "$OUTPUT"
+fi
+
+exit $status
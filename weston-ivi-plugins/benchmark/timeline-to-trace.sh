@@ -0,0 +1,99 @@
+#!/bin/bash
+#
+# Copyright (C) 2017 Advanced Driver Information Technology GmbH, Advanced Driver Information Technology Corporation, Robert Bosch GmbH, Robert Bosch Car Multimedia GmbH, DENSO Corporation
+#
+# Permission is hereby granted, free of charge, to any person obtaining
+# a copy of this software and associated documentation files (the
+# "Software"), to deal in the Software without restriction, including
+# without limitation the rights to use, copy, modify, merge, publish,
+# distribute, sublicense, and/or sell copies of the Software, and to
+# permit persons to whom the Software is furnished to do so, subject to
+# the following conditions:
+#
+# The above copyright notice and this permission notice (including the
+# next paragraph) shall be included in all copies or substantial
+# portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+# EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+# MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+# NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+# BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+# ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+# CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+#
+#
+# Converts a "transmitter-timeline" debug scope capture into Chrome trace
+# JSON, to be opened with chrome://tracing or https://ui.perfetto.dev:
+#
+#   weston-debug -o timeline.txt transmitter-timeline
+#   timeline-to-trace.sh timeline.txt > timeline.json
+#
+# Each output gets its own track, with the capture, push and flush steps of
+# every frame as slices, and the frame size and encoder queue as counters.
+
+set -u
+
+usage()
+{
+	echo "Usage: $0 [timeline.txt]"
+}
+
+case "${1:-}" in
+-h|--help) usage; exit 0 ;;
+esac
+
+if [ $# -gt 1 ]; then
+	usage >&2
+	exit 1
+fi
+
+awk '
+	function slice(name, t0, t1) {
+		printf ",\n{ \"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, " \
+		       "\"tid\": %d, \"ts\": %s, \"dur\": %d, " \
+		       "\"args\": { \"frame\": %d } }",
+		       name, tid, t0, t1 - t0, f["frame"]
+	}
+	function counter(name, ts, value) {
+		printf ",\n{ \"name\": \"%s %s\", \"ph\": \"C\", \"pid\": 1, " \
+		       "\"ts\": %s, \"args\": { \"value\": %d } }",
+		       output, name, ts, value
+	}
+	BEGIN {
+		printf "{ \"displayTimeUnit\": \"ms\", \"traceEvents\": [\n"
+		printf "{ \"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, " \
+		       "\"args\": { \"name\": \"transmitter\" } }"
+	}
+	/^#/ || NF < 2 { next }
+	{
+		output = $1
+		split("", f)
+		for (i = 2; i <= NF; i++) {
+			eq = index($i, "=")
+			if (eq)
+				f[substr($i, 1, eq - 1)] = substr($i, eq + 1)
+		}
+		if (!(output in tids)) {
+			tids[output] = ++ntids
+			printf ",\n{ \"name\": \"thread_name\", \"ph\": \"M\", " \
+			       "\"pid\": 1, \"tid\": %d, " \
+			       "\"args\": { \"name\": \"%s\" } }", ntids, output
+		}
+		tid = tids[output]
+
+		if ("error" in f) {
+			printf ",\n{ \"name\": \"%s failed\", \"ph\": \"i\", " \
+			       "\"s\": \"t\", \"pid\": 1, \"tid\": %d, " \
+			       "\"ts\": %s }", f["error"], tid, f["capture"]
+			next
+		}
+
+		slice("capture", f["repaint"], f["capture"])
+		slice("push", f["capture"], f["push"])
+		slice("flush", f["push"], f["flush"])
+		counter("bytes", f["repaint"], f["bytes"])
+		counter("queue", f["flush"], f["queue"])
+	}
+	END { printf "\n] }\n" }' "${1:--}"
@@ -42,6 +42,7 @@
 #include <sys/epoll.h>
 #include <errno.h>
 #include <netinet/in.h>
+#include <arpa/inet.h>
 #include <string.h>
 #include <assert.h>
 #include <getopt.h>
@@ -58,14 +59,17 @@
 #include <waltham-server.h>
 #include <waltham-connection.h>
 
+#include "waltham-stream.h"
+
 #define DEBUG 0
 
+#include "wth-receiver-log.h"
+
 struct receiver;
 struct client;
 struct window;
 struct pointer;
 struct touch;
-static int verbose = 0;
 
 const struct wth_display_interface display_implementation;
 
@@ -102,6 +106,33 @@ void receiver_flush_clients(struct receiver *srv);
 */
 void client_destroy(struct client *c);
 
+/**
+* client_dispatch
+*
+* Flush a client connection and, if it is readable, dispatch its requests.
+* For the render loop, which keeps the main loop from running while a
+* surface is streamed.
+*
+* @param names        struct client *c
+*             bool readable
+* @param value        c        - client data
+*             readable - the connection fd polled readable
+* @return             0 on success, -1 if the connection failed
+*/
+int client_dispatch(struct client *c, bool readable);
+
+/**
+* client_request_keyframe
+*
+* Ask the transmitter for a key frame now, see WTH_STREAM_GLOBAL_KEYFRAME.
+* For the render loop, like client_dispatch.
+*
+* @param names        struct client *c
+* @param value        c - client data
+* @return             none
+*/
+void client_request_keyframe(struct client *c);
+
 /**
 * waltham_pointer_enter
 *
@@ -274,27 +305,16 @@ void waltham_touch_frame(struct window *window);
 void waltham_touch_cancel(struct window *window);
 
 /**
- * set verbosity
- */
-inline void set_verbosity(int verbosity)
-{
-	verbose = verbosity;
-}
-
-/**
- * get verbosity
- */
-inline bool get_verbosity()
-{
-    if (verbose == 1)
-    {
-        return true;
-    }
-    else
-    {
-        return false;
-    }
-}
+* wth_receiver_weston_probe_caps
+*
+* Fill in the decoders available to GStreamer and the display size
+*
+* @param names        struct wth_stream_caps *caps, bool headless
+* @param value        capabilities advertised to the transmitter, and
+*                     whether there is a compositor to ask for the size
+* @return             none
+*/
+void wth_receiver_weston_probe_caps(struct wth_stream_caps *caps, bool headless);
 
 /***** macros *******/
 #define MAX_EPOLL_WATCHES 2
@@ -313,21 +333,6 @@ inline bool get_verbosity()
 #define ARRAY_LENGTH(a) (sizeof (a) / sizeof (a)[0])
 #endif
 
-#ifndef pr_fmt
-#   define pr_fmt(fmt) fmt
-#endif
-
-#define wth_error(fmt, ...) \
-    ({ fprintf(stderr, pr_fmt(fmt), ## __VA_ARGS__); fflush(stderr); })
-
-#if DEBUG
-#define wth_verbose(fmt, ...) \
-    ({ if (get_verbosity()) { fprintf(stdout, pr_fmt(fmt), ## __VA_ARGS__); fflush(stdout); } })
-#else
-#define wth_verbose(fmt, ...)\
-		({})
-#endif
-
 /****** incline functions *****/
 static inline void *
 zalloc(size_t size)
@@ -362,7 +367,7 @@ struct blob_factory {
 struct buffer {
     struct wthp_buffer *obj;
     uint32_t data_sz;
-    void *data;
+    void *data; /* a copy we own for WTH_STREAM_BLOB_RAW */
     int32_t width;
     int32_t height;
     int32_t stride;
@@ -404,10 +409,12 @@ struct touch {
 /* wthp_surface protocol object */
 struct surface {
     struct wthp_surface *obj;
+    struct client *client;
     uint32_t ivi_id;
     struct ivisurface *ivisurf;
     struct wthp_callback *cb;
     struct window *shm_window;
+    struct wthp_buffer *raw_buffer; /* attached, completed on commit */
     struct wl_list link; /* struct client::surface_list */
 };
 /* wthp_ivi_surface protocol object */
@@ -460,6 +467,7 @@ struct client {
 
     struct wth_connection *connection;
     struct watch conn_watch;
+    char peer[INET_ADDRSTRLEN]; /* transmitter address, for RTCP */
 
     /* client object lists for clean-up on disconnection */
     struct wl_list registry_list;     /* struct registry::link */
@@ -470,6 +478,26 @@ struct client {
     struct wl_list seat_list;         /* struct seat::link */
     struct wl_list pointer_list;      /* struct pointer::link */
     struct wl_list touch_list;        /* struct touch::link */
+
+    /* media stream chosen by the transmitter, if it negotiated one */
+    bool has_stream_config;
+    struct wth_stream_config stream_config;
+
+    /* receiver clock - transmitter clock in us, as estimated by the
+     * transmitter and sent with its pings */
+    bool has_clock_offset;
+    int64_t clock_offset;
+
+    uint32_t keyframe_requests; /* sent so far */
+
+    /* the window whose render loop runs, and dispatches this connection */
+    struct window *rendering;
+
+    /* with stream_config.atlas: the window whose render loop presents
+     * the surfaces, and where they are in the frames */
+    struct window *atlas;
+    struct wth_stream_atlas_entry atlas_layout[WTH_STREAM_ATLAS_MAX_ENTRIES];
+    int atlas_entries;
 };
 
 /* receiver structure */
@@ -481,12 +509,32 @@ struct receiver {
     int epoll_fd;
 
     struct wl_list client_list; /* struct client::link */
+
+    /* advertised to every client through the registry */
+    struct wth_stream_caps caps;
+
+    /* show only the newest decoded frame at each display refresh */
+    bool present_latest;
+
+    /* decode without a compositor, into fakesink */
+    bool headless;
+
+    /* per-frame CSV statistics, NULL if not requested */
+    FILE *stats;
+};
+
+/* rects of a raw surface, see wth_receiver_weston_shm_commit */
+struct shm_damage {
+    int count; /* -1: all of the surface */
+    struct wth_stream_raw_rect rects[WTH_STREAM_RAW_MAX_RECTS];
 };
 
 struct shm_buffer {
     struct wl_buffer *buffer;
     void *shm_data;
+    size_t size;
     int busy;
+    struct shm_damage stale; /* changed since this buffer was drawn */
 };
 
 struct display {
@@ -494,6 +542,7 @@ struct display {
     struct wl_registry *registry;
     struct wl_compositor *compositor;
     struct wl_shm *shm;
+    struct wl_subcompositor *subcompositor;
     bool has_xrgb;
     struct ivi_application *ivi_application;
 
@@ -502,6 +551,9 @@ struct display {
     struct wl_keyboard *wl_keyboard;
     struct wl_touch *wl_touch;
     struct window *window;
+    struct wl_list atlas;       /* struct window::atlas_link */
+    struct window *pointer_focus; /* NULL: window */
+    struct window *touch_focus;
     struct {
 	    EGLDisplay dpy;
 	    EGLContext ctx;
@@ -510,12 +562,16 @@ struct display {
 	    PFNEGLCREATEIMAGEKHRPROC create_image;
 	    PFNEGLDESTROYIMAGEKHRPROC destroy_image;
 	    PFNGLEGLIMAGETARGETTEXTURE2DOESPROC image_texture_2d;
+	    bool has_dmabuf_import;
     } egl;
     struct {
 	    GLuint vertex_shader;
 	    GLuint fragment_shader;
 	    GLuint program_object;
 	    GLuint texture;
+	    /* samplerExternalOES variant for imported YUV dmabufs, 0 if unsupported */
+	    GLuint external_program;
+	    GLuint external_texture;
     } gl;
 };
 
@@ -543,6 +599,28 @@ struct window {
     struct pointer *receiver_pointer;
     bool ready;
     uint32_t id_ivisurf;
+    uint32_t frames_displayed;
+    uint32_t frames_dropped;    /* superseded before they could be shown */
+
+    /* transport=raw: wl_shm buffers patched from the blobs */
+    bool raw;
+    /* transport=hybrid: the same on a subsurface over the video, ARGB */
+    bool hybrid;
+    struct wl_surface *raw_surface; /* surface, or the overlay for hybrid */
+    struct wl_subsurface *overlay;
+    struct _GstAppContext *gstctx; /* while the render loop runs */
+    const void *raw_data;       /* attached, applied on commit */
+    uint32_t raw_size;
+    uint8_t *raw_image;         /* the whole surface, XRGB8888 */
+    uint8_t *raw_scratch;       /* one rect, decompressed */
+    size_t raw_scratch_size;
+    int32_t raw_width, raw_height;
+    struct shm_damage raw_damage; /* since the last wl_surface.commit */
+    bool raw_owed;              /* no buffer was free to show it */
+
+    /* stream_config.atlas: one of the surfaces cut out of the frames */
+    bool atlas;
+    struct wl_list atlas_link;  /* struct display::atlas */
 };
 
 
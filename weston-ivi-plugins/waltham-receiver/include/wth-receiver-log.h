@@ -0,0 +1,137 @@
+/*
+ * Copyright © 2019 Advanced Driver Information Technology GmbH
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*******************************************************************************
+**                                                                            **
+**  TARGET    : linux                                                         **
+**                                                                            **
+**  PROJECT   : waltham-receiver                                              **
+**                                                                            **
+**  PURPOSE   : Leveled logging. Messages go to a ring buffer per thread and  **
+**  a background thread writes them to stderr, or keeps them in memory until **
+**  a dump is requested (flight recorder).                                   **
+**                                                                            **
+*******************************************************************************/
+
+#ifndef WTH_RECEIVER_LOG_H_
+#define WTH_RECEIVER_LOG_H_
+
+#include <stdbool.h>
+
+enum wth_log_level {
+    WTH_LOG_ERROR,
+    WTH_LOG_WARNING,
+    WTH_LOG_INFO,
+    WTH_LOG_DEBUG,
+    WTH_LOG_TRACE,      /* function entry and exit */
+};
+
+/* Levels above this are compiled out */
+#ifndef WTH_LOG_LEVEL_MAX
+#   if DEBUG
+#       define WTH_LOG_LEVEL_MAX WTH_LOG_TRACE
+#   else
+#       define WTH_LOG_LEVEL_MAX WTH_LOG_INFO
+#   endif
+#endif
+
+/* Runtime level, WTH_LOG_INFO by default */
+extern int wth_log_level;
+
+#ifndef pr_fmt
+#   define pr_fmt(fmt) fmt
+#endif
+
+#define wth_log_enabled(level) \
+    ((level) <= WTH_LOG_LEVEL_MAX && (level) <= wth_log_level)
+
+#define wth_log(level, fmt, ...) \
+    ({ if (wth_log_enabled(level)) wth_log_write(level, pr_fmt(fmt), ## __VA_ARGS__); })
+
+#define wth_error(fmt, ...)   wth_log(WTH_LOG_ERROR, fmt, ## __VA_ARGS__)
+#define wth_warning(fmt, ...) wth_log(WTH_LOG_WARNING, fmt, ## __VA_ARGS__)
+#define wth_info(fmt, ...)    wth_log(WTH_LOG_INFO, fmt, ## __VA_ARGS__)
+#define wth_verbose(fmt, ...) wth_log(WTH_LOG_DEBUG, fmt, ## __VA_ARGS__)
+#define wth_enter()           wth_log(WTH_LOG_TRACE, "%s >>> \n", __func__)
+#define wth_leave()           wth_log(WTH_LOG_TRACE, " <<< %s \n", __func__)
+
+/**
+* wth_log_write
+*
+* Queues a message on the calling thread's ring. Does not block and makes no
+* system call, except for errors which wake the writer right away. When the
+* ring is full the message is dropped and counted.
+* Before wth_log_init() and after wth_log_fini() it writes to stderr directly.
+*
+* @param names        enum wth_log_level level, const char *fmt, ...
+* @param value        level and printf style message
+* @return             none
+*/
+void wth_log_write(enum wth_log_level level, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+/**
+* wth_log_init
+*
+* Starts the writer thread
+*
+* @param names        bool recorder
+* @param value        true to keep the last messages of each thread in memory
+*                     until wth_log_dump(), instead of writing them out
+* @return             0 on success, -1 on error (messages then go to stderr)
+*/
+int wth_log_init(bool recorder);
+
+/**
+* wth_log_dump
+*
+* Asks the writer to write out everything queued now. Safe to call from a
+* signal handler.
+*
+* @param names        void
+* @return             none
+*/
+void wth_log_dump(void);
+
+/**
+* wth_log_fini
+*
+* Writes out what is left (unless in recorder mode) and stops the writer
+*
+* @param names        void
+* @return             none
+*/
+void wth_log_fini(void);
+
+/**
+* wth_log_parse_level
+*
+* @param names        const char *name
+* @param value        error, warning, info, debug or trace
+* @return             the level, -1 if unknown
+*/
+int wth_log_parse_level(const char *name);
+
+#endif /* WTH_RECEIVER_LOG_H_ */
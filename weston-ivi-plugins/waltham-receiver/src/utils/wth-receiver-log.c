@@ -0,0 +1,382 @@
+/*
+ * Copyright © 2019 Advanced Driver Information Technology GmbH
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * One single-producer single-consumer ring per thread: the thread that logs
+ * is the only one moving head, the writer thread the only one moving tail.
+ * Rings are created on a thread's first message and released once the
+ * thread has exited and its ring has been written out.
+ *
+ * In recorder mode nothing is written until wth_log_dump(): producers
+ * overwrite their oldest entries, and the writer skips any entry that was
+ * overwritten while it was copying it.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+
+#include "wth-receiver-log.h"
+
+#define LOG_RING_SIZE 256	/* entries per thread, a power of two */
+#define LOG_LINE 240
+#define LOG_FLUSH_MS 100
+
+struct log_entry {
+	uint64_t time;		/* CLOCK_MONOTONIC, us */
+	int level;
+	char text[LOG_LINE];
+};
+
+struct log_ring {
+	struct log_ring *next;
+	pid_t tid;
+	atomic_uint head;	/* next entry to write, owner thread */
+	atomic_uint tail;	/* next entry to read, writer thread */
+	atomic_uint dropped;
+	atomic_bool done;	/* owner thread has exited */
+	struct log_entry entries[LOG_RING_SIZE];
+};
+
+int wth_log_level = WTH_LOG_INFO;
+
+static struct {
+	pthread_mutex_t lock;	/* rings list */
+	struct log_ring *rings;
+	pthread_key_t key;
+	pthread_t thread;
+	int wake_fd;
+	bool recorder;
+	atomic_bool running;
+	atomic_bool dump;
+	atomic_bool stop;
+} logger = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.wake_fd = -1,
+};
+
+static __thread struct log_ring *thread_ring;
+
+static const char level_char[] = { 'E', 'W', 'I', 'D', 'T' };
+
+static uint64_t
+log_now(void)
+{
+	struct timespec ts;
+
+	/* vDSO, no system call */
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void
+log_wake(void)
+{
+	uint64_t one = 1;
+	ssize_t ret;
+
+	/* write() is async-signal-safe, the result does not matter */
+	ret = write(logger.wake_fd, &one, sizeof one);
+	(void)ret;
+}
+
+static void
+log_thread_exit(void *data)
+{
+	struct log_ring *ring = data;
+
+	atomic_store_explicit(&ring->done, true, memory_order_release);
+}
+
+static struct log_ring *
+log_ring_get(void)
+{
+	struct log_ring *ring = thread_ring;
+
+	if (ring)
+		return ring;
+
+	ring = calloc(1, sizeof *ring);
+	if (!ring)
+		return NULL;
+	ring->tid = syscall(SYS_gettid);
+
+	pthread_mutex_lock(&logger.lock);
+	ring->next = logger.rings;
+	logger.rings = ring;
+	pthread_mutex_unlock(&logger.lock);
+
+	pthread_setspecific(logger.key, ring);
+	thread_ring = ring;
+
+	return ring;
+}
+
+static void
+log_print(FILE *fp, pid_t tid, const struct log_entry *e)
+{
+	size_t len = strlen(e->text);
+
+	fprintf(fp, "[%" PRIu64 ".%06u] %c %d: %s%s",
+		e->time / 1000000, (unsigned int)(e->time % 1000000),
+		level_char[e->level], (int)tid, e->text,
+		len && e->text[len - 1] == '\n' ? "" : "\n");
+}
+
+void
+wth_log_write(enum wth_log_level level, const char *fmt, ...)
+{
+	struct log_ring *ring;
+	struct log_entry *e;
+	unsigned int head, tail;
+	va_list ap;
+
+	if (!atomic_load_explicit(&logger.running, memory_order_acquire) ||
+	    !(ring = log_ring_get())) {
+		va_start(ap, fmt);
+		vfprintf(stderr, fmt, ap);
+		va_end(ap);
+		fflush(stderr);
+		return;
+	}
+
+	head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+	if (!logger.recorder && head - tail >= LOG_RING_SIZE) {
+		atomic_fetch_add_explicit(&ring->dropped, 1,
+					  memory_order_relaxed);
+		return;
+	}
+
+	/* recorder mode overwrites a slot the writer thread may be copying:
+	 * the head that tells it so goes out before the new entry, see
+	 * log_drain() */
+	if (logger.recorder)
+		atomic_thread_fence(memory_order_release);
+
+	e = &ring->entries[head & (LOG_RING_SIZE - 1)];
+	e->time = log_now();
+	e->level = level;
+	va_start(ap, fmt);
+	vsnprintf(e->text, sizeof e->text, fmt, ap);
+	va_end(ap);
+
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+
+	if (level == WTH_LOG_ERROR && !logger.recorder)
+		log_wake();
+}
+
+/*
+ * Writes out the queued entries of all rings, oldest first, and releases
+ * the rings of exited threads. Called on the writer thread only.
+ */
+static void
+log_drain(FILE *fp)
+{
+	struct log_ring *ring, **link;
+	unsigned int n = 0, i;
+
+	pthread_mutex_lock(&logger.lock);
+
+	for (ring = logger.rings; ring; ring = ring->next)
+		n++;
+
+	{
+		struct log_ring *rings[n ? n : 1];
+		unsigned int pos[n ? n : 1], end[n ? n : 1];
+		struct log_entry e;
+
+		i = 0;
+		for (ring = logger.rings; ring; ring = ring->next, i++) {
+			unsigned int dropped;
+
+			rings[i] = ring;
+			end[i] = atomic_load_explicit(&ring->head,
+						      memory_order_acquire);
+			pos[i] = atomic_load_explicit(&ring->tail,
+						      memory_order_relaxed);
+			if (end[i] - pos[i] > LOG_RING_SIZE)
+				pos[i] = end[i] - LOG_RING_SIZE;
+
+			dropped = atomic_exchange_explicit(&ring->dropped, 0,
+							   memory_order_relaxed);
+			if (dropped)
+				fprintf(fp, "%d: %u messages dropped\n",
+					(int)ring->tid, dropped);
+		}
+
+		for (;;) {
+			int oldest = -1;
+
+			for (i = 0; i < n; i++) {
+				if (pos[i] == end[i])
+					continue;
+				if (oldest < 0 ||
+				    rings[i]->entries[pos[i] & (LOG_RING_SIZE - 1)].time <
+				    rings[oldest]->entries[pos[oldest] & (LOG_RING_SIZE - 1)].time)
+					oldest = i;
+			}
+			if (oldest < 0)
+				break;
+
+			ring = rings[oldest];
+			e = ring->entries[pos[oldest] & (LOG_RING_SIZE - 1)];
+			/* in recorder mode the owner may have reused the slot
+			 * while we copied it: the head is read after the copy,
+			 * as with a seqlock */
+			atomic_thread_fence(memory_order_acquire);
+			if (atomic_load_explicit(&ring->head, memory_order_relaxed) <
+			    pos[oldest] + LOG_RING_SIZE)
+				log_print(fp, ring->tid, &e);
+			pos[oldest]++;
+		}
+
+		for (i = 0; i < n; i++)
+			atomic_store_explicit(&rings[i]->tail, end[i],
+					      memory_order_release);
+	}
+
+	link = &logger.rings;
+	while ((ring = *link)) {
+		if (atomic_load_explicit(&ring->done, memory_order_acquire) &&
+		    atomic_load_explicit(&ring->head, memory_order_acquire) ==
+		    atomic_load_explicit(&ring->tail, memory_order_relaxed)) {
+			*link = ring->next;
+			free(ring);
+		} else {
+			link = &ring->next;
+		}
+	}
+
+	pthread_mutex_unlock(&logger.lock);
+	fflush(fp);
+}
+
+static void *
+log_writer(void *data)
+{
+	struct pollfd pfd = { .fd = logger.wake_fd, .events = POLLIN };
+	uint64_t count;
+
+	while (!atomic_load(&logger.stop)) {
+		if (poll(&pfd, 1, logger.recorder ? -1 : LOG_FLUSH_MS) > 0 &&
+		    read(logger.wake_fd, &count, sizeof count) < 0 &&
+		    errno != EAGAIN)
+			break;
+
+		if (!logger.recorder || atomic_exchange(&logger.dump, false))
+			log_drain(stderr);
+	}
+
+	return NULL;
+}
+
+int
+wth_log_init(bool recorder)
+{
+	if (atomic_load(&logger.running))
+		return 0;
+
+	logger.recorder = recorder;
+	logger.wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (logger.wake_fd < 0)
+		return -1;
+
+	if (pthread_key_create(&logger.key, log_thread_exit) != 0)
+		goto err_fd;
+
+	if (pthread_create(&logger.thread, NULL, log_writer, NULL) != 0)
+		goto err_key;
+
+	atomic_store_explicit(&logger.running, true, memory_order_release);
+	return 0;
+
+err_key:
+	pthread_key_delete(logger.key);
+err_fd:
+	close(logger.wake_fd);
+	logger.wake_fd = -1;
+	return -1;
+}
+
+void
+wth_log_dump(void)
+{
+	if (logger.wake_fd < 0)
+		return;
+
+	atomic_store(&logger.dump, true);
+	log_wake();
+}
+
+void
+wth_log_fini(void)
+{
+	if (!atomic_load(&logger.running))
+		return;
+
+	atomic_store_explicit(&logger.running, false, memory_order_release);
+	atomic_store(&logger.stop, true);
+	log_wake();
+	pthread_join(logger.thread, NULL);
+
+	if (!logger.recorder)
+		log_drain(stderr);
+
+	/*
+	 * Other threads may still log, straight to stderr from now on. Their
+	 * rings are left alone, one of them may be writing to its own.
+	 */
+	close(logger.wake_fd);
+	logger.wake_fd = -1;
+}
+
+int
+wth_log_parse_level(const char *name)
+{
+	static const char *const names[] = {
+		"error", "warning", "info", "debug", "trace",
+	};
+	unsigned int i;
+
+	for (i = 0; i < sizeof names / sizeof names[0]; i++) {
+		if (strcmp(name, names[i]) == 0)
+			return i;
+	}
+
+	return -1;
+}
@@ -40,8 +40,14 @@ extern int wth_receiver_weston_main(struct window *);
 
 extern void wth_receiver_weston_shm_attach(struct window *, uint32_t data_sz, void * data,
        int32_t width, int32_t height, int32_t stride, uint32_t format);
-extern void wth_receiver_weston_shm_damage(struct window *);
+extern void wth_receiver_weston_shm_damage(struct window *, int32_t x, int32_t y,
+       int32_t width, int32_t height);
 extern void wth_receiver_weston_shm_commit(struct window *);
+extern void wth_receiver_weston_atlas_add(struct window *atlas, struct window *);
+extern void wth_receiver_weston_atlas_remove(struct window *);
+
+/* ivi ids here are the transmitter's plus this */
+#define IVI_ID_OFFSET 100
 
 /*
  * utility functions
@@ -49,25 +55,25 @@ extern void wth_receiver_weston_shm_commit(struct window *);
 static int
 watch_ctl(struct watch *w, int op, uint32_t events)
 {
-    wth_verbose("%s >>> \n",__func__);
+    wth_enter();
     struct epoll_event ee;
 
     ee.events = events;
     ee.data.ptr = w;
-    wth_verbose(" <<< %s \n",__func__);
+    wth_leave();
     return epoll_ctl(w->receiver->epoll_fd, op, w->fd, &ee);
 }
 
 static void
 client_post_out_of_memory(struct client *c)
 {
-    wth_verbose("%s >>> \n",__func__);
+    wth_enter();
     struct wth_display *disp;
 
     disp = wth_connection_get_display(c->connection);
     wth_object_post_error((struct wth_object *)disp, 1,
                   "out of memory");
-    wth_verbose(" <<< %s \n",__func__);
+    wth_leave();
 }
 
 /*
@@ -76,36 +82,44 @@ client_post_out_of_memory(struct client *c)
 static void
 surface_destroy(struct surface *surface)
 {
-    wth_verbose("%s >>> \n",__func__);
+    wth_enter();
     wth_verbose("surface %p destroy\n", surface->obj);
 
+    /* a surface of a running atlas stream goes with its wthp_surface */
+    if (surface->client->atlas && surface->shm_window)
+        wth_receiver_weston_atlas_remove(surface->shm_window);
+
     wthp_surface_free(surface->obj);
     wl_list_remove(&surface->link);
     free(surface);
-    wth_verbose(" <<< %s \n",__func__);
+    wth_leave();
 }
 
 static void
 surface_handle_destroy(struct wthp_surface *wthp_surface)
 {
-    wth_verbose("%s >>> \n",__func__);
+    wth_enter();
     struct surface *surface = wth_object_get_user_data((struct wth_object *)wthp_surface);
 
     assert(wthp_surface == surface->obj);
 
     surface_destroy(surface);
-    wth_verbose(" <<< %s \n",__func__);
+    wth_leave();
 }
 
 static void
 surface_handle_attach(struct wthp_surface *wthp_surface,
               struct wthp_buffer *wthp_buffer, int32_t x, int32_t y)
 {
-    wth_verbose("%s >>> \n",__func__);
+    wth_enter();
     struct surface *surf = wth_object_get_user_data((struct wth_object *)wthp_surface);
     struct buffer *buf = NULL;
 
-    buf = container_of(wthp_buffer, struct buffer, obj);
+    if (!wthp_buffer) {
+        wth_leave();
+        return;
+    }
+    buf = wth_object_get_user_data((struct wth_object *)wthp_buffer);
 
     if (surf->ivi_id != 0) {
         wth_receiver_weston_shm_attach(surf->shm_window,
@@ -116,16 +130,20 @@ surface_handle_attach(struct wthp_surface *wthp_surface,
                buf->stride,
                buf->format);
 
-        wthp_buffer_send_complete(wthp_buffer, 0);
+        /* raw frames are complete once the commit applied them */
+        if (buf->format == WTH_STREAM_BLOB_RAW)
+            surf->raw_buffer = wthp_buffer;
+        else
+            wthp_buffer_send_complete(wthp_buffer, 0);
     }
-    wth_verbose(" <<< %s \n",__func__);
+    wth_leave();
 }
 
 static void
 surface_handle_damage(struct wthp_surface *wthp_surface,
               int32_t x, int32_t y, int32_t width, int32_t height)
 {
-    wth_verbose("%s >>> \n",__func__);
+    wth_enter();
 
     wth_verbose("surface %p damage(%d, %d, %d, %d)\n",
                 wthp_surface, x, y, width, height);
@@ -133,21 +151,21 @@ surface_handle_damage(struct wthp_surface *wthp_surface,
     struct surface *surf = wth_object_get_user_data((struct wth_object *)wthp_surface);
 
     if (surf->ivi_id != 0) {
-        wth_receiver_weston_shm_damage(surf->shm_window);
+        wth_receiver_weston_shm_damage(surf->shm_window, x, y, width, height);
     }
-    wth_verbose(" <<< %s \n",__func__);
+    wth_leave();
 }
 
 static void
 surface_handle_frame(struct wthp_surface *wthp_surface,
              struct wthp_callback *callback)
 {
-    wth_verbose("%s >>> \n",__func__);
+    wth_enter();
     struct surface *surf = wth_object_get_user_data((struct wth_object *)wthp_surface);
     wth_verbose("surface %p callback(%p)\n",wthp_surface, callback);
 
     surf->cb = callback;
-    wth_verbose(" <<< %s \n",__func__);
+    wth_leave();
 }
 
 static void
@@ -169,15 +187,19 @@ surface_handle_set_input_region(struct wthp_surface *wthp_surface,
 static void
 surface_handle_commit(struct wthp_surface *wthp_surface)
 {
-    wth_verbose("%s >>> \n",__func__);
+    wth_enter();
 
     struct surface *surf = wth_object_get_user_data((struct wth_object *)wthp_surface);
     wth_verbose("commit %p\n",wthp_surface);
 
     if (surf->ivi_id != 0) {
         wth_receiver_weston_shm_commit(surf->shm_window);
+        if (surf->raw_buffer) {
+            wthp_buffer_send_complete(surf->raw_buffer, 0);
+            surf->raw_buffer = NULL;
+        }
     }
-    wth_verbose(" <<< %s \n",__func__);
+    wth_leave();
 }
 
 static void
@@ -227,6 +249,8 @@ buffer_handle_destroy(struct wthp_buffer *wthp_buffer)
 
 	wthp_buffer_free(wthp_buffer);
 	wl_list_remove(&buf->link);
+	if (buf->format == WTH_STREAM_BLOB_RAW)
+		free(buf->data);
 	free(buf);
 }
 
@@ -238,6 +262,32 @@ static const struct wthp_buffer_interface buffer_implementation = {
 
 /* BEGIN wthp_blob_factory implementation */
 
+/* Answer a clock ping right away, see waltham-stream.h */
+static void
+client_handle_ping(struct client *c, const void *data, uint32_t data_sz)
+{
+	uint64_t received = wth_stream_now_us();
+	struct wth_stream_ping ping;
+	struct registry *reg;
+	char pong[96];
+
+	if (wth_stream_ping_unpack(&ping, data, data_sz) < 0) {
+		wth_error("invalid ping from client %p\n", c);
+		return;
+	}
+
+	c->has_clock_offset = ping.valid;
+	c->clock_offset = ping.offset;
+
+	if (wl_list_empty(&c->registry_list))
+		return;
+
+	reg = wl_container_of(c->registry_list.next, reg, link);
+	wth_stream_pong_format(pong, sizeof pong, ping.sent, received,
+			       wth_stream_now_us());
+	wthp_registry_send_global(reg->obj, ping.seq, pong, 1);
+}
+
 static void
 blob_factory_create_buffer(struct wthp_blob_factory *blob_factory,
 			   struct wthp_buffer *wthp_buffer, uint32_t data_sz, void *data,
@@ -267,6 +317,53 @@ blob_factory_create_buffer(struct wthp_blob_factory *blob_factory,
 	buffer->obj = wthp_buffer;
 
 	wthp_buffer_set_interface(wthp_buffer, &buffer_implementation, buffer);
+
+	if (format == WTH_STREAM_BLOB_CONFIG) {
+		/* not a picture: the stream the transmitter picked for us */
+		if (wth_stream_config_unpack(&blob->client->stream_config,
+					     data, data_sz) == 0) {
+			blob->client->has_stream_config = true;
+			wth_verbose("stream config: %s, pt %u, port %u, %dx%d\n",
+				wth_stream_codec_name(blob->client->stream_config.codec),
+				blob->client->stream_config.payload,
+				blob->client->stream_config.port,
+				blob->client->stream_config.width,
+				blob->client->stream_config.height);
+		} else {
+			wth_error("invalid stream config from client %p\n",
+				  blob->client);
+		}
+		buffer->data = NULL;
+		wthp_buffer_send_complete(wthp_buffer, 0);
+	} else if (format == WTH_STREAM_BLOB_ATLAS) {
+		/* where the surfaces are in the frames, presentation reads it */
+		struct client *c = blob->client;
+		int i, n;
+
+		n = wth_stream_atlas_unpack(c->atlas_layout, data, data_sz);
+		if (n < 0) {
+			wth_error("invalid atlas layout from client %p\n", c);
+			n = 0;
+		}
+		for (i = 0; i < n; i++)
+			c->atlas_layout[i].ivi_id += IVI_ID_OFFSET;
+		c->atlas_entries = n;
+		wth_verbose("atlas layout: %d surfaces\n", n);
+		buffer->data = NULL;
+		wthp_buffer_send_complete(wthp_buffer, 0);
+	} else if (format == WTH_STREAM_BLOB_PING) {
+		client_handle_ping(blob->client, data, data_sz);
+		buffer->data = NULL;
+		wthp_buffer_send_complete(wthp_buffer, 0);
+	} else if (format == WTH_STREAM_BLOB_RAW) {
+		/* the message is gone once we return, the commit comes later */
+		buffer->data = malloc(data_sz);
+		if (!buffer->data) {
+			client_post_out_of_memory(blob->client);
+			return;
+		}
+		memcpy(buffer->data, data, data_sz);
+	}
 }
 
 static const struct wthp_blob_factory_interface blob_factory_implementation = {
@@ -290,7 +387,7 @@ client_bind_blob_factory(struct client *c, struct wthp_blob_factory *obj)
 
 	wthp_blob_factory_set_interface(obj, &blob_factory_implementation,
 					 blob);
-  fprintf(stderr, "client %p bound wthp_blob_factory\n", c);
+  wth_verbose("client %p bound wthp_blob_factory\n", c);
 }
 
 /*
@@ -299,10 +396,10 @@ client_bind_blob_factory(struct client *c, struct wthp_blob_factory *obj)
 static void
 wthp_ivi_surface_destroy(struct wthp_ivi_surface * ivi_surface)
 {
-    wth_verbose("%s >>> \n",__func__);
+    wth_enter();
     struct ivisurface *ivisurf = wth_object_get_user_data((struct wth_object *)ivi_surface);
     free(ivisurf);
-    wth_verbose(" <<< %s \n",__func__);
+    wth_leave();
 }
 
 static const struct wthp_ivi_surface_interface wthp_ivi_surface_implementation = {
@@ -317,7 +414,7 @@ static void
 wthp_ivi_application_surface_create(struct wthp_ivi_application * ivi_application, uint32_t ivi_id,
                    struct wthp_surface * wthp_surface, struct wthp_ivi_surface *obj)
 {
-    wth_verbose("%s >>> \n",__func__);
+    wth_enter();
     wth_verbose("ivi_application %p surface_create(%d, %p, %p)\n",
         ivi_application, ivi_id, wthp_surface, obj);
     struct surface *surface = wth_object_get_user_data((struct wth_object *)wthp_surface);
@@ -326,7 +423,7 @@ wthp_ivi_application_surface_create(struct wthp_ivi_application * ivi_applicatio
     wth_verbose("shm_window [%p]\n\n\n", surface->shm_window);
     wth_verbose("----------------------------------\n");
 
-    surface->ivi_id = ivi_id + 100;
+    surface->ivi_id = ivi_id + IVI_ID_OFFSET;
     surface->shm_window->id_ivisurf = surface->ivi_id;
     struct ivisurface *ivisurf;
 
@@ -338,14 +435,29 @@ wthp_ivi_application_surface_create(struct wthp_ivi_application * ivi_applicatio
     ivisurf->obj = obj;
     ivisurf->surf = surface;
 
-    wth_receiver_weston_main(surface->shm_window);
+    if (surface->client->atlas) {
+        /* the frames are an atlas, and the render loop running for the
+         * first surface cuts this one out of them too */
+        wth_receiver_weston_atlas_add(surface->client->atlas,
+                                      surface->shm_window);
+    } else if (surface->client->rendering) {
+        /* we are called from the first surface's render loop, which
+         * dispatches the connection: a render loop nested in it would
+         * stop that stream */
+        wth_error("surface %u: one video stream per connection, showing "
+                  "surface %u only
+", surface->ivi_id,
+                  surface->client->rendering->id_ivisurf);
+    } else {
+        wth_receiver_weston_main(surface->shm_window);
 
-    while (!surface->shm_window->ready)
-        usleep(1);
+        while (!surface->shm_window->ready)
+            usleep(1);
+    }
 
     wthp_ivi_surface_set_interface(obj, &wthp_ivi_surface_implementation,
                   ivisurf);
-    wth_verbose(" <<< %s \n",__func__);
+    wth_leave();
 }
 
 static const struct wthp_ivi_application_interface wthp_ivi_application_implementation = {
@@ -355,7 +467,7 @@ static const struct wthp_ivi_application_interface wthp_ivi_application_implemen
 static void
 client_bind_wthp_ivi_application(struct client *c, struct wthp_ivi_application *obj)
 {
-    wth_verbose("%s >>> \n",__func__);
+    wth_enter();
 
     struct application *app;
 
@@ -372,7 +484,7 @@ client_bind_wthp_ivi_application(struct client *c, struct wthp_ivi_application *
     wthp_ivi_application_set_interface(obj, &wthp_ivi_application_implementation,
                       app);
     wth_verbose("client %p bound wthp_ivi_application\n", c);
-    wth_verbose(" <<< %s \n",__func__);
+    wth_leave();
 }
 
 /*
@@ -383,7 +495,7 @@ void
 waltham_pointer_enter(struct window *window, uint32_t serial,
                       wl_fixed_t sx, wl_fixed_t sy)
 {
-    wth_verbose("%s >>> \n",__func__);
+    wth_enter();
 
     struct surface *surface = window->receiver_surf;
     struct seat *seat = window->receiver_seat;
@@ -393,14 +505,14 @@ waltham_pointer_enter(struct window *window, uint32_t serial,
 
     wthp_pointer_send_enter (pointer->obj, serial, surface->obj, sx, sy);
 
-    wth_verbose(" <<< %s \n",__func__);
+    wth_leave();
     return;
 }
 
 void
 waltham_pointer_leave(struct window *window, uint32_t serial)
 {
-    wth_verbose("%s >>> \n",__func__);
+    wth_enter();
     struct surface *surface = window->receiver_surf;
     struct seat *seat = window->receiver_seat;
     struct pointer *pointer = seat->pointer;
@@ -409,7 +521,7 @@ waltham_pointer_leave(struct window *window, uint32_t serial)
 
     wthp_pointer_send_leave (pointer->obj, serial, surface->obj);
 
-    wth_verbose(" <<< %s \n",__func__);
+    wth_leave();
     return;
 }
 
@@ -417,13 +529,13 @@ void
 waltham_pointer_motion(struct window *window, uint32_t time,
                        wl_fixed_t sx, wl_fixed_t sy)
 {
-    wth_verbose("%s >>> \n",__func__);
+    wth_enter();
     struct seat *seat = window->receiver_seat;
     struct pointer *pointer = seat->pointer;
 
     wthp_pointer_send_motion (pointer->obj, time, sx, sy);
 
-    wth_verbose(" <<< %s \n",__func__);
+    wth_leave();
     return;
 }
 
@@ -432,13 +544,13 @@ waltham_pointer_button(struct window *window, uint32_t serial,
                uint32_t time, uint32_t button,
                uint32_t state)
 {
-    wth_verbose("%s >>> \n",__func__);
+    wth_enter();
     struct seat *seat = window->receiver_seat;
     struct pointer *pointer = seat->pointer;
 
     wthp_pointer_send_button (pointer->obj, serial, time, button, state);
 
-    wth_verbose(" <<< %s \n",__func__);
+    wth_leave();
     return;
 }
 
@@ -446,13 +558,13 @@ void
 waltham_pointer_axis(struct window *window, uint32_t time,
              uint32_t axis, wl_fixed_t value)
 {
-    wth_verbose("%s >>> \n",__func__);
+    wth_enter();
     struct seat *seat = window->receiver_seat;
     struct pointer *pointer = seat->pointer;
 
     wthp_pointer_send_axis (pointer->obj, time, axis, value);
 
-    wth_verbose(" <<< %s \n",__func__);
+    wth_leave();
     return;
 }
 
@@ -492,7 +604,7 @@ waltham_touch_down(struct window *window, uint32_t serial,
                    uint32_t time, int32_t id,
            wl_fixed_t x_w, wl_fixed_t y_w)
 {
-    wth_verbose("%s >>> \n",__func__);
+    wth_enter();
     struct surface *surface = window->receiver_surf;
     struct seat *seat = window->receiver_seat;
     struct touch *touch = seat->touch;
@@ -500,7 +612,7 @@ waltham_touch_down(struct window *window, uint32_t serial,
     wth_verbose("touch_handle_down surface [%d]\n", surface->ivi_id);
     wthp_touch_send_down(touch->obj, serial, time, surface->obj, id, x_w, y_w);
 
-    wth_verbose(" <<< %s \n",__func__);
+    wth_leave();
     return;
 }
 
@@ -508,13 +620,13 @@ void
 waltham_touch_up(struct window *window, uint32_t serial,
                  uint32_t time, int32_t id)
 {
-    wth_verbose("%s >>> \n",__func__);
+    wth_enter();
     struct seat *seat = window->receiver_seat;
     struct touch *touch = seat->touch;
 
     wthp_touch_send_up(touch->obj, serial, time, id);
 
-    wth_verbose(" <<< %s \n",__func__);
+    wth_leave();
     return;
 }
 
@@ -522,39 +634,39 @@ void
 waltham_touch_motion(struct window *window, uint32_t time,
              int32_t id, wl_fixed_t x_w, wl_fixed_t y_w)
 {
-    wth_verbose("%s >>> \n",__func__);
+    wth_enter();
     struct seat *seat = window->receiver_seat;
     struct touch *touch = seat->touch;
 
     wthp_touch_send_motion(touch->obj, time, id, x_w, y_w);
 
-    wth_verbose(" <<< %s \n",__func__);
+    wth_leave();
     return;
 }
 
 void
 waltham_touch_frame(struct window *window)
 {
-    wth_verbose("%s >>> \n",__func__);
+    wth_enter();
     struct seat *seat = window->receiver_seat;
     struct touch *touch = seat->touch;
 
     wthp_touch_send_frame(touch->obj);
 
-    wth_verbose(" <<< %s \n",__func__);
+    wth_leave();
     return;
 }
 
 void
 waltham_touch_cancel(struct window *window)
 {
-    wth_verbose("%s >>> \n",__func__);
+    wth_enter();
     struct seat *seat = window->receiver_seat;
     struct touch *touch = seat->touch;
 
     wthp_touch_send_cancel(touch->obj);
 
-    wth_verbose(" <<< %s \n",__func__);
+    wth_leave();
     return;
 }
 
@@ -564,7 +676,7 @@ waltham_touch_cancel(struct window *window)
 static void
 touch_release(struct wthp_touch *wthp_touch)
 {
-    wth_verbose("%s >>> \n",__func__);
+    wth_enter();
     struct touch *touch = wth_object_get_user_data((struct wth_object *)wthp_touch);
 
     wth_verbose("%p\n",wthp_touch);
@@ -580,7 +692,7 @@ static const struct wthp_touch_interface touch_implementation = {
 static void
 seat_get_pointer(struct wthp_seat *wthp_seat, struct wthp_pointer *wthp_pointer)
 {
-    wth_verbose("%s >>> \n",__func__);
+    wth_enter();
 
     wth_verbose("wthp_seat %p get_pointer(%p)\n",
         wthp_seat, wthp_pointer);
@@ -600,13 +712,13 @@ seat_get_pointer(struct wthp_seat *wthp_seat, struct wthp_pointer *wthp_pointer)
     wl_list_insert(&seat->client->pointer_list, &pointer->link);
 
     wthp_pointer_set_interface(wthp_pointer, &pointer_implementation, pointer);
-    wth_verbose(" <<< %s \n",__func__);
+    wth_leave();
 }
 
 static void
 seat_get_touch(struct wthp_seat *wthp_seat, struct wthp_touch *wthp_touch)
 {
-    wth_verbose("%s >>> \n",__func__);
+    wth_enter();
     wth_verbose("wthp_seat %p get_touch(%p)\n",
         wthp_seat, wthp_touch);
 
@@ -625,7 +737,7 @@ seat_get_touch(struct wthp_seat *wthp_seat, struct wthp_touch *wthp_touch)
     wl_list_insert(&seat->client->touch_list, &touch->link);
 
     wthp_touch_set_interface(wthp_touch, &touch_implementation, touch);
-    wth_verbose(" <<< %s \n",__func__);
+    wth_leave();
 }
 
 static void
@@ -644,7 +756,7 @@ static const struct wthp_seat_interface seat_implementation = {
 static void
 seat_send_updated_caps(struct seat *seat)
 {
-    wth_verbose("%s >>> \n",__func__);
+    wth_enter();
     enum wthp_seat_capability caps = 0;
 
     caps |= WTHP_SEAT_CAPABILITY_POINTER;
@@ -654,13 +766,13 @@ seat_send_updated_caps(struct seat *seat)
     wth_verbose("WTHP_SEAT_CAPABILITY_TOUCH %d\n", caps);
 
     wthp_seat_send_capabilities(seat->obj, caps);
-    wth_verbose(" <<< %s \n",__func__);
+    wth_leave();
 }
 
 static void
 client_bind_seat(struct client *c, struct wthp_seat *obj)
 {
-    wth_verbose("%s >>> \n",__func__);
+    wth_enter();
     struct seat *seat;
 
     seat = zalloc(sizeof *seat);
@@ -677,7 +789,7 @@ client_bind_seat(struct client *c, struct wthp_seat *obj)
                 seat);
     wth_verbose("client %p bound wthp_seat\n", c);
     seat_send_updated_caps(seat);
-    wth_verbose(" <<< %s \n",__func__);
+    wth_leave();
 }
 
 /*
@@ -687,25 +799,25 @@ client_bind_seat(struct client *c, struct wthp_seat *obj)
 static void
 region_destroy(struct region *region)
 {
-    wth_verbose("%s >>> \n",__func__);
+    wth_enter();
     wth_verbose("region %p destroy\n", region->obj);
 
     wthp_region_free(region->obj);
     wl_list_remove(&region->link);
     free(region);
-    wth_verbose(" <<< %s \n",__func__);
+    wth_leave();
 }
 
 static void
 region_handle_destroy(struct wthp_region *wthp_region)
 {
-    wth_verbose("%s >>> \n",__func__);
+    wth_enter();
     struct region *region = wth_object_get_user_data((struct wth_object *)wthp_region);
 
     assert(wthp_region == region->obj);
 
     region_destroy(region);
-    wth_verbose(" <<< %s \n",__func__);
+    wth_leave();
 }
 
 static void
@@ -737,20 +849,20 @@ static const struct wthp_region_interface region_implementation = {
 static void
 compositor_destroy(struct compositor *comp)
 {
-    wth_verbose("%s >>> \n",__func__);
+    wth_enter();
     wth_verbose("%s: %p\n", __func__, comp->obj);
 
     wthp_compositor_free(comp->obj);
     wl_list_remove(&comp->link);
     free(comp);
-    wth_verbose(" <<< %s \n",__func__);
+    wth_leave();
 }
 
 static void
 compositor_handle_create_surface(struct wthp_compositor *compositor,
                  struct wthp_surface *id)
 {
-    wth_verbose("%s >>> \n",__func__);
+    wth_enter();
     struct compositor *comp = wth_object_get_user_data((struct wth_object *)compositor);
     struct client *client = comp->client;
     struct surface *surface;
@@ -766,6 +878,7 @@ compositor_handle_create_surface(struct wthp_compositor *compositor,
     }
 
     surface->obj = id;
+    surface->client = client;
     wl_list_insert(&comp->client->surface_list, &surface->link);
 
     wthp_surface_set_interface(id, &surface_implementation, surface);
@@ -782,14 +895,14 @@ compositor_handle_create_surface(struct wthp_compositor *compositor,
         surface->shm_window->receiver_seat = seat;
     }
 
-    wth_verbose(" <<< %s \n",__func__);
+    wth_leave();
 }
 
 static void
 compositor_handle_create_region(struct wthp_compositor *compositor,
                 struct wthp_region *id)
 {
-    wth_verbose("%s >>> \n",__func__);
+    wth_enter();
     struct compositor *comp = wth_object_get_user_data((struct wth_object *)compositor);
     struct region *region;
 
@@ -806,7 +919,7 @@ compositor_handle_create_region(struct wthp_compositor *compositor,
     wl_list_insert(&comp->client->region_list, &region->link);
 
     wthp_region_set_interface(id, &region_implementation, region);
-    wth_verbose(" <<< %s \n",__func__);
+    wth_leave();
 }
 
 static const struct wthp_compositor_interface compositor_implementation = {
@@ -817,7 +930,7 @@ static const struct wthp_compositor_interface compositor_implementation = {
 static void
 client_bind_compositor(struct client *c, struct wthp_compositor *obj)
 {
-    wth_verbose("%s >>> \n",__func__);
+    wth_enter();
     struct compositor *comp;
 
     comp = zalloc(sizeof *comp);
@@ -833,7 +946,7 @@ client_bind_compositor(struct client *c, struct wthp_compositor *obj)
     wthp_compositor_set_interface(obj, &compositor_implementation,
                       comp);
     wth_verbose("client %p bound wthp_compositor\n", c);
-    wth_verbose(" <<< %s \n",__func__);
+    wth_leave();
 }
 
 /*
@@ -842,23 +955,23 @@ client_bind_compositor(struct client *c, struct wthp_compositor *obj)
 static void
 registry_destroy(struct registry *reg)
 {
-    wth_verbose("%s >>> \n",__func__);
+    wth_enter();
     wth_verbose("%s: %p\n", __func__, reg->obj);
 
     wthp_registry_free(reg->obj);
     wl_list_remove(&reg->link);
     free(reg);
-    wth_verbose(" <<< %s \n",__func__);
+    wth_leave();
 }
 
 static void
 registry_handle_destroy(struct wthp_registry *registry)
 {
-    wth_verbose("%s >>> \n",__func__);
+    wth_enter();
     struct registry *reg = wth_object_get_user_data((struct wth_object *)registry);
 
     registry_destroy(reg);
-    wth_verbose(" <<< %s \n",__func__);
+    wth_leave();
 }
 
 static void
@@ -868,7 +981,7 @@ registry_handle_bind(struct wthp_registry *registry,
              const char *interface,
              uint32_t version)
 {
-    wth_verbose("%s >>> \n",__func__);
+    wth_enter();
     struct registry *reg = wth_object_get_user_data((struct wth_object *)registry);
     wth_verbose("Recieved registry : %s\n", interface);
 
@@ -892,7 +1005,7 @@ registry_handle_bind(struct wthp_registry *registry,
                       "%s: unknown name %u", __func__, name);
         wth_object_delete(id);
     }
-    wth_verbose(" <<< %s \n",__func__);
+    wth_leave();
 }
 
 static const struct wthp_registry_interface registry_implementation = {
@@ -908,29 +1021,29 @@ static void
 display_handle_client_version(struct wth_display *wth_display,
                   uint32_t client_version)
 {
-    wth_verbose("%s >>> \n",__func__);
+    wth_enter();
     wth_object_post_error((struct wth_object *)wth_display, 0,
                   "unimplemented: %s", __func__);
-    wth_verbose(" <<< %s \n",__func__);
+    wth_leave();
 }
 
 static void
 display_handle_sync(struct wth_display * wth_display, struct wthp_callback * callback)
 {
-    wth_verbose("%s >>> \n",__func__);
+    wth_enter();
     struct client *c = wth_object_get_user_data((struct wth_object *)wth_display);
 
     wth_verbose("Client %p requested wth_display.sync\n", c);
     wthp_callback_send_done(callback, 0);
     wthp_callback_free(callback);
-    wth_verbose(" <<< %s \n",__func__);
+    wth_leave();
 }
 
 static void
 display_handle_get_registry(struct wth_display *wth_display,
                 struct wthp_registry *registry)
 {
-    wth_verbose("%s >>> \n",__func__);
+    wth_enter();
     struct client *c = wth_object_get_user_data((struct wth_object *)wth_display);
     struct registry *reg;
 
@@ -950,7 +1063,21 @@ display_handle_get_registry(struct wth_display *wth_display,
     wthp_registry_send_global(registry, 1, "wthp_ivi_application", 1);
     wthp_registry_send_global(registry, 1, "wthp_seat", 4);
     wthp_registry_send_global(registry, 1, "wthp_blob_factory", 4);
-    wth_verbose(" <<< %s \n",__func__);
+
+    /* stream caps, see waltham-stream.h */
+    if (c->receiver->caps.codecs) {
+        wthp_registry_send_global(registry, 1, WTH_STREAM_GLOBAL_CODECS,
+                                  c->receiver->caps.codecs);
+        wthp_registry_send_global(registry, 1, WTH_STREAM_GLOBAL_DISPLAY,
+                                  WTH_STREAM_DISPLAY_PACK(c->receiver->caps.width,
+                                                          c->receiver->caps.height));
+        wthp_registry_send_global(registry, 1, WTH_STREAM_GLOBAL_PORT,
+                                  c->receiver->caps.port);
+        wthp_registry_send_global(registry, 1, WTH_STREAM_GLOBAL_ATLAS, 1);
+        wthp_registry_send_global(registry, 1, WTH_STREAM_GLOBAL_MULTICAST, 1);
+    }
+    wthp_registry_send_global(registry, 1, WTH_STREAM_GLOBAL_CLOCK, 1);
+    wth_leave();
 }
 
 const struct wth_display_interface display_implementation = {
@@ -965,7 +1092,7 @@ const struct wth_display_interface display_implementation = {
 static void
 connection_handle_data(struct watch *w, uint32_t events)
 {
-    wth_verbose("%s >>> \n",__func__);
+    wth_enter();
     struct client *c = container_of(w, struct client, conn_watch);
     int ret;
 
@@ -1012,7 +1139,7 @@ connection_handle_data(struct watch *w, uint32_t events)
             return;
         }
     }
-    wth_verbose(" <<< %s \n",__func__);
+    wth_leave();
 }
 
 /**
@@ -1027,7 +1154,7 @@ connection_handle_data(struct watch *w, uint32_t events)
 static struct client *
 client_create(struct receiver *srv, struct wth_connection *conn)
 {
-    wth_verbose("%s >>> \n",__func__);
+    wth_enter();
     struct client *c;
     struct wth_display *disp;
 
@@ -1062,7 +1189,7 @@ client_create(struct receiver *srv, struct wth_connection *conn)
     disp = wth_connection_get_display(c->connection);
     wth_display_set_interface(disp, &display_implementation, c);
 
-    wth_verbose(" <<< %s \n",__func__);
+    wth_leave();
     return c;
 }
 
@@ -1078,7 +1205,7 @@ client_create(struct receiver *srv, struct wth_connection *conn)
 void
 client_destroy(struct client *c)
 {
-    wth_verbose("%s >>> \n",__func__);
+    wth_enter();
     struct region *region;
     struct compositor *comp;
     struct registry *reg;
@@ -1105,7 +1232,61 @@ client_destroy(struct client *c)
     watch_ctl(&c->conn_watch, EPOLL_CTL_DEL, 0);
     wth_connection_destroy(c->connection);
     free(c);
-    wth_verbose(" <<< %s \n",__func__);
+    wth_leave();
+}
+
+/**
+* client_dispatch
+*
+* Flush a client connection and, if it is readable, dispatch its requests
+*
+* @param names        struct client *c
+*             bool readable
+* @param value        c        - client data
+*             readable - the connection fd polled readable
+* @return             0 on success, -1 if the connection failed
+*/
+int
+client_dispatch(struct client *c, bool readable)
+{
+    /* Errors are left to the main loop, which destroys the client once
+     * the render loop has returned.
+     */
+    if (readable) {
+        if (wth_connection_read(c->connection) < 0)
+            return -1;
+
+        if (wth_connection_dispatch(c->connection) < 0 && errno != EPROTO)
+            return -1;
+    }
+
+    if (wth_connection_flush(c->connection) < 0 && errno != EAGAIN)
+        return -1;
+
+    return 0;
+}
+
+/**
+* client_request_keyframe
+*
+* Ask the transmitter for a key frame, see WTH_STREAM_GLOBAL_KEYFRAME
+*
+* @param names        struct client *c
+* @param value        c - client data
+* @return             none
+*/
+void
+client_request_keyframe(struct client *c)
+{
+    struct registry *reg;
+
+    if (wl_list_empty(&c->registry_list))
+        return;
+
+    reg = wl_container_of(c->registry_list.next, reg, link);
+    wthp_registry_send_global(reg->obj, ++c->keyframe_requests,
+                              WTH_STREAM_GLOBAL_KEYFRAME, 1);
+    wth_connection_flush(c->connection);
 }
 
 /**
@@ -1120,7 +1301,7 @@ client_destroy(struct client *c)
 void
 receiver_flush_clients(struct receiver *srv)
 {
-    wth_verbose("%s >>> \n",__func__);
+    wth_enter();
     struct client *c, *tmp;
     int ret;
 
@@ -1138,7 +1319,7 @@ receiver_flush_clients(struct receiver *srv)
         }
     }
 
-    wth_verbose(" <<< %s \n",__func__);
+    wth_leave();
 
 }
 
@@ -1154,7 +1335,7 @@ receiver_flush_clients(struct receiver *srv)
 void
 receiver_accept_client(struct receiver *srv)
 {
-    wth_verbose("%s >>> \n",__func__);
+    wth_enter();
     struct client *client;
     struct wth_connection *conn;
     struct sockaddr_in addr;
@@ -1172,5 +1353,6 @@ receiver_accept_client(struct receiver *srv)
         wth_error("Failed client_create().\n");
         return;
     }
-    wth_verbose(" <<< %s \n",__func__);
+    inet_ntop(AF_INET, &addr.sin_addr, client->peer, sizeof client->peer);
+    wth_leave();
 }
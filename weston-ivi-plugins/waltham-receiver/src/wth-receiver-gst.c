@@ -35,13 +35,17 @@
  *******************************************************************************/
 
 #include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <poll.h>
 #include <signal.h>
 #include <sys/time.h>
+#include <arpa/inet.h>
 #include <gst/gst.h>
 #include <GL/gl.h>
 #include <gst/video/gstvideometa.h>
 #include <gst/allocators/gstdmabuf.h>
 #include <gst/app/gstappsink.h>
+#include <gst/rtp/gstrtpbuffer.h>
 #include <pthread.h>
 #include <gst/wayland/wayland.h>
 #include <gst/video/videooverlay.h>
@@ -49,6 +53,7 @@
 #include <xf86drm.h>
 #include <drm.h>
 #include <drm_fourcc.h>
+#include <lz4.h>
 
 #include "wth-receiver-comm.h"
 #include "os-compatibility.h"
@@ -56,6 +61,17 @@
 #include "bitmap.h"
 static int running = 1;
 
+/* encoded frames whose decode is still in flight */
+#define STATS_RING 64
+
+struct stats_entry {
+	GstClockTime pts;
+	gint64 arrival;		/* monotonic, microseconds */
+	gint64 decoded;		/* same, -1 until it reaches the sink */
+	gsize size;		/* encoded size */
+	struct wth_stream_trace trace;
+};
+
 typedef struct _GstAppContext
 {
 	GMainLoop *loop;
@@ -64,7 +80,43 @@ typedef struct _GstAppContext
 	GstElement *sink;
 	struct display *display;
 	struct window *window;
+	struct client *client;	/* NULL if the surface has none */
 	GstVideoInfo info;
+
+	int event_fd;		/* wakes up the render loop */
+	gint stream_size;	/* WTH_STREAM_DISPLAY_PACK of the last caps */
+
+	/* appsink presentation, unused with waylandsink */
+	GstElement *appsink;
+	GstSample *current;	/* on screen; holds its buffer out of the pool */
+
+	/* latest-frame-only presentation */
+	bool latest;
+	GMutex lock;
+	GstSample *pending;	/* newest sample not shown yet, under lock */
+
+	/* per-frame statistics, see stats_arrival_probe */
+	FILE *stats;
+	GMutex stats_lock;
+	struct stats_entry stats_ring[STATS_RING];
+	unsigned int stats_head;
+	uint32_t stats_frames;
+	struct wth_stream_trace stats_trace;	/* from the last RTP packet */
+	bool has_clock_offset;	/* copied from the client by the render loop */
+	int64_t clock_offset;
+
+	/* key frame requests, see keyframe_probe */
+	gint keyframe_wanted;	/* atomic, set from any thread */
+	gint64 keyframe_sent;	/* last request, render loop only */
+	guint16 rtp_seq;	/* newest seen, streaming thread only */
+	bool rtp_started;
+
+	/* error concealment, see conceal_probe; streaming thread only */
+	bool concealing;
+	bool decoded_any;	/* a key frame went through */
+	gint64 conceal_start;
+	gint64 concealed_us;
+	uint32_t frames_concealed;
 }GstAppContext;
 
 static const gchar *vertex_shader_str =
@@ -91,6 +143,35 @@ static const gchar *fragment_shader_str =
 "gl_FragColor = c;                                     \n"
 "}                                                     \n";
 
+static const gchar *fragment_shader_external_str =
+"#extension GL_OES_EGL_image_external : require        \n"
+"precision mediump float;                              \n"
+"varying vec2 v_texCoord;                              \n"
+"uniform samplerExternalOES tex;                       \n"
+"void main()                                           \n"
+"{                                                     \n"
+"gl_FragColor = texture2D(tex, v_texCoord);            \n"
+"}                                                     \n";
+
+/* the window of a wl_surface, with an atlas stream there are several */
+static struct window *
+display_window(struct display *display, struct wl_surface *surface)
+{
+	struct window *window;
+
+	wl_list_for_each(window, &display->atlas, atlas_link)
+		if (window->surface == surface)
+			return window;
+
+	return display->window;
+}
+
+static struct window *
+focus_window(struct display *display, struct window *focus)
+{
+	return focus ? focus : display->window;
+}
+
 /*
  * pointer callbcak functions
  */
@@ -99,46 +180,49 @@ pointer_handle_enter(void *data, struct wl_pointer *wl_pointer,
 		uint32_t serial, struct wl_surface *wl_surface,
 		wl_fixed_t sx, wl_fixed_t sy)
 {
-	wth_verbose("%s >>> \n",__func__);
+	wth_enter();
 
 	wth_verbose("data [%p]\n", data);
 
 	struct display *display = data;
-	struct window *window = display->window;
+	struct window *window = display_window(display, wl_surface);
+
+	display->pointer_focus = window;
 
 	waltham_pointer_enter(window, serial, sx, sy);
 
-	wth_verbose(" <<< %s \n",__func__);
+	wth_leave();
 }
 
 static void
 pointer_handle_leave(void *data, struct wl_pointer *pointer,
 		uint32_t serial, struct wl_surface *surface)
 {
-	wth_verbose("%s >>> \n",__func__);
+	wth_enter();
 
 	wth_verbose("data [%p]\n", data);
 
 	struct display *display = data;
-	struct window *window = display->window;
+	struct window *window = focus_window(display, display->pointer_focus);
 
 	waltham_pointer_leave(window, serial);
+	display->pointer_focus = NULL;
 
-	wth_verbose(" <<< %s \n",__func__);
+	wth_leave();
 }
 
 static void
 pointer_handle_motion(void *data, struct wl_pointer *pointer,
 		uint32_t time, wl_fixed_t sx, wl_fixed_t sy)
 {
-	wth_verbose("%s >>> \n",__func__);
+	wth_enter();
 
 	struct display *display = data;
-	struct window *window = display->window;
+	struct window *window = focus_window(display, display->pointer_focus);
 
 	waltham_pointer_motion(window, time, sx, sy);
 
-	wth_verbose(" <<< %s \n",__func__);
+	wth_leave();
 }
 
 static void
@@ -146,28 +230,28 @@ pointer_handle_button(void *data, struct wl_pointer *wl_pointer,
 		uint32_t serial, uint32_t time, uint32_t button,
 		uint32_t state)
 {
-	wth_verbose("%s >>> \n",__func__);
+	wth_enter();
 
 	struct display *display = data;
-	struct window *window = display->window;
+	struct window *window = focus_window(display, display->pointer_focus);
 
 	waltham_pointer_button(window, serial, time, button, state);
 
-	wth_verbose(" <<< %s \n",__func__);
+	wth_leave();
 }
 
 static void
 pointer_handle_axis(void *data, struct wl_pointer *wl_pointer,
 		uint32_t time, uint32_t axis, wl_fixed_t value)
 {
-	wth_verbose("%s >>> \n",__func__);
+	wth_enter();
 
 	struct display *display = data;
-	struct window *window = display->window;
+	struct window *window = focus_window(display, display->pointer_focus);
 
 	waltham_pointer_axis(window, time, axis, value);
 
-	wth_verbose(" <<< %s \n",__func__);
+	wth_leave();
 }
 
 static const struct wl_pointer_listener pointer_listener = {
@@ -187,28 +271,29 @@ touch_handle_down(void *data, struct wl_touch *touch, uint32_t serial,
 		uint32_t time, struct wl_surface *surface, int32_t id,
 		wl_fixed_t x_w, wl_fixed_t y_w)
 {
-	wth_verbose("%s >>> \n",__func__);
+	wth_enter();
 
 	struct display *display = data;
-	struct window *window = display->window;
+	struct window *window = display_window(display, surface);
 
 	int x = (int)wl_fixed_to_double(x_w);
 	int y = (int)wl_fixed_to_double(y_w);
 	wth_verbose("%p x %d y %d\n",window, x, y);
 
+	display->touch_focus = window;
 	waltham_touch_down(window, serial, time, id, x_w, y_w);
 
-	wth_verbose(" <<< %s \n",__func__);
+	wth_leave();
 }
 
 static void
 touch_handle_up(void *data, struct wl_touch *touch, uint32_t serial,
 		uint32_t time, int32_t id)
 {
-	wth_verbose("%s >>> \n",__func__);
+	wth_enter();
 
 	struct display *display = data;
-	struct window *window = display->window;
+	struct window *window = focus_window(display, display->touch_focus);
 
 	waltham_touch_up(window, serial, time, id);
 }
@@ -217,40 +302,40 @@ static void
 touch_handle_motion(void *data, struct wl_touch *touch, uint32_t time,
 		int32_t id, wl_fixed_t x_w, wl_fixed_t y_w)
 {
-	wth_verbose("%s >>> \n",__func__);
+	wth_enter();
 
 	struct display *display = data;
-	struct window *window = display->window;
+	struct window *window = focus_window(display, display->touch_focus);
 
 	waltham_touch_motion(window, time, id, x_w, y_w);
 
-	wth_verbose(" <<< %s \n",__func__);
+	wth_leave();
 }
 
 static void
 touch_handle_frame(void *data, struct wl_touch *touch)
 {
-	wth_verbose("%s >>> \n",__func__);
+	wth_enter();
 
 	struct display *display = data;
-	struct window *window = display->window;
+	struct window *window = focus_window(display, display->touch_focus);
 
 	waltham_touch_frame(window);
 
-	wth_verbose(" <<< %s \n",__func__);
+	wth_leave();
 }
 
 static void
 touch_handle_cancel(void *data, struct wl_touch *touch)
 {
-	wth_verbose("%s >>> \n",__func__);
+	wth_enter();
 
 	struct display *display = data;
-	struct window *window = display->window;
+	struct window *window = focus_window(display, display->touch_focus);
 
 	waltham_touch_cancel(window);
 
-	wth_verbose(" <<< %s \n",__func__);
+	wth_leave();
 }
 
 static const struct wl_touch_listener touch_listener = {
@@ -267,7 +352,7 @@ static const struct wl_touch_listener touch_listener = {
 static void
 seat_capabilities(void *data, struct wl_seat *wl_seat, enum wl_seat_capability caps)
 {
-	wth_verbose("%s >>> \n",__func__);
+	wth_enter();
 
 	struct display *display = data;
 
@@ -299,7 +384,7 @@ seat_capabilities(void *data, struct wl_seat *wl_seat, enum wl_seat_capability c
 		display->wl_touch = NULL;
 	}
 
-	wth_verbose(" <<< %s \n",__func__);
+	wth_leave();
 }
 
 static const struct wl_seat_listener seat_listener = {
@@ -310,7 +395,7 @@ static const struct wl_seat_listener seat_listener = {
 static void
 add_seat(struct display *display, uint32_t id, uint32_t version)
 {
-	wth_verbose("%s >>> \n",__func__);
+	wth_enter();
 
 	display->wl_pointer = NULL;
 	display->wl_touch = NULL;
@@ -318,14 +403,48 @@ add_seat(struct display *display, uint32_t id, uint32_t version)
 	display->seat = wl_registry_bind(display->registry, id,
 			&wl_seat_interface, 1);
 	wl_seat_add_listener(display->seat, &seat_listener, display);
-	wth_verbose(" <<< %s \n",__func__);
+	wth_leave();
+}
+
+/*
+ * Key frame requests. After a loss the decoder has nothing to refer to
+ * until the next key frame, so the receiver asks for one on joining the
+ * stream, on RTP sequence gaps and on decoder warnings. The waltham
+ * connection belongs to the render loop, which sends the request; the
+ * others only flag it. At most one request goes out per KEYFRAME_INTERVAL,
+ * which is more than the round trip to the transmitter: the key frame
+ * answering a request also repairs what was lost while it was on its way.
+ */
+#define KEYFRAME_INTERVAL (100 * G_TIME_SPAN_MILLISECOND)
+
+/* time for the GOP the transmitter replays on joining a multicast group to
+ * get in before the packets from the group, see build_pipeline() */
+#define MULTICAST_LATENCY_MS 100
+
+/*
+ * keyframe_request
+ *
+ * Flags a key frame request and wakes up the render loop. Any thread.
+ */
+static void
+keyframe_request(GstAppContext *ctx, const char *why)
+{
+	uint64_t one = 1;
+
+	if (!ctx->client ||
+	    !g_atomic_int_compare_and_exchange(&ctx->keyframe_wanted, 0, 1))
+		return;
+
+	wth_verbose("key frame wanted: %s\n", why);
+	if (write(ctx->event_fd, &one, sizeof one) < 0)
+		wth_error("eventfd write failed: %s\n", strerror(errno));
 }
 
 gboolean bus_message(GstBus *bus, GstMessage *message, gpointer p)
 {
 	GstAppContext *gstctx = p;
 
-	fprintf(stderr, "mesage: %s\n", GST_MESSAGE_TYPE_NAME(message));
+	wth_verbose("message: %s\n", GST_MESSAGE_TYPE_NAME(message));
 
 	switch( GST_MESSAGE_TYPE(message)) {
 	case GST_MESSAGE_ERROR:
@@ -334,7 +453,7 @@ gboolean bus_message(GstBus *bus, GstMessage *message, gpointer p)
 		gchar *debug;
 
 		gst_message_parse_error(message, &err, &debug);
-		g_print("ERROR: %s\n", err->message);
+		wth_error("ERROR: %s\n", err->message);
 
 		g_error_free(err);
 		g_free(debug);
@@ -342,33 +461,39 @@ gboolean bus_message(GstBus *bus, GstMessage *message, gpointer p)
 		break;
 	}
 
+	case GST_MESSAGE_WARNING:
+		/* decoders warn about the frames they could not decode */
+		keyframe_request(gstctx, GST_MESSAGE_SRC_NAME(message));
+		break;
+
 	case GST_MESSAGE_STATE_CHANGED:
 	{
 		GstState oldstate, newstate;
 
 		gst_message_parse_state_changed(message, &oldstate, &newstate, NULL);
-		fprintf(stderr, "#%s state changed\n", GST_MESSAGE_SRC_NAME(message));
+		wth_verbose("#%s state changed\n", GST_MESSAGE_SRC_NAME(message));
 		switch (newstate){
 		case GST_STATE_NULL:
-			fprintf(stderr, "%s: state is NULL\n", GST_MESSAGE_SRC_NAME(message));
+			wth_verbose("%s: state is NULL\n", GST_MESSAGE_SRC_NAME(message));
 			break;
 		case GST_STATE_READY:
-			fprintf(stderr, "%s: state is READY\n", GST_MESSAGE_SRC_NAME(message));
+			wth_verbose("%s: state is READY\n", GST_MESSAGE_SRC_NAME(message));
 			break;
 		case GST_STATE_PAUSED:
-			fprintf(stderr, "%s: state is PAUSED\n", GST_MESSAGE_SRC_NAME(message));
+			wth_verbose("%s: state is PAUSED\n", GST_MESSAGE_SRC_NAME(message));
 			break;
 		case GST_STATE_PLAYING:
-			fprintf(stderr, "%s: state is PLAYING\n", GST_MESSAGE_SRC_NAME(message));
+			wth_verbose("%s: state is PLAYING\n", GST_MESSAGE_SRC_NAME(message));
 			break;
 		}
 		break;
 	}
 	default:
-		fprintf(stderr, "Unhandled message\n");
+		wth_verbose("Unhandled message\n");
 		break;
 	}
-	fprintf(stderr, "-----------------\n");
+
+	return TRUE;
 }
 
 /*
@@ -378,7 +503,7 @@ static void
 registry_handle_global(void *data, struct wl_registry *registry,
 		uint32_t id, const char *interface, uint32_t version)
 {
-	wth_verbose("%s >>> \n",__func__);
+	wth_enter();
 
 	struct display *d = data;
 
@@ -392,8 +517,13 @@ registry_handle_global(void *data, struct wl_registry *registry,
 					 &ivi_application_interface, 1);
 	} else if (strcmp(interface, "wl_seat") == 0) {
 		add_seat(d, id, version);
+	} else if (strcmp(interface, "wl_shm") == 0) {
+		d->shm = wl_registry_bind(registry, id, &wl_shm_interface, 1);
+	} else if (strcmp(interface, "wl_subcompositor") == 0) {
+		d->subcompositor = wl_registry_bind(registry, id,
+						    &wl_subcompositor_interface, 1);
 	}
-	wth_verbose(" <<< %s \n",__func__);
+	wth_leave();
 }
 
 static void
@@ -408,27 +538,10 @@ static const struct wl_registry_listener registry_listener = {
 	registry_handle_global_remove
 };
 
-wth_receiver_weston_shm_attach(struct window *window, uint32_t data_sz, void * data,
-		int32_t width, int32_t height, int32_t stride, uint32_t format)
-{
-	/* stub */
-}
-void
-wth_receiver_weston_shm_damage(struct window *window)
-{
-	/* stub */
-}
-
-void
-wth_receiver_weston_shm_commit(struct window *window)
-{
-	/* stub */
-}
-
 static struct display *
 create_display(void)
 {
-	wth_verbose("%s >>> \n",__func__);
+	wth_enter();
 
 	struct display *display;
 
@@ -441,20 +554,27 @@ create_display(void)
 	assert(display->display);
 
 	display->has_xrgb = false;
+	display->shm = NULL;
+	display->subcompositor = NULL;
+	wl_list_init(&display->atlas);
+	display->pointer_focus = NULL;
+	display->touch_focus = NULL;
 	display->registry = wl_display_get_registry(display->display);
 	wl_registry_add_listener(display->registry,
 			&registry_listener, display);
 	wl_display_roundtrip(display->display);
 
-	wth_verbose(" <<< %s \n",__func__);
+	wth_leave();
 	return display;
 }
 
 static void
 destroy_display(struct display *display)
 {
-	wth_verbose("%s >>> \n",__func__);
+	wth_enter();
 
+	if (display->subcompositor)
+		wl_subcompositor_destroy(display->subcompositor);
 	if (display->compositor)
 		wl_compositor_destroy(display->compositor);
 
@@ -463,7 +583,7 @@ destroy_display(struct display *display)
 	wl_display_disconnect(display->display);
 	free(display);
 
-	wth_verbose(" <<< %s \n",__func__);
+	wth_leave();
 }
 
 /*
@@ -483,7 +603,7 @@ static const struct ivi_surface_listener ivi_surface_listener = {
 static void
 init_egl(struct display *display)
 {
-	wth_verbose("%s >>> \n",__func__);
+	wth_enter();
 	EGLint config_attribs[] = {
 		EGL_SURFACE_TYPE, EGL_WINDOW_BIT,
 		EGL_RED_SIZE, 8,
@@ -532,12 +652,16 @@ init_egl(struct display *display)
 	display->egl.destroy_image =
 		(void *) eglGetProcAddress("eglDestroyImageKHR");
 	assert(display->egl.destroy_image);
-	wth_verbose("%s <<< \n",__func__);
+
+	display->egl.has_dmabuf_import =
+		strstr(eglQueryString(display->egl.dpy, EGL_EXTENSIONS),
+		       "EGL_EXT_image_dma_buf_import") != NULL;
+	wth_leave();
 }
 
 GLuint load_shader(GLenum type, const char *shaderSrc)
 {
-	wth_verbose("%s >>> \n",__func__);
+	wth_enter();
 	GLuint shader;
 	GLint compiled;
 
@@ -545,7 +669,7 @@ GLuint load_shader(GLenum type, const char *shaderSrc)
 	shader = glCreateShader(type);
 	if (shader == 0)
 	{
-		printf("\n Failed to create shader \n");
+		wth_error("Failed to create shader\n");
 		return 0;
 	}
 	/* Load the shader source */
@@ -562,7 +686,7 @@ GLuint load_shader(GLenum type, const char *shaderSrc)
 		{
 			char* infoLog = (char*)malloc (sizeof(char) * infoLen );
 			glGetShaderInfoLog(shader, infoLen, NULL, infoLog);
-			fprintf(stderr, "Error compiling shader:%s\n",infoLog);
+			wth_error("Error compiling shader:%s\n",infoLog);
 			free(infoLog);
 		}
 		glDeleteShader(shader);
@@ -573,7 +697,7 @@ GLuint load_shader(GLenum type, const char *shaderSrc)
 
 void init_gl(struct display *display)
 {
-	wth_verbose("%s >>> \n",__func__);
+	wth_enter();
 	GLint linked;
 
 	/* load vertext/fragment shader */
@@ -584,7 +708,7 @@ void init_gl(struct display *display)
 	display->gl.program_object = glCreateProgram();
 	if (display->gl.program_object == 0)
 	{
-		fprintf(stderr, "error program object\n");
+		wth_error("error program object\n");
 		return;
 	}
 
@@ -604,7 +728,7 @@ void init_gl(struct display *display)
 		{
 			char* infoLog = (char*)malloc(sizeof(char) * infoLen);
 			glGetProgramInfoLog(display->gl.program_object, infoLen, NULL, infoLog);
-			fprintf(stderr, "Error linking program:%s\n", infoLog);
+			wth_error("Error linking program:%s\n", infoLog);
 			free(infoLog);
 		}
 		glDeleteProgram(display->gl.program_object);
@@ -612,26 +736,83 @@ void init_gl(struct display *display)
 
 	glGenTextures(1, &display->gl.texture);
 
+	/* YUV dmabufs can only be sampled through an external texture */
+	display->gl.external_program = 0;
+	if (display->egl.has_dmabuf_import &&
+	    strstr((const char *)glGetString(GL_EXTENSIONS),
+		   "GL_OES_EGL_image_external")) {
+		GLuint fs = load_shader(GL_FRAGMENT_SHADER,
+					fragment_shader_external_str);
+		GLuint program = glCreateProgram();
+
+		glAttachShader(program, display->gl.vertex_shader);
+		glAttachShader(program, fs);
+		glBindAttribLocation(program, 0, "a_position");
+		glLinkProgram(program);
+		glGetProgramiv(program, GL_LINK_STATUS, &linked);
+		glDeleteShader(fs);
+		if (linked) {
+			display->gl.external_program = program;
+			glGenTextures(1, &display->gl.external_texture);
+		} else {
+			wth_error("Error linking external program\n");
+			glDeleteProgram(program);
+		}
+	}
+
 	return;
 }
 
+/*
+ * The lossless layer of transport=hybrid: a subsurface over the video at
+ * its origin, taking no input. Without one the receiver shows the video
+ * alone, the tiles in it are only coarser.
+ */
+static void
+create_overlay(struct window *window)
+{
+	struct display *display = window->display;
+	struct wl_region *region;
+
+	if (!display->subcompositor || !display->shm) {
+		wth_error("no wl_subcompositor or wl_shm, showing the video only\n");
+		window->hybrid = false;
+		return;
+	}
+
+	window->raw_surface = wl_compositor_create_surface(display->compositor);
+	window->overlay = wl_subcompositor_get_subsurface(display->subcompositor,
+							  window->raw_surface,
+							  window->surface);
+	wl_subsurface_set_position(window->overlay, 0, 0);
+	wl_subsurface_set_desync(window->overlay);
+
+	region = wl_compositor_create_region(display->compositor);
+	wl_surface_set_input_region(window->raw_surface, region);
+	wl_region_destroy(region);
+}
+
 static void
 create_surface(struct window *window)
 {
-	wth_verbose("%s >>> \n",__func__);
+	wth_enter();
 	struct display *display = window->display;
 	int ret;
 
 	window->surface = wl_compositor_create_surface(display->compositor);
 	assert(window->surface);
+	window->raw_surface = window->surface;
 
-	window->native = wl_egl_window_create(window->surface,
-					      window->width, window->height);
-	assert(window->native);
+	/* raw: wl_shm buffers, see raw_present */
+	if (!window->raw) {
+		window->native = wl_egl_window_create(window->surface,
+						      window->width, window->height);
+		assert(window->native);
 
-	window->egl_surface = eglCreateWindowSurface(display->egl.dpy,
-						     display->egl.conf,
-						     (NativeWindowType)window->native, NULL);
+		window->egl_surface = eglCreateWindowSurface(display->egl.dpy,
+							     display->egl.conf,
+							     (NativeWindowType)window->native, NULL);
+	}
 
 	wl_display_roundtrip(display->display);
 	if (display->ivi_application ) {
@@ -649,21 +830,33 @@ create_surface(struct window *window)
 	} else {
 		assert(0);
 	}
+	if (window->raw) {
+		wth_leave();
+		return;
+	}
+	if (window->hybrid)
+		create_overlay(window);
+
 	ret = eglMakeCurrent(display->egl.dpy, window->egl_surface,
 			     window->egl_surface, display->egl.ctx);
 	assert(ret == EGL_TRUE);
 
+	/* one frame is drawn on each surface of an atlas in turn, a swap
+	 * waiting for each of them would take as many refreshes */
+	if (window->atlas)
+		eglSwapInterval(display->egl.dpy, 0);
+
 	glClearColor(0.0, 0.0, 0.0, 1.0);
 	glClear(GL_COLOR_BUFFER_BIT);
 
 	eglSwapBuffers(display->egl.dpy, window->egl_surface);
-	wth_verbose(" <<< %s \n",__func__);
+	wth_leave();
 }
 
 static void
 create_window(struct window *window, struct display *display, int width, int height)
 {
-	wth_verbose("%s >>> \n",__func__);
+	wth_enter();
 
 	window->callback = NULL;
 
@@ -675,14 +868,14 @@ create_window(struct window *window, struct display *display, int width, int hei
 
 	create_surface(window);
 
-	wth_verbose(" <<< %s \n",__func__);
+	wth_leave();
 	return;
 }
 
 static void
 destroy_window(struct window *window)
 {
-	wth_verbose("%s >>> \n",__func__);
+	wth_enter();
 
 	if (window->callback)
 		wl_callback_destroy(window->callback);
@@ -691,11 +884,21 @@ destroy_window(struct window *window)
 		wl_buffer_destroy(window->buffers[0].buffer);
 	if (window->buffers[1].buffer)
 		wl_buffer_destroy(window->buffers[1].buffer);
-
+	if (window->buffers[0].shm_data)
+		munmap(window->buffers[0].shm_data, window->buffers[0].size);
+	if (window->buffers[1].shm_data)
+		munmap(window->buffers[1].shm_data, window->buffers[1].size);
+
+	if (window->overlay) {
+		wl_subsurface_destroy(window->overlay);
+		wl_surface_destroy(window->raw_surface);
+	}
 	wl_surface_destroy(window->surface);
+	free(window->raw_image);
+	free(window->raw_scratch);
 	free(window);
 
-	wth_verbose(" <<< %s \n",__func__);
+	wth_leave();
 }
 
 static void
@@ -706,19 +909,20 @@ signal_int(int signum)
 
 void *stream_thread(void *data)
 {
-	wth_verbose("%s >>> \n",__func__);
+	wth_enter();
 	GMainLoop *loop = data;
 	g_main_loop_run(loop);
-	wth_verbose(" <<< %s \n",__func__);
+	wth_leave();
 }
 
 static GstPadProbeReturn
 pad_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
 {
-	wth_verbose("%s >>> \n",__func__);
+	wth_enter();
 	GstAppContext *dec = user_data;
 	GstEvent *event = GST_PAD_PROBE_INFO_EVENT(info);
 	GstCaps *caps;
+	uint64_t one = 1;
 
 	(void)pad;
 
@@ -737,69 +941,437 @@ pad_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
 		return GST_PAD_PROBE_OK;
 	}
 
-	dec->window->width=GST_VIDEO_INFO_WIDTH(&dec->info);
-	dec->window->height=GST_VIDEO_INFO_HEIGHT(&dec->info);
-	gst_video_overlay_set_render_rectangle(GST_VIDEO_OVERLAY (dec->sink),0,0,dec->window->width,dec->window->height);
-	wl_surface_commit(dec->window->surface);
+	/* the render loop owns the EGL surface and does the resize */
+	g_atomic_int_set(&dec->stream_size,
+			 WTH_STREAM_DISPLAY_PACK(GST_VIDEO_INFO_WIDTH(&dec->info),
+						 GST_VIDEO_INFO_HEIGHT(&dec->info)));
+	if (write(dec->event_fd, &one, sizeof one) < 0)
+		wth_error("eventfd write failed: %s\n", strerror(errno));
 
-	wth_verbose(" <<< %s \n",__func__);
+	wth_leave();
 	return GST_PAD_PROBE_OK;
 }
 
+/* Decoder chains, preferred ones first. The first element of each chain
+ * whose factory is present decides whether the chain is usable. Software
+ * decoders end in RGBA, the only system memory format upload_buffer()
+ * takes.
+ */
+struct decoder {
+	const char *element;
+	uint32_t codec;
+	const char *chain;
+};
+
+static const struct decoder decoders[] = {
+	{ "omxh264dec",   WTH_STREAM_CODEC_H264,
+	  "h264parse config-interval=1 disable-passthrough=true ! omxh264dec no-reorder=true" },
+	{ "mfxdecode",    WTH_STREAM_CODEC_H264, "h264parse ! mfxdecode" },
+	{ "vaapih264dec", WTH_STREAM_CODEC_H264, "h264parse ! vaapih264dec" },
+	{ "v4l2h264dec",  WTH_STREAM_CODEC_H264, "h264parse ! v4l2h264dec" },
+	{ "avdec_h264",   WTH_STREAM_CODEC_H264, "h264parse ! avdec_h264 ! "
+	  "videoconvert ! video/x-raw,format=RGBA" },
+	{ "jpegdec",      WTH_STREAM_CODEC_JPEG,
+	  "jpegdec ! videoconvert ! video/x-raw,format=RGBA" },
+};
+
+/* chosen decoder per codec, filled by wth_receiver_weston_probe_caps */
+static const struct decoder *decoder_jpeg;
+static const struct decoder *decoder_h264;
+
+static void
+output_handle_geometry(void *data, struct wl_output *wl_output,
+		int32_t x, int32_t y, int32_t physical_width,
+		int32_t physical_height, int32_t subpixel,
+		const char *make, const char *model, int32_t transform)
+{
+	/* stub */
+}
+
+static void
+output_handle_mode(void *data, struct wl_output *wl_output,
+		uint32_t flags, int32_t width, int32_t height, int32_t refresh)
+{
+	struct wth_stream_caps *caps = data;
+
+	if (!(flags & WL_OUTPUT_MODE_CURRENT))
+		return;
+
+	/* several outputs: stream for the largest one */
+	if (width * height > caps->width * caps->height) {
+		caps->width = width;
+		caps->height = height;
+	}
+}
+
+static const struct wl_output_listener output_listener = {
+	output_handle_geometry,
+	output_handle_mode,
+};
+
+static void
+probe_registry_handle_global(void *data, struct wl_registry *registry,
+		uint32_t id, const char *interface, uint32_t version)
+{
+	struct wl_output *output;
+
+	if (strcmp(interface, "wl_output") == 0) {
+		output = wl_registry_bind(registry, id, &wl_output_interface, 1);
+		wl_output_add_listener(output, &output_listener, data);
+	}
+}
+
+static const struct wl_registry_listener probe_registry_listener = {
+	probe_registry_handle_global,
+	registry_handle_global_remove
+};
+
 /**
- * wth_receiver_weston_main
+ * wth_receiver_weston_probe_caps
  *
- * This is the main function which will handle connection to the compositor at receiver side
+ * Finds out what this receiver can decode and how large its display is
  *
- * @param names        void *data
- * @param value        struct window data
- * @return             0 on success, -1 on error
+ * @param caps        filled with the result
+ * @param headless    true if there is no compositor to ask for the size
  */
-int
-wth_receiver_weston_main(struct window *window)
+void
+wth_receiver_weston_probe_caps(struct wth_stream_caps *caps, bool headless)
 {
-	wth_verbose("%s >>> \n",__func__);
+	wth_enter();
 
-	struct sigaction sigint;
-	pthread_t pthread;
-	GstAppContext gstctx;
-	int ret = 0;
-	GError *gerror = NULL;
-	char * pipe = NULL;
-	FILE *pFile;
-	long lSize;
-	size_t res;
-	GstContext *context;
+	struct wl_display *display;
+	struct wl_registry *registry;
+	GstElementFactory *factory;
+	unsigned int i;
 
-	memset(&gstctx, 0, sizeof(gstctx));
-	/* Initialization for window creation */
-	gstctx.display = create_display();
-	init_egl(gstctx.display);
-	/* ToDo: fix the hardcoded value of width, height */
-	create_window(window, gstctx.display,1920,1080);
-	init_gl(gstctx.display);
-	gstctx.window = window;
+	memset(caps, 0, sizeof *caps);
+
+	/* patched into wl_shm buffers, nothing to probe */
+	caps->codecs = WTH_STREAM_CODEC_RAW;
+
+	gst_init(NULL, NULL);
+	for (i = 0; i < ARRAY_LENGTH(decoders); i++) {
+		if (caps->codecs & decoders[i].codec)
+			continue;
+
+		factory = gst_element_factory_find(decoders[i].element);
+		if (!factory)
+			continue;
+		gst_object_unref(factory);
+
+		caps->codecs |= decoders[i].codec;
+		if (decoders[i].codec == WTH_STREAM_CODEC_JPEG)
+			decoder_jpeg = &decoders[i];
+		else
+			decoder_h264 = &decoders[i];
+
+		wth_verbose("decoding %s with %s\n",
+			    wth_stream_codec_name(decoders[i].codec),
+			    decoders[i].element);
+	}
 
-	gstctx.display->window = window;
+	display = headless ? NULL : wl_display_connect(NULL);
+	if (display) {
+		registry = wl_display_get_registry(display);
+		wl_registry_add_listener(registry, &probe_registry_listener, caps);
+		/* globals, then the output events */
+		wl_display_roundtrip(display);
+		wl_display_roundtrip(display);
+		wl_registry_destroy(registry);
+		wl_display_disconnect(display);
+	} else if (!headless) {
+		wth_error("failed to connect to the compositor\n");
+	}
 
-	wth_verbose("display %p\n", gstctx.display);
-	wth_verbose("display->window %p\n", gstctx.display->window);
-	wth_verbose("window %p\n", window);
+	wth_verbose("codecs 0x%x display %dx%d\n",
+		    caps->codecs, caps->width, caps->height);
+	wth_leave();
+}
 
-	sigint.sa_handler = signal_int;
-	sigemptyset(&sigint.sa_mask);
-	sigint.sa_flags = SA_RESETHAND;
-	sigaction(SIGINT, &sigint, NULL);
+/*
+ * build_pipeline
+ *
+ * Builds the receiving pipeline for a negotiated stream. When the
+ * transmitter takes RTCP, an rtpbin sends it receiver reports (loss and
+ * jitter, for its bitrate control) and takes its sender reports.
+ *
+ * A multicast stream comes from the group, and on joining the packets
+ * since the last key frame come to our own port. The jitter buffer orders
+ * them before the ones from the group; there is no RTCP, and no rtpbin,
+ * which would take the two sources of one SSRC for a collision.
+ *
+ * @param config      the stream the transmitter announced
+ * @param sink        the sink element, named "sink"
+ * @param peer        the transmitter's address
+ * @return            the pipeline description, NULL if it cannot be decoded
+ */
+static char *
+build_pipeline(const struct wth_stream_config *config, const char *sink,
+	       const char *peer)
+{
+	const char *encoding, *depay, *chain, *jitter = "";
+	char group[INET_ADDRSTRLEN];
+	struct in_addr addr;
+
+	switch (config->codec) {
+	case WTH_STREAM_CODEC_JPEG:
+		if (!decoder_jpeg)
+			return NULL;
+		encoding = "JPEG";
+		depay = "rtpjpegdepay";
+		chain = decoder_jpeg->chain;
+		break;
+	case WTH_STREAM_CODEC_H264:
+		if (!decoder_h264)
+			return NULL;
+		encoding = "H264";
+		depay = "rtph264depay";
+		jitter = "rtpjitterbuffer latency=0 ! ";
+		chain = decoder_h264->chain;
+		break;
+	default:
+		return NULL;
+	}
 
-	/* create gstreamer pipeline */
-	gst_init(NULL, NULL);
-	gstctx.loop = g_main_loop_new(NULL, FALSE);
+	if (config->multicast) {
+		addr.s_addr = htonl(config->multicast);
+		inet_ntop(AF_INET, &addr, group, sizeof group);
+		return g_strdup_printf("udpsrc address=%s port=%u "
+			"auto-multicast=true "
+			"caps=\"application/x-rtp,media=video,clock-rate=90000,"
+			"encoding-name=%s,payload=%u\" ! funnel name=join ! "
+			"rtpjitterbuffer latency=%d ! %s name=depay ! %s ! %s "
+			"udpsrc port=%u "
+			"caps=\"application/x-rtp,media=video,clock-rate=90000,"
+			"encoding-name=%s,payload=%u\" ! join.",
+			group, config->port, encoding, config->payload,
+			MULTICAST_LATENCY_MS, depay, chain, sink,
+			config->join_port, encoding, config->payload);
+	}
+
+	if (!config->rtcp_port || !peer[0])
+		return g_strdup_printf("udpsrc port=%u "
+			"caps=\"application/x-rtp,media=video,clock-rate=90000,"
+			"encoding-name=%s,payload=%u\" ! "
+			"%s%s name=depay ! %s ! %s",
+			config->port, encoding, config->payload,
+			jitter, depay, chain, sink);
+
+	return g_strdup_printf("rtpbin name=rtpbin latency=0 "
+		"udpsrc port=%u "
+		"caps=\"application/x-rtp,media=video,clock-rate=90000,"
+		"encoding-name=%s,payload=%u\" ! rtpbin.recv_rtp_sink_0 "
+		"rtpbin. ! %s name=depay ! %s ! %s "
+		"udpsrc port=%u ! rtpbin.recv_rtcp_sink_0 "
+		"rtpbin.send_rtcp_src_0 ! udpsink host=%s port=%u "
+		"sync=false async=false",
+		config->port, encoding, config->payload, depay, chain, sink,
+		WTH_STREAM_RTCP_PORT(config->port), peer, config->rtcp_port);
+}
+
+/*
+ * keyframe_send
+ *
+ * Sends the flagged request, if the last one is old enough. Render loop.
+ */
+static void
+keyframe_send(GstAppContext *ctx)
+{
+	gint64 now = g_get_monotonic_time();
+
+	if (!g_atomic_int_get(&ctx->keyframe_wanted) ||
+	    now - ctx->keyframe_sent < KEYFRAME_INTERVAL)
+		return;
+
+	g_atomic_int_set(&ctx->keyframe_wanted, 0);
+	ctx->keyframe_sent = now;
+	client_request_keyframe(ctx->client);
+}
+
+/*
+ * keyframe_timeout
+ *
+ * Milliseconds until a flagged request may be sent, -1 if none is flagged
+ */
+static int
+keyframe_timeout(GstAppContext *ctx)
+{
+	gint64 left;
+
+	if (!g_atomic_int_get(&ctx->keyframe_wanted))
+		return -1;
+
+	left = ctx->keyframe_sent + KEYFRAME_INTERVAL - g_get_monotonic_time();
+	return left > 0 ? (left + 999) / 1000 : 0;
+}
+
+/*
+ * keyframe_probe
+ *
+ * Watches the RTP sequence numbers going into the depayloader
+ */
+static GstPadProbeReturn
+keyframe_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+	GstAppContext *ctx = user_data;
+	GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+	guint16 seq;
+
+	if (!gst_rtp_buffer_map(GST_PAD_PROBE_INFO_BUFFER(info),
+				GST_MAP_READ, &rtp))
+		return GST_PAD_PROBE_OK;
+	seq = gst_rtp_buffer_get_seq(&rtp);
+	gst_rtp_buffer_unmap(&rtp);
+
+	if (!ctx->rtp_started) {
+		/* most likely in the middle of a GOP */
+		keyframe_request(ctx, "joined");
+		ctx->rtp_started = true;
+	} else if ((gint16)(seq - ctx->rtp_seq) <= 0) {
+		/* late or duplicate, the gap was counted already */
+		return GST_PAD_PROBE_OK;
+	} else if (seq != (guint16)(ctx->rtp_seq + 1)) {
+		keyframe_request(ctx, "packet loss");
+	}
+	ctx->rtp_seq = seq;
+
+	return GST_PAD_PROBE_OK;
+}
+
+/*
+ * conceal_probe
+ *
+ * Error concealment. The depayloader flags what it hands on after missing
+ * packets as a discontinuity; from there on, until a key frame that is not
+ * one itself, every frame would refer to something the decoder does not
+ * have. They are dropped before the decoder, which saves decoding them
+ * and leaves the last good frame on screen instead of a smeared one.
+ */
+static GstPadProbeReturn
+conceal_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+	GstAppContext *ctx = user_data;
+	GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+	bool key = !GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+	bool discont = GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DISCONT);
+	gint64 now = g_get_monotonic_time();
+
+	if (!ctx->concealing && discont) {
+		ctx->concealing = true;
+		ctx->conceal_start = now;
+		keyframe_request(ctx, "discontinuity");
+	}
+	if (!ctx->concealing)
+		return GST_PAD_PROBE_OK;
+
+	/* a key frame may itself have lost packets, unless it is the first */
+	if (!key || (discont && ctx->decoded_any)) {
+		if (key)
+			keyframe_request(ctx, "broken key frame");
+		if (ctx->decoded_any)
+			ctx->frames_concealed++;
+		return GST_PAD_PROBE_DROP;
+	}
+
+	/* waiting for the first key frame is not concealment */
+	ctx->concealing = false;
+	if (ctx->decoded_any) {
+		ctx->concealed_us += now - ctx->conceal_start;
+		wth_verbose("concealed %" G_GINT64_FORMAT " ms\n",
+			    (now - ctx->conceal_start) / 1000);
+	}
+	ctx->decoded_any = true;
+
+	/* the decoder has not seen the discontinuity, tell it here */
+	buffer = gst_buffer_make_writable(buffer);
+	GST_BUFFER_FLAG_SET(buffer, GST_BUFFER_FLAG_DISCONT);
+	GST_PAD_PROBE_INFO_DATA(info) = buffer;
+
+	return GST_PAD_PROBE_OK;
+}
+
+/*
+ * keyframe_setup
+ *
+ * Watches the depayloader named "depay", unless every frame is a key frame.
+ * Nothing is shown before the first key frame.
+ */
+static void
+keyframe_setup(GstAppContext *ctx)
+{
+	GstElement *depay;
+	GstPad *pad;
+
+	if (ctx->client && ctx->client->has_stream_config &&
+	    ctx->client->stream_config.codec == WTH_STREAM_CODEC_JPEG)
+		return;
+
+	depay = gst_bin_get_by_name(GST_BIN(ctx->pipeline), "depay");
+	if (!depay)
+		return;
+
+	pad = gst_element_get_static_pad(depay, "sink");
+	gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER,
+			  keyframe_probe, ctx, NULL);
+	gst_object_unref(pad);
+
+	ctx->concealing = true;
+	ctx->conceal_start = g_get_monotonic_time();
+	pad = gst_element_get_static_pad(depay, "src");
+	gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER,
+			  conceal_probe, ctx, NULL);
+	gst_object_unref(pad);
+	gst_object_unref(depay);
+}
+
+/*
+ * rtcp_setup
+ *
+ * Sends receiver reports as often as the transmitter looks at them
+ *
+ * @param ctx         the pipeline, with an rtpbin named "rtpbin" or not
+ * @return            none
+ */
+static void
+rtcp_setup(GstAppContext *ctx)
+{
+	GstElement *rtpbin;
+	GObject *session = NULL;
+
+	rtpbin = gst_bin_get_by_name(GST_BIN(ctx->pipeline), "rtpbin");
+	if (!rtpbin)
+		return;
+
+	g_signal_emit_by_name(rtpbin, "get-internal-session", 0, &session);
+	if (session) {
+		g_object_set(session, "rtcp-min-interval",
+			     (guint64)WTH_STREAM_RTCP_INTERVAL_MS * GST_MSECOND,
+			     NULL);
+		g_object_unref(session);
+	}
+	gst_object_unref(rtpbin);
+}
+
+/*
+ * read_pipeline_file
+ *
+ * Reads the static pipeline used when nothing was negotiated
+ *
+ * @return            the pipeline description, NULL on error
+ */
+static char *
+read_pipeline_file(void)
+{
+	char *pipe = NULL;
+	FILE *pFile;
+	long lSize;
+	size_t res;
 
 	/* Read pipeline from file */
 	pFile = fopen ( "/etc/xdg/weston/receiver_pipeline.cfg" , "rb" );
 	if (pFile==NULL){
-		fprintf(stderr, "failed to open file\n");
-		return -1;
+		wth_error("failed to open file\n");
+		return NULL;
 	}
 
 	/* obtain file size */
@@ -808,72 +1380,1592 @@ wth_receiver_weston_main(struct window *window)
 	rewind (pFile);
 
 	/* allocate memory to contain the whole file */
-	pipe = (char*) zalloc (sizeof(char)*lSize);
+	pipe = (char*) zalloc (sizeof(char)*(lSize + 1));
 	if (pipe == NULL){
-		fprintf(stderr,"Cannot allocate memory\n");
-		return -1;
+		wth_error("Cannot allocate memory\n");
+		fclose (pFile);
+		return NULL;
 	}
 
 	/* copy the file into the buffer */
 	res = fread (pipe,1,lSize,pFile);
+	fclose (pFile);
 	if (res != lSize){
-		fprintf(stderr,"File read error\n");
-		return -1;
+		wth_error("File read error\n");
+		free(pipe);
+		return NULL;
 	}
 
-	wth_verbose("Gst Pipeline=%s",pipe);
-	/* close file */
-	fclose (pFile);
+	return pipe;
+}
 
-	/* parse the pipeline */
-	gstctx.pipeline = gst_parse_launch(pipe, &gerror);
+/*
+ * per-frame statistics
+ *
+ * One CSV line per frame:
+ * surface,frame,arrival_us,decode_us,size,tx_frame,capture_us,
+ * capture_dur_us,encode_dur_us,present_us,clock_offset_us
+ *
+ * arrival_us and present_us are on this side's CLOCK_MONOTONIC, capture_us
+ * on the transmitter's; tx_frame and the transmitter times come from the
+ * trace extension (see waltham-stream.h). Unknown values are -1, except
+ * for clock_offset_us (this clock - the transmitter's) which can be
+ * negative and is left empty until the transmitter has an estimate.
+ */
+static gint64
+trace_value(const struct stats_entry *entry, uint64_t value)
+{
+	return entry->trace.frame ? (gint64)value : -1;
+}
 
-	if(!gstctx.pipeline)
-		fprintf(stderr,"Could not create gstreamer pipeline.\n");
-	free(pipe);
+static void
+stats_write(GstAppContext *ctx, const struct stats_entry *entry,
+	    gint64 present)
+{
+	char offset[24] = "";
+	uint32_t frame;
+
+	g_mutex_lock(&ctx->stats_lock);
+	frame = ctx->stats_frames++;
+	if (ctx->has_clock_offset)
+		g_snprintf(offset, sizeof offset, "%" G_GINT64_FORMAT,
+			   (gint64)ctx->clock_offset);
+	g_mutex_unlock(&ctx->stats_lock);
+
+	fprintf(ctx->stats, "%u,%u,%" G_GINT64_FORMAT ",%" G_GINT64_FORMAT
+		",%" G_GSSIZE_FORMAT ",%" G_GINT64_FORMAT ",%" G_GINT64_FORMAT
+		",%" G_GINT64_FORMAT ",%" G_GINT64_FORMAT ",%" G_GINT64_FORMAT
+		",%s\n",
+		ctx->window->id_ivisurf, frame,
+		entry->arrival >= 0 ? entry->arrival : present,
+		entry->arrival >= 0 && entry->decoded >= 0 ?
+			entry->decoded - entry->arrival : -1,
+		entry->arrival >= 0 ? (gssize)entry->size : -1,
+		trace_value(entry, entry->trace.frame),
+		trace_value(entry, entry->trace.capture),
+		trace_value(entry, entry->trace.capture_dur),
+		trace_value(entry, entry->trace.encode_dur),
+		present, offset);
+}
 
-	gstctx.bus = gst_pipeline_get_bus((GstPipeline*)((void*)gstctx.pipeline));
-	gst_bus_add_watch(gstctx.bus, bus_message, &gstctx);
-	fprintf(stderr, "registered bus signal\n");
+/* with stats_lock held */
+static struct stats_entry *
+stats_find(GstAppContext *ctx, GstClockTime pts)
+{
+	struct stats_entry *entry;
+	unsigned int i;
+
+	for (i = 1; i <= STATS_RING && GST_CLOCK_TIME_IS_VALID(pts); i++) {
+		entry = &ctx->stats_ring[(ctx->stats_head - i) % STATS_RING];
+		if (entry->pts == pts)
+			return entry;
+	}
+
+	return NULL;
+}
+
+/*
+ * stats_rtp_probe
+ *
+ * Picks up the transmitter's trace from the RTP packets going into the
+ * depayloader
+ */
+static GstPadProbeReturn
+stats_rtp_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+	GstAppContext *ctx = user_data;
+	GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+	GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+	struct wth_stream_trace trace;
+	gpointer data;
+	guint size;
+
+	if (!gst_rtp_buffer_map(buffer, GST_MAP_READ, &rtp))
+		return GST_PAD_PROBE_OK;
+
+	if (gst_rtp_buffer_get_extension_onebyte_header(&rtp,
+				WTH_STREAM_TRACE_EXT_ID, 0, &data, &size) &&
+	    wth_stream_trace_unpack(&trace, data, size) == 0) {
+		g_mutex_lock(&ctx->stats_lock);
+		ctx->stats_trace = trace;
+		g_mutex_unlock(&ctx->stats_lock);
+	}
+
+	gst_rtp_buffer_unmap(&rtp);
+	return GST_PAD_PROBE_OK;
+}
+
+/*
+ * stats_arrival_probe
+ *
+ * Notes when an encoded frame leaves the depayloader, i.e. when its last
+ * packet has arrived. That packet carried the frame's trace.
+ */
+static GstPadProbeReturn
+stats_arrival_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+	GstAppContext *ctx = user_data;
+	GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+	struct stats_entry *entry;
+
+	g_mutex_lock(&ctx->stats_lock);
+	entry = &ctx->stats_ring[ctx->stats_head++ % STATS_RING];
+	entry->pts = GST_BUFFER_PTS(buffer);
+	entry->arrival = g_get_monotonic_time();
+	entry->decoded = -1;
+	entry->size = gst_buffer_get_size(buffer);
+	entry->trace = ctx->stats_trace;
+	g_mutex_unlock(&ctx->stats_lock);
+
+	return GST_PAD_PROBE_OK;
+}
+
+/*
+ * stats_decoded_probe
+ *
+ * Notes when a decoded frame reaches the sink. Unless the render loop
+ * presents it, that is the end of the frame's way.
+ */
+static GstPadProbeReturn
+stats_decoded_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+	GstAppContext *ctx = user_data;
+	GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+	gint64 now = g_get_monotonic_time();
+	struct stats_entry found = { GST_CLOCK_TIME_NONE, -1, -1, 0 };
+	struct stats_entry *entry;
+
+	g_mutex_lock(&ctx->stats_lock);
+	entry = stats_find(ctx, GST_BUFFER_PTS(buffer));
+	if (entry) {
+		entry->decoded = now;
+		found = *entry;
+		if (!ctx->appsink)
+			entry->pts = GST_CLOCK_TIME_NONE;
+	}
+	g_mutex_unlock(&ctx->stats_lock);
+
+	if (!ctx->appsink)
+		stats_write(ctx, &found, now);
+
+	return GST_PAD_PROBE_OK;
+}
+
+/*
+ * stats_presented
+ *
+ * Called by the render loop once a buffer is on screen
+ */
+static void
+stats_presented(GstAppContext *ctx, GstBuffer *buffer)
+{
+	gint64 now = g_get_monotonic_time();
+	struct stats_entry found = { GST_CLOCK_TIME_NONE, -1, -1, 0 };
+	struct stats_entry *entry;
+
+	g_mutex_lock(&ctx->stats_lock);
+	entry = stats_find(ctx, GST_BUFFER_PTS(buffer));
+	if (entry) {
+		found = *entry;
+		entry->pts = GST_CLOCK_TIME_NONE;
+	}
+	g_mutex_unlock(&ctx->stats_lock);
+
+	stats_write(ctx, &found, now);
+}
+
+static void
+stats_setup(GstAppContext *ctx)
+{
+	GstElement *depay;
+	GstPad *pad;
+	unsigned int i;
+
+	g_mutex_init(&ctx->stats_lock);
+	for (i = 0; i < STATS_RING; i++)
+		ctx->stats_ring[i].pts = GST_CLOCK_TIME_NONE;
+
+	depay = gst_bin_get_by_name(GST_BIN(ctx->pipeline), "depay");
+	if (depay) {
+		pad = gst_element_get_static_pad(depay, "sink");
+		gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER,
+				  stats_rtp_probe, ctx, NULL);
+		gst_object_unref(pad);
+
+		pad = gst_element_get_static_pad(depay, "src");
+		gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER,
+				  stats_arrival_probe, ctx, NULL);
+		gst_object_unref(pad);
+		gst_object_unref(depay);
+	}
+
+	pad = gst_element_get_static_pad(ctx->sink, "sink");
+	gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER,
+			  stats_decoded_probe, ctx, NULL);
+	gst_object_unref(pad);
+}
+
+/*
+ * raw transport
+ *
+ * With transport=raw the transmitter sends no media stream: each commit of
+ * the wthp_surface carries a WTH_STREAM_BLOB_RAW blob with the rects that
+ * changed, LZ4 compressed. They are patched into window->raw_image, the
+ * whole surface, and from there into whichever of the two wl_shm buffers
+ * the compositor is not holding. Each buffer remembers the rects it missed
+ * while the other one was on screen, so that bringing it up to date copies
+ * only those.
+ */
+
+/* an empty set of rects */
+static void
+shm_damage_clear(struct shm_damage *damage)
+{
+	damage->count = 0;
+}
+
+static void
+shm_damage_add(struct shm_damage *damage, const struct wth_stream_raw_rect *rect)
+{
+	if (damage->count < 0)
+		return;
+	if (damage->count == WTH_STREAM_RAW_MAX_RECTS) {
+		damage->count = -1;
+		return;
+	}
+	damage->rects[damage->count++] = *rect;
+}
+
+static void
+raw_copy_rect(uint8_t *dst, const uint8_t *src, int32_t surface_width,
+	      const struct wth_stream_raw_rect *rect)
+{
+	size_t stride = (size_t)surface_width * WTH_STREAM_RAW_BPP;
+	size_t offset = rect->y * stride + (size_t)rect->x * WTH_STREAM_RAW_BPP;
+	int32_t y;
+
+	for (y = 0; y < rect->height; y++, offset += stride)
+		memcpy(dst + offset, src + offset,
+		       (size_t)rect->width * WTH_STREAM_RAW_BPP);
+}
+
+static void
+raw_buffer_release(void *data, struct wl_buffer *wl_buffer);
+
+static const struct wl_buffer_listener raw_buffer_listener = {
+	raw_buffer_release
+};
+
+static void
+raw_buffer_destroy(struct shm_buffer *buf)
+{
+	if (buf->buffer)
+		wl_buffer_destroy(buf->buffer);
+	if (buf->shm_data)
+		munmap(buf->shm_data, buf->size);
+	memset(buf, 0, sizeof *buf);
+}
+
+static int
+raw_buffer_create(GstAppContext *ctx, struct shm_buffer *buf)
+{
+	struct window *window = ctx->window;
+	int32_t stride = window->raw_width * WTH_STREAM_RAW_BPP;
+	size_t size = (size_t)stride * window->raw_height;
+	struct wl_shm_pool *pool;
+	void *data;
+	int fd;
+
+	fd = os_create_anonymous_file(size);
+	if (fd < 0) {
+		wth_error("creating a buffer file for %zu B failed: %s\n",
+			  size, strerror(errno));
+		return -1;
+	}
+
+	data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (data == MAP_FAILED) {
+		wth_error("mmap failed: %s\n", strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	pool = wl_shm_create_pool(ctx->display->shm, fd, size);
+	/* hybrid: transparent where the video shows through */
+	buf->buffer = wl_shm_pool_create_buffer(pool, 0, window->raw_width,
+						window->raw_height, stride,
+						window->hybrid ?
+						WL_SHM_FORMAT_ARGB8888 :
+						WL_SHM_FORMAT_XRGB8888);
+	wl_buffer_add_listener(buf->buffer, &raw_buffer_listener, ctx);
+	wl_shm_pool_destroy(pool);
+	close(fd);
+
+	buf->shm_data = data;
+	buf->size = size;
+	buf->busy = 0;
+	buf->stale.count = -1;
+
+	return 0;
+}
+
+/*
+ * raw_present
+ *
+ * Brings a free buffer up to date and commits it. With both buffers held by
+ * the compositor the frame is owed until one is released.
+ *
+ * @param ctx         the gstreamer context, display and window
+ */
+static void
+raw_present(GstAppContext *ctx)
+{
+	struct window *window = ctx->window;
+	struct shm_buffer *buf = NULL;
+	const struct shm_damage *damage;
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		if (!window->buffers[i].busy) {
+			buf = &window->buffers[i];
+			break;
+		}
+	}
+	if (!buf) {
+		window->raw_owed = true;
+		return;
+	}
+	window->raw_owed = false;
+
+	if (!buf->buffer && raw_buffer_create(ctx, buf) < 0)
+		return;
+
+	if (buf->stale.count < 0) {
+		memcpy(buf->shm_data, window->raw_image, buf->size);
+	} else {
+		for (i = 0; i < buf->stale.count; i++)
+			raw_copy_rect(buf->shm_data, window->raw_image,
+				      window->raw_width, &buf->stale.rects[i]);
+	}
+	shm_damage_clear(&buf->stale);
+
+	wl_surface_attach(window->raw_surface, buf->buffer, 0, 0);
+	damage = &window->raw_damage;
+	if (damage->count < 0) {
+		wl_surface_damage(window->raw_surface, 0, 0,
+				  window->raw_width, window->raw_height);
+	} else {
+		for (i = 0; i < damage->count; i++)
+			wl_surface_damage(window->raw_surface,
+					  damage->rects[i].x, damage->rects[i].y,
+					  damage->rects[i].width,
+					  damage->rects[i].height);
+	}
+	wl_surface_commit(window->raw_surface);
+	shm_damage_clear(&window->raw_damage);
+
+	buf->busy = 1;
+	window->prev_buffer = buf;
+	/* hybrid frames are counted as the video shows them */
+	if (!window->hybrid)
+		window->frames_displayed++;
+}
+
+static void
+raw_buffer_release(void *data, struct wl_buffer *wl_buffer)
+{
+	GstAppContext *ctx = data;
+	struct window *window = ctx->window;
+	int i;
+
+	for (i = 0; i < 2; i++)
+		if (window->buffers[i].buffer == wl_buffer)
+			window->buffers[i].busy = 0;
+
+	if (window->raw_owed)
+		raw_present(ctx);
+}
+
+/*
+ * raw_resize
+ *
+ * Starts over from a blank surface of the size in the blob
+ */
+static int
+raw_resize(struct window *window, int32_t width, int32_t height)
+{
+	uint8_t *image;
+
+	if (width == window->raw_width && height == window->raw_height)
+		return 0;
+
+	image = calloc((size_t)width * height, WTH_STREAM_RAW_BPP);
+	if (!image) {
+		wth_error("out of memory for a %dx%d surface\n", width, height);
+		return -1;
+	}
+
+	wth_verbose("surface %u: raw %dx%d -> %dx%d\n", window->id_ivisurf,
+		    window->raw_width, window->raw_height, width, height);
+
+	free(window->raw_image);
+	window->raw_image = image;
+	window->raw_width = width;
+	window->raw_height = height;
+	/* with hybrid, the video sizes the window */
+	if (!window->hybrid) {
+		window->width = width;
+		window->height = height;
+	}
+	window->raw_damage.count = -1;
+	raw_buffer_destroy(&window->buffers[0]);
+	raw_buffer_destroy(&window->buffers[1]);
+	window->prev_buffer = NULL;
+
+	return 0;
+}
+
+/*
+ * raw_patch
+ *
+ * Decodes one rect of a blob into window->raw_image, XOR rects against
+ * what it holds already
+ *
+ * @return            0 on success, -1 if the data is corrupt
+ */
+static int
+raw_patch(struct window *window, const struct wth_stream_raw_rect *rect,
+	  const uint8_t *data)
+{
+	size_t stride = (size_t)window->raw_width * WTH_STREAM_RAW_BPP;
+	size_t size = (size_t)rect->width * rect->height * WTH_STREAM_RAW_BPP;
+	uint8_t *dst = window->raw_image + rect->y * stride +
+		(size_t)rect->x * WTH_STREAM_RAW_BPP;
+	const uint8_t *src = data;
+	int32_t y;
+
+	if (rect->encoding == WTH_STREAM_RAW_XOR_RLE)
+		return wth_stream_xor_rle_apply(dst, stride, rect->width,
+						rect->height, data, rect->size);
+	if (rect->encoding != WTH_STREAM_RAW_LZ4)
+		return -1;
+
+	/* full rows land in place */
+	if (rect->width == window->raw_width) {
+		if (rect->size == size) {
+			memcpy(dst, data, size);
+			return 0;
+		}
+		return LZ4_decompress_safe((const char *)data, (char *)dst,
+					   rect->size, size) == (int)size ? 0 : -1;
+	}
+
+	if (rect->size != size) {
+		if (size > window->raw_scratch_size) {
+			uint8_t *scratch = realloc(window->raw_scratch, size);
+
+			if (!scratch)
+				return -1;
+			window->raw_scratch = scratch;
+			window->raw_scratch_size = size;
+		}
+		if (LZ4_decompress_safe((const char *)data,
+					(char *)window->raw_scratch,
+					rect->size, size) != (int)size)
+			return -1;
+		src = window->raw_scratch;
+	}
+
+	for (y = 0; y < rect->height; y++, dst += stride)
+		memcpy(dst, src + (size_t)y * rect->width * WTH_STREAM_RAW_BPP,
+		       (size_t)rect->width * WTH_STREAM_RAW_BPP);
+
+	return 0;
+}
+
+/**
+ * wth_receiver_weston_shm_attach
+ *
+ * Keeps the blob attached to a raw surface until the commit
+ *
+ * @param names        struct window *window
+ *                     uint32_t data_sz, void *data
+ *                     int32_t width, int32_t height, int32_t stride
+ *                     uint32_t format
+ * @param value        window - window information
+ *                     data   - the blob, owned by the wthp_buffer
+ *                     format - WTH_STREAM_BLOB_RAW, others are ignored
+ * @return             none
+ */
+void
+wth_receiver_weston_shm_attach(struct window *window, uint32_t data_sz, void * data,
+		int32_t width, int32_t height, int32_t stride, uint32_t format)
+{
+	if (!(window->raw || window->hybrid) || format != WTH_STREAM_BLOB_RAW)
+		return;
+
+	window->raw_data = data;
+	window->raw_size = data_sz;
+}
+
+/**
+ * wth_receiver_weston_shm_damage
+ *
+ * Nothing to do: the blob carries the same rects, checked against it
+ *
+ * @param names        struct window *window
+ *                     int32_t x, int32_t y, int32_t width, int32_t height
+ * @param value        window - window information
+ * @return             none
+ */
+void
+wth_receiver_weston_shm_damage(struct window *window, int32_t x, int32_t y,
+			       int32_t width, int32_t height)
+{
+}
+
+/**
+ * wth_receiver_weston_shm_commit
+ *
+ * Applies the attached blob to the surface and shows the result
+ *
+ * @param names        struct window *window
+ * @param value        window - window information
+ * @return             none
+ */
+void
+wth_receiver_weston_shm_commit(struct window *window)
+{
+	struct wth_stream_raw_rect rects[WTH_STREAM_RAW_MAX_RECTS];
+	GstAppContext *ctx = window->gstctx;
+	struct stats_entry entry = { 0 };
+	struct wth_stream_raw raw;
+	const uint8_t *data = window->raw_data;
+	uint32_t i, offset;
+
+	if (!data || !ctx)
+		return;
+	window->raw_data = NULL;
+
+	entry.arrival = g_get_monotonic_time();
+	entry.size = window->raw_size;
+
+	offset = wth_stream_raw_unpack(&raw, rects, data, window->raw_size);
+	if (!offset) {
+		wth_error("invalid raw frame on surface %u\n", window->id_ivisurf);
+		return;
+	}
+	if (raw_resize(window, raw.width, raw.height) < 0)
+		return;
+
+	for (i = 0; i < raw.rects; i++) {
+		if (raw_patch(window, &rects[i], data + offset) < 0)
+			wth_error("corrupt rect %dx%d+%d+%d on surface %u\n",
+				  rects[i].width, rects[i].height,
+				  rects[i].x, rects[i].y, window->id_ivisurf);
+		offset += rects[i].size;
+
+		shm_damage_add(&window->raw_damage, &rects[i]);
+		shm_damage_add(&window->buffers[0].stale, &rects[i]);
+		shm_damage_add(&window->buffers[1].stale, &rects[i]);
+	}
+	entry.decoded = g_get_monotonic_time();
+	entry.trace = raw.trace;
+
+	if (ctx->display)
+		raw_present(ctx);
+	else if (!window->hybrid)
+		window->frames_displayed++;
+
+	/* hybrid: the stats are the video's */
+	if (ctx->stats && !window->hybrid)
+		stats_write(ctx, &entry, g_get_monotonic_time());
+}
+
+/*
+ * appsink presentation
+ *
+ * Instead of handing the decoded buffers to waylandsink, the render loop
+ * pulls them from appsink and draws them on window->egl_surface. Buffers in
+ * dmabufs are imported as EGLImages, which are kept on the GstMemory so that
+ * each buffer of the decoder's pool is imported once; a buffer goes back to
+ * the pool as soon as the next one is on screen. Buffers in system memory
+ * (software decoders, Mesa's software rasterizer) are uploaded instead.
+ */
+#define APPSINK_CAPS "video/x-raw,format={RGBA,RGBx,BGRA,BGRx,NV12,I420}"
+
+/* samples appsink may queue before the decoder is throttled */
+#define APPSINK_MAX_BUFFERS 2
+
+static GQuark egl_image_quark;
+
+struct egl_image {
+	struct display *display;
+	EGLImageKHR image;
+};
+
+static void
+egl_image_destroy(gpointer data)
+{
+	struct egl_image *img = data;
+
+	img->display->egl.destroy_image(img->display->egl.dpy, img->image);
+	free(img);
+}
+
+static uint32_t
+drm_format_from_video(GstVideoFormat format)
+{
+	switch (format) {
+	case GST_VIDEO_FORMAT_BGRx:
+		return DRM_FORMAT_XRGB8888;
+	case GST_VIDEO_FORMAT_BGRA:
+		return DRM_FORMAT_ARGB8888;
+	case GST_VIDEO_FORMAT_RGBx:
+		return DRM_FORMAT_XBGR8888;
+	case GST_VIDEO_FORMAT_RGBA:
+		return DRM_FORMAT_ABGR8888;
+	case GST_VIDEO_FORMAT_NV12:
+		return DRM_FORMAT_NV12;
+	case GST_VIDEO_FORMAT_I420:
+		return DRM_FORMAT_YUV420;
+	default:
+		return 0;
+	}
+}
+
+static EGLImageKHR
+import_dmabuf(GstAppContext *ctx, GstBuffer *buffer, GstVideoInfo *info)
+{
+	static const EGLint plane_attribs[3][3] = {
+		{ EGL_DMA_BUF_PLANE0_FD_EXT, EGL_DMA_BUF_PLANE0_OFFSET_EXT,
+		  EGL_DMA_BUF_PLANE0_PITCH_EXT },
+		{ EGL_DMA_BUF_PLANE1_FD_EXT, EGL_DMA_BUF_PLANE1_OFFSET_EXT,
+		  EGL_DMA_BUF_PLANE1_PITCH_EXT },
+		{ EGL_DMA_BUF_PLANE2_FD_EXT, EGL_DMA_BUF_PLANE2_OFFSET_EXT,
+		  EGL_DMA_BUF_PLANE2_PITCH_EXT },
+	};
+	struct display *display = ctx->display;
+	GstMemory *first = gst_buffer_peek_memory(buffer, 0);
+	GstVideoMeta *meta;
+	struct egl_image *img;
+	EGLint attribs[6 + 3 * 6 + 1];
+	uint32_t fourcc;
+	guint i, n = 0;
+
+	img = gst_mini_object_get_qdata(GST_MINI_OBJECT(first), egl_image_quark);
+	if (img)
+		return img->image;
+
+	fourcc = drm_format_from_video(GST_VIDEO_INFO_FORMAT(info));
+	if (!fourcc || GST_VIDEO_INFO_N_PLANES(info) > 3)
+		return EGL_NO_IMAGE_KHR;
+
+	meta = gst_buffer_get_video_meta(buffer);
+
+	attribs[n++] = EGL_WIDTH;
+	attribs[n++] = GST_VIDEO_INFO_WIDTH(info);
+	attribs[n++] = EGL_HEIGHT;
+	attribs[n++] = GST_VIDEO_INFO_HEIGHT(info);
+	attribs[n++] = EGL_LINUX_DRM_FOURCC_EXT;
+	attribs[n++] = fourcc;
+
+	for (i = 0; i < GST_VIDEO_INFO_N_PLANES(info); i++) {
+		gsize offset = meta ? meta->offset[i] :
+			GST_VIDEO_INFO_PLANE_OFFSET(info, i);
+		gint stride = meta ? meta->stride[i] :
+			GST_VIDEO_INFO_PLANE_STRIDE(info, i);
+		GstMemory *mem;
+		guint idx, len;
+		gsize skip;
+
+		/* planes may live in separate dmabufs */
+		if (!gst_buffer_find_memory(buffer, offset, 1, &idx, &len, &skip))
+			return EGL_NO_IMAGE_KHR;
+
+		mem = gst_buffer_peek_memory(buffer, idx);
+		if (!gst_is_dmabuf_memory(mem))
+			return EGL_NO_IMAGE_KHR;
+
+		attribs[n++] = plane_attribs[i][0];
+		attribs[n++] = gst_dmabuf_memory_get_fd(mem);
+		attribs[n++] = plane_attribs[i][1];
+		attribs[n++] = mem->offset + skip;
+		attribs[n++] = plane_attribs[i][2];
+		attribs[n++] = stride;
+	}
+	attribs[n] = EGL_NONE;
+
+	img = zalloc(sizeof *img);
+	if (!img)
+		return EGL_NO_IMAGE_KHR;
+
+	img->display = display;
+	img->image = display->egl.create_image(display->egl.dpy,
+					       EGL_NO_CONTEXT,
+					       EGL_LINUX_DMA_BUF_EXT,
+					       NULL, attribs);
+	if (img->image == EGL_NO_IMAGE_KHR) {
+		free(img);
+		return EGL_NO_IMAGE_KHR;
+	}
+
+	gst_mini_object_set_qdata(GST_MINI_OBJECT(first), egl_image_quark,
+				  img, egl_image_destroy);
+
+	return img->image;
+}
+
+static void
+set_texture_params(GLenum target)
+{
+	glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+}
+
+static bool
+upload_buffer(GstAppContext *ctx, GstBuffer *buffer, GstVideoInfo *info)
+{
+	GstVideoFrame frame;
+	const guint8 *data;
+	gint width, height, stride, y;
+
+	switch (GST_VIDEO_INFO_FORMAT(info)) {
+	case GST_VIDEO_FORMAT_RGBA:
+	case GST_VIDEO_FORMAT_RGBx:
+		break;
+	default:
+		return false;
+	}
+
+	if (!gst_video_frame_map(&frame, info, buffer, GST_MAP_READ))
+		return false;
+
+	width = GST_VIDEO_FRAME_WIDTH(&frame);
+	height = GST_VIDEO_FRAME_HEIGHT(&frame);
+	data = GST_VIDEO_FRAME_PLANE_DATA(&frame, 0);
+	stride = GST_VIDEO_FRAME_PLANE_STRIDE(&frame, 0);
+
+	glBindTexture(GL_TEXTURE_2D, ctx->display->gl.texture);
+	set_texture_params(GL_TEXTURE_2D);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	if (stride == width * 4) {
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0,
+			     GL_RGBA, GL_UNSIGNED_BYTE, data);
+	} else {
+		/* GLES2 has no GL_UNPACK_ROW_LENGTH */
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0,
+			     GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		for (y = 0; y < height; y++)
+			glTexSubImage2D(GL_TEXTURE_2D, 0, 0, y, width, 1,
+					GL_RGBA, GL_UNSIGNED_BYTE,
+					data + y * stride);
+	}
+
+	gst_video_frame_unmap(&frame);
+	return true;
+}
+
+static void
+present_latest(GstAppContext *ctx);
+
+static void
+frame_done(void *data, struct wl_callback *callback, uint32_t time)
+{
+	GstAppContext *ctx = data;
+
+	wl_callback_destroy(callback);
+	ctx->window->callback = NULL;
+
+	/* the compositor is ready for the next frame: show the newest one */
+	present_latest(ctx);
+}
+
+static const struct wl_callback_listener frame_listener = {
+	frame_done
+};
+
+/*
+ * draw_texture
+ *
+ * Draws the texture on a window and swaps
+ *
+ * @param ctx         the gstreamer context
+ * @param window      ctx->window, or another surface of an atlas
+ * @param texcoord    the part of the texture to draw, NULL for all of it
+ */
+static void
+draw_texture(GstAppContext *ctx, struct window *window,
+	     const GLfloat *texcoord, GLenum target, GLuint program,
+	     GLuint texture)
+{
+	static const GLfloat position[] = {
+		-1.0f, -1.0f,  1.0f, -1.0f,  -1.0f, 1.0f,  1.0f, 1.0f,
+	};
+	static const GLfloat whole[] = {
+		0.0f, 1.0f,  1.0f, 1.0f,  0.0f, 0.0f,  1.0f, 0.0f,
+	};
+	GLint loc;
+
+	if (!texcoord)
+		texcoord = whole;
+
+	glViewport(0, 0, window->width, window->height);
+	glUseProgram(program);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(target, texture);
+
+	loc = glGetAttribLocation(program, "a_texCoord");
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, position);
+	glVertexAttribPointer(loc, 2, GL_FLOAT, GL_FALSE, 0, texcoord);
+	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(loc);
+
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+
+	glDisableVertexAttribArray(loc);
+	glDisableVertexAttribArray(0);
+
+	/* the swap commits the surface, so ask for the callback before it */
+	if (ctx->latest && window == ctx->window) {
+		window->callback = wl_surface_frame(window->surface);
+		wl_callback_add_listener(window->callback, &frame_listener, ctx);
+	}
+
+	eglSwapBuffers(ctx->display->egl.dpy, window->egl_surface);
+}
+
+/* the window's place in the frames of an atlas stream, NULL if none */
+static const struct wth_stream_atlas_entry *
+atlas_entry(GstAppContext *ctx, struct window *window)
+{
+	int i;
+
+	if (!ctx->client)
+		return NULL;
+
+	for (i = 0; i < ctx->client->atlas_entries; i++)
+		if (ctx->client->atlas_layout[i].ivi_id == window->id_ivisurf)
+			return &ctx->client->atlas_layout[i];
+
+	return NULL;
+}
+
+/*
+ * present_atlas
+ *
+ * Draws each surface of an atlas stream with its part of the frame, as the
+ * last layout has it. Surfaces not in the layout keep what they show.
+ *
+ * @param ctx         the gstreamer context
+ * @param info        of the frame in the texture
+ */
+static void
+present_atlas(GstAppContext *ctx, const GstVideoInfo *info, GLenum target,
+	      GLuint program, GLuint texture)
+{
+	struct display *display = ctx->display;
+	const struct wth_stream_atlas_entry *entry;
+	int width = GST_VIDEO_INFO_WIDTH(info);
+	int height = GST_VIDEO_INFO_HEIGHT(info);
+	struct window *window;
+	GLfloat texcoord[8];
+	GLfloat s0, s1, t0, t1;
+
+	wl_list_for_each(window, &display->atlas, atlas_link) {
+		entry = atlas_entry(ctx, window);
+		if (!entry || entry->x + entry->width > width ||
+		    entry->y + entry->height > height)
+			continue;
+
+		if (entry->width != window->width ||
+		    entry->height != window->height) {
+			window->width = entry->width;
+			window->height = entry->height;
+			wl_egl_window_resize(window->native, window->width,
+					     window->height, 0, 0);
+		}
+
+		s0 = (GLfloat)entry->x / width;
+		s1 = (GLfloat)(entry->x + entry->width) / width;
+		t0 = (GLfloat)entry->y / height;
+		t1 = (GLfloat)(entry->y + entry->height) / height;
+		texcoord[0] = s0; texcoord[1] = t1;
+		texcoord[2] = s1; texcoord[3] = t1;
+		texcoord[4] = s0; texcoord[5] = t0;
+		texcoord[6] = s1; texcoord[7] = t0;
+
+		eglMakeCurrent(display->egl.dpy, window->egl_surface,
+			       window->egl_surface, display->egl.ctx);
+		draw_texture(ctx, window, texcoord, target, program, texture);
+	}
+}
+
+/*
+ * present_sample
+ *
+ * Draws a decoded sample and makes it the one on screen
+ *
+ * @param ctx         the gstreamer context
+ * @param sample      the sample, ownership is taken
+ */
+static void
+present_sample(GstAppContext *ctx, GstSample *sample)
+{
+	struct display *display = ctx->display;
+	GstBuffer *buffer = gst_sample_get_buffer(sample);
+	GstCaps *caps = gst_sample_get_caps(sample);
+	EGLImageKHR image = EGL_NO_IMAGE_KHR;
+	GLenum target = GL_TEXTURE_2D;
+	GLuint program = display->gl.program_object;
+	GLuint texture = display->gl.texture;
+	GstVideoInfo info;
+	static bool warned;
+
+	if (!buffer || !caps || !gst_video_info_from_caps(&info, caps)) {
+		gst_sample_unref(sample);
+		return;
+	}
+
+	if (display->egl.has_dmabuf_import &&
+	    gst_is_dmabuf_memory(gst_buffer_peek_memory(buffer, 0))) {
+		if (GST_VIDEO_INFO_IS_YUV(&info)) {
+			target = GL_TEXTURE_EXTERNAL_OES;
+			program = display->gl.external_program;
+			texture = display->gl.external_texture;
+		}
+		if (program)
+			image = import_dmabuf(ctx, buffer, &info);
+	}
+
+	if (image != EGL_NO_IMAGE_KHR) {
+		glBindTexture(target, texture);
+		set_texture_params(target);
+		display->egl.image_texture_2d(target, image);
+	} else {
+		/* not importable: copy it */
+		target = GL_TEXTURE_2D;
+		program = display->gl.program_object;
+		texture = display->gl.texture;
+		if (!upload_buffer(ctx, buffer, &info)) {
+			if (!warned)
+				wth_error("cannot present %s buffers\n",
+					  gst_video_format_to_string(GST_VIDEO_INFO_FORMAT(&info)));
+			warned = true;
+			gst_sample_unref(sample);
+			return;
+		}
+	}
+
+	if (ctx->window->atlas)
+		present_atlas(ctx, &info, target, program, texture);
+	else
+		draw_texture(ctx, ctx->window, NULL, target, program, texture);
+	ctx->window->frames_displayed++;
+	if (ctx->stats)
+		stats_presented(ctx, buffer);
+
+	/* the previous buffer is off screen now, back to the pool */
+	if (ctx->current)
+		gst_sample_unref(ctx->current);
+	ctx->current = sample;
+}
+
+/*
+ * present_pending
+ *
+ * Presents the samples queued in appsink, called from the render loop
+ *
+ * @param ctx         the gstreamer context
+ */
+static void
+present_pending(GstAppContext *ctx)
+{
+	GstSample *sample;
+
+	if (ctx->latest) {
+		present_latest(ctx);
+		return;
+	}
+
+	while ((sample = gst_app_sink_try_pull_sample(GST_APP_SINK(ctx->appsink), 0)))
+		present_sample(ctx, sample);
+}
+
+/*
+ * present_latest
+ *
+ * Presents the newest decoded sample, unless the previous one is still
+ * waiting for its frame callback; frame_done comes back here then.
+ *
+ * @param ctx         the gstreamer context
+ */
+static void
+present_latest(GstAppContext *ctx)
+{
+	GstSample *sample;
+
+	if (ctx->window->callback)
+		return;
+
+	g_mutex_lock(&ctx->lock);
+	sample = ctx->pending;
+	ctx->pending = NULL;
+	g_mutex_unlock(&ctx->lock);
+
+	if (sample)
+		present_sample(ctx, sample);
+}
+
+/* called from the streaming thread, latest-frame-only mode */
+static GstFlowReturn
+appsink_new_sample_latest(GstAppSink *appsink, gpointer user_data)
+{
+	GstAppContext *ctx = user_data;
+	GstSample *sample, *old;
+	uint64_t one = 1;
+
+	sample = gst_app_sink_pull_sample(appsink);
+	if (!sample)
+		return GST_FLOW_OK;
+
+	/* replace whatever has not been shown yet */
+	g_mutex_lock(&ctx->lock);
+	old = ctx->pending;
+	ctx->pending = sample;
+	if (old)
+		ctx->window->frames_dropped++;
+	g_mutex_unlock(&ctx->lock);
+
+	if (old)
+		gst_sample_unref(old);
+
+	if (write(ctx->event_fd, &one, sizeof one) < 0)
+		wth_error("eventfd write failed: %s\n", strerror(errno));
+
+	return GST_FLOW_OK;
+}
+
+/* called from the streaming thread */
+static GstFlowReturn
+appsink_new_sample(GstAppSink *appsink, gpointer user_data)
+{
+	GstAppContext *ctx = user_data;
+	uint64_t one = 1;
+
+	/* the sample stays queued in appsink until the render loop pulls it */
+	if (write(ctx->event_fd, &one, sizeof one) < 0)
+		wth_error("eventfd write failed: %s\n", strerror(errno));
+
+	return GST_FLOW_OK;
+}
+
+static void
+appsink_setup(GstAppContext *ctx)
+{
+	GstAppSinkCallbacks callbacks;
+	GstAppSink *appsink = GST_APP_SINK(ctx->sink);
+	GstCaps *caps;
+
+	ctx->appsink = ctx->sink;
+
+	egl_image_quark = g_quark_from_static_string("wth-receiver-egl-image");
+
+	caps = gst_caps_from_string(APPSINK_CAPS);
+	gst_app_sink_set_caps(appsink, caps);
+	gst_caps_unref(caps);
+
+	/* bounded, so that a slow display throttles the decoder instead of
+	 * draining its pool */
+	gst_app_sink_set_max_buffers(appsink, APPSINK_MAX_BUFFERS);
+	gst_app_sink_set_drop(appsink, FALSE);
+	g_object_set(appsink, "enable-last-sample", FALSE, NULL);
+
+	memset(&callbacks, 0, sizeof callbacks);
+	callbacks.new_sample = appsink_new_sample;
+
+	if (ctx->latest) {
+		/* frames are paced by the frame callback, not by the clock
+		 * nor by a blocking swap */
+		g_mutex_init(&ctx->lock);
+		g_object_set(appsink, "sync", FALSE, NULL);
+		eglSwapInterval(ctx->display->egl.dpy, 0);
+		callbacks.new_sample = appsink_new_sample_latest;
+	}
+
+	gst_app_sink_set_callbacks(appsink, &callbacks, ctx, NULL);
+}
+
+/*
+ * resize_window
+ *
+ * Resizes the window to the size of the stream, once the caps are known
+ *
+ * @param ctx         the gstreamer context
+ */
+static void
+resize_window(GstAppContext *ctx)
+{
+	struct window *window = ctx->window;
+	uint32_t size = (uint32_t)g_atomic_int_get(&ctx->stream_size);
+	int32_t width = WTH_STREAM_DISPLAY_WIDTH(size);
+	int32_t height = WTH_STREAM_DISPLAY_HEIGHT(size);
+
+	/* the surfaces of an atlas have sizes of their own */
+	if (!ctx->display || !size || window->atlas ||
+	    (width == window->width && height == window->height))
+		return;
+
+	wth_verbose("surface %u: %dx%d -> %dx%d\n", window->id_ivisurf,
+		    window->width, window->height, width, height);
+
+	window->width = width;
+	window->height = height;
+
+	/* Takes effect with the next swap. ivi-shell passes the new buffer
+	 * size on to the layout controller, which can then place the
+	 * surface at its real size. */
+	wl_egl_window_resize(window->native, width, height, 0, 0);
+
+	if (ctx->appsink)
+		return;
+
+	/* waylandsink draws on a subsurface: commit our own size now */
+	gst_video_overlay_set_render_rectangle(GST_VIDEO_OVERLAY(ctx->sink),
+					       0, 0, width, height);
+	glViewport(0, 0, width, height);
+	glClear(GL_COLOR_BUFFER_BIT);
+	eglSwapBuffers(ctx->display->egl.dpy, window->egl_surface);
+}
+
+/* takes a surface of an atlas stream off the display */
+static void
+atlas_unmap(struct display *display, struct window *window)
+{
+	struct window *primary = display->window;
+
+	wl_list_remove(&window->atlas_link);
+	wl_list_init(&window->atlas_link);
+	window->atlas = false;
+	if (display->pointer_focus == window)
+		display->pointer_focus = NULL;
+	if (display->touch_focus == window)
+		display->touch_focus = NULL;
+
+	/* off the EGL surface first, the context goes back to the first */
+	eglMakeCurrent(display->egl.dpy, primary->egl_surface,
+		       primary->egl_surface, display->egl.ctx);
+	eglDestroySurface(display->egl.dpy, window->egl_surface);
+	wl_egl_window_destroy(window->native);
+	window->egl_surface = EGL_NO_SURFACE;
+	window->native = NULL;
+	if (window->ivi_surface)
+		ivi_surface_destroy(window->ivi_surface);
+	window->ivi_surface = NULL;
+	wl_surface_destroy(window->surface);
+	window->surface = NULL;
+}
+
+/**
+ * wth_receiver_weston_atlas_add
+ *
+ * Gives a surface of an atlas stream, one after the first, a window on the
+ * display of the first. Called from its wthp_ivi_application.surface_create
+ * while the first one's render loop runs, which presents both.
+ *
+ * @param names        struct window *atlas, struct window *window
+ * @param value        atlas  - the window of the first surface
+ *                     window - the new surface's
+ * @return             none
+ */
+void
+wth_receiver_weston_atlas_add(struct window *atlas, struct window *window)
+{
+	struct display *display = atlas->display;
+
+	/* headless: nothing to present on */
+	if (!atlas->gstctx || !atlas->gstctx->display)
+		return;
+
+	window->atlas = true;
+	/* its size comes with the layout, see present_atlas */
+	create_window(window, display, 1, 1);
+	wl_list_insert(display->atlas.prev, &window->atlas_link);
+	window->gstctx = atlas->gstctx;
+	wth_verbose("atlas: surface %u added\n", window->id_ivisurf);
+}
+
+/**
+ * wth_receiver_weston_atlas_remove
+ *
+ * Takes a surface of a running atlas stream off the display, when its
+ * wthp_surface is destroyed. The window of the first surface is only no
+ * longer drawn, its render loop still runs.
+ *
+ * @param names        struct window *window
+ * @param value        window - the surface's window
+ * @return             none
+ */
+void
+wth_receiver_weston_atlas_remove(struct window *window)
+{
+	struct display *display = window->display;
+
+	if (!window->atlas)
+		return;
+
+	if (window == display->window) {
+		wl_list_remove(&window->atlas_link);
+		wl_list_init(&window->atlas_link);
+		return;
+	}
+
+	atlas_unmap(display, window);
+	free(window);
+}
+
+/*
+ * render_loop
+ *
+ * Dispatches the wayland display and the waltham client, follows the stream
+ * size and, with appsink, presents the decoded samples until SIGINT or a
+ * display error
+ *
+ * @param ctx         the gstreamer context
+ */
+static void
+render_loop(GstAppContext *ctx)
+{
+	struct wl_display *display = NULL;
+	struct pollfd fds[3];
+	uint64_t count;
+
+	/* headless: only the eventfd */
+	fds[0].fd = -1;
+	fds[0].events = POLLIN;
+	fds[1].fd = ctx->event_fd;
+	fds[1].events = POLLIN;
+	if (ctx->display) {
+		display = ctx->display->display;
+		fds[0].fd = wl_display_get_fd(display);
+	}
+
+	/* the waltham connection, for input events and clock pings */
+	fds[2].fd = -1;
+	fds[2].events = POLLIN;
+	fds[2].revents = 0;
+	if (ctx->client)
+		fds[2].fd = ctx->client->conn_watch.fd;
+
+	while (running) {
+		if (fds[2].fd >= 0) {
+			if ((fds[2].revents & (POLLERR | POLLHUP)) ||
+			    client_dispatch(ctx->client, fds[2].revents & POLLIN) < 0) {
+				wth_error("waltham connection failed\n");
+				fds[2].fd = -1;
+			} else {
+				keyframe_send(ctx);
+				if (ctx->stats) {
+					g_mutex_lock(&ctx->stats_lock);
+					ctx->has_clock_offset = ctx->client->has_clock_offset;
+					ctx->clock_offset = ctx->client->clock_offset;
+					g_mutex_unlock(&ctx->stats_lock);
+				}
+			}
+		}
+
+		if (display) {
+			while (wl_display_prepare_read(display) != 0)
+				wl_display_dispatch_pending(display);
+			wl_display_flush(display);
+		}
+
+		if (poll(fds, ARRAY_LENGTH(fds),
+			 fds[2].fd >= 0 ? keyframe_timeout(ctx) : -1) < 0) {
+			if (display)
+				wl_display_cancel_read(display);
+			if (errno == EINTR)
+				continue;
+			wth_error("poll failed: %s\n", strerror(errno));
+			break;
+		}
+
+		if (display) {
+			if (fds[0].revents & POLLIN) {
+				if (wl_display_read_events(display) < 0)
+					break;
+			} else {
+				wl_display_cancel_read(display);
+			}
+
+			if (wl_display_dispatch_pending(display) < 0)
+				break;
+		}
+
+		if (!(fds[1].revents & POLLIN))
+			continue;
+
+		if (read(ctx->event_fd, &count, sizeof count) < 0 &&
+		    errno != EAGAIN)
+			wth_error("eventfd read failed: %s\n", strerror(errno));
+
+		resize_window(ctx);
+		if (ctx->appsink)
+			present_pending(ctx);
+	}
+}
+
+/**
+ * wth_receiver_weston_main
+ *
+ * This is the main function which will handle connection to the compositor at receiver side
+ *
+ * @param names        void *data
+ * @param value        struct window data
+ * @return             0 on success, -1 on error
+ */
+int
+wth_receiver_weston_main(struct window *window)
+{
+	wth_enter();
+
+	struct sigaction sigint;
+	pthread_t pthread;
+	GstAppContext gstctx;
+	GError *gerror = NULL;
+	struct client *client = NULL;
+	bool headless = false;
+	const char *sink = "appsink name=sink sync=true";
+	char * pipe = NULL;
+	gchar *gpipe = NULL;
+	GstContext *context;
+
+	memset(&gstctx, 0, sizeof(gstctx));
+	if (window->receiver_surf)
+		client = window->receiver_surf->client;
+	if (client) {
+		gstctx.latest = client->receiver->present_latest;
+		gstctx.stats = client->receiver->stats;
+		headless = client->receiver->headless;
+	}
+
+	gstctx.event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (gstctx.event_fd < 0) {
+		wth_error("eventfd failed: %s\n", strerror(errno));
+		return -1;
+	}
+	gstctx.window = window;
+	gstctx.client = client;
+	window->raw = client && client->has_stream_config &&
+		client->stream_config.codec == WTH_STREAM_CODEC_RAW;
+	window->hybrid = client && client->has_stream_config && !window->raw &&
+		(client->stream_config.overlay & WTH_STREAM_CODEC_RAW);
+	window->atlas = !headless && client && client->has_stream_config &&
+		!window->raw && client->stream_config.atlas;
+
+	if (headless) {
+		sink = "fakesink name=sink sync=false";
+		gstctx.latest = false;
+	} else {
+		/* Initialization for window creation */
+		gstctx.display = create_display();
+		if (window->raw && !gstctx.display->shm) {
+			wth_error("no wl_shm for the raw transport\n");
+			close(gstctx.event_fd);
+			return -1;
+		}
+		if (!window->raw)
+			init_egl(gstctx.display);
+		/* best guess until the first caps event, see resize_window;
+		 * an atlas surface's size comes with the layout */
+		if (window->atlas)
+			create_window(window, gstctx.display, 1, 1);
+		else if (client && client->has_stream_config &&
+		    client->stream_config.width > 0 && client->stream_config.height > 0)
+			create_window(window, gstctx.display,
+				      client->stream_config.width,
+				      client->stream_config.height);
+		else
+			create_window(window, gstctx.display,1920,1080);
+		if (!window->raw)
+			init_gl(gstctx.display);
+
+		gstctx.display->window = window;
+		if (window->atlas)
+			wl_list_insert(&gstctx.display->atlas,
+				       &window->atlas_link);
+
+		wth_verbose("display %p\n", gstctx.display);
+		wth_verbose("display->window %p\n", gstctx.display->window);
+		wth_verbose("window %p\n", window);
+	}
+
+	sigint.sa_handler = signal_int;
+	sigemptyset(&sigint.sa_mask);
+	sigint.sa_flags = SA_RESETHAND;
+	sigaction(SIGINT, &sigint, NULL);
+
+	if (window->raw) {
+		/* no pipeline, the frames come with the surface commits */
+		if (gstctx.stats)
+			g_mutex_init(&gstctx.stats_lock);
+		window->gstctx = &gstctx;
+		if (client)
+			client->rendering = window;
+		render_loop(&gstctx);
+		window->gstctx = NULL;
+		goto stopped;
+	}
+
+	/* create gstreamer pipeline */
+	gst_init(NULL, NULL);
+	gstctx.loop = g_main_loop_new(NULL, FALSE);
+
+	if (client && client->has_stream_config) {
+		gpipe = build_pipeline(&client->stream_config, sink,
+				       client->peer);
+		if (!gpipe)
+			wth_error("cannot decode %s, using %s\n",
+				  wth_stream_codec_name(client->stream_config.codec),
+				  "/etc/xdg/weston/receiver_pipeline.cfg");
+	}
+	if (gpipe) {
+		pipe = strdup(gpipe);
+		g_free(gpipe);
+	} else {
+		pipe = read_pipeline_file();
+	}
+	if (!pipe) {
+		close(gstctx.event_fd);
+		return -1;
+	}
+
+	wth_verbose("Gst Pipeline=%s",pipe);
+
+	/* parse the pipeline */
+	gstctx.pipeline = gst_parse_launch(pipe, &gerror);
+
+	if(!gstctx.pipeline)
+		wth_error("Could not create gstreamer pipeline.\n");
+	free(pipe);
+
+	gstctx.bus = gst_pipeline_get_bus((GstPipeline*)((void*)gstctx.pipeline));
+	gst_bus_add_watch(gstctx.bus, bus_message, &gstctx);
+	wth_verbose("registered bus signal\n");
 
 	/* get sink element */
 	gstctx.sink = gst_bin_get_by_name(GST_BIN(gstctx.pipeline), "sink");
-	/* get display context */
-	context = gst_wayland_display_handle_context_new(gstctx.display->display);
-	/* set external display from context to sink */
-	gst_element_set_context(gstctx.sink,context);
-	/* Attach existing surface to sink */
-	gst_video_overlay_set_window_handle(GST_VIDEO_OVERLAY (gstctx.sink),window->surface);
+	if (headless) {
+		/* nothing to draw on: an appsink from the pipeline file only
+		 * keeps the newest sample */
+		if (GST_IS_APP_SINK(gstctx.sink))
+			g_object_set(gstctx.sink, "drop", TRUE,
+				     "max-buffers", 1, NULL);
+	} else if (GST_IS_APP_SINK(gstctx.sink)) {
+		/* we draw on window->egl_surface ourselves */
+		appsink_setup(&gstctx);
+	} else {
+		if (window->atlas)
+			wth_error("an atlas needs appsink, showing it whole\n");
+		window->atlas = false;
+
+		if (gstctx.latest)
+			wth_error("latest-frame-only needs appsink, ignored\n");
+		gstctx.latest = false;
+
+		/* get display context */
+		context = gst_wayland_display_handle_context_new(gstctx.display->display);
+		/* set external display from context to sink */
+		gst_element_set_context(gstctx.sink,context);
+		/* Attach existing surface to sink */
+		gst_video_overlay_set_window_handle(GST_VIDEO_OVERLAY (gstctx.sink),window->surface);
+	}
 
 	gst_pad_add_probe(gst_element_get_static_pad(gstctx.sink, "sink"),
 			GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
 			pad_probe, &gstctx, NULL);
 
-	fprintf(stderr, "set state as playing\n");
+	rtcp_setup(&gstctx);
+	keyframe_setup(&gstctx);
+	if (gstctx.stats)
+		stats_setup(&gstctx);
+
+	wth_verbose("set state as playing\n");
 	gst_element_set_state((GstElement*)((void*)gstctx.pipeline), GST_STATE_PLAYING);
 
 
 	pthread_create(&pthread, NULL, &stream_thread, gstctx.loop);
 
-	fprintf(stderr, "rendering part\n");
+	wth_verbose("rendering part\n");
 
 	wth_verbose("in render loop\n");
-	while (running && ret != -1)
-		ret=wl_display_dispatch_pending(gstctx.display->display);
+	/* the lossless layer comes with the surface commits, and the other
+	 * surfaces of an atlas with their surface_create */
+	if (window->hybrid || window->atlas)
+		window->gstctx = &gstctx;
+	if (client && client->has_stream_config && client->stream_config.atlas)
+		client->atlas = window;
+	if (client)
+		client->rendering = window;
+	render_loop(&gstctx);
+	window->gstctx = NULL;
+	if (client)
+		client->atlas = NULL;
+
+stopped:
+	if (client)
+		client->rendering = NULL;
+	wth_verbose("wth_receiver_gst_main exiting\n");
 
+	/* the other surfaces' windows stay with them, unmapped */
+	if (!headless) {
+		struct window *other, *tmp;
 
-	wth_verbose("wth_receiver_gst_main exiting\n");
+		wl_list_for_each_safe(other, tmp, &gstctx.display->atlas,
+				      atlas_link)
+			if (other != window)
+				atlas_unmap(gstctx.display, other);
+	}
 
-	if (window->display->ivi_application) {
+	if (!headless && window->display->ivi_application) {
 		ivi_surface_destroy(window->ivi_surface);
 		ivi_application_destroy(window->display->ivi_application);
 	}
 
-	gst_element_set_state((GstElement*)((void*)gstctx.pipeline), GST_STATE_NULL);
-	destroy_window(window);
-	destroy_display(gstctx.display);
+	if (gstctx.pipeline)
+		gst_element_set_state((GstElement*)((void*)gstctx.pipeline), GST_STATE_NULL);
+	if (gstctx.current)
+		gst_sample_unref(gstctx.current);
+	if (gstctx.latest) {
+		if (gstctx.pending)
+			gst_sample_unref(gstctx.pending);
+		g_mutex_clear(&gstctx.lock);
+	}
+	wth_info("surface %u: %u frames displayed, %u dropped\n",
+		window->id_ivisurf, window->frames_displayed,
+		window->frames_dropped);
+	if (gstctx.decoded_any)
+		wth_info("surface %u: %u frames concealed, for %" G_GINT64_FORMAT " ms\n",
+			 window->id_ivisurf, gstctx.frames_concealed,
+			 (gstctx.concealed_us +
+			  (gstctx.concealing ? g_get_monotonic_time() - gstctx.conceal_start : 0)) / 1000);
+	if (gstctx.stats) {
+		fflush(gstctx.stats);
+		g_mutex_clear(&gstctx.stats_lock);
+	}
+	close(gstctx.event_fd);
+	if (headless) {
+		free(window->raw_image);
+		free(window->raw_scratch);
+		free(window);
+	} else {
+		destroy_window(window);
+		destroy_display(gstctx.display);
+	}
 
-	wth_verbose(" <<< %s \n",__func__);
+	wth_leave();
 
 	return 0;
 }
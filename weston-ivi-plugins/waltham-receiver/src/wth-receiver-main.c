@@ -39,6 +39,12 @@
 #define MAX_EPOLL_WATCHES 2
 
 uint16_t tcp_port;
+static uint16_t stream_port;
+static char *codecs_arg;
+static bool latest_frame;
+static bool headless;
+static char *stats_path;
+static bool log_recorder;
 
 /** Print out the application help
  */
@@ -47,12 +53,26 @@ static void usage(void)
     printf("Usage: waltham receiver [options]\n");
     printf("Options:\n");
     printf("  -p --port number          TCP port number\n");
+    printf("  -u --stream-port number   UDP port for the media stream (Default: TCP port)\n");
+    printf("  -c --codecs list          Codecs to offer, e.g. jpeg,h264,raw (Default: all decodable)\n");
+    printf("  -l --latest-frame         Show only the newest frame at each refresh, drop the others\n");
+    printf("  -H --headless             Decode into fakesink, no compositor needed\n");
+    printf("  -s --stats file           Write per-frame statistics (CSV) to file, - for stdout\n");
+    printf("  -L --log-level level      error, warning, info, debug or trace (Default: info)\n");
+    printf("  -R --log-recorder         Keep the last log messages in memory, write them out on SIGUSR1\n");
     printf("  -h --help                 Usage\n");
-    printf("  -v --verbose              Set verbose flag (Default:%d)\n", get_verbosity());
+    printf("  -v --verbose              Debug messages, twice for trace\n");
 }
 
 static struct option long_options[] = {
     {"port",     required_argument,  0,  'p'},
+    {"stream-port", required_argument,  0,  'u'},
+    {"codecs",   required_argument,  0,  'c'},
+    {"latest-frame", no_argument,    0,  'l'},
+    {"headless", no_argument,    0,  'H'},
+    {"stats",    required_argument,  0,  's'},
+    {"log-level", required_argument, 0,  'L'},
+    {"log-recorder", no_argument,    0,  'R'},
     {"verbose",  no_argument,    0,  'v'},
     {"help",     no_argument,    0,  'h'},
     {0,          0,              0,   0}
@@ -73,10 +93,11 @@ static int parse_args(int argc, char *argv[])
 {
     int c = -1;
     int long_index = 0;
+    int level;
 
     while ((c = getopt_long(argc,
                             argv,
-                            "p:vh",
+                            "p:u:c:lHs:L:Rvh",
                             long_options,
                             &long_index)) != -1)
     {
@@ -85,12 +106,37 @@ static int parse_args(int argc, char *argv[])
         case 'p':
             tcp_port = atoi(optarg);
             break;
+        case 'u':
+            stream_port = atoi(optarg);
+            break;
+        case 'c':
+            codecs_arg = optarg;
+            break;
+        case 'l':
+            latest_frame = true;
+            break;
+        case 'H':
+            headless = true;
+            break;
+        case 's':
+            stats_path = optarg;
+            break;
+        case 'L':
+            /* the error below still needs the old level */
+            level = wth_log_parse_level(optarg);
+            if (level < 0) {
+                wth_error("Unknown log level %s\n", optarg);
+                return -1;
+            }
+            wth_log_level = level;
+            break;
+        case 'R':
+            log_recorder = true;
+            break;
         case 'v':
-#if DEBUG
-            set_verbosity(1);
-#else
-            printf("No verbose logs for release mode");
-#endif
+            if (wth_log_level < WTH_LOG_TRACE)
+                wth_log_level = wth_log_level < WTH_LOG_DEBUG ?
+                    WTH_LOG_DEBUG : WTH_LOG_TRACE;
             break;
         case 'h':
             usage();
@@ -114,12 +160,12 @@ static int parse_args(int argc, char *argv[])
 static int
 watch_ctl(struct watch *w, int op, uint32_t events)
 {
-    wth_verbose("%s >>> \n",__func__);
+    wth_enter();
     struct epoll_event ee;
 
     ee.events = events;
     ee.data.ptr = w;
-    wth_verbose(" <<< %s \n",__func__);
+    wth_leave();
     return epoll_ctl(w->receiver->epoll_fd, op, w->fd, &ee);
 }
 
@@ -135,7 +181,7 @@ watch_ctl(struct watch *w, int op, uint32_t events)
 static void
 listen_socket_handle_data(struct watch *w, uint32_t events)
 {
-    wth_verbose("%s >>> \n",__func__);
+    wth_enter();
     struct receiver *srv = container_of(w, struct receiver, listen_watch);
 
     if (events & EPOLLERR) {
@@ -157,7 +203,7 @@ listen_socket_handle_data(struct watch *w, uint32_t events)
         wth_verbose("EPOLLIN evnet received. \n");
         receiver_accept_client(srv);
     }
-    wth_verbose(" <<< %s \n",__func__);
+    wth_leave();
 }
 
 /**
@@ -174,7 +220,7 @@ listen_socket_handle_data(struct watch *w, uint32_t events)
 static void
 receiver_mainloop(struct receiver *srv)
 {
-    wth_verbose("%s >>> \n",__func__);
+    wth_enter();
 
     struct epoll_event ee[MAX_EPOLL_WATCHES];
     struct watch *w;
@@ -205,13 +251,13 @@ receiver_mainloop(struct receiver *srv)
             w->cb(w, ee[i].events);
         }
     }
-    wth_verbose(" <<< %s \n",__func__);
+    wth_leave();
 }
 
 static int
 receiver_listen(uint16_t tcp_port)
 {
-    wth_verbose("%s >>> \n",__func__);
+    wth_enter();
     int fd;
     int reuse = 1;
     struct sockaddr_in addr;
@@ -237,27 +283,67 @@ receiver_listen(uint16_t tcp_port)
         return -1;
     }
 
-    wth_verbose(" <<< %s \n",__func__);
+    wth_leave();
     return fd;
 }
 
+/**
+ * parse_codecs
+ *
+ * Turns a comma separated list of codec names into a bitmask
+ *
+ * @param list The list given on the command line
+ *
+ * @return enum wth_stream_codec bitmask
+ */
+static uint32_t parse_codecs(const char *list)
+{
+    static const uint32_t codecs[] = {
+        WTH_STREAM_CODEC_JPEG,
+        WTH_STREAM_CODEC_H264,
+        WTH_STREAM_CODEC_RAW,
+    };
+    const char *name;
+    uint32_t mask = 0;
+    size_t len;
+    unsigned int i;
+
+    while (*list) {
+        len = strcspn(list, ",");
+        for (i = 0; i < ARRAY_LENGTH(codecs); i++) {
+            name = wth_stream_codec_name(codecs[i]);
+            if (strlen(name) == len && strncmp(list, name, len) == 0)
+                mask |= codecs[i];
+        }
+        list += len;
+        if (*list == ',')
+            list++;
+    }
+
+    return mask;
+}
+
 static bool *signal_int_handler_run_flag;
 
 static void
 signal_int_handler(int signum)
 {
-    wth_verbose("%s >>> \n",__func__);
     if (!*signal_int_handler_run_flag)
         abort();
 
     *signal_int_handler_run_flag = false;
-    wth_verbose(" <<< %s \n",__func__);
+}
+
+static void
+signal_usr1_handler(int signum)
+{
+    wth_log_dump();
 }
 
 static void
 set_sigint_handler(bool *running)
 {
-    wth_verbose("%s >>> \n",__func__);
+    wth_enter();
     struct sigaction sigint;
 
     signal_int_handler_run_flag = running;
@@ -265,7 +351,12 @@ set_sigint_handler(bool *running)
     sigemptyset(&sigint.sa_mask);
     sigint.sa_flags = SA_RESETHAND;
     sigaction(SIGINT, &sigint, NULL);
-    wth_verbose(" <<< %s \n",__func__);
+
+    /* write out the queued log messages, see --log-recorder */
+    sigint.sa_handler = signal_usr1_handler;
+    sigint.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &sigint, NULL);
+    wth_leave();
 }
 
 /**
@@ -285,7 +376,7 @@ main(int argc, char *argv[])
     struct receiver srv = { 0 };
     struct client *c;
 
-    wth_verbose("%s >>> \n",__func__);
+    wth_enter();
 
     /* Get command line arguments */
     if (parse_args(argc, argv) != 0)
@@ -293,8 +384,37 @@ main(int argc, char *argv[])
         return -1;
     }
 
+    if (wth_log_level > WTH_LOG_LEVEL_MAX)
+        wth_error("Log levels above %d are not built in, see DEBUG\n",
+                  WTH_LOG_LEVEL_MAX);
+    if (wth_log_init(log_recorder) < 0)
+        wth_error("Failed to start the log writer, logging directly\n");
+    else
+        atexit(wth_log_fini);
+
     set_sigint_handler(&srv.running);
 
+    if (stats_path) {
+        srv.stats = strcmp(stats_path, "-") == 0 ?
+            stdout : fopen(stats_path, "w");
+        if (!srv.stats) {
+            wth_error("Failed to open %s: %s\n", stats_path, strerror(errno));
+            return -1;
+        }
+        /* whole lines, so that a killed receiver leaves a usable file */
+        setvbuf(srv.stats, NULL, _IOLBF, 0);
+        fprintf(srv.stats, "surface,frame,arrival_us,decode_us,size,"
+                "tx_frame,capture_us,capture_dur_us,encode_dur_us,present_us,"
+                "clock_offset_us\n");
+    }
+    srv.headless = headless;
+
+    wth_receiver_weston_probe_caps(&srv.caps, headless);
+    if (codecs_arg)
+        srv.caps.codecs &= parse_codecs(codecs_arg);
+    srv.caps.port = stream_port ? stream_port : tcp_port;
+    srv.present_latest = latest_frame;
+
     wl_list_init(&srv.client_list);
 
     srv.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
@@ -328,7 +448,9 @@ main(int argc, char *argv[])
 
     close(srv.listen_fd);
     close(srv.epoll_fd);
+    if (srv.stats && srv.stats != stdout)
+        fclose(srv.stats);
 
-    wth_verbose(" <<< %s \n",__func__);
+    wth_leave();
     return 0;
 }
@@ -0,0 +1,299 @@
+/*
+ * Copyright (C) 2017 Advanced Driver Information Technology Joint Venture GmbH
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "compositor.h"
+
+#include "plugin.h"
+#include "transmitter_api.h"
+
+#include <waltham-object.h>
+
+/** @file
+ *
+ * atlas=true: the surfaces of an output too small to be worth a stream of
+ * their own, clocks, icons, status widgets, go out together in the frames
+ * of one. Each gets a cell of a fixed grid in a frame composed here, and the
+ * receiver cuts them out again onto surfaces of their own, by the layout
+ * sent in a WTH_STREAM_BLOB_ATLAS blob.
+ *
+ * A surface keeps its cell for as long as it is on the output, resized or
+ * not, so the layout only changes when one comes or goes. A frame and a
+ * layout which do not match, they take different ways to the receiver, can
+ * then cost a blank cell for a frame at most: a freed cell is cleared at
+ * the end of a repaint, so not given to another surface before the next.
+ */
+
+#define ATLAS_WIDTH (TRANSMITTER_ATLAS_COLS * TRANSMITTER_ATLAS_CELL)
+#define ATLAS_HEIGHT (TRANSMITTER_ATLAS_ROWS * TRANSMITTER_ATLAS_CELL)
+#define ATLAS_BPP 4
+
+void
+transmitter_atlas_init(struct transmitter_atlas *atlas)
+{
+	memset(atlas, 0, sizeof *atlas);
+}
+
+void
+transmitter_atlas_release(struct transmitter_atlas *atlas)
+{
+	free(atlas->cell);
+	atlas->cell = NULL;
+}
+
+/* at the start of a repaint, before the surfaces are placed */
+void
+transmitter_atlas_begin(struct transmitter_atlas *atlas)
+{
+	int i;
+
+	for (i = 0; i < TRANSMITTER_ATLAS_SLOTS; i++)
+		atlas->slots[i].seen = false;
+}
+
+/*
+ * Gives the surface its cell, the one it had if it had one. Returns the
+ * slot, -1 if the surface does not fit or all cells are taken.
+ */
+int
+transmitter_atlas_place(struct transmitter_atlas *atlas,
+			struct weston_surface *surface, uint32_t ivi_id)
+{
+	struct transmitter_atlas_slot *slot;
+	int i, free_slot = -1;
+
+	if (surface->width <= 0 || surface->height <= 0 ||
+	    surface->width > TRANSMITTER_ATLAS_CELL ||
+	    surface->height > TRANSMITTER_ATLAS_CELL || !ivi_id)
+		return -1;
+
+	for (i = 0; i < TRANSMITTER_ATLAS_SLOTS; i++) {
+		slot = &atlas->slots[i];
+		if (slot->surface == surface && slot->ivi_id == ivi_id)
+			break;
+		if (!slot->surface && free_slot < 0)
+			free_slot = i;
+	}
+
+	if (i == TRANSMITTER_ATLAS_SLOTS) {
+		if (free_slot < 0) {
+			if (!atlas->full_logged)
+				weston_log("Atlas full, %d surfaces\n",
+					   TRANSMITTER_ATLAS_SLOTS);
+			atlas->full_logged = true;
+			return -1;
+		}
+		i = free_slot;
+		slot = &atlas->slots[i];
+		slot->surface = surface;
+		slot->ivi_id = ivi_id;
+		slot->width = 0;
+		slot->height = 0;
+	}
+
+	slot->seen = true;
+	if (slot->width != surface->width || slot->height != surface->height) {
+		slot->width = surface->width;
+		slot->height = surface->height;
+		slot->dirty = true;
+		atlas->layout_changed = true;
+	}
+
+	return i;
+}
+
+static uint8_t *
+atlas_cell_data(struct renderer *renderer, int slot)
+{
+	int x = (slot % TRANSMITTER_ATLAS_COLS) * TRANSMITTER_ATLAS_CELL;
+	int y = (slot / TRANSMITTER_ATLAS_COLS) * TRANSMITTER_ATLAS_CELL;
+
+	return (uint8_t *)renderer->shm_data + y * renderer->buf_stride +
+		x * ATLAS_BPP;
+}
+
+static void
+atlas_clear_cell(struct renderer *renderer, int slot)
+{
+	uint8_t *dst = atlas_cell_data(renderer, slot);
+	int row;
+
+	for (row = 0; row < TRANSMITTER_ATLAS_CELL; row++)
+		memset(dst + row * renderer->buf_stride, 0,
+		       TRANSMITTER_ATLAS_CELL * ATLAS_BPP);
+
+	pixman_region32_union_rect(&renderer->damage, &renderer->damage,
+				   (slot % TRANSMITTER_ATLAS_COLS) *
+				   TRANSMITTER_ATLAS_CELL,
+				   (slot / TRANSMITTER_ATLAS_COLS) *
+				   TRANSMITTER_ATLAS_CELL,
+				   TRANSMITTER_ATLAS_CELL,
+				   TRANSMITTER_ATLAS_CELL);
+}
+
+/*
+ * Sets the renderer up for an atlas frame. The frame is kept from one
+ * repaint to the next, in the renderer's copy of the surface, so only the
+ * cells that changed are drawn again; the damage starts out empty.
+ */
+int
+transmitter_atlas_frame(struct transmitter_atlas *atlas,
+			struct renderer *renderer)
+{
+	size_t size = (size_t)ATLAS_WIDTH * ATLAS_HEIGHT * ATLAS_BPP;
+	int i;
+
+	if (!atlas->cell) {
+		atlas->cell = malloc(TRANSMITTER_ATLAS_CELL *
+				     TRANSMITTER_ATLAS_CELL * ATLAS_BPP);
+		if (!atlas->cell)
+			return -1;
+	}
+
+	if (renderer->shm_size != size) {
+		free(renderer->shm_data);
+		renderer->shm_data = calloc(1, size);
+		if (!renderer->shm_data) {
+			renderer->shm_size = 0;
+			return -1;
+		}
+		renderer->shm_size = size;
+		for (i = 0; i < TRANSMITTER_ATLAS_SLOTS; i++)
+			atlas->slots[i].dirty = true;
+	}
+
+	renderer->dmafd = -1;
+	renderer->buf_stride = ATLAS_WIDTH * ATLAS_BPP;
+	renderer->surface_width = ATLAS_WIDTH;
+	renderer->surface_height = ATLAS_HEIGHT;
+	pixman_region32_fini(&renderer->damage);
+	pixman_region32_init(&renderer->damage);
+
+	return 0;
+}
+
+/* draws the slot's surface into its cell, the rest of the cell cleared */
+int
+transmitter_atlas_copy(struct transmitter_atlas *atlas,
+		       struct renderer *renderer, int slot)
+{
+	struct transmitter_atlas_slot *s = &atlas->slots[slot];
+	uint8_t *dst = atlas_cell_data(renderer, slot);
+	int row, len = s->width * ATLAS_BPP;
+
+	atlas_clear_cell(renderer, slot);
+	s->dirty = false;
+
+	if (weston_surface_copy_content(s->surface, atlas->cell,
+					len * s->height, 0, 0,
+					s->width, s->height) < 0) {
+		weston_log("Failed to copy surface content\n");
+		return -1;
+	}
+
+	for (row = 0; row < s->height; row++)
+		memcpy(dst + row * renderer->buf_stride, atlas->cell + row * len,
+		       len);
+
+	return 0;
+}
+
+/* at the end of a repaint: the cells of surfaces gone are cleared */
+void
+transmitter_atlas_end(struct transmitter_atlas *atlas,
+		      struct renderer *renderer)
+{
+	struct transmitter_atlas_slot *slot;
+	int i;
+
+	for (i = 0; i < TRANSMITTER_ATLAS_SLOTS; i++) {
+		slot = &atlas->slots[i];
+		if (!slot->surface || slot->seen)
+			continue;
+
+		atlas_clear_cell(renderer, i);
+		slot->surface = NULL;
+		slot->ivi_id = 0;
+		slot->width = 0;
+		slot->height = 0;
+		atlas->layout_changed = true;
+	}
+}
+
+static void
+atlas_buffer_complete(struct wthp_buffer *b, uint32_t serial)
+{
+	wthp_buffer_destroy(b);
+}
+
+static const struct wthp_buffer_listener atlas_buffer_listener = {
+	atlas_buffer_complete
+};
+
+/* sends the layout if it changed since it was last sent */
+void
+transmitter_atlas_send_layout(struct transmitter_atlas *atlas,
+			      struct weston_transmitter_remote *remote)
+{
+	/* one entry per slot, TRANSMITTER_ATLAS_SLOTS is within
+	 * WTH_STREAM_ATLAS_MAX_ENTRIES */
+	uint32_t words[WTH_STREAM_ATLAS_WORDS +
+		       TRANSMITTER_ATLAS_SLOTS * WTH_STREAM_ATLAS_ENTRY_WORDS];
+	struct wth_stream_atlas_entry entries[TRANSMITTER_ATLAS_SLOTS];
+	struct transmitter_atlas_slot *slot;
+	struct wthp_buffer *buf;
+	uint32_t count = 0, size;
+	int i;
+
+	if (!atlas->layout_changed || !remote->display->blob_factory)
+		return;
+
+	for (i = 0; i < TRANSMITTER_ATLAS_SLOTS; i++) {
+		slot = &atlas->slots[i];
+		if (!slot->surface)
+			continue;
+
+		entries[count].ivi_id = slot->ivi_id;
+		entries[count].x = (i % TRANSMITTER_ATLAS_COLS) *
+			TRANSMITTER_ATLAS_CELL;
+		entries[count].y = (i / TRANSMITTER_ATLAS_COLS) *
+			TRANSMITTER_ATLAS_CELL;
+		entries[count].width = slot->width;
+		entries[count].height = slot->height;
+		count++;
+	}
+
+	size = wth_stream_atlas_pack(entries, count, words);
+	buf = wthp_blob_factory_create_buffer(remote->display->blob_factory,
+					      size, words, ATLAS_WIDTH,
+					      ATLAS_HEIGHT, 0,
+					      WTH_STREAM_BLOB_ATLAS);
+	wthp_buffer_set_listener(buf, &atlas_buffer_listener, NULL);
+	wth_connection_flush(remote->display->connection);
+
+	atlas->layout_changed = false;
+}
@@ -0,0 +1,236 @@
+/*
+ * Copyright (C) 2017 Advanced Driver Information Technology Joint Venture GmbH
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "compositor.h"
+
+#include "plugin.h"
+
+/** @file
+ *
+ * Offset and drift between our CLOCK_MONOTONIC and the receiver's.
+ *
+ * Once a second a WTH_STREAM_BLOB_PING goes out; each answer gives one NTP
+ * sample:
+ *
+ *   offset = ((t2 - t1) + (t3 - t4)) / 2
+ *   delay  = (t4 - t1) - (t3 - t2)
+ *
+ * Samples with a long round trip are the ones most likely to be skewed by
+ * queueing, so the estimate is the sample with the shortest delay among the
+ * last TRANSMITTER_CLOCK_SAMPLES. The drift comes from the best samples of the
+ * older and the newer half of that window.
+ */
+
+#define CLOCK_PING_PERIOD 1000		/* ms */
+#define CLOCK_DRIFT_SPAN 4000000	/* us between samples to trust a drift */
+#define CLOCK_MAX_DRIFT 0.0005		/* 500 ppm, anything above is noise */
+
+static const struct transmitter_clock_sample *
+best_sample(const struct transmitter_clock *clock,
+	    unsigned int first, unsigned int last)
+{
+	const struct transmitter_clock_sample *best = NULL, *sample;
+	unsigned int i;
+
+	for (i = first; i < last; i++) {
+		sample = &clock->samples[i % TRANSMITTER_CLOCK_SAMPLES];
+		if (!best || sample->delay < best->delay)
+			best = sample;
+	}
+
+	return best;
+}
+
+static void
+clock_update(struct transmitter_clock *clock)
+{
+	const struct transmitter_clock_sample *best, *older, *newer;
+	unsigned int first, mid;
+	double drift;
+
+	first = clock->count > TRANSMITTER_CLOCK_SAMPLES ?
+		clock->count - TRANSMITTER_CLOCK_SAMPLES : 0;
+	mid = first + (clock->count - first) / 2;
+
+	best = best_sample(clock, first, clock->count);
+	clock->base = best->local;
+	clock->offset = best->offset;
+	clock->delay = best->delay;
+	clock->valid = true;
+
+	if (mid == first)
+		return;
+
+	older = best_sample(clock, first, mid);
+	newer = best_sample(clock, mid, clock->count);
+	if (newer->local < older->local + CLOCK_DRIFT_SPAN)
+		return;
+
+	drift = (double)(newer->offset - older->offset) /
+		(double)(newer->local - older->local);
+	if (drift > CLOCK_MAX_DRIFT)
+		drift = CLOCK_MAX_DRIFT;
+	else if (drift < -CLOCK_MAX_DRIFT)
+		drift = -CLOCK_MAX_DRIFT;
+	clock->drift = drift;
+}
+
+/** Estimated receiver clock minus ours, in microseconds, at a local time */
+int64_t
+transmitter_clock_offset(const struct transmitter_clock *clock, uint64_t local)
+{
+	if (!clock->valid)
+		return 0;
+
+	return clock->offset +
+	       llround(clock->drift * (double)((int64_t)(local - clock->base)));
+}
+
+/** Move a millisecond timestamp of the receiver to our clock.
+ *
+ * Input events carry the receiver compositor's time. Clients compute
+ * velocities from these, so they have to be comparable with the times of
+ * our own events. Until there is an estimate the time is left alone.
+ */
+uint32_t
+transmitter_remote_rebase_time(struct weston_transmitter_remote *remote,
+			       uint32_t time)
+{
+	int64_t offset;
+
+	if (!remote->clock.valid)
+		return time;
+
+	offset = transmitter_clock_offset(&remote->clock, wth_stream_now_us());
+	return time - (uint32_t)(int32_t)(offset / 1000);
+}
+
+void
+transmitter_clock_handle_pong(struct weston_transmitter_remote *remote,
+			      uint32_t seq, uint64_t t1, uint64_t t2,
+			      uint64_t t3)
+{
+	struct transmitter_clock *clock = &remote->clock;
+	struct transmitter_clock_sample *sample;
+	uint64_t t4 = wth_stream_now_us();
+
+	/* only the answer to the last ping, a late one says little */
+	if (seq != clock->seq || t4 < t1 || t3 < t2 ||
+	    t4 - t1 < t3 - t2)
+		return;
+
+	sample = &clock->samples[clock->count++ % TRANSMITTER_CLOCK_SAMPLES];
+	sample->local = t4;
+	sample->delay = (t4 - t1) - (t3 - t2);
+	sample->offset = ((int64_t)(t2 - t1) + (int64_t)(t3 - t4)) / 2;
+
+	clock_update(clock);
+}
+
+static void
+ping_handle_complete(struct wthp_buffer *b, uint32_t serial)
+{
+	if (b)
+		wthp_buffer_destroy(b);
+}
+
+static const struct wthp_buffer_listener ping_buffer_listener = {
+	ping_handle_complete
+};
+
+static int
+ping_timer_handler(void *data)
+{
+	struct weston_transmitter_remote *remote = data;
+	struct transmitter_clock *clock = &remote->clock;
+	struct waltham_display *dpy = remote->display;
+	uint32_t words[WTH_STREAM_PING_WORDS];
+	struct wth_stream_ping ping;
+	struct wthp_buffer *buf;
+	uint32_t size;
+
+	/* restarted by transmitter_clock_start() on the next connection */
+	if (!dpy || !dpy->running || !dpy->blob_factory)
+		return 0;
+
+	ping.seq = ++clock->seq;
+	ping.sent = wth_stream_now_us();
+	ping.offset = transmitter_clock_offset(clock, ping.sent);
+	ping.valid = clock->valid;
+
+	size = wth_stream_ping_pack(&ping, words);
+	buf = wthp_blob_factory_create_buffer(dpy->blob_factory, size, words,
+					      0, 0, 0, WTH_STREAM_BLOB_PING);
+	wthp_buffer_set_listener(buf, &ping_buffer_listener, NULL);
+	wth_connection_flush(dpy->connection);
+
+	wl_event_source_timer_update(clock->ping_timer, CLOCK_PING_PERIOD);
+	return 0;
+}
+
+/** Start pinging a receiver which advertised WTH_STREAM_GLOBAL_CLOCK.
+ *
+ * The estimate starts over: a new connection may well be a different
+ * receiver, or the same one after a reboot.
+ */
+void
+transmitter_clock_start(struct weston_transmitter_remote *remote)
+{
+	struct transmitter_clock *clock = &remote->clock;
+	struct wl_event_loop *loop;
+
+	memset(clock->samples, 0, sizeof clock->samples);
+	clock->count = 0;
+	clock->valid = false;
+	clock->drift = 0.0;
+
+	if (!remote->caps.clock) {
+		weston_log("%s:%s does not answer pings, input times are not rebased\n",
+			   remote->addr, remote->port);
+		return;
+	}
+
+	if (!clock->ping_timer) {
+		loop = wl_display_get_event_loop(remote->transmitter->compositor->wl_display);
+		clock->ping_timer = wl_event_loop_add_timer(loop, ping_timer_handler,
+							    remote);
+		if (!clock->ping_timer)
+			return;
+	}
+
+	wl_event_source_timer_update(clock->ping_timer, 1);
+}
+
+void
+transmitter_clock_destroy(struct weston_transmitter_remote *remote)
+{
+	if (remote->clock.ping_timer)
+		wl_event_source_remove(remote->clock.ping_timer);
+	remote->clock.ping_timer = NULL;
+}
@@ -0,0 +1,222 @@
+/*
+ * Copyright (C) 2017 Advanced Driver Information Technology Joint Venture GmbH
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "compositor.h"
+
+#include "plugin.h"
+
+/** @file
+ *
+ * WTH_STREAM_RAW_XOR_RLE for the raw transport: a rect XORed with what the
+ * receiver already has of it, then run-length encoded. A UI that changes a
+ * few glyphs or a progress bar leaves most of a damaged rect as it was, so
+ * most of the XOR is zero and goes out as skips; flat fills that did change
+ * become repeats. What is left goes out literally, and raw.c falls back to
+ * LZ4 for rects where that is most of them.
+ *
+ * Both passes are memory bound. The XOR and the search for zeros take 16
+ * or 32 bytes at a time with SSE2 or NEON, the baseline of the targets we
+ * build for, so that they run at several GB/s a core and need no runtime
+ * dispatch. Only the literals are looked at pixel by pixel.
+ */
+
+static inline uint32_t
+load32(const uint8_t *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof v);
+	return v;
+}
+
+/* delta = cur ^ ref and then ref = cur, n pixels; cur need not be aligned */
+void
+transmitter_delta_xor(uint32_t *delta, const uint8_t *cur, uint32_t *ref,
+		      int n)
+{
+	int i = 0;
+
+#if defined(__x86_64__)
+	for (; i + 4 <= n; i += 4) {
+		__m128i c = _mm_loadu_si128((const __m128i *)(cur + i * 4));
+		__m128i r = _mm_loadu_si128((const __m128i *)(ref + i));
+
+		_mm_storeu_si128((__m128i *)(delta + i), _mm_xor_si128(c, r));
+		_mm_storeu_si128((__m128i *)(ref + i), c);
+	}
+#elif defined(__ARM_NEON)
+	for (; i + 4 <= n; i += 4) {
+		uint32x4_t c = vreinterpretq_u32_u8(vld1q_u8(cur + i * 4));
+
+		vst1q_u32(delta + i, veorq_u32(c, vld1q_u32(ref + i)));
+		vst1q_u32(ref + i, c);
+	}
+#endif
+
+	for (; i < n; i++) {
+		uint32_t c = load32(cur + i * 4);
+
+		delta[i] = c ^ ref[i];
+		ref[i] = c;
+	}
+}
+
+/* zero pixels at the start of p, at most n */
+static size_t
+zero_run(const uint32_t *p, size_t n)
+{
+	size_t i = 0;
+
+#if defined(__x86_64__)
+	const __m128i zero = _mm_setzero_si128();
+
+	for (; i + 8 <= n; i += 8) {
+		__m128i v = _mm_or_si128(_mm_loadu_si128((const __m128i *)(p + i)),
+					 _mm_loadu_si128((const __m128i *)(p + i + 4)));
+
+		if (_mm_movemask_epi8(_mm_cmpeq_epi32(v, zero)) != 0xffff)
+			break;
+	}
+#elif defined(__ARM_NEON)
+	for (; i + 8 <= n; i += 8) {
+		uint32x4_t v = vorrq_u32(vld1q_u32(p + i), vld1q_u32(p + i + 4));
+		uint32x2_t h = vorr_u32(vget_low_u32(v), vget_high_u32(v));
+
+		if (vget_lane_u32(vpmax_u32(h, h), 0))
+			break;
+	}
+#endif
+
+	while (i < n && !p[i])
+		i++;
+
+	return i;
+}
+
+/* pixels at the start of p equal to the first, at most n */
+static size_t
+repeat_run(const uint32_t *p, size_t n)
+{
+	size_t i = 1;
+
+	while (i < n && p[i] == p[0])
+		i++;
+
+	return i;
+}
+
+/* a literal stops where a skip of 2 or a repeat of 3 pays for its token */
+static size_t
+literal_run(const uint32_t *p, size_t n)
+{
+	size_t i = 1;
+
+	for (; i < n; i++) {
+		if (!p[i] && (i + 1 == n || !p[i + 1]))
+			break;
+		if (i + 2 < n && p[i] == p[i + 1] && p[i] == p[i + 2])
+			break;
+	}
+
+	return i;
+}
+
+static size_t
+put_token(uint8_t *dst, uint32_t kind, size_t count)
+{
+	uint32_t v = (uint32_t)count << 2 | kind;
+	size_t len = 0;
+
+	while (v >= 0x80) {
+		dst[len++] = (v & 0x7f) | 0x80;
+		v >>= 7;
+	}
+	dst[len++] = v;
+
+	return len;
+}
+
+/*
+ * Run-length encodes n pixels of XOR into dst, see
+ * wth_stream_xor_rle_apply(). Returns the length, -1 if it takes more than
+ * max bytes; an unchanged rect takes none.
+ */
+ssize_t
+transmitter_delta_encode(uint8_t *dst, size_t max,
+			 const uint32_t *delta, size_t n)
+{
+	size_t i = 0, len = 0, run;
+	uint32_t kind;
+
+	/* a count fits the token's 30 bits */
+	if (n >= 1u << 30)
+		return -1;
+
+	while (i < n) {
+		run = zero_run(delta + i, n - i);
+		if (run) {
+			kind = WTH_STREAM_RLE_SKIP;
+		} else {
+			run = repeat_run(delta + i, n - i);
+			kind = WTH_STREAM_RLE_REPEAT;
+			if (run < 3) {
+				run = literal_run(delta + i, n - i);
+				kind = WTH_STREAM_RLE_LITERAL;
+			}
+		}
+
+		/* unchanged to the end: nothing to say */
+		if (kind == WTH_STREAM_RLE_SKIP && i + run == n)
+			break;
+
+		if (max - len < 5)
+			return -1;
+		len += put_token(dst + len, kind, run);
+
+		if (kind == WTH_STREAM_RLE_LITERAL) {
+			if (max - len < run * 4)
+				return -1;
+			memcpy(dst + len, delta + i, run * 4);
+			len += run * 4;
+		} else if (kind == WTH_STREAM_RLE_REPEAT) {
+			if (max - len < 4)
+				return -1;
+			memcpy(dst + len, delta + i, 4);
+			len += 4;
+		}
+		i += run;
+	}
+
+	return len;
+}
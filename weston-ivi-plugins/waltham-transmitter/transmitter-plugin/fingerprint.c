@@ -0,0 +1,215 @@
+/*
+ * Copyright (C) 2017 Advanced Driver Information Technology Joint Venture GmbH
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "compositor.h"
+
+#include "plugin.h"
+
+/** @file
+ *
+ * Content fingerprints of captured frames, to tell a client that committed
+ * the same pixels again from one that drew something new.
+ *
+ * The frame is cut into TRANSMITTER_TILE_SIZE square tiles and each tile
+ * gets a 64-bit hash. The hash runs four independent multiply-rotate lanes
+ * over 32 bytes at a time, the xxHash64 round, so that the multiplies
+ * pipeline instead of waiting on each other; a 1080p frame takes well under
+ * a millisecond, against the encoder's several. It is not meant to resist
+ * crafted input, only to make two different frames with equal hashes
+ * practically impossible.
+ */
+
+#define PRIME1 0x9e3779b185ebca87ULL
+#define PRIME2 0xc2b2ae3d27d4eb4fULL
+#define PRIME3 0x165667b19e3779f9ULL
+
+static inline uint64_t
+rotl(uint64_t v, int bits)
+{
+	return (v << bits) | (v >> (64 - bits));
+}
+
+static inline uint64_t
+load64(const uint8_t *p)
+{
+	uint64_t v;
+
+	memcpy(&v, p, sizeof v);
+	return v;
+}
+
+static inline uint64_t
+round64(uint64_t acc, uint64_t v)
+{
+	acc += v * PRIME2;
+	acc = rotl(acc, 31);
+	return acc * PRIME1;
+}
+
+/* One row of one tile into its four lanes; len is a multiple of 4 */
+static void
+hash_row(uint64_t *lane, const uint8_t *p, size_t len)
+{
+	uint64_t a = lane[0], b = lane[1], c = lane[2], d = lane[3];
+	const uint8_t *end = p + len;
+
+	for (; p + 32 <= end; p += 32) {
+		a = round64(a, load64(p));
+		b = round64(b, load64(p + 8));
+		c = round64(c, load64(p + 16));
+		d = round64(d, load64(p + 24));
+	}
+	/* right edge, whole pixels left */
+	for (; p < end; p += 4) {
+		uint32_t v;
+
+		memcpy(&v, p, sizeof v);
+		a = round64(a, v);
+	}
+
+	lane[0] = a;
+	lane[1] = b;
+	lane[2] = c;
+	lane[3] = d;
+}
+
+static uint64_t
+hash_final(const uint64_t *lane)
+{
+	uint64_t h = rotl(lane[0], 1) + rotl(lane[1], 7) +
+		     rotl(lane[2], 12) + rotl(lane[3], 18);
+
+	h ^= h >> 33;
+	h *= PRIME2;
+	h ^= h >> 29;
+	h *= PRIME3;
+	return h ^ (h >> 32);
+}
+
+static int
+fingerprint_resize(struct transmitter_fingerprint *fp, int width, int height)
+{
+	int cols = (width + TRANSMITTER_TILE_SIZE - 1) / TRANSMITTER_TILE_SIZE;
+	int rows = (height + TRANSMITTER_TILE_SIZE - 1) / TRANSMITTER_TILE_SIZE;
+
+	transmitter_fingerprint_release(fp);
+
+	fp->tiles = calloc((size_t)cols * rows, sizeof fp->tiles[0]);
+	fp->changed = calloc((size_t)cols * rows, sizeof fp->changed[0]);
+	fp->lanes = malloc((size_t)cols * 4 * sizeof fp->lanes[0]);
+	if (!fp->tiles || !fp->changed || !fp->lanes) {
+		transmitter_fingerprint_release(fp);
+		return -1;
+	}
+
+	fp->width = width;
+	fp->height = height;
+	fp->cols = cols;
+	fp->rows = rows;
+	return 0;
+}
+
+/** Hash a frame and compare it with the previous one
+ *
+ * \param fp The fingerprint of the previous frame, zeroed for none.
+ * \param data The frame, 32 bits per pixel.
+ * \param stride Bytes per row.
+ * \return The number of tiles that changed, all of them if the size did;
+ * -1 if out of memory. fp->changed flags the changed tiles.
+ */
+int
+transmitter_fingerprint_update(struct transmitter_fingerprint *fp,
+			       const void *data, int stride,
+			       int width, int height)
+{
+	const uint8_t *pixels = data;
+	int changed = 0;
+	bool resized = false;
+	int row, col, y;
+
+	if (fp->width != width || fp->height != height) {
+		if (fingerprint_resize(fp, width, height) < 0)
+			return -1;
+		resized = true;
+	}
+
+	for (row = 0; row < fp->rows; row++) {
+		int y0 = row * TRANSMITTER_TILE_SIZE;
+		int y1 = y0 + TRANSMITTER_TILE_SIZE;
+
+		if (y1 > height)
+			y1 = height;
+
+		for (col = 0; col < fp->cols; col++) {
+			uint64_t *lane = &fp->lanes[col * 4];
+
+			/* seeded with the position, so that swapped tiles
+			 * do not look the same */
+			lane[0] = PRIME1 + PRIME2 + row;
+			lane[1] = PRIME2 + col;
+			lane[2] = 0;
+			lane[3] = -PRIME1;
+		}
+
+		for (y = y0; y < y1; y++) {
+			const uint8_t *p = pixels + (size_t)y * stride;
+
+			for (col = 0; col < fp->cols; col++) {
+				int x0 = col * TRANSMITTER_TILE_SIZE;
+				int x1 = x0 + TRANSMITTER_TILE_SIZE;
+
+				if (x1 > width)
+					x1 = width;
+
+				hash_row(&fp->lanes[col * 4], p + x0 * 4,
+					 (x1 - x0) * 4);
+			}
+		}
+
+		for (col = 0; col < fp->cols; col++) {
+			int i = row * fp->cols + col;
+			uint64_t h = hash_final(&fp->lanes[col * 4]);
+
+			fp->changed[i] = resized || h != fp->tiles[i];
+			fp->tiles[i] = h;
+			changed += fp->changed[i];
+		}
+	}
+
+	return changed;
+}
+
+void
+transmitter_fingerprint_release(struct transmitter_fingerprint *fp)
+{
+	free(fp->tiles);
+	free(fp->changed);
+	free(fp->lanes);
+	memset(fp, 0, sizeof *fp);
+}
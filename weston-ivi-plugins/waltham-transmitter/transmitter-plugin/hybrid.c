@@ -0,0 +1,228 @@
+/*
+ * Copyright (C) 2017 Advanced Driver Information Technology Joint Venture GmbH
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "compositor.h"
+
+#include "plugin.h"
+
+/** @file
+ *
+ * transport=hybrid: the video stream as usual, and on top of it, at the
+ * receiver, a lossless layer with the tiles that video does badly: text and
+ * flat UI, which an encoder blurs at any bitrate it is given. The layer
+ * goes the way of transport=raw (raw.c), with the video tiles transparent.
+ *
+ * A tile is left to video when it is natural, a photo or a video frame, or
+ * when it is moving. Natural content is told from synthetic by how few of
+ * its pixels repeat the one to their left: text and flat fills repeat most
+ * of theirs, camera content almost none. Moving means it changed at least
+ * HYBRID_MOVING_CHANGES times, each within HYBRID_MOVING_US of the one
+ * before; a clock ticking every second stays lossless, an animation does
+ * not. Both come from the fingerprint, so only tiles that changed are
+ * looked at again.
+ *
+ * Tiles in the lossless layer are also covered at the receiver, the encoder
+ * is told so through a positive delta QP region of interest.
+ */
+
+#define HYBRID_MOVING_US 200000
+#define HYBRID_MOVING_CHANGES 3
+/* out of 256: fewer pixels repeating their left neighbour is natural */
+#define HYBRID_NATURAL_REPEATS 64
+
+void
+transmitter_hybrid_init(struct transmitter_hybrid *hy)
+{
+	pixman_region32_init(&hy->lossless);
+	pixman_region32_init(&hy->flipped);
+}
+
+static void
+hybrid_free(struct transmitter_hybrid *hy)
+{
+	free(hy->changed_at);
+	free(hy->moves);
+	free(hy->natural);
+	free(hy->video);
+	hy->changed_at = NULL;
+	hy->moves = NULL;
+	hy->natural = NULL;
+	hy->video = NULL;
+	hy->cols = 0;
+	hy->rows = 0;
+}
+
+void
+transmitter_hybrid_release(struct transmitter_hybrid *hy)
+{
+	hybrid_free(hy);
+	pixman_region32_fini(&hy->lossless);
+	pixman_region32_fini(&hy->flipped);
+}
+
+/* every tile starts in the lossless layer, as if static */
+static int
+hybrid_resize(struct transmitter_hybrid *hy, int cols, int rows)
+{
+	size_t n = (size_t)cols * rows;
+
+	hybrid_free(hy);
+	hy->changed_at = calloc(n, sizeof hy->changed_at[0]);
+	hy->moves = calloc(n, sizeof hy->moves[0]);
+	hy->natural = calloc(n, sizeof hy->natural[0]);
+	hy->video = calloc(n, sizeof hy->video[0]);
+	if (!hy->changed_at || !hy->moves || !hy->natural || !hy->video) {
+		hybrid_free(hy);
+		return -1;
+	}
+
+	hy->cols = cols;
+	hy->rows = rows;
+	return 0;
+}
+
+/* of 256 pixels, how many repeat their left neighbour; every other row */
+static int
+tile_repeats(const uint8_t *data, int stride, int x0, int y0, int x1, int y1)
+{
+	const uint32_t *row;
+	int x, y, same = 0, total = 0;
+
+	for (y = y0; y < y1; y += 2) {
+		row = (const uint32_t *)(data + (size_t)y * stride);
+		for (x = x0 + 1; x < x1; x++)
+			same += row[x] == row[x - 1];
+		total += x1 - x0 - 1;
+	}
+
+	return total ? same * 256 / total : 256;
+}
+
+/** Sort the tiles of a frame into the two layers
+ *
+ * \param hy The layers of the frame before.
+ * \param fp The fingerprint of this frame, for the tiles that changed.
+ * \param data The frame, 32 bits per pixel.
+ * \param stride Bytes per row.
+ * \param now wth_stream_now_us() of the frame.
+ * \return -1 if out of memory, all of the frame goes to video then.
+ *
+ * hy->lossless is updated, and the tiles that moved to the other layer are
+ * added to hy->flipped for the lossless layer to redraw.
+ */
+int
+transmitter_hybrid_classify(struct transmitter_hybrid *hy,
+			    const struct transmitter_fingerprint *fp,
+			    const void *data, int stride, uint64_t now)
+{
+	int row, col, i, x0, y0, x1, y1;
+	bool video;
+
+	pixman_region32_fini(&hy->lossless);
+	pixman_region32_init(&hy->lossless);
+
+	if (hy->cols != fp->cols || hy->rows != fp->rows) {
+		pixman_region32_union_rect(&hy->flipped, &hy->flipped, 0, 0,
+					   fp->width, fp->height);
+		if (hybrid_resize(hy, fp->cols, fp->rows) < 0)
+			return -1;
+	}
+
+	for (row = 0; row < hy->rows; row++) {
+		for (col = 0; col < hy->cols; col++) {
+			i = row * hy->cols + col;
+			x0 = col * TRANSMITTER_TILE_SIZE;
+			y0 = row * TRANSMITTER_TILE_SIZE;
+			x1 = x0 + TRANSMITTER_TILE_SIZE;
+			y1 = y0 + TRANSMITTER_TILE_SIZE;
+			if (x1 > fp->width)
+				x1 = fp->width;
+			if (y1 > fp->height)
+				y1 = fp->height;
+
+			if (fp->changed[i]) {
+				if (now - hy->changed_at[i] >= HYBRID_MOVING_US)
+					hy->moves[i] = 0;
+				else if (hy->moves[i] < 255)
+					hy->moves[i]++;
+				hy->changed_at[i] = now;
+				hy->natural[i] = tile_repeats(data, stride, x0, y0,
+							      x1, y1) <
+						 HYBRID_NATURAL_REPEATS;
+			} else if (now - hy->changed_at[i] >= HYBRID_MOVING_US) {
+				hy->moves[i] = 0;
+			}
+
+			video = hy->natural[i] ||
+				hy->moves[i] >= HYBRID_MOVING_CHANGES;
+			if (video != hy->video[i])
+				pixman_region32_union_rect(&hy->flipped,
+							   &hy->flipped, x0, y0,
+							   x1 - x0, y1 - y0);
+			hy->video[i] = video;
+			if (!video)
+				pixman_region32_union_rect(&hy->lossless,
+							   &hy->lossless, x0, y0,
+							   x1 - x0, y1 - y0);
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * One rect of the lossless layer, packed by raw.c at (x, y) of the
+ * surface: the video tiles become transparent, the others opaque.
+ */
+void
+transmitter_hybrid_mask(const struct transmitter_hybrid *hy, uint8_t *pixels,
+			int x, int y, int width, int height)
+{
+	uint8_t *p;
+	int tx, ty, xe, col, i, j;
+
+	for (j = 0; j < height; j++) {
+		ty = (y + j) / TRANSMITTER_TILE_SIZE;
+		p = pixels + (size_t)j * width * 4;
+
+		for (tx = x; tx < x + width; tx = xe) {
+			col = tx / TRANSMITTER_TILE_SIZE;
+			xe = (col + 1) * TRANSMITTER_TILE_SIZE;
+			if (xe > x + width)
+				xe = x + width;
+
+			if (ty >= hy->rows || col >= hy->cols ||
+			    hy->video[ty * hy->cols + col]) {
+				memset(p + (tx - x) * 4, 0, (xe - tx) * 4);
+				continue;
+			}
+			for (i = tx - x; i < xe - x; i++)
+				p[i * 4 + 3] = 0xff;
+		}
+	}
+}
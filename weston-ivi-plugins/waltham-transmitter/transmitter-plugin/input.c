@@ -855,7 +855,8 @@ pointer_handle_motion(struct wthp_pointer *wthp_pointer,
 
 	seat = wl_container_of(seat_list->next, seat, link);
 
-	transmitter_seat_pointer_motion(seat, time,
+	transmitter_seat_pointer_motion(seat,
+					transmitter_remote_rebase_time(remote, time),
 					surface_x,
 					surface_y);
 }
@@ -876,7 +877,8 @@ pointer_handle_button(struct wthp_pointer *wthp_pointer,
 	seat = wl_container_of(seat_list->next, seat, link);
 
 	transmitter_seat_pointer_button(seat, serial,
-					time, button,
+					transmitter_remote_rebase_time(remote, time),
+					button,
 					state);
 }
 
@@ -893,7 +895,8 @@ pointer_handle_axis(struct wthp_pointer *wthp_pointer,
 
 	seat = wl_container_of(seat_list->next, seat, link);
 
-	transmitter_seat_pointer_axis(seat, time,
+	transmitter_seat_pointer_axis(seat,
+				      transmitter_remote_rebase_time(remote, time),
 				      axis, value);
 }
 
@@ -1014,7 +1017,9 @@ keyboard_handle_key(struct wthp_keyboard *wthp_keyboard,
 
 	seat = wl_container_of(seat_list->next, seat, link);
 
-	transmitter_seat_keyboard_key(seat, serial, time, key, state);
+	transmitter_seat_keyboard_key(seat, serial,
+				      transmitter_remote_rebase_time(remote, time),
+				      key, state);
 }
 
 static void
@@ -1066,7 +1071,8 @@ touch_handle_down (struct wthp_touch * wthp_touch,
 	wl_list_for_each(txs, &remote->surface_list, link)
 	{
 		if (txs->wthp_surf == surface) {
-			transmitter_seat_touch_down(seat, serial, time,
+			transmitter_seat_touch_down(seat, serial,
+						    transmitter_remote_rebase_time(remote, time),
 						    txs, id, x, y);
 		}
 	}
@@ -1086,7 +1092,9 @@ touch_handle_up (struct wthp_touch * wthp_touch,
 
 	seat = wl_container_of(seat_list->next, seat, link);
 
-	transmitter_seat_touch_up(seat, serial, time, id);
+	transmitter_seat_touch_up(seat, serial,
+				  transmitter_remote_rebase_time(remote, time),
+				  id);
 }
 
 static void
@@ -1104,7 +1112,9 @@ touch_handle_motion (struct wthp_touch * wthp_touch,
 
 	seat = wl_container_of(seat_list->next, seat, link);
 
-	transmitter_seat_touch_motion(seat, time, id, x, y);
+	transmitter_seat_touch_motion(seat,
+				      transmitter_remote_rebase_time(remote, time),
+				      id, x, y);
 }
 
 
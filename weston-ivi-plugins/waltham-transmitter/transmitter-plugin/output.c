@@ -26,10 +26,15 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/dma-buf.h>
 
 #include "compositor.h"
 #include "compositor-drm.h"
 #include "plugin-registry.h"
+#include "weston-debug.h"
 
 #include "plugin.h"
 #include "transmitter_api.h"
@@ -122,6 +127,10 @@ transmitter_output_disable(struct weston_output *base)
 {
 	struct weston_transmitter_output *output = wl_container_of(base, output, base);
 	wl_event_source_remove(output->finish_frame_timer);
+	if (output->keepalive_timer) {
+		wl_event_source_remove(output->keepalive_timer);
+		output->keepalive_timer = NULL;
+	}
 	return 0;
 }
 
@@ -135,6 +144,9 @@ transmitter_output_destroy(struct weston_transmitter_output *output)
 	weston_head_release(head);
 	free(head);
 	transmitter_output_disable(&output->base);
+	transmitter_fingerprint_release(&output->fingerprint);
+	transmitter_hybrid_release(&output->hybrid);
+	transmitter_atlas_release(&output->atlas);
 	weston_output_release(&output->base);
 	free(output);
 }
@@ -164,6 +176,515 @@ transmitter_start_repaint_loop(struct weston_output *base)
 	weston_output_finish_frame(&output->base,NULL, WP_PRESENTATION_FEEDBACK_INVALID);
 }
 
+/*
+ * Gets the content of the view to the renderer: as a dmabuf from
+ * compositor-drm if it is there, otherwise as a copy made by the
+ * compositor's renderer, e.g. with the headless backend.
+ */
+static int
+transmitter_output_enable(struct weston_output *base);
+
+/* whether a weston_output is one of ours, for the stats API */
+bool
+transmitter_output_is(struct weston_output *base)
+{
+	return base->enable == transmitter_output_enable;
+}
+
+static int
+transmitter_output_capture(struct weston_transmitter_output *output,
+			   struct weston_view *view,
+			   const struct weston_drm_output_api *api)
+{
+	struct renderer *renderer = output->renderer;
+	struct weston_surface *surface = view->surface;
+	size_t size;
+
+	renderer->capture_start = wth_stream_now_us();
+
+	if (api) {
+		renderer->dmafd =
+			api->get_dma_fd_from_view(&output->base, view,
+						  &renderer->buf_stride);
+		if (renderer->dmafd < 0) {
+			/* once per run of failures, this is called every frame */
+			if (!output->capture_failing)
+				weston_log("Failed to get dmafd\n");
+			goto dropped;
+		}
+		goto captured;
+	}
+
+	renderer->dmafd = -1;
+	renderer->buf_stride = surface->width * 4;
+	size = renderer->buf_stride * surface->height;
+	if (size > renderer->shm_size) {
+		free(renderer->shm_data);
+		renderer->shm_data = malloc(size);
+		if (!renderer->shm_data) {
+			renderer->shm_size = 0;
+			goto dropped;
+		}
+		renderer->shm_size = size;
+	}
+
+	if (weston_surface_copy_content(surface, renderer->shm_data, size,
+					0, 0, surface->width,
+					surface->height) < 0) {
+		weston_log("Failed to copy surface content\n");
+		goto dropped;
+	}
+
+captured:
+	output->capture_failing = false;
+	transmitter_counter_add(&renderer->counters.frames_captured, 1);
+	return 0;
+
+dropped:
+	output->capture_failing = true;
+	transmitter_counter_add(&renderer->counters.frames_dropped, 1);
+	return -1;
+}
+
+/*
+ * Repaints happen only on damage, so with nothing changing on screen the
+ * encoder would see no frame at all: a lost packet would then stay on the
+ * receiver's display, and a key frame request would not be answered until
+ * something moved. Both get a frame pushed through a repaint of its own.
+ */
+void
+transmitter_output_force_push(struct weston_transmitter_output *output)
+{
+	output->force_push = true;
+	weston_output_schedule_repaint(&output->base);
+}
+
+static int
+transmitter_output_keepalive_handler(void *data)
+{
+	struct weston_transmitter_output *output = data;
+
+	transmitter_output_force_push(output);
+	return 0;
+}
+
+/* whether the repaint touched the view at all */
+static bool
+transmitter_view_damaged(struct weston_view *view, pixman_region32_t *damage)
+{
+	pixman_region32_t region;
+	bool damaged;
+
+	pixman_region32_init(&region);
+	pixman_region32_intersect(&region, damage, &view->transform.boundingbox);
+	damaged = pixman_region32_not_empty(&region);
+	pixman_region32_fini(&region);
+
+	return damaged;
+}
+
+/*
+ * Compares the captured frame with the one before, for clients that commit
+ * the same pixels again with full damage, e.g. a video player paused or a
+ * toolkit redrawing a static screen every vsync. Returns the number of
+ * tiles that changed, -1 if the frame could not be compared.
+ *
+ * With transport=hybrid the tiles are sorted into the video and the
+ * lossless layer while the frame is mapped, see hybrid.c.
+ */
+static int
+transmitter_output_fingerprint(struct weston_transmitter_output *output,
+			       struct weston_view *view, bool hybrid)
+{
+	struct renderer *renderer = output->renderer;
+	size_t size = (size_t)renderer->buf_stride * view->surface->height;
+	struct dma_buf_sync sync = { 0 };
+	const void *data = renderer->shm_data;
+	int changed;
+
+	if (renderer->dmafd >= 0) {
+		data = mmap(NULL, size, PROT_READ, MAP_SHARED,
+			    renderer->dmafd, 0);
+		/* not mappable, the frame cannot be compared */
+		if (data == MAP_FAILED)
+			return -1;
+		sync.flags = DMA_BUF_SYNC_START | DMA_BUF_SYNC_READ;
+		ioctl(renderer->dmafd, DMA_BUF_IOCTL_SYNC, &sync);
+	}
+
+	changed = transmitter_fingerprint_update(&output->fingerprint, data,
+						 renderer->buf_stride,
+						 view->surface->width,
+						 view->surface->height);
+	if (hybrid && changed >= 0)
+		transmitter_hybrid_classify(&output->hybrid,
+					    &output->fingerprint, data,
+					    renderer->buf_stride,
+					    renderer->capture_start);
+
+	if (renderer->dmafd >= 0) {
+		sync.flags = DMA_BUF_SYNC_END | DMA_BUF_SYNC_READ;
+		ioctl(renderer->dmafd, DMA_BUF_IOCTL_SYNC, &sync);
+		munmap((void *)data, size);
+	}
+
+	return changed;
+}
+
+/*
+ * What changed in the frame about to be pushed, in surface coordinates, for
+ * the encoder's regions of interest: the damage on the view, narrowed down
+ * to the tiles whose fingerprint changed when it was taken. Forced frames
+ * and transformed views count as changed all over.
+ */
+static void
+transmitter_output_frame_damage(struct weston_transmitter_output *output,
+				struct weston_view *view,
+				pixman_region32_t *damage,
+				bool all, bool fingerprinted)
+{
+	pixman_region32_t *frame = &output->renderer->damage;
+	const struct transmitter_fingerprint *fp = &output->fingerprint;
+	int width = view->surface->width, height = view->surface->height;
+	pixman_region32_t tiles;
+	int row, col;
+
+	if (all || view->transform.enabled) {
+		pixman_region32_fini(frame);
+		pixman_region32_init_rect(frame, 0, 0, width, height);
+		return;
+	}
+
+	pixman_region32_intersect(frame, damage, &view->transform.boundingbox);
+	pixman_region32_translate(frame, -(int)view->geometry.x,
+				  -(int)view->geometry.y);
+
+	if (fingerprinted) {
+		pixman_region32_init(&tiles);
+		for (row = 0; row < fp->rows; row++)
+			for (col = 0; col < fp->cols; col++)
+				if (fp->changed[row * fp->cols + col])
+					pixman_region32_union_rect(&tiles, &tiles,
+						col * TRANSMITTER_TILE_SIZE,
+						row * TRANSMITTER_TILE_SIZE,
+						TRANSMITTER_TILE_SIZE,
+						TRANSMITTER_TILE_SIZE);
+		pixman_region32_intersect(frame, frame, &tiles);
+		pixman_region32_fini(&tiles);
+	}
+
+	pixman_region32_intersect_rect(frame, frame, 0, 0, width, height);
+}
+
+/*
+ * Sent to each new subscriber of "transmitter-timeline". Times are
+ * CLOCK_MONOTONIC in microseconds, queue is the number of frames pushed to
+ * the encoder that have not left the payloader yet.
+ */
+void
+transmitter_timeline_begin(struct weston_debug_stream *stream, void *data)
+{
+	weston_debug_stream_printf(stream,
+		"# output frame= repaint= capture= push= flush= bytes= queue=\n"
+		"# output repaint= skip=damage|content\n");
+}
+
+/* a frame goes out whatever changed: forced, the first, or keepalive ms on */
+static bool
+transmitter_output_due(struct weston_transmitter_output *output, uint64_t now)
+{
+	struct weston_transmitter_remote *remote = output->remote;
+
+	return output->force_push || !output->last_push ||
+	       (remote->keepalive > 0 &&
+		now - output->last_push >= remote->keepalive * 1000ULL);
+}
+
+/* the timeline line of a pushed frame, see transmitter_timeline_begin() */
+static void
+transmitter_output_print_timeline(struct weston_transmitter_output *output,
+				  uint64_t repaint_start, uint64_t captured,
+				  uint64_t pushed, int bytes)
+{
+	struct weston_transmitter *txr = output->remote->transmitter;
+	struct transmitter_counters *counters = &output->renderer->counters;
+	uint64_t frames_pushed = atomic_load_explicit(
+		&counters->frames_pushed, memory_order_relaxed);
+	uint64_t frames_sent = atomic_load_explicit(
+		&counters->frames_sent, memory_order_relaxed);
+
+	weston_debug_scope_printf(txr->timeline,
+		"%s frame=%" PRIu64 " repaint=%" PRIu64
+		" capture=%" PRIu64 " push=%" PRIu64 " flush=%" PRIu64
+		" bytes=%d queue=%" PRIu64 "\n",
+		output->base.name,
+		atomic_load_explicit(&counters->frames_captured,
+				     memory_order_relaxed),
+		repaint_start, captured, pushed, wth_stream_now_us(), bytes,
+		frames_sent && frames_pushed > frames_sent ?
+			frames_pushed - frames_sent : 0);
+}
+
+/*
+ * Captures the view, hands it to the renderer and commits the surface to
+ * the remote. With the "transmitter-timeline" debug scope subscribed, one
+ * line per frame records when each step finished.
+ *
+ * Unless skip-unchanged is off, a view outside the damage is not captured
+ * at all, and with "content" a captured frame whose fingerprint matches the
+ * previous one is not pushed either. The surface is committed to the remote
+ * all the same, that is how a lost connection is noticed. A frame still
+ * goes out every keepalive ms and when forced, see
+ * transmitter_output_force_push().
+ *
+ * With the raw transport the frame's damage goes to raw.c instead of the
+ * renderer. The receiver keeps the surface, so only the first frame is sent
+ * whole, not the forced ones. The hybrid transport sends it both ways, the
+ * lossless tiles to raw.c and the whole frame to the encoder.
+ *
+ * A mirror's frames come from the encoder of its leader, its own output
+ * only commits the surface.
+ */
+static int
+transmitter_output_send(struct weston_transmitter_output *output,
+			struct weston_transmitter_surface *txs,
+			struct weston_view *view,
+			const struct weston_drm_output_api *api,
+			pixman_region32_t *damage,
+			uint64_t repaint_start)
+{
+	struct weston_transmitter_remote *remote = output->remote;
+	struct weston_transmitter *txr = remote->transmitter;
+	struct weston_transmitter_api *transmitter_api =
+		weston_get_transmitter_api(txr->compositor);
+	struct transmitter_counters *counters = &output->renderer->counters;
+	bool timeline = weston_debug_scope_is_enabled(txr->timeline);
+	uint64_t captured, pushed, now = wth_stream_now_us();
+	const char *skipped = NULL;
+	bool raw = remote->stream.codec == WTH_STREAM_CODEC_RAW;
+	bool hybrid = remote->stream.overlay & WTH_STREAM_CODEC_RAW;
+	int changed = -1, mapped = 0;
+	bool due;
+
+	if (remote->mirrored) {
+		transmitter_api->surface_gather_state(txs);
+		weston_buffer_reference(&view->surface->buffer_ref, NULL);
+		return 0;
+	}
+
+	due = transmitter_output_due(output, now);
+
+	if (!due && remote->skip != TRANSMITTER_SKIP_OFF &&
+	    !transmitter_view_damaged(view, damage)) {
+		skipped = "damage";
+		goto skip;
+	}
+
+	if (transmitter_output_capture(output, view, api) < 0) {
+		if (timeline)
+			weston_debug_scope_printf(txr->timeline,
+				"%s repaint=%" PRIu64 " capture=%" PRIu64
+				" error=capture\n", output->base.name,
+				repaint_start, wth_stream_now_us());
+		return -1;
+	}
+	captured = timeline ? wth_stream_now_us() : 0;
+
+	/* hashed even when due, the next frame is compared with this one */
+	if (remote->skip == TRANSMITTER_SKIP_CONTENT || hybrid)
+		changed = transmitter_output_fingerprint(output, view, hybrid);
+	if (changed == 0 && !due && remote->skip == TRANSMITTER_SKIP_CONTENT) {
+		if (output->renderer->dmafd >= 0)
+			close(output->renderer->dmafd);
+		output->renderer->dmafd = -1;
+		skipped = "content";
+		goto skip;
+	}
+
+	/*
+	 * Updating the width x height
+	 * from surface to gst-recorder
+	 */
+	output->renderer->surface_width = view->surface->width;
+	output->renderer->surface_height = view->surface->height;
+	transmitter_output_frame_damage(output, view, damage,
+					raw ? !output->last_push : due,
+					changed > 0);
+
+	/* a lossless layer that cannot be read just lags, the video goes */
+	if (raw || hybrid)
+		mapped = transmitter_raw_frame(output, txs, view);
+
+	if (raw) {
+		if (output->renderer->dmafd >= 0)
+			close(output->renderer->dmafd);
+		output->renderer->dmafd = -1;
+		if (mapped < 0) {
+			if (timeline)
+				weston_debug_scope_printf(txr->timeline,
+					"%s repaint=%" PRIu64 " capture=%" PRIu64
+					" error=map\n", output->base.name,
+					repaint_start, captured);
+			return -1;
+		}
+	} else {
+		/* the receiver shows the lossless tiles, not the encoder's */
+		if (hybrid) {
+			pixman_region32_copy(&output->renderer->covered,
+					     &output->hybrid.lossless);
+			pixman_region32_subtract(&output->renderer->damage,
+						 &output->renderer->damage,
+						 &output->hybrid.lossless);
+		}
+		output->renderer->repaint_output(output);
+		output->renderer->dmafd = -1;
+	}
+	pushed = timeline ? wth_stream_now_us() : 0;
+
+	output->force_push = false;
+	output->last_push = now;
+	if (output->keepalive_timer)
+		wl_event_source_timer_update(output->keepalive_timer,
+					     remote->keepalive);
+
+	transmitter_api->surface_gather_state(txs);
+	weston_buffer_reference(&view->surface->buffer_ref, NULL);
+
+	if (timeline)
+		transmitter_output_print_timeline(output, repaint_start,
+			captured, pushed,
+			output->renderer->buf_stride * view->surface->height);
+
+	return 0;
+
+skip:
+	transmitter_counter_add(&counters->frames_skipped, 1);
+	transmitter_api->surface_gather_state(txs);
+	weston_buffer_reference(&view->surface->buffer_ref, NULL);
+
+	if (timeline)
+		weston_debug_scope_printf(txr->timeline,
+			"%s repaint=%" PRIu64 " skip=%s\n",
+			output->base.name, repaint_start, skipped);
+
+	return 0;
+}
+
+/*
+ * atlas=true: the views of surfaces up to TRANSMITTER_ATLAS_CELL square go
+ * out together in one frame, see atlas.c; larger ones are not sent on this
+ * output. Skipping is by damage as for a single surface: only the cells of
+ * damaged surfaces are drawn again, and with none the frame is not pushed
+ * unless it is due. A surface is committed to the remote when its cell is
+ * drawn, for its wthp_surface to follow.
+ */
+static void
+transmitter_output_send_atlas(struct weston_transmitter_output *output,
+			      pixman_region32_t *damage,
+			      uint64_t repaint_start)
+{
+	struct weston_transmitter_remote *remote = output->remote;
+	struct weston_transmitter *txr = remote->transmitter;
+	struct weston_transmitter_api *transmitter_api =
+		weston_get_transmitter_api(txr->compositor);
+	struct weston_compositor *compositor = output->base.compositor;
+	struct transmitter_atlas *atlas = &output->atlas;
+	struct renderer *renderer = output->renderer;
+	struct transmitter_counters *counters = &renderer->counters;
+	bool timeline = weston_debug_scope_is_enabled(txr->timeline);
+	struct weston_transmitter_surface *txs;
+	struct weston_view *view;
+	uint64_t captured, pushed, now = wth_stream_now_us();
+	bool due;
+	int slot;
+
+	due = transmitter_output_due(output, now);
+
+	if (transmitter_atlas_frame(atlas, renderer) < 0) {
+		transmitter_counter_add(&counters->frames_dropped, 1);
+		return;
+	}
+	renderer->capture_start = now;
+
+	/* with the key frames, for a receiver that missed the layout */
+	if (due)
+		atlas->layout_changed = true;
+
+	transmitter_atlas_begin(atlas);
+	wl_list_for_each_reverse(view, &compositor->view_list, link) {
+		if (view->output != &output->base ||
+		    view->surface->width > TRANSMITTER_ATLAS_CELL ||
+		    view->surface->height > TRANSMITTER_ATLAS_CELL)
+			continue;
+
+		txs = transmitter_api->surface_push_to_remote(view->surface,
+							       remote, NULL);
+		if (!txs)
+			continue;
+
+		slot = transmitter_atlas_place(atlas, view->surface,
+					       txs->ivi_id);
+		if (slot < 0 ||
+		    !(due || atlas->slots[slot].dirty ||
+		      remote->skip == TRANSMITTER_SKIP_OFF ||
+		      transmitter_view_damaged(view, damage)))
+			continue;
+
+		transmitter_atlas_copy(atlas, renderer, slot);
+		transmitter_api->surface_gather_state(txs);
+		weston_buffer_reference(&view->surface->buffer_ref, NULL);
+	}
+	transmitter_atlas_end(atlas, renderer);
+	transmitter_atlas_send_layout(atlas, remote);
+
+	if (!due && !pixman_region32_not_empty(&renderer->damage)) {
+		transmitter_counter_add(&counters->frames_skipped, 1);
+		if (timeline)
+			weston_debug_scope_printf(txr->timeline,
+				"%s repaint=%" PRIu64 " skip=damage\n",
+				output->base.name, repaint_start);
+		return;
+	}
+
+	if (due) {
+		pixman_region32_fini(&renderer->damage);
+		pixman_region32_init_rect(&renderer->damage, 0, 0,
+					  renderer->surface_width,
+					  renderer->surface_height);
+	}
+
+	transmitter_counter_add(&counters->frames_captured, 1);
+	captured = timeline ? wth_stream_now_us() : 0;
+	renderer->repaint_output(output);
+	pushed = timeline ? wth_stream_now_us() : 0;
+
+	output->force_push = false;
+	output->last_push = now;
+	if (output->keepalive_timer)
+		wl_event_source_timer_update(output->keepalive_timer,
+					     remote->keepalive);
+
+	if (timeline)
+		transmitter_output_print_timeline(output, repaint_start,
+			captured, pushed,
+			renderer->buf_stride * renderer->surface_height);
+}
+
+/* whether a view is sent on the output, see transmitter_output_repaint() */
+static bool
+transmitter_output_takes(struct weston_transmitter_output *output,
+			 struct weston_view *view)
+{
+	int width = view->surface->width, height = view->surface->height;
+
+	if (view->output != &output->base)
+		return false;
+	if (output->remote->stream.atlas)
+		return width <= TRANSMITTER_ATLAS_CELL &&
+			height <= TRANSMITTER_ATLAS_CELL;
+	return width >= 64 && height >= 64;
+}
+
 static int
 transmitter_output_repaint(struct weston_output *base,
 			   pixman_region32_t *damage,void *repaint_data)
@@ -178,6 +699,7 @@ transmitter_output_repaint(struct weston_output *base,
 	struct weston_view *view;
 	bool found_output = false;
 	struct timespec ts;
+	uint64_t repaint_start = 0;
 
 	struct weston_drm_output_api *api =
 		weston_plugin_api_get(txr->compositor,  WESTON_DRM_OUTPUT_API_NAME, sizeof(api));
@@ -194,9 +716,21 @@ transmitter_output_repaint(struct weston_output *base,
 	if (remote->status != WESTON_TRANSMITTER_CONNECTION_READY)
 		goto out;
 
+	/* no stream config yet, the receiver would not know what to show */
+	if (remote->mirror_waiting)
+		goto out;
+
+	if (weston_debug_scope_is_enabled(txr->timeline))
+		repaint_start = wth_stream_now_us();
+
+	if (remote->stream.atlas) {
+		transmitter_output_send_atlas(output, damage, repaint_start);
+		goto out;
+	}
+
 	wl_list_for_each_reverse(view, &compositor->view_list, link) {
 		bool found_surface = false;
-		if (view->output == &output->base && (view->surface->width >= 64 && view->surface->height >= 64)) {
+		if (transmitter_output_takes(output, view)) {
 			found_output = true;
 			wl_list_for_each(txs, &remote->surface_list, link) {
 				if (txs->surface == view->surface) {
@@ -205,45 +739,18 @@ transmitter_output_repaint(struct weston_output *base,
 						transmitter_api->surface_push_to_remote
 							(view->surface, remote, NULL);
 
-					output->renderer->dmafd =
-						api->get_dma_fd_from_view(&output->base, view, &output->renderer->buf_stride);
-					if(output->renderer->dmafd < 0) {
-						weston_log("Failed to get dmafd\n");
+					if (transmitter_output_send(output, txs, view, api,
+								    damage, repaint_start) < 0)
 						goto out;
-					}
-
-					/*
-					 * Updating the width x height
-					 * from surface to gst-recorder
-					 */
-					output->renderer->surface_width
-						= view->surface->width;
-					output->renderer->surface_height
-						= view->surface->height;
-
-					output->renderer->repaint_output(output);
-					output->renderer->dmafd = NULL;
-					transmitter_api->surface_gather_state(txs);
-					weston_buffer_reference(&view->surface->buffer_ref, NULL);
 					break;
 				}
 			}
 			if (!found_surface){
 				txs = transmitter_api->surface_push_to_remote(view->surface,
 									remote, NULL);
-				output->renderer->dmafd =
-						api->get_dma_fd_from_view(&output->base, view, &output->renderer->buf_stride);
-				if (output->renderer->dmafd < 0) {
-					weston_log("Failed to get dmafd\n");
+				if (transmitter_output_send(output, txs, view, api,
+							    damage, repaint_start) < 0)
 					goto out;
-				}
-				output->renderer->surface_width = view->surface->width;
-				output->renderer->surface_height = view->surface->height;
-
-				output->renderer->repaint_output(output);
-				output->renderer->dmafd = NULL;
-				transmitter_api->surface_gather_state(txs);
-				weston_buffer_reference(&view->surface->buffer_ref, NULL);
 				break;
 			}
 		}
@@ -271,7 +778,7 @@ transmitter_assign_planes(struct weston_output *base,void *repaint_data) {
 	struct weston_view *view;
 
 	wl_list_for_each_reverse(view, &compositor->view_list, link) {
-		if (view->output == &output->base && (view->surface->width >= 64 && view->surface->height >= 64)) {
+		if (transmitter_output_takes(output, view)) {
 			view->surface->keep_buffer = true;
 		}
 	}
@@ -297,6 +804,13 @@ transmitter_output_enable(struct weston_output *base)
 			wl_event_loop_add_timer(loop,
 						transmitter_output_finish_frame_handler,
 						output);
+	/* armed by every push, so it only fires while frames are skipped */
+	if (output->remote->skip != TRANSMITTER_SKIP_OFF &&
+	    output->remote->keepalive > 0)
+		output->keepalive_timer =
+			wl_event_loop_add_timer(loop,
+						transmitter_output_keepalive_handler,
+						output);
 	return 0;
 }
 
@@ -339,6 +853,8 @@ transmitter_remote_create_output(struct weston_transmitter_remote *remote,
 		return -1;
 
 	output->parent.draw_initial_frame = true;
+	transmitter_hybrid_init(&output->hybrid);
+	transmitter_atlas_init(&output->atlas);
 
 	weston_head_init(head,connector_name);
 	weston_head_set_subpixel(head, info->subpixel);
@@ -40,6 +40,7 @@
 #include <errno.h>
 #include <sys/epoll.h>
 #include <sys/timerfd.h>
+#include <arpa/inet.h>
 #include <waltham-object.h>
 #include <waltham-client.h>
 #include <waltham-connection.h>
@@ -118,7 +119,17 @@ transmitter_surface_gather_state(struct weston_transmitter_surface *txs)
 			wl_event_source_timer_update(remote->retry_timer, 1);
 		}
 	}
+	else if (remote->stream.codec == WTH_STREAM_CODEC_RAW) {
+		transmitter_raw_commit(txs);
+	}
 	else {
+		/* transport=hybrid: the lossless layer's blob goes with the
+		 * commit. Frames without one still commit the surface below,
+		 * which keeps the video surface committed */
+		if ((remote->stream.overlay & WTH_STREAM_CODEC_RAW) &&
+		    transmitter_raw_commit(txs) == 0)
+			return;
+
 		/* TODO: transmit surface state to remote */
 		/* The buffer must be transmitted to remote side */
 
@@ -195,6 +206,7 @@ static void
 transmitter_surface_destroy(struct weston_transmitter_surface *txs)
 {
 	transmitter_surface_zombify(txs);
+	transmitter_raw_release(txs);
 
 	wl_list_remove(&txs->link);
 	free(txs);
@@ -264,6 +276,8 @@ transmitter_surface_set_ivi_id(struct weston_transmitter_surface *txs)
 			weston_log("surface ID %d\n", ivi_surf->id_surface);
 			if(!txs->wthp_ivi_surface){
 				weston_log("Failed to create txs->ivi_surf\n");
+			} else {
+				txs->ivi_id = ivi_surf->id_surface;
 			}
 		}
 	}
@@ -315,6 +329,7 @@ transmitter_surface_push_to_remote(struct weston_surface *ws,
 
 		wl_list_init(&txs->frame_callback_list);
 		wl_list_init(&txs->feedback_list);
+		transmitter_raw_init(txs);
 
 		txs->lyt = weston_plugin_api_get(txr->compositor,
 						 IVI_LAYOUT_API_NAME, sizeof(txs->lyt));
@@ -339,6 +354,36 @@ transmitter_surface_get_stream_status(struct weston_transmitter_surface *txs)
 	return txs->status;
 }
 
+/** The receiver asked for a key frame.
+ *
+ * A mirror's request goes to the encoder it shares. The first one of a
+ * receiver of a multicast group is its join: it gets the packets since the
+ * last key frame from the cache, the others on the group keep their stream
+ * as it is. Only if nothing is cached does the encoder make a key frame.
+ */
+static void
+transmitter_remote_request_keyframe(struct weston_transmitter_remote *remote)
+{
+	struct weston_transmitter *txr = remote->transmitter;
+	struct weston_transmitter_remote *encoding = remote;
+	struct weston_transmitter_output *output;
+	bool join = remote->stream.multicast && !remote->joined;
+
+	if (remote->mirrored)
+		encoding = remote->leader;
+	remote->joined = true;
+
+	wl_list_for_each(output, &encoding->output_list, link) {
+		if (join && txr->waltham_renderer->replay(output, remote) == 0)
+			continue;
+
+		if (output->renderer && output->renderer->request_keyframe)
+			output->renderer->request_keyframe(output);
+		/* the key frame is the next one the encoder gets */
+		transmitter_output_force_push(output);
+	}
+}
+
 /* waltham */
 /* The server advertises a global interface.
  * We can store the ad for later and/or bind to it immediately
@@ -353,6 +398,7 @@ registry_handle_global(struct wthp_registry *registry,
 		       uint32_t version)
 {
 	struct waltham_display *dpy = wth_object_get_user_data((struct wth_object *)registry);
+	uint64_t t1, t2, t3;
 
 	if (strcmp(interface, "wthp_compositor") == 0) {
 		assert(!dpy->compositor);
@@ -369,6 +415,292 @@ registry_handle_global(struct wthp_registry *registry,
 	} else if (strcmp(interface, "wthp_ivi_application") == 0) {
 	        assert(!dpy->application);
 		dpy->application = (struct wthp_ivi_application *)wthp_registry_bind(registry, name, interface, 1);
+	} else if (strcmp(interface, WTH_STREAM_GLOBAL_CODECS) == 0) {
+		/* not bound, the stream caps are carried in 'version' */
+		dpy->remote->caps.codecs = version;
+	} else if (strcmp(interface, WTH_STREAM_GLOBAL_DISPLAY) == 0) {
+		dpy->remote->caps.width = WTH_STREAM_DISPLAY_WIDTH(version);
+		dpy->remote->caps.height = WTH_STREAM_DISPLAY_HEIGHT(version);
+	} else if (strcmp(interface, WTH_STREAM_GLOBAL_PORT) == 0) {
+		dpy->remote->caps.port = version;
+	} else if (strcmp(interface, WTH_STREAM_GLOBAL_CLOCK) == 0) {
+		dpy->remote->caps.clock = version;
+	} else if (strcmp(interface, WTH_STREAM_GLOBAL_ATLAS) == 0) {
+		dpy->remote->caps.atlas = version;
+	} else if (strcmp(interface, WTH_STREAM_GLOBAL_MULTICAST) == 0) {
+		dpy->remote->caps.multicast = version;
+	} else if (strcmp(interface, WTH_STREAM_GLOBAL_KEYFRAME) == 0) {
+		/* the receiver lost the stream, the name counts its requests */
+		transmitter_remote_request_keyframe(dpy->remote);
+	} else if (wth_stream_pong_parse(interface, &t1, &t2, &t3) == 0) {
+		/* answer to a ping, the name is its sequence number */
+		transmitter_clock_handle_pong(dpy->remote, name, t1, t2, t3);
+	}
+}
+
+static void
+transmitter_remote_send_stream_config(struct weston_transmitter_remote *remote)
+{
+	struct waltham_display *dpy = remote->display;
+	uint32_t words[WTH_STREAM_CONFIG_WORDS];
+	struct wthp_buffer *buf;
+	uint32_t size;
+
+	size = wth_stream_config_pack(&remote->stream, words);
+	buf = wthp_blob_factory_create_buffer(dpy->blob_factory, size, words,
+					      0, 0, 0, WTH_STREAM_BLOB_CONFIG);
+	wthp_buffer_set_listener(buf, &buffer_listener, NULL);
+	wth_connection_flush(dpy->connection);
+}
+
+/** Take the stream of the remote named by mirror-of.
+ *
+ * The receiver gets the leader's stream config on its own ports, and the
+ * leader's encoder tees the payloaded stream off to it, see mirror_add()
+ * in the renderer. Until the leader has a stream the remote waits, it shows
+ * nothing.
+ *
+ * \return 0 if the remote is mirrored or waits, -1 if it cannot take the
+ * leader's stream and negotiates one of its own.
+ */
+static int
+transmitter_remote_mirror_stream(struct weston_transmitter_remote *remote)
+{
+	struct weston_transmitter *txr = remote->transmitter;
+	struct weston_transmitter_remote *leader = remote->leader;
+	struct weston_transmitter_output *output;
+
+	remote->mirrored = false;
+	remote->mirror_waiting = false;
+
+	if (!leader->stream.codec &&
+	    leader->status == WESTON_TRANSMITTER_CONNECTION_READY) {
+		weston_log("%s:%s: %s uses pipeline files, not mirrored\n",
+			   remote->addr, remote->port, leader->model);
+		return -1;
+	}
+
+	if (!leader->stream.codec) {
+		weston_log("%s:%s waits for %s to mirror its stream\n",
+			   remote->addr, remote->port, leader->model);
+		remote->mirror_waiting = true;
+		return 0;
+	}
+
+	if (leader->stream.codec == WTH_STREAM_CODEC_RAW ||
+	    leader->stream.overlay || leader->stream.atlas ||
+	    !(remote->caps.codecs & leader->stream.codec)) {
+		weston_log("%s:%s cannot take the stream of %s, not mirrored\n",
+			   remote->addr, remote->port, leader->model);
+		return -1;
+	}
+
+	/* a multicast leader's pipeline has no tee to branch off */
+	if (leader->stream.multicast && !remote->caps.multicast) {
+		weston_log("%s:%s cannot join the group of %s, streaming to "
+			   "it alone\n", remote->addr, remote->port,
+			   leader->model);
+		return -1;
+	}
+
+	remote->stream = leader->stream;
+
+	/* it joins the group, only the GOP cache is sent to it alone */
+	if (leader->stream.multicast && remote->caps.multicast) {
+		remote->stream.join_port = remote->caps.port ? remote->caps.port :
+			(uint32_t)atoi(remote->port);
+		remote->mirrored = true;
+		weston_log("Stream to %s:%s: joins the group of %s, key frames "
+			   "on port %u\n", remote->addr, remote->port,
+			   leader->model, remote->stream.join_port);
+		transmitter_remote_send_stream_config(remote);
+		return 0;
+	}
+
+	remote->stream.multicast = 0;
+	remote->stream.join_port = 0;
+	remote->stream.port = remote->caps.port ? remote->caps.port :
+		(uint32_t)atoi(remote->port);
+	remote->stream.rtcp_port = remote->rtcp_port ? remote->rtcp_port :
+		remote->stream.port + 2;
+	remote->mirrored = true;
+
+	if (wl_list_empty(&leader->output_list)) {
+		output = NULL;
+	} else {
+		output = wl_container_of(leader->output_list.next, output, link);
+		if (txr->waltham_renderer->mirror_add(output, remote) < 0) {
+			weston_log("%s:%s: no branch off the stream of %s, "
+				   "not mirrored\n", remote->addr,
+				   remote->port, leader->model);
+			memset(&remote->stream, 0, sizeof remote->stream);
+			remote->mirrored = false;
+			return -1;
+		}
+	}
+
+	weston_log("Stream to %s:%s: mirror of %s, port %u, RTCP reports "
+		   "on %u\n", remote->addr, remote->port, leader->model,
+		   remote->stream.port, remote->stream.rtcp_port);
+	transmitter_remote_send_stream_config(remote);
+
+	if (!output)
+		return 0;
+
+	/* the new receiver starts at a key frame */
+	if (output->renderer->request_keyframe)
+		output->renderer->request_keyframe(output);
+	transmitter_output_force_push(output);
+
+	return 0;
+}
+
+/* the mirror disconnected, nothing more is sent to it */
+static void
+transmitter_remote_mirror_stop(struct weston_transmitter_remote *remote)
+{
+	struct weston_transmitter *txr = remote->transmitter;
+	struct weston_transmitter_output *output;
+
+	if (remote->mirrored && !wl_list_empty(&remote->leader->output_list)) {
+		output = wl_container_of(remote->leader->output_list.next,
+					 output, link);
+		txr->waltham_renderer->mirror_remove(output, remote);
+	}
+
+	remote->mirrored = false;
+	remote->mirror_waiting = false;
+}
+
+/** Send the stream to the multicast group from weston.ini.
+ *
+ * Every receiver of the group gets the same packets, the bandwidth does not
+ * grow with their number. Its own receiver and the remotes with mirror-of
+ * join it, see transmitter_remote_mirror_stream(); their first key frame
+ * comes from the GOP cache, unicast to their own port. There are no RTCP
+ * reports, the bitrate stays at bitrate=.
+ */
+static void
+transmitter_remote_multicast(struct weston_transmitter_remote *remote)
+{
+	struct in_addr group;
+
+	if (remote->stream.codec == WTH_STREAM_CODEC_RAW ||
+	    remote->stream.overlay || remote->stream.atlas) {
+		weston_log("%s:%s: multicast needs a video stream alone, "
+			   "ignored\n", remote->addr, remote->port);
+		return;
+	}
+
+	if (!remote->caps.multicast) {
+		weston_log("%s:%s cannot join multicast=%s, streaming to it "
+			   "alone\n", remote->addr, remote->port,
+			   remote->multicast);
+		return;
+	}
+
+	if (inet_pton(AF_INET, remote->multicast, &group) != 1 ||
+	    !IN_MULTICAST(ntohl(group.s_addr))) {
+		weston_log("%s:%s: multicast=%s is no IPv4 multicast group, "
+			   "ignored\n", remote->addr, remote->port,
+			   remote->multicast);
+		return;
+	}
+
+	remote->stream.multicast = ntohl(group.s_addr);
+	remote->stream.join_port = remote->stream.port;
+	if (remote->multicast_port)
+		remote->stream.port = remote->multicast_port;
+	remote->stream.rtcp_port = 0;
+	weston_log("Stream to %s:%s: multicast to %s:%u, key frames on "
+		   "port %u\n", remote->addr, remote->port, remote->multicast,
+		   remote->stream.port, remote->stream.join_port);
+}
+
+/** Agree on the media stream with the receiver.
+ *
+ * Called once the registry roundtrip is done, so the receiver's stream caps
+ * are known. The chosen config is sent back as a blob, so that the receiver
+ * can set up the matching depayloader and decoder. Receivers which do not
+ * advertise caps keep using the static pipeline files on both ends.
+ *
+ * Remotes with mirror-of take the stream of their leader if they can, see
+ * transmitter_remote_mirror_stream(); the ones waiting for it get theirs
+ * once it is negotiated here.
+ */
+static void
+transmitter_remote_negotiate_stream(struct weston_transmitter_remote *remote)
+{
+	struct weston_transmitter *txr = remote->transmitter;
+	struct waltham_display *dpy = remote->display;
+	struct weston_transmitter_remote *mirror;
+
+	memset(&remote->stream, 0, sizeof remote->stream);
+	remote->joined = false;
+
+	if (!remote->caps.codecs || !dpy->blob_factory) {
+		weston_log("%s:%s has no stream caps, using pipeline files\n",
+			   remote->addr, remote->port);
+		return;
+	}
+
+	if (remote->leader && transmitter_remote_mirror_stream(remote) == 0)
+		return;
+
+	if (remote->transport == TRANSMITTER_TRANSPORT_RAW &&
+	    (remote->caps.codecs & WTH_STREAM_CODEC_RAW)) {
+		/* no media stream, the frames go over this connection */
+		remote->stream.codec = WTH_STREAM_CODEC_RAW;
+		remote->stream.width = remote->caps.width ?
+			remote->caps.width : remote->width;
+		remote->stream.height = remote->caps.height ?
+			remote->caps.height : remote->height;
+		weston_log("Stream to %s:%s negotiated: raw\n",
+			   remote->addr, remote->port);
+	} else if (remote->transport != TRANSMITTER_TRANSPORT_VIDEO &&
+		   !(remote->caps.codecs & WTH_STREAM_CODEC_RAW)) {
+		weston_log("%s:%s cannot take transport=%s, using video\n",
+			   remote->addr, remote->port,
+			   remote->transport == TRANSMITTER_TRANSPORT_RAW ?
+			   "raw" : "hybrid");
+	}
+
+	if (!remote->stream.codec &&
+	    txr->waltham_renderer->stream_negotiate(remote, &remote->stream) < 0) {
+		memset(&remote->stream, 0, sizeof remote->stream);
+		return;
+	}
+
+	/* the lossless tiles over the video, see hybrid.c */
+	if (remote->transport == TRANSMITTER_TRANSPORT_HYBRID &&
+	    (remote->caps.codecs & WTH_STREAM_CODEC_RAW) && !remote->atlas) {
+		remote->stream.overlay = WTH_STREAM_CODEC_RAW;
+		weston_log("Stream to %s:%s: raw tiles over the video\n",
+			   remote->addr, remote->port);
+	}
+
+	/* the small surfaces packed into the video, see atlas.c */
+	if (remote->atlas && remote->stream.codec == WTH_STREAM_CODEC_RAW) {
+		weston_log("%s:%s: atlas=true needs a video stream, ignored\n",
+			   remote->addr, remote->port);
+	} else if (remote->atlas && !remote->caps.atlas) {
+		weston_log("%s:%s cannot take atlas=true, small surfaces "
+			   "are not sent\n", remote->addr, remote->port);
+	} else if (remote->atlas) {
+		remote->stream.atlas = 1;
+		weston_log("Stream to %s:%s: atlas of %dx%d surfaces\n",
+			   remote->addr, remote->port,
+			   TRANSMITTER_ATLAS_CELL, TRANSMITTER_ATLAS_CELL);
+	}
+
+	if (remote->multicast)
+		transmitter_remote_multicast(remote);
+
+	transmitter_remote_send_stream_config(remote);
+
+	wl_list_for_each(mirror, &txr->remote_list, link) {
+		if (mirror->leader == remote && mirror->mirror_waiting)
+			transmitter_remote_negotiate_stream(mirror);
 	}
 }
 
@@ -575,7 +907,11 @@ waltham_client_init(struct waltham_display *dpy)
 		return -1;
 	}
 
+	transmitter_remote_negotiate_stream(dpy->remote);
+
 	dpy->running = true;
+	dpy->remote->connections++;
+	transmitter_clock_start(dpy->remote);
 
 	return 0;
 }
@@ -600,6 +936,7 @@ establish_timer_handler(void *data)
 static void
 init_globals(struct waltham_display *dpy)
 {
+	memset(&dpy->remote->caps, 0, sizeof dpy->remote->caps);
 	dpy->compositor = NULL;
 	dpy->blob_factory = NULL;
 	dpy->seat = NULL;
@@ -619,6 +956,8 @@ disconnect_surface(struct weston_transmitter_remote *remote)
 		txs->wthp_ivi_surface = NULL;
 		free(txs->wthp_surf);
 		txs->wthp_surf = NULL;
+		txs->ivi_id = 0;
+		transmitter_raw_reset(txs);
 	}
 }
 
@@ -633,6 +972,7 @@ retry_timer_handler(void *data)
 		registry_handle_global_remove(dpy->registry, 1);
 		init_globals(dpy);
 		disconnect_surface(remote);
+		transmitter_remote_mirror_stop(remote);
 		wl_event_source_timer_update(remote->establish_timer,
 					     ESTABLISH_CONNECTION_PERIOD);
 
@@ -712,9 +1052,14 @@ transmitter_remote_destroy(struct weston_transmitter_remote *remote)
 		transmitter_output_destroy(output);
 
 	free(remote->addr);
+	free(remote->encoder);
+	free(remote->converter);
+	free(remote->mirror_of);
+	free(remote->multicast);
 	wl_list_remove(&remote->link);
 
 	wl_event_source_remove(remote->source);
+	transmitter_clock_destroy(remote);
 
 	free(remote);
 }
@@ -744,6 +1089,7 @@ transmitter_compositor_destroyed(struct wl_listener *listener, void *data)
 	 */
 	wl_list_remove(&txr->remote_list);
 
+	weston_debug_scope_destroy(txr->timeline);
 	free(txr);
 }
 
@@ -805,7 +1151,7 @@ static const struct weston_transmitter_ivi_api transmitter_ivi_api_impl = {
 	transmitter_surface_set_resize_callback,
 };
 
-static int
+static struct weston_transmitter_remote *
 transmitter_create_remote(struct weston_transmitter *txr,
 			  const char *model,
 			  const char *addr,
@@ -817,7 +1163,7 @@ transmitter_create_remote(struct weston_transmitter *txr,
 
 	remote = zalloc(sizeof (*remote));
 	if (!remote)
-		return -1;
+		return NULL;
 
 	remote->transmitter = txr;
 	wl_list_insert(&txr->remote_list, &remote->link);
@@ -835,7 +1181,45 @@ transmitter_create_remote(struct weston_transmitter *txr,
 	remote->establish_listener.notify = conn_ready_notify;
 	wl_signal_add(&remote->conn_establish_signal, &remote->establish_listener);
 
-	return 0;
+	return remote;
+}
+
+static enum transmitter_scaling
+transmitter_parse_scaling(const char *scaling)
+{
+	if (strcmp(scaling, "off") == 0)
+		return TRANSMITTER_SCALING_OFF;
+	if (strcmp(scaling, "stretch") == 0)
+		return TRANSMITTER_SCALING_STRETCH;
+	if (strcmp(scaling, "fill") == 0)
+		return TRANSMITTER_SCALING_FILL;
+	if (strcmp(scaling, "fit") != 0)
+		weston_log("Unknown scaling %s, using fit\n", scaling);
+	return TRANSMITTER_SCALING_FIT;
+}
+
+static enum transmitter_skip
+transmitter_parse_skip(const char *skip)
+{
+	if (strcmp(skip, "off") == 0)
+		return TRANSMITTER_SKIP_OFF;
+	if (strcmp(skip, "content") == 0)
+		return TRANSMITTER_SKIP_CONTENT;
+	if (strcmp(skip, "damage") != 0)
+		weston_log("Unknown skip-unchanged %s, using damage\n", skip);
+	return TRANSMITTER_SKIP_DAMAGE;
+}
+
+static enum transmitter_transport
+transmitter_parse_transport(const char *transport)
+{
+	if (strcmp(transport, "raw") == 0)
+		return TRANSMITTER_TRANSPORT_RAW;
+	if (strcmp(transport, "hybrid") == 0)
+		return TRANSMITTER_TRANSPORT_HYBRID;
+	if (strcmp(transport, "video") != 0)
+		weston_log("Unknown transport %s, using video\n", transport);
+	return TRANSMITTER_TRANSPORT_VIDEO;
 }
 
 struct wet_compositor {
@@ -858,7 +1242,10 @@ transmitter_get_server_config(struct weston_transmitter *txr)
 	char *port = NULL;
 	char *width = '0';
 	char *height = '0';
-	int ret;
+	char *scaling;
+	char *skip;
+	char *transport;
+	struct weston_transmitter_remote *remote, *leader;
 
 	section = weston_config_get_section(config, "remote", NULL, NULL);
 
@@ -883,12 +1270,76 @@ transmitter_get_server_config(struct weston_transmitter *txr)
 			if (0 != weston_config_section_get_string(section, "height",
 								  &height, 0))
 				continue;
-			ret = transmitter_create_remote(txr, model, addr,
-							port, width, height);
-			if (ret < 0) {
+			remote = transmitter_create_remote(txr, model, addr,
+							   port, width, height);
+			if (!remote) {
 				weston_log("Fatal: Transmitter create_remote failed.\n");
+				continue;
 			}
+
+			weston_config_section_get_int(section, "bitrate",
+						      &remote->bitrate,
+						      TRANSMITTER_BITRATE_DEFAULT);
+			weston_config_section_get_int(section, "min-bitrate",
+						      &remote->min_bitrate,
+						      remote->bitrate / 8);
+			weston_config_section_get_int(section, "max-bitrate",
+						      &remote->max_bitrate,
+						      remote->bitrate);
+			weston_config_section_get_uint(section, "rtcp-port",
+						       &remote->rtcp_port, 0);
+			weston_config_section_get_string(section, "encoder",
+							 &remote->encoder, NULL);
+			weston_config_section_get_string(section, "converter",
+							 &remote->converter, NULL);
+			weston_config_section_get_string(section, "scaling",
+							 &scaling, "fit");
+			remote->scaling = transmitter_parse_scaling(scaling);
+			free(scaling);
+			weston_config_section_get_string(section, "skip-unchanged",
+							 &skip, "damage");
+			remote->skip = transmitter_parse_skip(skip);
+			free(skip);
+			weston_config_section_get_int(section, "keepalive",
+						      &remote->keepalive,
+						      TRANSMITTER_KEEPALIVE_DEFAULT);
+			weston_config_section_get_bool(section, "roi",
+						       &remote->roi, true);
+			weston_config_section_get_bool(section, "quality",
+						       &remote->quality, false);
+			weston_config_section_get_string(section, "transport",
+							 &transport, "video");
+			remote->transport = transmitter_parse_transport(transport);
+			free(transport);
+			weston_config_section_get_bool(section, "atlas",
+						       &remote->atlas, false);
+			weston_config_section_get_string(section, "mirror-of",
+							 &remote->mirror_of, NULL);
+			weston_config_section_get_string(section, "multicast",
+							 &remote->multicast, NULL);
+			weston_config_section_get_uint(section, "multicast-port",
+						       &remote->multicast_port, 0);
+			if (remote->min_bitrate > remote->bitrate)
+				remote->min_bitrate = remote->bitrate;
+			if (remote->max_bitrate < remote->bitrate)
+				remote->max_bitrate = remote->bitrate;
+		}
+	}
+
+	/* once all are known; a leader is not a mirror itself */
+	wl_list_for_each(remote, &txr->remote_list, link) {
+		if (!remote->mirror_of)
+			continue;
+
+		wl_list_for_each(leader, &txr->remote_list, link) {
+			if (leader != remote && !leader->mirror_of &&
+			    strcmp(leader->model, remote->mirror_of) == 0)
+				remote->leader = leader;
 		}
+		if (!remote->leader)
+			weston_log("mirror-of=%s of %s: no such transmitter-output "
+				   "without mirror-of, encoding its own stream\n",
+				   remote->mirror_of, remote->model);
 	}
 }
 
@@ -906,6 +1357,10 @@ wet_module_init(struct weston_compositor *compositor, int *argc, char *argv[])
 	wl_list_init(&txr->remote_list);
 
 	txr->compositor = compositor;
+	txr->timeline = weston_compositor_add_debug_scope(compositor,
+		"transmitter-timeline",
+		"Per-frame timestamps of the transmitter outputs, in us\n",
+		transmitter_timeline_begin, txr);
 	txr->compositor_destroy_listener.notify =
 		transmitter_compositor_destroyed;
 	wl_signal_add(&compositor->destroy_signal,
@@ -929,12 +1384,22 @@ wet_module_init(struct weston_compositor *compositor, int *argc, char *argv[])
 		goto fail;
 	}
 
+	ret = weston_plugin_api_register(compositor,
+					 WESTON_TRANSMITTER_STATS_API_NAME,
+					 &transmitter_stats_api_impl,
+					 sizeof(transmitter_stats_api_impl));
+	if (ret < 0) {
+		weston_log("Fatal: Transmitter stats API registration failed.\n");
+		goto fail;
+	}
+
 	/* Loading a waltham renderer library */
 	txr->waltham_renderer = weston_load_module("waltham-renderer.so","waltham_renderer_interface");
 	if (txr->waltham_renderer == NULL) {
 		weston_log("Failed to load waltham-renderer\n");
 		goto fail;
 	}
+	txr->waltham_renderer->probe();
 
 	weston_log("Transmitter initialized.\n");
 
@@ -946,6 +1411,7 @@ wet_module_init(struct weston_compositor *compositor, int *argc, char *argv[])
 
 fail:
 	wl_list_remove(&txr->compositor_destroy_listener.link);
+	weston_debug_scope_destroy(txr->timeline);
 	free(txr);
 
 	return -1;
@@ -32,11 +32,14 @@
  */
 
 #include <stdint.h>
+#include <sys/types.h>
 #include <wayland-client.h>
 
 #include "compositor.h"
+#include "weston-debug.h"
 #include "transmitter_api.h"
 #include "ivi-layout-export.h"
+#include "waltham-stream.h"
 
 #include <waltham-client.h>
 
@@ -108,6 +111,60 @@ struct weston_transmitter {
 	struct wl_event_loop *loop;
 
 	struct waltham_renderer_interface *waltham_renderer;
+
+	/* "transmitter-timeline" debug scope, see output.c */
+	struct weston_debug_scope *timeline;
+};
+
+/* encoder bitrate when weston.ini has none, bps */
+#define TRANSMITTER_BITRATE_DEFAULT 3000000
+
+/* how a surface larger than the receiver's display is scaled down */
+enum transmitter_scaling {
+	TRANSMITTER_SCALING_OFF,	/* not at all */
+	TRANSMITTER_SCALING_STRETCH,	/* to the display, aspect ignored */
+	TRANSMITTER_SCALING_FIT,	/* within the display, aspect kept */
+	TRANSMITTER_SCALING_FILL,	/* over the display, edges cropped */
+};
+
+/* which frames are not pushed to the encoder, see output.c */
+enum transmitter_skip {
+	TRANSMITTER_SKIP_OFF,		/* none, every repaint is encoded */
+	TRANSMITTER_SKIP_DAMAGE,	/* the view is not in the damage */
+	TRANSMITTER_SKIP_CONTENT,	/* and the pixels did not change */
+};
+
+/* how the surface goes to the receiver */
+enum transmitter_transport {
+	TRANSMITTER_TRANSPORT_VIDEO,	/* encoded, over RTP */
+	TRANSMITTER_TRANSPORT_RAW,	/* damaged rects in waltham blobs */
+	TRANSMITTER_TRANSPORT_HYBRID,	/* video, text tiles as raw on top */
+};
+
+/* a frame is pushed at least this often while skipping, ms */
+#define TRANSMITTER_KEEPALIVE_DEFAULT 1000
+
+#define TRANSMITTER_CLOCK_SAMPLES 16
+
+struct transmitter_clock_sample {
+	uint64_t local;		/* when the answer came, our clock */
+	int64_t offset;		/* receiver clock - ours, us */
+	uint64_t delay;		/* round trip without the receiver's time */
+};
+
+/* see clock.c */
+struct transmitter_clock {
+	struct wl_event_source *ping_timer;
+	uint32_t seq;		/* of the last ping sent */
+
+	struct transmitter_clock_sample samples[TRANSMITTER_CLOCK_SAMPLES];
+	unsigned int count;	/* samples taken, the ring index is modulo */
+
+	bool valid;		/* there is an estimate */
+	uint64_t base;		/* local time of the estimate */
+	int64_t offset;		/* receiver clock - ours at base, us */
+	double drift;		/* change of offset per us */
+	uint64_t delay;		/* round trip of the sample used */
 };
 
 struct weston_transmitter_remote {
@@ -134,6 +191,66 @@ struct weston_transmitter_remote {
 
 	struct waltham_display *display; /* waltham */
 	struct wl_event_source *source;
+
+	struct wth_stream_caps caps; /* advertised by the receiver */
+	struct wth_stream_config stream; /* negotiated, codec 0 if none */
+	struct transmitter_clock clock; /* offset to the receiver's clock */
+	uint32_t connections; /* established so far, for the stats */
+
+	/* encoder bitrate in bps from weston.ini, adapted between min and
+	 * max from the receiver's RTCP reports */
+	int32_t bitrate;
+	int32_t min_bitrate;
+	int32_t max_bitrate;
+	uint32_t rtcp_port; /* local, for the reports; 0: stream port + 2 */
+
+	/* element names from weston.ini, NULL: probed at startup */
+	char *encoder;
+	char *converter;
+	enum transmitter_scaling scaling;
+	enum transmitter_skip skip;
+	int32_t keepalive; /* ms, 0: only on key frame requests */
+	bool roi; /* damage to the encoder as regions of interest */
+	bool quality; /* decode the stream again and measure it */
+	enum transmitter_transport transport; /* asked for in weston.ini */
+	bool atlas; /* small surfaces packed into one stream, see atlas.c */
+
+	/* mirror-of: the stream of another remote's output is sent here
+	 * too, from its encoder, see transmitter_remote_mirror_stream() */
+	char *mirror_of; /* its output-name from weston.ini */
+	struct weston_transmitter_remote *leader; /* it, NULL: none */
+	bool mirrored; /* the stream comes from the leader's encoder */
+	bool mirror_waiting; /* connected, the leader has no stream yet */
+
+	/* the stream goes to a multicast group, its receivers are the
+	 * mirrors, see transmitter_remote_multicast() */
+	char *multicast; /* the group from weston.ini, NULL: unicast */
+	uint32_t multicast_port; /* 0: the stream port */
+	bool joined; /* its first key frame request since connecting */
+};
+
+/* raw blobs sent to the receiver and not completed yet, at most */
+#define TRANSMITTER_RAW_INFLIGHT 2
+
+/* see raw.c */
+struct transmitter_raw {
+	pixman_region32_t owed;	/* damage not sent yet, surface coordinates */
+	int32_t width, height;	/* of the last blob, 0: none since connecting */
+	uint32_t frame;		/* blobs built */
+
+	uint8_t *blob;		/* the next blob, blob_len bytes; 0: none */
+	size_t blob_len;
+	size_t blob_size;
+	uint8_t *pixels;	/* scratch, one rect tightly packed */
+	size_t pixels_size;
+	uint8_t *shadow;	/* the surface as the receiver will have it */
+	bool shadow_valid;	/* false until a whole surface went out */
+	uint8_t *delta;		/* scratch, one rect XORed with the shadow */
+	size_t delta_size;
+	uint64_t capture_start;	/* of the frame in the blob */
+
+	struct wthp_buffer *inflight[TRANSMITTER_RAW_INFLIGHT];
+	struct weston_transmitter_output *output; /* pushes what is owed */
 };
 
 
@@ -166,6 +283,9 @@ struct weston_transmitter_surface {
 	struct wthp_buffer *wthp_buf;
         struct wthp_ivi_surface *wthp_ivi_surface;
         struct wthp_ivi_application *wthp_ivi_application;
+	uint32_t ivi_id; /* the surface was created with, 0: none */
+
+	struct transmitter_raw raw; /* transport=raw only */
 };
 
 struct weston_transmitter_output_info {
@@ -182,6 +302,51 @@ struct weston_transmitter_output_info {
 	struct weston_mode mode;
 };
 
+#define TRANSMITTER_TILE_SIZE 64
+
+/* see fingerprint.c */
+struct transmitter_fingerprint {
+	int width, height;	/* of the last frame, 0 if none */
+	int cols, rows;		/* tiles */
+	uint64_t *tiles;	/* hashes, row-major */
+	uint8_t *changed;	/* from the frame before */
+	uint64_t *lanes;	/* scratch, one row of tiles */
+};
+
+/* see hybrid.c */
+struct transmitter_hybrid {
+	int cols, rows;		/* tiles, as the fingerprint's */
+	uint64_t *changed_at;	/* wth_stream_now_us() of the last change */
+	uint8_t *moves;		/* changes in quick succession */
+	uint8_t *natural;	/* photo-like content */
+	uint8_t *video;		/* left to the video layer */
+	pixman_region32_t lossless;	/* the other tiles */
+	pixman_region32_t flipped;	/* changed layer, for raw.c to redraw */
+};
+
+/* see atlas.c: cells of a fixed grid, so that the stream size never
+ * changes, each holding one surface up to the cell size */
+#define TRANSMITTER_ATLAS_CELL 64
+#define TRANSMITTER_ATLAS_COLS 8
+#define TRANSMITTER_ATLAS_ROWS 8
+#define TRANSMITTER_ATLAS_SLOTS (TRANSMITTER_ATLAS_COLS * TRANSMITTER_ATLAS_ROWS)
+
+struct transmitter_atlas_slot {
+	struct weston_surface *surface; /* NULL: free; compared, never
+					 * followed outside of a repaint */
+	uint32_t ivi_id;
+	int32_t width, height;
+	bool seen;		/* on the output in this repaint */
+	bool dirty;		/* placed or resized, not drawn since */
+};
+
+struct transmitter_atlas {
+	struct transmitter_atlas_slot slots[TRANSMITTER_ATLAS_SLOTS];
+	uint8_t *cell;		/* scratch, one surface tightly packed */
+	bool layout_changed;	/* not sent to the receiver since */
+	bool full_logged;
+};
+
 struct weston_transmitter_output {
 	struct weston_output base;
 
@@ -201,6 +366,15 @@ struct weston_transmitter_output {
         struct wl_event_source *finish_frame_timer;
 	struct wl_callback *frame_cb;
 	struct renderer *renderer;
+	bool capture_failing;	/* last capture failed, already logged */
+
+	/* unchanged frames, see transmitter_output_send() */
+	struct transmitter_fingerprint fingerprint;
+	struct transmitter_hybrid hybrid; /* transport=hybrid only */
+	struct transmitter_atlas atlas; /* atlas=true only */
+	struct wl_event_source *keepalive_timer;
+	uint64_t last_push;	/* wth_stream_now_us(), 0 if none yet */
+	bool force_push;	/* next frame goes out even if unchanged */
 };
 
 struct weston_transmitter_seat {
@@ -255,12 +429,118 @@ transmitter_remote_create_output(struct weston_transmitter_remote *remote,
 void
 transmitter_output_destroy(struct weston_transmitter_output *output);
 
+bool
+transmitter_output_is(struct weston_output *base);
+
+void
+transmitter_output_force_push(struct weston_transmitter_output *output);
+
+int
+transmitter_fingerprint_update(struct transmitter_fingerprint *fp,
+			       const void *data, int stride,
+			       int width, int height);
+
+void
+transmitter_fingerprint_release(struct transmitter_fingerprint *fp);
+
+void
+transmitter_raw_init(struct weston_transmitter_surface *txs);
+
+void
+transmitter_raw_reset(struct weston_transmitter_surface *txs);
+
+void
+transmitter_raw_release(struct weston_transmitter_surface *txs);
+
+int
+transmitter_raw_frame(struct weston_transmitter_output *output,
+		      struct weston_transmitter_surface *txs,
+		      struct weston_view *view);
+
+int
+transmitter_raw_commit(struct weston_transmitter_surface *txs);
+
+void
+transmitter_delta_xor(uint32_t *delta, const uint8_t *cur, uint32_t *ref,
+		      int n);
+
+ssize_t
+transmitter_delta_encode(uint8_t *dst, size_t max,
+			 const uint32_t *delta, size_t n);
+
+void
+transmitter_hybrid_init(struct transmitter_hybrid *hy);
+
+void
+transmitter_hybrid_release(struct transmitter_hybrid *hy);
+
+int
+transmitter_hybrid_classify(struct transmitter_hybrid *hy,
+			    const struct transmitter_fingerprint *fp,
+			    const void *data, int stride, uint64_t now);
+
+void
+transmitter_hybrid_mask(const struct transmitter_hybrid *hy, uint8_t *pixels,
+			int x, int y, int width, int height);
+
+void
+transmitter_atlas_init(struct transmitter_atlas *atlas);
+
+void
+transmitter_atlas_release(struct transmitter_atlas *atlas);
+
+void
+transmitter_atlas_begin(struct transmitter_atlas *atlas);
+
+int
+transmitter_atlas_place(struct transmitter_atlas *atlas,
+			struct weston_surface *surface, uint32_t ivi_id);
+
+int
+transmitter_atlas_frame(struct transmitter_atlas *atlas,
+			struct renderer *renderer);
+
+int
+transmitter_atlas_copy(struct transmitter_atlas *atlas,
+		       struct renderer *renderer, int slot);
+
+void
+transmitter_atlas_end(struct transmitter_atlas *atlas,
+		      struct renderer *renderer);
+
+void
+transmitter_atlas_send_layout(struct transmitter_atlas *atlas,
+			      struct weston_transmitter_remote *remote);
+
+void
+transmitter_timeline_begin(struct weston_debug_stream *stream, void *data);
+
+extern const struct weston_transmitter_stats_api transmitter_stats_api_impl;
+
 int
 transmitter_remote_create_seat(struct weston_transmitter_remote *remote);
 
 void
 transmitter_seat_destroy(struct weston_transmitter_seat *seat);
 
+void
+transmitter_clock_start(struct weston_transmitter_remote *remote);
+
+void
+transmitter_clock_destroy(struct weston_transmitter_remote *remote);
+
+void
+transmitter_clock_handle_pong(struct weston_transmitter_remote *remote,
+			      uint32_t seq, uint64_t t1, uint64_t t2,
+			      uint64_t t3);
+
+int64_t
+transmitter_clock_offset(const struct transmitter_clock *clock, uint64_t local);
+
+uint32_t
+transmitter_remote_rebase_time(struct weston_transmitter_remote *remote,
+			       uint32_t time);
+
 /* The below are the functions to be called from the network protocol
  * input event handlers.
  */
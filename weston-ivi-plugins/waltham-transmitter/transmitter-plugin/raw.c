@@ -0,0 +1,478 @@
+/*
+ * Copyright (C) 2017 Advanced Driver Information Technology Joint Venture GmbH
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/dma-buf.h>
+#include <lz4.h>
+
+#include "compositor.h"
+
+#include "plugin.h"
+#include "transmitter_api.h"
+
+#include <waltham-object.h>
+
+/** @file
+ *
+ * transport=raw: the surface goes to the receiver as its damaged
+ * rectangles, LZ4 compressed, in waltham blobs attached to the wthp_surface,
+ * see WTH_STREAM_BLOB_RAW. There is no encoder and no RTP: the receiver
+ * shows exactly what was rendered, and a mostly static UI costs only the
+ * few rects that change. Full-screen video still wants the video transport.
+ *
+ * LZ4 rather than zstd: flat UI content compresses well at either, and LZ4
+ * does it at several GB/s a core with decompression faster still, where
+ * zstd's better ratio costs more time than it saves on a LAN.
+ *
+ * Once the receiver has the whole surface, a rect is first tried as its
+ * XOR against what the receiver has, run-length encoded (delta.c): the
+ * part of a damaged rect that really changed is often small. Waltham runs
+ * over one ordered, reliable connection, so what the receiver has when it
+ * applies a blob is what all the blobs before it left, and the shadow kept
+ * here of exactly that needs no acknowledgement to be trusted. Rects the
+ * XOR does not shrink to half go out LZ4 compressed.
+ *
+ * transport=hybrid sends a layer of lossless tiles over the video the same
+ * way, see hybrid.c: the owed damage is that of the lossless tiles and of
+ * the tiles that changed layer, and the video tiles go out transparent.
+ *
+ * Damage not sent yet is owed. It piles up while TRANSMITTER_RAW_INFLIGHT
+ * blobs wait for the receiver's wthp_buffer.complete, and then goes out as
+ * one blob: a slow link or receiver gets fewer, larger updates instead of
+ * a growing queue.
+ */
+
+void
+transmitter_raw_init(struct weston_transmitter_surface *txs)
+{
+	pixman_region32_init(&txs->raw.owed);
+}
+
+/* index of a free in-flight slot, -1 if the receiver is behind */
+static int
+raw_slot(const struct transmitter_raw *raw)
+{
+	int i;
+
+	for (i = 0; i < TRANSMITTER_RAW_INFLIGHT; i++)
+		if (!raw->inflight[i])
+			return i;
+
+	return -1;
+}
+
+/*
+ * The connection is gone, and the blobs in flight with it. The receiver of
+ * the next connection starts from nothing, so the next blob is the whole
+ * surface.
+ */
+void
+transmitter_raw_reset(struct weston_transmitter_surface *txs)
+{
+	struct transmitter_raw *raw = &txs->raw;
+	int i;
+
+	for (i = 0; i < TRANSMITTER_RAW_INFLIGHT; i++) {
+		free(raw->inflight[i]);
+		raw->inflight[i] = NULL;
+	}
+	raw->width = 0;
+	raw->height = 0;
+	raw->blob_len = 0;
+	raw->shadow_valid = false;
+}
+
+static const struct wthp_buffer_listener raw_buffer_listener;
+
+void
+transmitter_raw_release(struct weston_transmitter_surface *txs)
+{
+	struct transmitter_raw *raw = &txs->raw;
+	int i;
+
+	/* completes still on their way find no surface */
+	for (i = 0; i < TRANSMITTER_RAW_INFLIGHT; i++)
+		if (raw->inflight[i])
+			wthp_buffer_set_listener(raw->inflight[i],
+						 &raw_buffer_listener, NULL);
+
+	pixman_region32_fini(&raw->owed);
+	free(raw->blob);
+	free(raw->pixels);
+	free(raw->shadow);
+	free(raw->delta);
+	memset(raw, 0, sizeof *raw);
+}
+
+static void
+raw_buffer_complete(struct wthp_buffer *b, uint32_t serial)
+{
+	struct weston_transmitter_surface *txs =
+		wth_object_get_user_data((struct wth_object *)b);
+	struct transmitter_raw *raw;
+	int i;
+
+	if (txs) {
+		raw = &txs->raw;
+		for (i = 0; i < TRANSMITTER_RAW_INFLIGHT; i++)
+			if (raw->inflight[i] == b)
+				raw->inflight[i] = NULL;
+
+		/* held back while the receiver was behind */
+		if (raw->output && pixman_region32_not_empty(&raw->owed))
+			transmitter_output_force_push(raw->output);
+	}
+
+	wthp_buffer_destroy(b);
+}
+
+static const struct wthp_buffer_listener raw_buffer_listener = {
+	raw_buffer_complete
+};
+
+static int
+raw_reserve(uint8_t **buf, size_t *size, size_t needed)
+{
+	uint8_t *p;
+
+	if (needed <= *size)
+		return 0;
+
+	p = realloc(*buf, needed);
+	if (!p)
+		return -1;
+
+	*buf = p;
+	*size = needed;
+	return 0;
+}
+
+/* one rect of the frame, rows tightly packed, R and B swapped if asked */
+static void
+raw_pack_rect(uint8_t *dst, const uint8_t *src, int stride,
+	      int width, int height, bool swap)
+{
+	const uint8_t *s;
+	int x, y;
+
+	for (y = 0; y < height; y++, src += stride) {
+		if (!swap) {
+			memcpy(dst, src, width * WTH_STREAM_RAW_BPP);
+			dst += width * WTH_STREAM_RAW_BPP;
+			continue;
+		}
+
+		for (x = 0, s = src; x < width; x++, s += 4, dst += 4) {
+			dst[0] = s[2];
+			dst[1] = s[1];
+			dst[2] = s[0];
+			dst[3] = s[3];
+		}
+	}
+}
+
+/*
+ * One rect, rows tightly packed at src, as its XOR against the shadow into
+ * the blob, unless that takes more than max bytes. Either way the shadow
+ * has the rect afterwards. Returns the length, -1 if it did not fit.
+ */
+static ssize_t
+raw_xor_rect(struct transmitter_raw *raw,
+	     const struct wth_stream_raw_rect *rect, const uint8_t *src,
+	     uint8_t *dst, size_t max)
+{
+	size_t row = (size_t)rect->width * WTH_STREAM_RAW_BPP;
+	uint8_t *ref = raw->shadow + ((size_t)rect->y * raw->width + rect->x) *
+		WTH_STREAM_RAW_BPP;
+	int32_t y;
+
+	/* no scratch: LZ4 for the rest of this blob */
+	if (raw->shadow_valid &&
+	    raw_reserve(&raw->delta, &raw->delta_size, row * rect->height) < 0)
+		raw->shadow_valid = false;
+
+	if (!raw->shadow_valid) {
+		for (y = 0; y < rect->height; y++)
+			memcpy(ref + (size_t)y * raw->width * WTH_STREAM_RAW_BPP,
+			       src + y * row, row);
+		return -1;
+	}
+
+	for (y = 0; y < rect->height; y++)
+		transmitter_delta_xor((uint32_t *)(raw->delta + y * row),
+				      src + y * row,
+				      (uint32_t *)(ref + (size_t)y * raw->width *
+						   WTH_STREAM_RAW_BPP),
+				      rect->width);
+
+	return transmitter_delta_encode(dst, max, (uint32_t *)raw->delta,
+					(size_t)rect->width * rect->height);
+}
+
+/* The owed region of the frame into raw->blob, see WTH_STREAM_BLOB_RAW */
+static int
+raw_build(struct transmitter_raw *raw, const uint8_t *data, int stride,
+	  bool swap, const struct transmitter_hybrid *hy,
+	  uint64_t capture_start)
+{
+	struct wth_stream_raw header = { 0 };
+	struct wth_stream_raw_rect rect;
+	pixman_box32_t *boxes, extents;
+	uint64_t start = wth_stream_now_us();
+	const uint8_t *src;
+	size_t bound, len, size;
+	ssize_t c;
+	int n, i;
+
+	boxes = pixman_region32_rectangles(&raw->owed, &n);
+	if (n > WTH_STREAM_RAW_MAX_RECTS) {
+		/* scattered: the rects in between compress to little */
+		extents = *pixman_region32_extents(&raw->owed);
+		boxes = &extents;
+		n = 1;
+	}
+
+	len = wth_stream_raw_data_offset(n);
+	bound = len;
+	for (i = 0; i < n; i++)
+		bound += LZ4_compressBound((boxes[i].x2 - boxes[i].x1) *
+					   (boxes[i].y2 - boxes[i].y1) *
+					   WTH_STREAM_RAW_BPP);
+	if (raw_reserve(&raw->blob, &raw->blob_size, bound) < 0)
+		return -1;
+
+	for (i = 0; i < n; i++) {
+		rect.x = boxes[i].x1;
+		rect.y = boxes[i].y1;
+		rect.width = boxes[i].x2 - boxes[i].x1;
+		rect.height = boxes[i].y2 - boxes[i].y1;
+		size = (size_t)rect.width * rect.height * WTH_STREAM_RAW_BPP;
+		src = data + (size_t)rect.y * stride + rect.x * WTH_STREAM_RAW_BPP;
+
+		/* full rows in the right order are used straight from the frame */
+		if (swap || hy || rect.width * WTH_STREAM_RAW_BPP != stride) {
+			if (raw_reserve(&raw->pixels, &raw->pixels_size, size) < 0)
+				goto err;
+			raw_pack_rect(raw->pixels, src, stride, rect.width,
+				      rect.height, swap);
+			if (hy)
+				transmitter_hybrid_mask(hy, raw->pixels, rect.x,
+							rect.y, rect.width,
+							rect.height);
+			src = raw->pixels;
+		}
+
+		rect.encoding = WTH_STREAM_RAW_XOR_RLE;
+		c = -1;
+		if (raw->shadow)
+			c = raw_xor_rect(raw, &rect, src, raw->blob + len,
+					 size / 2);
+		if (c < 0) {
+			rect.encoding = WTH_STREAM_RAW_LZ4;
+			c = LZ4_compress_default((const char *)src,
+						 (char *)raw->blob + len,
+						 size, bound - len);
+		}
+		if (rect.encoding == WTH_STREAM_RAW_LZ4 &&
+		    (c <= 0 || (size_t)c >= size)) {
+			memcpy(raw->blob + len, src, size);
+			c = size;
+		}
+
+		rect.size = c;
+		wth_stream_raw_rect_pack(&rect, raw->blob, i);
+		len += c;
+	}
+
+	header.width = raw->width;
+	header.height = raw->height;
+	header.rects = n;
+	header.trace.frame = ++raw->frame;
+	header.trace.capture = capture_start;
+	header.trace.capture_dur = start - capture_start;
+	header.trace.encode_dur = wth_stream_now_us() - start;
+	wth_stream_raw_pack(&header, raw->blob);
+
+	raw->blob_len = len;
+	raw->capture_start = capture_start;
+	pixman_region32_fini(&raw->owed);
+	pixman_region32_init(&raw->owed);
+	/* everything the receiver lacked is in the shadow now */
+	raw->shadow_valid = raw->shadow != NULL;
+
+	return 0;
+
+err:
+	/* rects already in the shadow will not reach the receiver */
+	raw->shadow_valid = false;
+	return -1;
+}
+
+/*
+ * Takes the damage of the captured frame, in output->renderer, and builds
+ * the blob for transmitter_raw_commit() out of everything owed, unless
+ * the receiver is behind. Returns -1 if the frame could not be read, its
+ * damage stays owed. The frame's dmafd is left open for the caller.
+ */
+int
+transmitter_raw_frame(struct weston_transmitter_output *output,
+		      struct weston_transmitter_surface *txs,
+		      struct weston_view *view)
+{
+	struct renderer *renderer = output->renderer;
+	struct transmitter_raw *raw = &txs->raw;
+	struct weston_surface *surface = view->surface;
+	size_t size = (size_t)renderer->buf_stride * surface->height;
+	pixman_format_code_t format = surface->compositor->read_format;
+	struct dma_buf_sync sync = { 0 };
+	const uint8_t *data = renderer->shm_data;
+	struct transmitter_hybrid *hy = NULL;
+	pixman_region32_t damage;
+	bool swap = false;
+	int ret;
+
+	raw->output = output;
+	if (txs->remote->stream.overlay & WTH_STREAM_CODEC_RAW)
+		hy = &output->hybrid;
+
+	if (surface->width != raw->width || surface->height != raw->height) {
+		/* the receiver starts over from the whole surface */
+		pixman_region32_fini(&raw->owed);
+		pixman_region32_init_rect(&raw->owed, 0, 0,
+					  surface->width, surface->height);
+		raw->width = surface->width;
+		raw->height = surface->height;
+
+		/* without one, every rect is LZ4 */
+		free(raw->shadow);
+		raw->shadow = malloc((size_t)raw->width * raw->height *
+				     WTH_STREAM_RAW_BPP);
+		raw->shadow_valid = false;
+	} else if (hy) {
+		pixman_region32_init(&damage);
+		pixman_region32_intersect(&damage, &renderer->damage,
+					  &hy->lossless);
+		pixman_region32_union(&raw->owed, &raw->owed, &damage);
+		pixman_region32_union(&raw->owed, &raw->owed, &hy->flipped);
+		pixman_region32_fini(&damage);
+	} else {
+		pixman_region32_union(&raw->owed, &raw->owed,
+				      &renderer->damage);
+	}
+	if (hy) {
+		pixman_region32_fini(&hy->flipped);
+		pixman_region32_init(&hy->flipped);
+	}
+
+	if (raw->blob_len || raw_slot(raw) < 0 ||
+	    !pixman_region32_not_empty(&raw->owed))
+		return 0;
+
+	if (renderer->dmafd >= 0) {
+		data = mmap(NULL, size, PROT_READ, MAP_SHARED,
+			    renderer->dmafd, 0);
+		if (data == MAP_FAILED)
+			return -1;
+		sync.flags = DMA_BUF_SYNC_START | DMA_BUF_SYNC_READ;
+		ioctl(renderer->dmafd, DMA_BUF_IOCTL_SYNC, &sync);
+	} else {
+		/* weston_surface_copy_content() gives the read_format */
+		swap = format == PIXMAN_a8b8g8r8 || format == PIXMAN_x8b8g8r8;
+	}
+
+	ret = raw_build(raw, data, renderer->buf_stride, swap, hy,
+			renderer->capture_start);
+	/* with hybrid, the frame is counted going to the encoder */
+	if (ret == 0 && !hy)
+		transmitter_counter_add(&renderer->counters.frames_pushed, 1);
+
+	if (renderer->dmafd >= 0) {
+		sync.flags = DMA_BUF_SYNC_END | DMA_BUF_SYNC_READ;
+		ioctl(renderer->dmafd, DMA_BUF_IOCTL_SYNC, &sync);
+		munmap((void *)data, size);
+	}
+
+	return ret;
+}
+
+/*
+ * Sends the blob built by transmitter_raw_frame(), if any, attached to the
+ * surface with its rects as damage. Returns -1 if there was none to send,
+ * the surface was not committed.
+ */
+int
+transmitter_raw_commit(struct weston_transmitter_surface *txs)
+{
+	struct weston_transmitter_remote *remote = txs->remote;
+	struct wth_stream_raw_rect rects[WTH_STREAM_RAW_MAX_RECTS];
+	struct transmitter_raw *raw = &txs->raw;
+	struct transmitter_counters *counters;
+	struct wth_stream_raw header;
+	struct wthp_buffer *buf;
+	uint32_t i;
+	int slot;
+
+	slot = raw_slot(raw);
+	if (!raw->blob_len || slot < 0 || !txs->wthp_surf)
+		return -1;
+
+	buf = wthp_blob_factory_create_buffer(remote->display->blob_factory,
+					      raw->blob_len, raw->blob,
+					      raw->width, raw->height,
+					      raw->width * WTH_STREAM_RAW_BPP,
+					      WTH_STREAM_BLOB_RAW);
+	wthp_buffer_set_listener(buf, &raw_buffer_listener, txs);
+	raw->inflight[slot] = buf;
+
+	wthp_surface_attach(txs->wthp_surf, buf, txs->attach_dx, txs->attach_dy);
+	if (wth_stream_raw_unpack(&header, rects, raw->blob, raw->blob_len))
+		for (i = 0; i < header.rects; i++)
+			wthp_surface_damage(txs->wthp_surf, rects[i].x,
+					    rects[i].y, rects[i].width,
+					    rects[i].height);
+	wthp_surface_commit(txs->wthp_surf);
+	wth_connection_flush(remote->display->connection);
+	txs->attach_dx = 0;
+	txs->attach_dy = 0;
+
+	if (raw->output) {
+		counters = &raw->output->renderer->counters;
+		transmitter_counter_add(&counters->bytes_sent, raw->blob_len);
+		/* hybrid frames are counted as the video sends them */
+		if (remote->stream.codec == WTH_STREAM_CODEC_RAW) {
+			transmitter_counter_add(&counters->frames_sent, 1);
+			transmitter_counter_latency(counters,
+						    wth_stream_now_us() -
+						    raw->capture_start);
+		}
+	}
+	raw->blob_len = 0;
+
+	return 0;
+}
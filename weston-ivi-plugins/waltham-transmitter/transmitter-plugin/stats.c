@@ -0,0 +1,204 @@
+/*
+ * Copyright (C) 2017 Advanced Driver Information Technology Joint Venture GmbH
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "compositor.h"
+
+#include "plugin.h"
+#include "transmitter_api.h"
+
+/** @file
+ *
+ * The Transmitter statistics API, see weston_transmitter_stats_api.
+ *
+ * The counters live in the output's renderer, where both the compositor
+ * (capture) and waltham-renderer's GStreamer threads (push, payloader)
+ * bump them. Reading takes a relaxed snapshot; the fields are not
+ * consistent with each other to the frame, which is fine for controllers.
+ */
+
+static uint64_t
+counter_get(atomic_uint_fast64_t *counter)
+{
+	return atomic_load_explicit(counter, memory_order_relaxed);
+}
+
+static int
+compare_u32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a;
+	uint32_t y = *(const uint32_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* nearest rank */
+static uint32_t
+percentile(const uint32_t *sorted, unsigned int n, unsigned int p)
+{
+	unsigned int rank = (n * p + 99) / 100;
+
+	return sorted[rank ? rank - 1 : 0];
+}
+
+static void
+latency_get(struct transmitter_counters *counters,
+	    struct weston_transmitter_output_stats *stats)
+{
+	uint32_t latency[TRANSMITTER_LATENCY_RING];
+	unsigned int head, n, i;
+
+	head = atomic_load_explicit(&counters->latency_head,
+				    memory_order_acquire);
+	n = head < TRANSMITTER_LATENCY_RING ? head : TRANSMITTER_LATENCY_RING;
+	if (n == 0)
+		return;
+
+	for (i = 0; i < n; i++)
+		latency[i] = atomic_load_explicit(&counters->latency_us[i],
+						  memory_order_relaxed);
+	qsort(latency, n, sizeof latency[0], compare_u32);
+
+	stats->latency_p50_us = percentile(latency, n, 50);
+	stats->latency_p99_us = percentile(latency, n, 99);
+}
+
+static void
+output_stats_get(struct weston_transmitter_output *output,
+		 struct weston_transmitter_output_stats *stats)
+{
+	struct transmitter_counters *counters = &output->renderer->counters;
+
+	memset(stats, 0, sizeof *stats);
+	stats->frames_captured = counter_get(&counters->frames_captured);
+	stats->frames_pushed = counter_get(&counters->frames_pushed);
+	stats->frames_dropped = counter_get(&counters->frames_dropped);
+	stats->frames_sent = counter_get(&counters->frames_sent);
+	stats->bytes_sent = counter_get(&counters->bytes_sent);
+	/* frames_sent stays 0 without a payloader named "pay" */
+	if (stats->frames_sent && stats->frames_pushed > stats->frames_sent)
+		stats->queue_depth = stats->frames_pushed - stats->frames_sent;
+	latency_get(counters, stats);
+	stats->bitrate = atomic_load_explicit(&counters->bitrate,
+					      memory_order_relaxed);
+	stats->fraction_lost = atomic_load_explicit(&counters->fraction_lost,
+						    memory_order_relaxed);
+	stats->frames_skipped = counter_get(&counters->frames_skipped);
+	stats->frames_measured = counter_get(&counters->frames_measured);
+	if (stats->frames_measured)
+		stats->psnr_cdb = counter_get(&counters->psnr_cdb_sum) /
+				  stats->frames_measured;
+}
+
+static struct weston_transmitter_output *
+transmitter_output_get(struct weston_output *base)
+{
+	struct weston_transmitter_output *output;
+
+	if (!transmitter_output_is(base))
+		return NULL;
+
+	output = wl_container_of(base, output, base);
+	if (!output->renderer)
+		return NULL;
+
+	return output;
+}
+
+static struct weston_transmitter_remote *
+transmitter_stats_output_get_remote(struct weston_output *base)
+{
+	struct weston_transmitter_output *output = transmitter_output_get(base);
+
+	return output ? output->remote : NULL;
+}
+
+static int
+transmitter_stats_output_get_stats(struct weston_output *base,
+				   struct weston_transmitter_output_stats *stats)
+{
+	struct weston_transmitter_output *output = transmitter_output_get(base);
+
+	if (!output)
+		return -1;
+
+	output_stats_get(output, stats);
+	return 0;
+}
+
+static void
+transmitter_stats_remote_get_stats(struct weston_transmitter_remote *remote,
+				   struct weston_transmitter_remote_stats *stats)
+{
+	struct weston_transmitter_output_stats *sum = &stats->outputs;
+	struct weston_transmitter_output_stats one;
+	struct weston_transmitter_output *output;
+	const struct transmitter_clock *clock = &remote->clock;
+
+	memset(stats, 0, sizeof *stats);
+	stats->status = remote->status;
+	stats->reconnects = remote->connections > 1 ? remote->connections - 1 : 0;
+
+	stats->clock_valid = clock->valid;
+	if (clock->valid) {
+		stats->rtt_us = clock->samples[(clock->count - 1) %
+					       TRANSMITTER_CLOCK_SAMPLES].delay;
+		stats->clock_offset_us =
+			transmitter_clock_offset(clock, wth_stream_now_us());
+	}
+
+	wl_list_for_each(output, &remote->output_list, link) {
+		if (!output->renderer)
+			continue;
+
+		output_stats_get(output, &one);
+		sum->frames_captured += one.frames_captured;
+		sum->frames_pushed += one.frames_pushed;
+		sum->frames_dropped += one.frames_dropped;
+		sum->frames_sent += one.frames_sent;
+		sum->queue_depth += one.queue_depth;
+		sum->bytes_sent += one.bytes_sent;
+		if (one.latency_p50_us > sum->latency_p50_us)
+			sum->latency_p50_us = one.latency_p50_us;
+		if (one.latency_p99_us > sum->latency_p99_us)
+			sum->latency_p99_us = one.latency_p99_us;
+		sum->bitrate += one.bitrate;
+		if (one.fraction_lost > sum->fraction_lost)
+			sum->fraction_lost = one.fraction_lost;
+		sum->frames_skipped += one.frames_skipped;
+		if (one.frames_measured &&
+		    (!sum->frames_measured || one.psnr_cdb < sum->psnr_cdb))
+			sum->psnr_cdb = one.psnr_cdb;
+		sum->frames_measured += one.frames_measured;
+	}
+}
+
+const struct weston_transmitter_stats_api transmitter_stats_api_impl = {
+	transmitter_stats_output_get_remote,
+	transmitter_stats_output_get_stats,
+	transmitter_stats_remote_get_stats,
+};
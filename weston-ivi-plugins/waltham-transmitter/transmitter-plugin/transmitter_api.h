@@ -28,7 +28,10 @@
 
 #include "plugin-registry.h"
 
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stdint.h>
+#include <pixman.h>
 
 /** \file
  *
@@ -38,6 +41,7 @@
 struct weston_transmitter;
 struct weston_transmitter_remote;
 struct weston_transmitter_surface;
+struct weston_transmitter_output;
 
 #define WESTON_TRANSMITTER_API_NAME "transmitter_v1"
 
@@ -260,20 +264,163 @@ weston_get_transmitter_ivi_api(struct weston_compositor *compositor)
 				     sizeof(struct weston_transmitter_ivi_api));
 }
 
+#define WESTON_TRANSMITTER_STATS_API_NAME "transmitter_stats_v1"
+
+/** Counters of a transmitter output, since it was created */
+struct weston_transmitter_output_stats {
+	uint64_t frames_captured;	/* taken from the compositor */
+	uint64_t frames_pushed;		/* handed to the encoder */
+	uint64_t frames_dropped;	/* failed to be taken or pushed */
+	uint64_t frames_sent;		/* first packet out of the payloader */
+	uint32_t queue_depth;		/* pushed, but not sent yet */
+	uint64_t bytes_sent;		/* RTP packets, headers included */
+
+	/* frames_sent, queue_depth, bytes_sent and the latencies need a
+	 * payloader named "pay", which negotiated pipelines have; they stay
+	 * 0 with pipeline files without one. */
+
+	/** Capture to first packet sent over the last frames, 0 if none */
+	uint32_t latency_p50_us;
+	uint32_t latency_p99_us;
+
+	/** Encoder bitrate in bps, and the loss in the last RTCP receiver
+	 * report in 1/256; both 0 when the stream has no RTCP. */
+	uint32_t bitrate;
+	uint32_t fraction_lost;
+
+	/** Repaints not encoded because the content did not change */
+	uint64_t frames_skipped;
+
+	/** Mean Y-PSNR of the decoded stream against what was encoded, in
+	 * 1/100 dB, and the frames it is over; 0 unless quality=true. */
+	uint32_t psnr_cdb;
+	uint64_t frames_measured;
+};
+
+/** State of a remote connection */
+struct weston_transmitter_remote_stats {
+	enum weston_transmitter_connection_status status;
+	uint32_t reconnects;		/* connections after the first one */
+
+	/** From the clock pings, only meaningful if clock_valid */
+	bool clock_valid;
+	uint32_t rtt_us;		/* round trip of the last ping */
+	int64_t clock_offset_us;	/* remote clock - local clock */
+
+	/** Sum over the outputs of the remote; the latencies and the loss
+	 * are the highest of them, the PSNR the lowest. */
+	struct weston_transmitter_output_stats outputs;
+};
+
+/** The Transmitter statistics API
+ *
+ * For controllers adapting to the network, e.g. lowering the quality on a
+ * congested remote. All calls are cheap enough to be made every frame:
+ * the counters are updated lock-free from the compositor and the encoder
+ * threads, and only read here.
+ */
+struct weston_transmitter_stats_api {
+	/** Get the remote a transmitter output streams to
+	 *
+	 * \param output Any weston_output.
+	 * \return The remote, or NULL if output is not a transmitter output.
+	 */
+	struct weston_transmitter_remote *
+	(*output_get_remote)(struct weston_output *output);
+
+	/** Fetch the counters of a transmitter output
+	 *
+	 * \param output Any weston_output.
+	 * \param stats Filled in on success.
+	 * \return 0 on success, -1 if output is not a transmitter output.
+	 */
+	int
+	(*output_get_stats)(struct weston_output *output,
+			    struct weston_transmitter_output_stats *stats);
+
+	/** Fetch the state and the output totals of a remote
+	 *
+	 * \param remote The remote connection.
+	 * \param stats Filled in.
+	 */
+	void
+	(*remote_get_stats)(struct weston_transmitter_remote *remote,
+			    struct weston_transmitter_remote_stats *stats);
+};
+
+static inline const struct weston_transmitter_stats_api *
+weston_get_transmitter_stats_api(struct weston_compositor *compositor)
+{
+	return weston_plugin_api_get(compositor,
+				     WESTON_TRANSMITTER_STATS_API_NAME,
+				     sizeof(struct weston_transmitter_stats_api));
+}
+
 /** Identifies outputs created by the Transmitter by make */
 #define WESTON_TRANSMITTER_OUTPUT_MAKE "Weston-Transmitter"
 
 /* Remote compositor/output are identified by model */
 
 
+/* frames the latency percentiles are taken over */
+#define TRANSMITTER_LATENCY_RING 64
+
+/* Behind weston_transmitter_output_stats; written by the compositor and
+ * the encoder threads, so only touched with relaxed atomics. */
+struct transmitter_counters {
+	atomic_uint_fast64_t frames_captured;
+	atomic_uint_fast64_t frames_pushed;
+	atomic_uint_fast64_t frames_dropped;
+	atomic_uint_fast64_t frames_sent;
+	atomic_uint_fast64_t bytes_sent;
+	atomic_uint latency_us[TRANSMITTER_LATENCY_RING];
+	atomic_uint latency_head;	/* single writer: the payloader */
+	atomic_uint bitrate;		/* see rate_control() in the renderer */
+	atomic_uint fraction_lost;
+	atomic_uint_fast64_t frames_skipped;
+	atomic_uint_fast64_t psnr_cdb_sum;	/* see quality_sample() */
+	atomic_uint_fast64_t frames_measured;
+};
+
+static inline void
+transmitter_counter_add(atomic_uint_fast64_t *counter, uint64_t value)
+{
+	atomic_fetch_add_explicit(counter, value, memory_order_relaxed);
+}
+
+static inline void
+transmitter_counter_latency(struct transmitter_counters *counters,
+			    uint32_t us)
+{
+	unsigned int head = atomic_load_explicit(&counters->latency_head,
+						 memory_order_relaxed);
+
+	atomic_store_explicit(&counters->latency_us[head % TRANSMITTER_LATENCY_RING],
+			      us, memory_order_relaxed);
+	atomic_store_explicit(&counters->latency_head, head + 1,
+			      memory_order_release);
+}
+
 struct renderer {
 	void (*repaint_output)(struct weston_output *base);
+	/* next frame out as a key frame, the receiver lost the stream */
+	void (*request_keyframe)(struct weston_transmitter_output *output);
 	struct GstAppContext *ctx;
 	int32_t dmafd;    /* dmafd received from compositor-drm */
 	int buf_stride;
+	uint64_t capture_start;	/* wth_stream_now_us() when the frame was taken */
+	/* RGBA copy of the surface when there is no dmafd (non-DRM backends) */
+	void *shm_data;
+	size_t shm_size;
 	int surface_width;
 	int surface_height;
+	/* what changed in the frame, surface coordinates, see
+	 * transmitter_output_frame_damage() */
+	pixman_region32_t damage;
+	/* transport=hybrid: what the receiver covers with lossless tiles */
+	pixman_region32_t covered;
 	bool recorder_enabled;
+	struct transmitter_counters counters;
 };
 
 #endif /* WESTON_TRANSMITTER_API_H */
@@ -0,0 +1,544 @@
+/*
+ * Copyright (C) 2017 Advanced Driver Information Technology GmbH, Advanced Driver Information Technology Corporation, Robert Bosch GmbH, Robert Bosch Car Multimedia GmbH, DENSO Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define CONVERT_X86
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define CONVERT_NEON
+#endif
+
+#include "waltham-convert.h"
+
+#ifndef ARRAY_LENGTH
+#define ARRAY_LENGTH(a) (sizeof (a) / sizeof (a)[0])
+#endif
+
+/* rounding and the offsets of 16 and 128, before the shifts */
+#define Y_BIAS (128 + (16 << 8))
+#define C_BIAS (512 + (128 << 10))
+
+/*
+ * Converts one pair of rows, n pixels of each, n a multiple of the
+ * kernel's block. v is NULL for NV12.
+ */
+typedef void (*convert_rows_t)(const struct wth_convert *cv,
+			       const uint8_t *s0, const uint8_t *s1,
+			       uint8_t *y0, uint8_t *y1,
+			       uint8_t *u, uint8_t *v, int n);
+
+/* the reference, and the tail of the rows for the others */
+static void
+convert_rows_c(const struct wth_convert *cv,
+	       const uint8_t *s0, const uint8_t *s1,
+	       uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v,
+	       int x, int width)
+{
+	const uint8_t *p[4];
+	int sum[3];
+	int i, k;
+
+	for (; x < width; x += 2) {
+		/* odd widths repeat the last column */
+		p[0] = s0 + x * 4;
+		p[1] = x + 1 < width ? p[0] + 4 : p[0];
+		p[2] = s1 + x * 4;
+		p[3] = x + 1 < width ? p[2] + 4 : p[2];
+
+		for (i = 0; i < 4; i++) {
+			uint8_t *y = (i < 2 ? y0 : y1) + x + (i & 1);
+
+			if (x + (i & 1) < width)
+				*y = (cv->y[0] * p[i][0] + cv->y[1] * p[i][1] +
+				      cv->y[2] * p[i][2] + Y_BIAS) >> 8;
+		}
+
+		for (k = 0; k < 3; k++)
+			sum[k] = p[0][k] + p[1][k] + p[2][k] + p[3][k];
+
+		i = x / 2;
+		if (v) {
+			u[i] = (cv->u[0] * sum[0] + cv->u[1] * sum[1] +
+				cv->u[2] * sum[2] + C_BIAS) >> 10;
+			v[i] = (cv->v[0] * sum[0] + cv->v[1] * sum[1] +
+				cv->v[2] * sum[2] + C_BIAS) >> 10;
+		} else {
+			u[2 * i] = (cv->u[0] * sum[0] + cv->u[1] * sum[1] +
+				    cv->u[2] * sum[2] + C_BIAS) >> 10;
+			u[2 * i + 1] = (cv->v[0] * sum[0] + cv->v[1] * sum[1] +
+					cv->v[2] * sum[2] + C_BIAS) >> 10;
+		}
+	}
+}
+
+static void
+convert_rows_scalar(const struct wth_convert *cv,
+		    const uint8_t *s0, const uint8_t *s1,
+		    uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v, int n)
+{
+	convert_rows_c(cv, s0, s1, y0, y1, u, v, 0, n);
+}
+
+/*
+ * The SIMD kernels keep every intermediate exact: Y fits in 16 bits
+ * unsigned, the chroma products are 32 bits wide, so they agree with
+ * convert_rows_c.
+ */
+#ifdef CONVERT_X86
+
+/* bytes 0, 1 and 2 of 8 pixels, as 16 bits */
+static inline void
+sse2_channels(const uint8_t *src, __m128i c[3])
+{
+	const __m128i mask = _mm_set1_epi32(0xff);
+	__m128i a = _mm_loadu_si128((const __m128i *)src);
+	__m128i b = _mm_loadu_si128((const __m128i *)(src + 16));
+
+	c[0] = _mm_packs_epi32(_mm_and_si128(a, mask), _mm_and_si128(b, mask));
+	c[1] = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(a, 8), mask),
+			       _mm_and_si128(_mm_srli_epi32(b, 8), mask));
+	c[2] = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(a, 16), mask),
+			       _mm_and_si128(_mm_srli_epi32(b, 16), mask));
+}
+
+static inline __m128i
+sse2_luma(const struct wth_convert *cv, const __m128i c[3])
+{
+	__m128i y;
+
+	/* wraps around in 16 bits, but the sum does not overflow */
+	y = _mm_mullo_epi16(c[0], _mm_set1_epi16(cv->y[0]));
+	y = _mm_add_epi16(y, _mm_mullo_epi16(c[1], _mm_set1_epi16(cv->y[1])));
+	y = _mm_add_epi16(y, _mm_mullo_epi16(c[2], _mm_set1_epi16(cv->y[2])));
+	y = _mm_add_epi16(y, _mm_set1_epi16(Y_BIAS));
+	return _mm_srli_epi16(y, 8);
+}
+
+/* 8 chroma samples from the 2x2 sums of 3 channels */
+static inline __m128i
+sse2_chroma(const int16_t coef[3], const __m128i s[3])
+{
+	const __m128i c01 = _mm_set1_epi32((uint16_t)coef[0] |
+					   (uint32_t)(uint16_t)coef[1] << 16);
+	const __m128i c2 = _mm_set1_epi32((uint16_t)coef[2]);
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i bias = _mm_set1_epi32(C_BIAS);
+	__m128i lo, hi;
+
+	lo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(s[0], s[1]), c01),
+			   _mm_madd_epi16(_mm_unpacklo_epi16(s[2], zero), c2));
+	hi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(s[0], s[1]), c01),
+			   _mm_madd_epi16(_mm_unpackhi_epi16(s[2], zero), c2));
+	lo = _mm_srai_epi32(_mm_add_epi32(lo, bias), 10);
+	hi = _mm_srai_epi32(_mm_add_epi32(hi, bias), 10);
+	return _mm_packs_epi32(lo, hi);
+}
+
+/* 2x2 sums of 16 pixels, two rows of 8 each side */
+static inline __m128i
+sse2_sum(__m128i a0, __m128i a1, __m128i b0, __m128i b1)
+{
+	const __m128i one = _mm_set1_epi16(1);
+
+	/* add the rows, then the pairs of columns */
+	return _mm_packs_epi32(_mm_madd_epi16(_mm_add_epi16(a0, b0), one),
+			       _mm_madd_epi16(_mm_add_epi16(a1, b1), one));
+}
+
+/* 16 pixels per step */
+static void
+convert_rows_sse2(const struct wth_convert *cv,
+		  const uint8_t *s0, const uint8_t *s1,
+		  uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v, int n)
+{
+	__m128i a0[3], a1[3], b0[3], b1[3], s[3], cu, cv_;
+	int x;
+
+	for (x = 0; x < n; x += 16) {
+		sse2_channels(s0 + x * 4, a0);
+		sse2_channels(s0 + x * 4 + 32, a1);
+		sse2_channels(s1 + x * 4, b0);
+		sse2_channels(s1 + x * 4 + 32, b1);
+
+		_mm_storeu_si128((__m128i *)(y0 + x),
+				 _mm_packus_epi16(sse2_luma(cv, a0),
+						  sse2_luma(cv, a1)));
+		_mm_storeu_si128((__m128i *)(y1 + x),
+				 _mm_packus_epi16(sse2_luma(cv, b0),
+						  sse2_luma(cv, b1)));
+
+		s[0] = sse2_sum(a0[0], a1[0], b0[0], b1[0]);
+		s[1] = sse2_sum(a0[1], a1[1], b0[1], b1[1]);
+		s[2] = sse2_sum(a0[2], a1[2], b0[2], b1[2]);
+
+		cu = sse2_chroma(cv->u, s);
+		cv_ = sse2_chroma(cv->v, s);
+		if (v) {
+			cu = _mm_packus_epi16(cu, cv_);
+			_mm_storel_epi64((__m128i *)(u + x / 2), cu);
+			_mm_storel_epi64((__m128i *)(v + x / 2),
+					 _mm_srli_si128(cu, 8));
+		} else {
+			/* both are 16..240, so they fit a byte each */
+			_mm_storeu_si128((__m128i *)(u + x),
+					 _mm_or_si128(cu, _mm_slli_epi16(cv_, 8)));
+		}
+	}
+}
+
+#define AVX2 __attribute__((target("avx2")))
+
+/* packs works within the 128 bit lanes, this puts them back in order */
+static inline AVX2 __m256i
+avx2_packs(__m256i a, __m256i b)
+{
+	return _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), 0xd8);
+}
+
+/* bytes 0, 1 and 2 of 16 pixels, as 16 bits */
+static inline AVX2 void
+avx2_channels(const uint8_t *src, __m256i c[3])
+{
+	const __m256i mask = _mm256_set1_epi32(0xff);
+	__m256i a = _mm256_loadu_si256((const __m256i *)src);
+	__m256i b = _mm256_loadu_si256((const __m256i *)(src + 32));
+
+	c[0] = avx2_packs(_mm256_and_si256(a, mask), _mm256_and_si256(b, mask));
+	c[1] = avx2_packs(_mm256_and_si256(_mm256_srli_epi32(a, 8), mask),
+			  _mm256_and_si256(_mm256_srli_epi32(b, 8), mask));
+	c[2] = avx2_packs(_mm256_and_si256(_mm256_srli_epi32(a, 16), mask),
+			  _mm256_and_si256(_mm256_srli_epi32(b, 16), mask));
+}
+
+static inline AVX2 __m256i
+avx2_luma(const struct wth_convert *cv, const __m256i c[3])
+{
+	__m256i y;
+
+	y = _mm256_mullo_epi16(c[0], _mm256_set1_epi16(cv->y[0]));
+	y = _mm256_add_epi16(y, _mm256_mullo_epi16(c[1], _mm256_set1_epi16(cv->y[1])));
+	y = _mm256_add_epi16(y, _mm256_mullo_epi16(c[2], _mm256_set1_epi16(cv->y[2])));
+	y = _mm256_add_epi16(y, _mm256_set1_epi16(Y_BIAS));
+	return _mm256_srli_epi16(y, 8);
+}
+
+static inline AVX2 __m256i
+avx2_chroma(const int16_t coef[3], const __m256i s[3])
+{
+	const __m256i c01 = _mm256_set1_epi32((uint16_t)coef[0] |
+					      (uint32_t)(uint16_t)coef[1] << 16);
+	const __m256i c2 = _mm256_set1_epi32((uint16_t)coef[2]);
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i bias = _mm256_set1_epi32(C_BIAS);
+	__m256i lo, hi;
+
+	lo = _mm256_add_epi32(_mm256_madd_epi16(_mm256_unpacklo_epi16(s[0], s[1]), c01),
+			      _mm256_madd_epi16(_mm256_unpacklo_epi16(s[2], zero), c2));
+	hi = _mm256_add_epi32(_mm256_madd_epi16(_mm256_unpackhi_epi16(s[0], s[1]), c01),
+			      _mm256_madd_epi16(_mm256_unpackhi_epi16(s[2], zero), c2));
+	lo = _mm256_srai_epi32(_mm256_add_epi32(lo, bias), 10);
+	hi = _mm256_srai_epi32(_mm256_add_epi32(hi, bias), 10);
+	/* unpack and pack again: same order as s */
+	return _mm256_packs_epi32(lo, hi);
+}
+
+static inline AVX2 __m256i
+avx2_sum(__m256i a0, __m256i a1, __m256i b0, __m256i b1)
+{
+	const __m256i one = _mm256_set1_epi16(1);
+
+	return avx2_packs(_mm256_madd_epi16(_mm256_add_epi16(a0, b0), one),
+			  _mm256_madd_epi16(_mm256_add_epi16(a1, b1), one));
+}
+
+/* 32 pixels per step */
+static AVX2 void
+convert_rows_avx2(const struct wth_convert *cv,
+		  const uint8_t *s0, const uint8_t *s1,
+		  uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v, int n)
+{
+	__m256i a0[3], a1[3], b0[3], b1[3], s[3], cu, cv_, y;
+	int x;
+
+	for (x = 0; x < n; x += 32) {
+		avx2_channels(s0 + x * 4, a0);
+		avx2_channels(s0 + x * 4 + 64, a1);
+		avx2_channels(s1 + x * 4, b0);
+		avx2_channels(s1 + x * 4 + 64, b1);
+
+		y = _mm256_packus_epi16(avx2_luma(cv, a0), avx2_luma(cv, a1));
+		_mm256_storeu_si256((__m256i *)(y0 + x),
+				    _mm256_permute4x64_epi64(y, 0xd8));
+		y = _mm256_packus_epi16(avx2_luma(cv, b0), avx2_luma(cv, b1));
+		_mm256_storeu_si256((__m256i *)(y1 + x),
+				    _mm256_permute4x64_epi64(y, 0xd8));
+
+		s[0] = avx2_sum(a0[0], a1[0], b0[0], b1[0]);
+		s[1] = avx2_sum(a0[1], a1[1], b0[1], b1[1]);
+		s[2] = avx2_sum(a0[2], a1[2], b0[2], b1[2]);
+
+		cu = avx2_chroma(cv->u, s);
+		cv_ = avx2_chroma(cv->v, s);
+		if (v) {
+			cu = _mm256_permute4x64_epi64(_mm256_packus_epi16(cu, cv_),
+						      0xd8);
+			_mm_storeu_si128((__m128i *)(u + x / 2),
+					 _mm256_castsi256_si128(cu));
+			_mm_storeu_si128((__m128i *)(v + x / 2),
+					 _mm256_extracti128_si256(cu, 1));
+		} else {
+			_mm256_storeu_si256((__m256i *)(u + x),
+					    _mm256_or_si256(cu, _mm256_slli_epi16(cv_, 8)));
+		}
+	}
+}
+
+#endif /* CONVERT_X86 */
+
+#ifdef CONVERT_NEON
+
+static inline uint8x8_t
+neon_luma(const struct wth_convert *cv, uint8x8_t c0, uint8x8_t c1,
+	  uint8x8_t c2)
+{
+	uint16x8_t y;
+
+	y = vmull_u8(c0, vdup_n_u8(cv->y[0]));
+	y = vmlal_u8(y, c1, vdup_n_u8(cv->y[1]));
+	y = vmlal_u8(y, c2, vdup_n_u8(cv->y[2]));
+	y = vaddq_u16(y, vdupq_n_u16(Y_BIAS));
+	return vshrn_n_u16(y, 8);
+}
+
+static inline uint8x8_t
+neon_chroma(const int16_t coef[3], const int16x8_t s[3])
+{
+	const int32x4_t bias = vdupq_n_s32(C_BIAS);
+	int32x4_t lo, hi;
+
+	lo = vmlal_n_s16(bias, vget_low_s16(s[0]), coef[0]);
+	lo = vmlal_n_s16(lo, vget_low_s16(s[1]), coef[1]);
+	lo = vmlal_n_s16(lo, vget_low_s16(s[2]), coef[2]);
+	hi = vmlal_n_s16(bias, vget_high_s16(s[0]), coef[0]);
+	hi = vmlal_n_s16(hi, vget_high_s16(s[1]), coef[1]);
+	hi = vmlal_n_s16(hi, vget_high_s16(s[2]), coef[2]);
+	return vqmovun_s16(vcombine_s16(vshrn_n_s32(lo, 10),
+					vshrn_n_s32(hi, 10)));
+}
+
+/* 16 pixels per step */
+static void
+convert_rows_neon(const struct wth_convert *cv,
+		  const uint8_t *s0, const uint8_t *s1,
+		  uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v, int n)
+{
+	uint8x16x4_t a, b;
+	uint8x8x2_t uv;
+	int16x8_t s[3];
+	int x, k;
+
+	for (x = 0; x < n; x += 16) {
+		a = vld4q_u8(s0 + x * 4);
+		b = vld4q_u8(s1 + x * 4);
+
+		vst1q_u8(y0 + x, vcombine_u8(
+			neon_luma(cv, vget_low_u8(a.val[0]), vget_low_u8(a.val[1]),
+				  vget_low_u8(a.val[2])),
+			neon_luma(cv, vget_high_u8(a.val[0]), vget_high_u8(a.val[1]),
+				  vget_high_u8(a.val[2]))));
+		vst1q_u8(y1 + x, vcombine_u8(
+			neon_luma(cv, vget_low_u8(b.val[0]), vget_low_u8(b.val[1]),
+				  vget_low_u8(b.val[2])),
+			neon_luma(cv, vget_high_u8(b.val[0]), vget_high_u8(b.val[1]),
+				  vget_high_u8(b.val[2]))));
+
+		for (k = 0; k < 3; k++)
+			s[k] = vreinterpretq_s16_u16(
+				vpadalq_u8(vpaddlq_u8(a.val[k]), b.val[k]));
+
+		uv.val[0] = neon_chroma(cv->u, s);
+		uv.val[1] = neon_chroma(cv->v, s);
+		if (v) {
+			vst1_u8(u + x / 2, uv.val[0]);
+			vst1_u8(v + x / 2, uv.val[1]);
+		} else {
+			vst2_u8(u + x, uv);
+		}
+	}
+}
+
+#endif /* CONVERT_NEON */
+
+struct kernel {
+	const char *name;
+	convert_rows_t rows;
+	int block;		/* pixels per step */
+};
+
+static const struct kernel kernel_scalar = { "scalar", convert_rows_scalar, 2 };
+static const struct kernel *kernel = &kernel_scalar;
+
+void
+wth_convert_init(struct wth_convert *cv, bool rgba, bool bt709, bool nv12)
+{
+	/* R, G, B; the Y rows sum to 220 and the chroma ones to 0 so no
+	 * intermediate result overflows, see the kernels */
+	static const int16_t bt601[3][3] = {
+		{ 66, 129, 25 }, { -38, -74, 112 }, { 112, -94, -18 },
+	};
+	static const int16_t bt709_[3][3] = {
+		{ 47, 157, 16 }, { -26, -86, 112 }, { 112, -102, -10 },
+	};
+	const int16_t (*m)[3] = bt709 ? bt709_ : bt601;
+	int r = rgba ? 0 : 2, b = rgba ? 2 : 0;
+
+	cv->y[r] = m[0][0];
+	cv->y[1] = m[0][1];
+	cv->y[b] = m[0][2];
+	cv->u[r] = m[1][0];
+	cv->u[1] = m[1][1];
+	cv->u[b] = m[1][2];
+	cv->v[r] = m[2][0];
+	cv->v[1] = m[2][1];
+	cv->v[b] = m[2][2];
+	cv->nv12 = nv12;
+}
+
+void
+wth_convert_frame(const struct wth_convert *cv,
+		  const uint8_t *src, int stride, int width, int height,
+		  const struct wth_convert_planes *dst)
+{
+	int n = width / kernel->block * kernel->block;
+	const uint8_t *s0, *s1;
+	uint8_t *y0, *y1, *u, *v;
+	int row;
+
+	for (row = 0; row < height; row += 2) {
+		/* odd heights repeat the last row */
+		s0 = src + (size_t)row * stride;
+		s1 = row + 1 < height ? s0 + stride : s0;
+		y0 = dst->y + (size_t)row * dst->y_stride;
+		y1 = row + 1 < height ? y0 + dst->y_stride : y0;
+		u = dst->u + (size_t)(row / 2) * dst->u_stride;
+		v = cv->nv12 ? NULL : dst->v + (size_t)(row / 2) * dst->v_stride;
+
+		kernel->rows(cv, s0, s1, y0, y1, u, v, n);
+		convert_rows_c(cv, s0, s1, y0, y1, u, v, n, width);
+	}
+}
+
+/*
+ * Converts an odd sized pattern with a kernel and with the reference, in
+ * every mode, and compares. Catches a kernel miscompiled for, or not
+ * quite supported by, the CPU it ends up on.
+ */
+static bool
+kernel_check(const struct kernel *k)
+{
+	enum { W = 99, H = 7, CH = (H + 1) / 2 };
+	const struct kernel *saved = kernel;
+	struct wth_convert cv;
+	struct wth_convert_planes planes[2];
+	uint8_t *src, *out[2];
+	uint32_t seed = 1;
+	bool ok = true;
+	int i, mode;
+
+	src = malloc(W * 4 * H);
+	out[0] = calloc(2, W * H * 2);
+	out[1] = out[0] + W * H * 2;
+	if (!src || !out[0]) {
+		free(src);
+		free(out[0]);
+		return false;
+	}
+
+	/* extremes first, then noise */
+	for (i = 0; i < W * 4 * H; i++) {
+		seed = seed * 1103515245 + 12345;
+		src[i] = i < 64 ? (i & 4 ? 255 : 0) : seed >> 16;
+	}
+
+	for (mode = 0; mode < 8 && ok; mode++) {
+		wth_convert_init(&cv, mode & 1, mode & 2, mode & 4);
+		for (i = 0; i < 2; i++) {
+			planes[i].y = out[i];
+			planes[i].y_stride = W;
+			planes[i].u = out[i] + W * H;
+			planes[i].u_stride = W + 1;
+			planes[i].v = planes[i].u + CH * planes[i].u_stride;
+			planes[i].v_stride = W / 2 + 1;
+
+			kernel = i ? k : &kernel_scalar;
+			memset(out[i], 0, W * H * 2);
+			wth_convert_frame(&cv, src, W * 4, W, H, &planes[i]);
+		}
+		ok = memcmp(out[0], out[1], W * H * 2) == 0;
+	}
+
+	kernel = saved;
+	free(src);
+	free(out[0]);
+	return ok;
+}
+
+const char *
+wth_convert_probe(void)
+{
+	static const struct kernel kernels[] = {
+#ifdef CONVERT_X86
+		{ "avx2", convert_rows_avx2, 32 },
+		{ "sse2", convert_rows_sse2, 16 },
+#endif
+#ifdef CONVERT_NEON
+		{ "neon", convert_rows_neon, 16 },
+#endif
+	};
+	static bool probed;
+	unsigned int i;
+
+	if (probed)
+		return kernel->name;
+	probed = true;
+
+	for (i = 0; i < ARRAY_LENGTH(kernels); i++) {
+#ifdef CONVERT_X86
+		if (kernels[i].rows == convert_rows_avx2 &&
+		    !__builtin_cpu_supports("avx2"))
+			continue;
+#endif
+		if (kernel_check(&kernels[i])) {
+			kernel = &kernels[i];
+			break;
+		}
+	}
+
+	return kernel->name;
+}
@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2017 Advanced Driver Information Technology GmbH, Advanced Driver Information Technology Corporation, Robert Bosch GmbH, Robert Bosch Car Multimedia GmbH, DENSO Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef TRANSMITTER_WALTHAM_CONVERT_H_
+#define TRANSMITTER_WALTHAM_CONVERT_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * BGRx or RGBA to I420 or NV12, in place of a videoconvert in front of
+ * software encoders. Limited range, chroma is the average of each 2x2
+ * block. The results are the same, bit for bit, whichever kernel runs.
+ */
+struct wth_convert {
+	int16_t y[3];		/* per source byte, in 1/256 */
+	int16_t u[3];		/* same, in 1/1024 of a 2x2 sum */
+	int16_t v[3];
+	bool nv12;		/* interleaved chroma in u, v unused */
+};
+
+struct wth_convert_planes {
+	uint8_t *y;
+	uint8_t *u;		/* NV12: UV */
+	uint8_t *v;
+	int y_stride;
+	int u_stride;
+	int v_stride;
+};
+
+/** Pick the fastest kernel this CPU runs correctly, once.
+ *
+ * \return Name of the kernel, for the log.
+ */
+const char *
+wth_convert_probe(void);
+
+/** Set up a conversion.
+ *
+ * \param rgba Source is RGBA rather than BGRx.
+ * \param bt709 BT.709 rather than BT.601 matrix.
+ * \param nv12 Output NV12 rather than I420.
+ */
+void
+wth_convert_init(struct wth_convert *cv, bool rgba, bool bt709, bool nv12);
+
+void
+wth_convert_frame(const struct wth_convert *cv,
+		  const uint8_t *src, int stride, int width, int height,
+		  const struct wth_convert_planes *dst);
+
+#endif /* TRANSMITTER_WALTHAM_CONVERT_H_ */
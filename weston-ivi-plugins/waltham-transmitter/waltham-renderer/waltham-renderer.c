@@ -24,22 +24,75 @@
  */
 
 #include <stdlib.h>
+#include <errno.h>
 #include <assert.h>
 #include <string.h>
+#include <math.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 
 #include <gst/gst.h>
+#include <gst/video/video.h>
 #include <gst/video/gstvideometa.h>
 #include <gst/allocators/gstdmabuf.h>
 #include <gst/app/gstappsrc.h>
+#include <gst/app/gstappsink.h>
+#include <gst/rtp/gstrtpbuffer.h>
 
 #include "compositor.h"
 
 #include "transmitter_api.h"
 #include "waltham-renderer.h"
+#include "waltham-stream.h"
+#include "waltham-convert.h"
+#include "waltham-scale.h"
 #include "plugin.h"
 
+#ifndef ARRAY_LENGTH
+#define ARRAY_LENGTH(a) (sizeof (a) / sizeof (a)[0])
+#endif
+
 struct waltham_renderer {
 	struct renderer base;
+	/* the stream the pipeline was built for, see
+	 * waltham_renderer_repaint_output() */
+	struct wth_stream_config stream;
+};
+
+/* frames between appsrc and the payloader */
+#define TRACE_RING 32
+
+/* frames kept to compare the decoded ones with, see quality_sample() */
+#define QUALITY_RING 16
+
+struct trace_entry {
+	GstClockTime pts;
+	uint64_t pushed;	/* into appsrc */
+	bool encoded;		/* encode_dur is final */
+	struct wth_stream_trace trace;
+};
+
+/* one per receiver of the stream, see rate_control() */
+struct rate_session {
+	GObject *session;		/* RTP session, NULL without rtpbin */
+	struct transmitter_counters *counters;	/* of the receiver's output */
+	int bitrate;			/* what its reports allow */
+	uint32_t rb_seq;		/* last receiver report acted on */
+	uint32_t rb_lsr;
+	uint32_t jitter_us;
+};
+
+/* a remote with mirror-of, the payloaded stream teed off to it */
+struct mirror_branch {
+	struct wl_list link;		/* GstAppContext::mirrors */
+	struct weston_transmitter_remote *remote;
+	GstElement *sink;
+	GstElement *rtcpsink;
+	gint active;			/* atomic, see mirror_probe() */
+	struct rate_session rate;
 };
 
 struct GstAppContext
@@ -49,6 +102,69 @@ struct GstAppContext
 	GstElement *pipeline;
 	GstElement *appsrc;
 	GstBuffer *gstbuffer;
+
+	/* per-frame trace, see waltham-stream.h */
+	GMutex trace_lock;
+	struct trace_entry trace_ring[TRACE_RING];
+	unsigned int trace_head;
+	uint32_t frame;
+	uint64_t base;		/* capture time of the first frame */
+
+	struct transmitter_counters *counters;	/* of the output */
+
+	/* bitrate control, see rate_control() */
+	GstElement *encoder;
+	const struct encoder *enc;	/* NULL if not one we know */
+	struct rate_session rate;	/* of the output's own remote */
+	int bitrate;
+	int min_bitrate;
+	int max_bitrate;
+	uint64_t rate_checked;		/* last look at the sessions, us */
+
+	guint keyframes;		/* requested by the receivers */
+	uint64_t keyframe_at;		/* last request passed on, us */
+
+	/* other remotes the stream goes to, see mirror_add() */
+	struct wl_list mirrors;		/* mirror_branch::link */
+	guint sessions;			/* RTP sessions in rtpbin */
+
+	/* multicast: the packets since the last key frame, see gop_keep() */
+	bool gop;
+	GMutex gop_lock;
+	GPtrArray *gop_packets;
+	size_t gop_bytes;
+	GstClockTime gop_pts;		/* of the key frame they start with */
+	GstClockTime key_pts;		/* of the last one out of the encoder */
+	bool gop_full;			/* over GOP_CACHE_MAX, not kept */
+	int gop_fd;			/* replays are sent from, -1: none yet */
+
+	/* our own conversion, NULL pool if the pipeline converts */
+	GstBufferPool *pool;
+	GstVideoInfo info;		/* of the converted frames */
+	struct wth_convert convert;
+	bool scaling;			/* first into scaled, see scale_geometry */
+	struct wth_scale scale;
+	uint8_t *scaled;
+	int width;			/* of the surface it is set up for */
+	int height;
+	int dropped_width;		/* a size that does not fit, logged */
+	int dropped_height;
+	int crop_x;
+	int crop_y;
+	int crop_width;
+	int crop_height;
+
+	/* damage as regions of interest, see add_roi() */
+	bool roi;
+
+	/* the stream decoded again, see quality_sample() */
+	bool quality;
+	GMutex quality_lock;
+	GstBuffer *quality_ring[QUALITY_RING];
+	unsigned int quality_head;
+	uint64_t quality_logged;	/* last log line, us */
+	uint64_t logged_sum;		/* counters at that time */
+	uint64_t logged_frames;
 };
 
 gboolean bus_message(GstBus *bus, GstMessage *message, gpointer p)
@@ -87,33 +203,317 @@ gboolean bus_message(GstBus *bus, GstMessage *message, gpointer p)
 	}
 }
 
+/* how the bitrate of an encoder is changed while it is playing */
+enum encoder_rate {
+	ENCODER_RATE_BITRATE,	/* "bitrate" property, in bps / bitrate_div */
+	ENCODER_RATE_V4L2,	/* video_bitrate in "extra-controls" */
+	ENCODER_RATE_QUALITY,	/* no bitrate, "quality" 0-100 instead */
+};
+
+/*
+ * Encoders the renderer knows how to drive, cheapest first. The cost only
+ * matters between encoders of different codecs: hardware H.264 beats
+ * software JPEG, which beats software H.264.
+ */
+struct encoder {
+	const char *element;
+	enum wth_stream_codec codec;
+	int cost;
+	const char *format;	/* raw format the encoder is fed with */
+	const char *params;	/* printf format taking the bitrate */
+	int bitrate_div;	/* the "bitrate" property is in bps / div */
+	enum encoder_rate rate;
+	const char *payloader;
+	const char *converter;	/* hardware converter feeding it, if any */
+	bool roi;		/* spends more bits on GstVideoRegionOfInterestMeta */
+};
+
+static const struct encoder encoders[] = {
+	{ "omxh264enc", WTH_STREAM_CODEC_H264, 1, "I420",
+	  "bitrate=%d control-rate=2", 1, ENCODER_RATE_BITRATE,
+	  "rtph264pay", "vspmfilter" },
+	{ "mfxh264enc", WTH_STREAM_CODEC_H264, 1, "I420",
+	  "bitrate=%d rate-control=1", 1000, ENCODER_RATE_BITRATE,
+	  "rtph264pay config-interval=1", "mfxvpp" },
+	{ "vaapih264enc", WTH_STREAM_CODEC_H264, 1, "NV12",
+	  "bitrate=%d", 1000, ENCODER_RATE_BITRATE,
+	  "rtph264pay config-interval=1", "vaapipostproc", true },
+	{ "v4l2h264enc", WTH_STREAM_CODEC_H264, 1, "NV12",
+	  "extra-controls=\"controls,video_bitrate=%d\"", 1, ENCODER_RATE_V4L2,
+	  "rtph264pay config-interval=1", "v4l2convert" },
+	{ "jpegenc", WTH_STREAM_CODEC_JPEG, 2, "I420",
+	  NULL, 1, ENCODER_RATE_QUALITY, "rtpjpegpay", NULL },
+	{ "x264enc", WTH_STREAM_CODEC_H264, 3, "I420",
+	  "bitrate=%d tune=zerolatency speed-preset=ultrafast", 1000,
+	  ENCODER_RATE_BITRATE, "rtph264pay config-interval=1", NULL },
+};
+
+/*
+ * What the GStreamer registry has, looked up once: scanning it takes a
+ * while and its answer does not change while weston runs.
+ */
+static bool probed;
+static bool encoder_present[ARRAY_LENGTH(encoders)];
+static bool converter_present[ARRAY_LENGTH(encoders)];
+
+static bool
+element_available(const char *element)
+{
+	GstElementFactory *factory;
+
+	factory = gst_element_factory_find(element);
+	if (!factory)
+		return false;
+
+	gst_object_unref(factory);
+	return true;
+}
+
+static void
+waltham_renderer_probe(void)
+{
+	unsigned int i;
+
+	if (probed)
+		return;
+
+	gst_init(NULL, NULL);
+	for (i = 0; i < ARRAY_LENGTH(encoders); i++) {
+		encoder_present[i] = element_available(encoders[i].element);
+		converter_present[i] = encoders[i].converter &&
+			element_available(encoders[i].converter);
+
+		if (encoder_present[i])
+			weston_log("Encoder %s available, converter %s\n",
+				   encoders[i].element, converter_present[i] ?
+				   encoders[i].converter : "built-in");
+	}
+	weston_log("Built-in converter uses %s kernels\n", wth_convert_probe());
+	probed = true;
+}
+
+/*
+ * Cheapest available encoder producing one of the given codecs, or the
+ * one named in weston.ini if it is available and the receiver decodes it.
+ */
+static const struct encoder *
+encoder_find(uint32_t codecs, const char *name)
+{
+	const struct encoder *best = NULL;
+	unsigned int i;
+
+	waltham_renderer_probe();
+
+	for (i = 0; name && i < ARRAY_LENGTH(encoders); i++) {
+		if (strcmp(encoders[i].element, name) != 0)
+			continue;
+		if (encoder_present[i] && (encoders[i].codec & codecs))
+			return &encoders[i];
+		break;
+	}
+	if (name)
+		weston_log("Encoder %s unknown, missing or not decoded by the "
+			   "receiver, choosing one\n", name);
+
+	for (i = 0; i < ARRAY_LENGTH(encoders); i++) {
+		if (!(encoders[i].codec & codecs))
+			continue;
+		if (best && best->cost <= encoders[i].cost)
+			continue;
+		if (!encoder_present[i])
+			continue;
+		best = &encoders[i];
+	}
+
+	return best;
+}
+
+/*
+ * Converter from the captured format to the encoder's, and the caps it
+ * must produce. A hardware converter keeps the frames in its own memory
+ * for the encoder, so the caps do not ask for system memory; it is only
+ * used on dmabufs, the copies of non-DRM backends are RGBA, which they
+ * may not take. NULL is the renderer's own, see convert_frame(), which
+ * takes the place of videoconvert unless that is asked for.
+ */
+static const char *
+converter_find(const struct encoder *enc, struct gst_settings *settings,
+	       const char **features)
+{
+	unsigned int i = enc - encoders;
+	bool dmabuf = strcmp(settings->format, "BGRx") == 0;
+
+	*features = "";
+	if (settings->converter) {
+		if (strcmp(settings->converter, "builtin") == 0)
+			return NULL;
+		if (strcmp(settings->converter, "videoconvert") == 0)
+			return settings->converter;
+		if (dmabuf && element_available(settings->converter)) {
+			*features = "(ANY)";
+			return settings->converter;
+		}
+		weston_log("Converter %s missing or not usable, choosing one\n",
+			   settings->converter);
+	}
+
+	if (!dmabuf || !converter_present[i])
+		return NULL;
+
+	*features = "(ANY)";
+	return enc->converter;
+}
+
 static int
-gst_pipe_init(struct weston_transmitter_output *output, struct gst_settings *settings)
+waltham_renderer_stream_negotiate(struct weston_transmitter_remote *remote,
+				  struct wth_stream_config *config)
 {
-	struct GstAppContext *gstctx;
-	gstctx=zalloc(sizeof (*gstctx));
-	if(!gstctx){
-		weston_log("Enable to allocate memory\n");
+	const struct encoder *enc;
+
+	gst_init(NULL, NULL);
+
+	enc = encoder_find(remote->caps.codecs, remote->encoder);
+	if (!enc) {
+		weston_log("No encoder for codecs 0x%x of %s:%s\n",
+			   remote->caps.codecs, remote->addr, remote->port);
 		return -1;
 	}
-	GstCaps *caps;
-	int ret = 0;
-	GError *gerror = NULL;
+
+	memset(config, 0, sizeof *config);
+	config->codec = enc->codec;
+	config->payload = enc->codec == WTH_STREAM_CODEC_JPEG ?
+		WTH_STREAM_PAYLOAD_JPEG : WTH_STREAM_PAYLOAD_H264;
+	config->port = remote->caps.port ? remote->caps.port :
+		(uint32_t)atoi(remote->port);
+	config->width = remote->caps.width ? remote->caps.width : remote->width;
+	config->height = remote->caps.height ? remote->caps.height : remote->height;
+	config->rtcp_port = remote->rtcp_port ? remote->rtcp_port :
+		config->port + 2;
+
+	weston_log("Stream to %s:%s negotiated: %s with %s, port %u, %dx%d, "
+		   "RTCP reports on %u\n",
+		   remote->addr, remote->port,
+		   wth_stream_codec_name(config->codec), enc->element,
+		   config->port, config->width, config->height,
+		   config->rtcp_port);
+
+	return 0;
+}
+
+/*
+ * Pipeline for the negotiated stream, replaces transmitter_pipeline.cfg.
+ * The RTP session sends sender reports to the receiver and takes its
+ * receiver reports back, for rate_control(). With quality=true the encoded
+ * stream is also decoded into an appsink named "quality". With mirrors the
+ * payloaded stream goes through a tee named "fanout", for mirror_add().
+ * Multicast streams send their sender reports to the group as well, no
+ * receiver reports come back.
+ */
+static char *
+build_pipeline(const struct wth_stream_config *config,
+	       struct gst_settings *settings)
+{
+	const struct encoder *enc;
+	const char *converter, *features;
+	const char *tee = "", *decode = "";
+	const char *fanout = settings->fanout ? "tee name=fanout ! queue ! " : "";
+	char *convert;
+	char *params = NULL;
+	char *pipe = NULL;
+
+	enc = encoder_find(config->codec, settings->encoder);
+	if (!enc)
+		return NULL;
+
+	converter = converter_find(enc, settings, &features);
+	if (converter) {
+		bool scaled = settings->out_width != settings->width ||
+			settings->out_height != settings->height;
+		char *crop = NULL, *size = NULL;
+
+		if (settings->crop_width != settings->width ||
+		    settings->crop_height != settings->height)
+			crop = g_strdup_printf("videocrop left=%d right=%d "
+					       "top=%d bottom=%d ! ",
+					       settings->crop_x,
+					       settings->width - settings->crop_width -
+					       settings->crop_x,
+					       settings->crop_y,
+					       settings->height - settings->crop_height -
+					       settings->crop_y);
+		if (scaled)
+			size = g_strdup_printf(",width=%d,height=%d",
+					       settings->out_width,
+					       settings->out_height);
+
+		/* the hardware converters scale too */
+		convert = g_strdup_printf("%s%s ! %svideo/x-raw%s,format=%s%s ! ",
+					  crop ? crop : "", converter,
+					  scaled && strcmp(converter, "videoconvert") == 0 ?
+					  "videoscale ! " : "",
+					  features, enc->format, size ? size : "");
+		g_free(crop);
+		g_free(size);
+	} else {
+		convert = g_strdup("");
+		settings->convert = enc->format;
+	}
+
+	if (enc->params)
+		params = g_strdup_printf(enc->params,
+					 settings->bitrate / enc->bitrate_div);
+
+	/* compared with the frames pushed, which only the renderer's own
+	 * conversion keeps at hand in the encoder's format and size */
+	if (settings->quality && settings->convert) {
+		tee = "tee name=encoded ! queue ! ";
+		decode = " encoded. ! queue ! decodebin ! "
+			 "queue leaky=downstream max-size-buffers=4 ! "
+			 "videoconvert ! video/x-raw,format=I420 ! "
+			 "appsink name=quality sync=false";
+	} else if (settings->quality) {
+		weston_log("quality=true needs the built-in converter, "
+			   "not measuring\n");
+	}
+
+	pipe = g_strdup_printf("rtpbin name=rtpbin "
+			       "appsrc name=src ! %s"
+			       "%s name=encoder %s ! %s%s name=pay pt=%u ! "
+			       "%srtpbin.send_rtp_sink_0 "
+			       "rtpbin.send_rtp_src_0 ! "
+			       "udpsink name=sink host=%s port=%d "
+			       "sync=false async=false "
+			       "rtpbin.send_rtcp_src_0 ! "
+			       "udpsink name=rtcpsink host=%s port=%d "
+			       "sync=false async=false "
+			       "udpsrc name=rtcpsrc port=%u ! "
+			       "rtpbin.recv_rtcp_sink_0%s",
+			       convert, enc->element, params ? params : "",
+			       tee, enc->payloader, config->payload, fanout,
+			       settings->ip, settings->port,
+			       settings->ip, WTH_STREAM_RTCP_PORT(settings->port),
+			       config->rtcp_port, decode);
+
+	g_free(convert);
+	g_free(params);
+	return pipe;
+}
+
+/* pipeline from /etc/xdg/weston/transmitter_pipeline.cfg */
+static char *
+read_pipeline_file(void)
+{
 	FILE * pFile;
 	long lSize;
 	char * pipe = NULL;
 	size_t res;
 
-	/* create gstreamer pipeline */
-	gst_init(NULL, NULL);
-	gstctx->loop = g_main_loop_new(NULL, FALSE);
-
 	/* read pipeline from file */
 	pFile = fopen ( "/etc/xdg/weston/transmitter_pipeline.cfg" , "rb" );
 	if (pFile==NULL)
 	{
 		weston_log("File open error\n");
-		return -1;
+		return NULL;
 	}
 
 	/* obtain file size */
@@ -122,11 +522,12 @@ gst_pipe_init(struct weston_transmitter_output *output, struct gst_settings *set
 	rewind (pFile);
 
 	/* allocate memory to contain the whole file: */
-	pipe = (char*) zalloc (sizeof(char)*lSize);
+	pipe = (char*) zalloc (sizeof(char)*(lSize + 1));
 	if (pipe == NULL)
 	{
 		weston_log("Cannot allocate memory\n");
-		return -1;
+		fclose (pFile);
+		return NULL;
 	}
 
 	/* copy the file into the buffer: */
@@ -134,32 +535,1033 @@ gst_pipe_init(struct weston_transmitter_output *output, struct gst_settings *set
 	if (res != lSize)
 	{
 		weston_log("File read error\n");
-		return -1;
+		fclose (pFile);
+		free(pipe);
+		return NULL;
 	}
 
 	/* close file */
 	fclose (pFile);
+
+	return pipe;
+}
+
+/*
+ * Stamps the buffer with its capture time and remembers the frame until
+ * the payloader sends it.
+ */
+static void
+trace_frame(struct GstAppContext *ctx, struct renderer *renderer,
+	    GstBuffer *buffer)
+{
+	uint64_t now = wth_stream_now_us();
+	struct trace_entry *entry;
+
+	if (!ctx->base)
+		ctx->base = renderer->capture_start;
+
+	GST_BUFFER_PTS(buffer) =
+		(renderer->capture_start - ctx->base) * GST_USECOND;
+
+	g_mutex_lock(&ctx->trace_lock);
+	entry = &ctx->trace_ring[ctx->trace_head++ % TRACE_RING];
+	entry->pts = GST_BUFFER_PTS(buffer);
+	entry->pushed = now;
+	entry->encoded = false;
+	entry->trace.frame = ++ctx->frame;
+	entry->trace.capture = renderer->capture_start;
+	entry->trace.capture_dur = now - renderer->capture_start;
+	entry->trace.encode_dur = 0;
+	g_mutex_unlock(&ctx->trace_lock);
+}
+
+static gboolean
+trace_rtp_buffer(GstBuffer **buffer, guint idx, gpointer user_data)
+{
+	struct GstAppContext *ctx = user_data;
+	GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+	GstClockTime pts = GST_BUFFER_PTS(*buffer);
+	uint8_t data[WTH_STREAM_TRACE_SIZE];
+	struct trace_entry *entry;
+	struct wth_stream_trace trace;
+	unsigned int i;
+	bool found = false, first = false;
+
+	g_mutex_lock(&ctx->trace_lock);
+	for (i = 1; i <= TRACE_RING && GST_CLOCK_TIME_IS_VALID(pts); i++) {
+		entry = &ctx->trace_ring[(ctx->trace_head - i) % TRACE_RING];
+		if (entry->trace.frame && entry->pts == pts) {
+			/* timed by the first packet of the frame */
+			if (!entry->encoded) {
+				entry->trace.encode_dur =
+					wth_stream_now_us() - entry->pushed;
+				entry->encoded = true;
+				first = true;
+			}
+			trace = entry->trace;
+			found = true;
+			break;
+		}
+	}
+	g_mutex_unlock(&ctx->trace_lock);
+
+	if (first) {
+		transmitter_counter_add(&ctx->counters->frames_sent, 1);
+		transmitter_counter_latency(ctx->counters,
+					    trace.capture_dur + trace.encode_dur);
+	}
+
+	if (found) {
+		*buffer = gst_buffer_make_writable(*buffer);
+		if (gst_rtp_buffer_map(*buffer, GST_MAP_READWRITE, &rtp)) {
+			wth_stream_trace_pack(&trace, data);
+			gst_rtp_buffer_add_extension_onebyte_header(&rtp,
+						WTH_STREAM_TRACE_EXT_ID,
+						data, sizeof data);
+			gst_rtp_buffer_unmap(&rtp);
+		}
+	}
+
+	transmitter_counter_add(&ctx->counters->bytes_sent,
+				gst_buffer_get_size(*buffer));
+	return TRUE;
+}
+
+/* adds the trace to every packet leaving the payloader, and counts them */
+static GstPadProbeReturn
+trace_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+	GstBufferList *list;
+	GstBuffer *buffer;
+
+	if (info->type & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+		list = gst_buffer_list_make_writable(
+			GST_PAD_PROBE_INFO_BUFFER_LIST(info));
+		gst_buffer_list_foreach(list, trace_rtp_buffer, user_data);
+		GST_PAD_PROBE_INFO_DATA(info) = list;
+	} else {
+		buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+		trace_rtp_buffer(&buffer, 0, user_data);
+		GST_PAD_PROBE_INFO_DATA(info) = buffer;
+	}
+
+	return GST_PAD_PROBE_OK;
+}
+
+/*
+ * What changed in the frame, the damage the compositor gave us, as regions
+ * of interest in the coordinates of the buffer pushed. Encoders that take
+ * the meta lower the QP there, so the bits go to the part of the UI that
+ * moved rather than to what the receiver already shows. A frame changed
+ * all over gets none, and more than ROI_MAX_RECTS rectangles are merged
+ * into their extents.
+ *
+ * With transport=hybrid the tiles the receiver covers with its lossless
+ * layer get a higher QP instead, nobody sees them.
+ */
+#define ROI_MAX_RECTS 8
+#define ROI_DELTA_QP -10
+#define ROI_COVERED_DELTA_QP 15
+
+static void
+add_roi_region(struct GstAppContext *ctx, struct renderer *renderer,
+	       GstBuffer *buffer, pixman_region32_t *region,
+	       const char *type, int delta_qp)
+{
+	GstVideoRegionOfInterestMeta *meta;
+	pixman_box32_t *boxes;
+	int width = renderer->surface_width, height = renderer->surface_height;
+	int ox = 0, oy = 0, n, i, x1, y1, x2, y2;
+	double sx = 1.0, sy = 1.0;
+
+	/* our own conversion crops and scales before the encoder */
+	if (ctx->pool) {
+		ox = ctx->crop_x;
+		oy = ctx->crop_y;
+		width = GST_VIDEO_INFO_WIDTH(&ctx->info);
+		height = GST_VIDEO_INFO_HEIGHT(&ctx->info);
+		sx = (double)width / ctx->crop_width;
+		sy = (double)height / ctx->crop_height;
+	}
+
+	boxes = pixman_region32_rectangles(region, &n);
+	if (n > ROI_MAX_RECTS) {
+		boxes = pixman_region32_extents(region);
+		n = 1;
+	}
+
+	for (i = 0; i < n; i++) {
+		x1 = MAX(0, (int)floor((boxes[i].x1 - ox) * sx));
+		y1 = MAX(0, (int)floor((boxes[i].y1 - oy) * sy));
+		x2 = MIN(width, (int)ceil((boxes[i].x2 - ox) * sx));
+		y2 = MIN(height, (int)ceil((boxes[i].y2 - oy) * sy));
+		if (x2 <= x1 || y2 <= y1)
+			continue;
+		if (x2 - x1 == width && y2 - y1 == height)
+			return;
+
+		meta = gst_buffer_add_video_region_of_interest_meta(buffer,
+				type, x1, y1, x2 - x1, y2 - y1);
+		gst_video_region_of_interest_meta_add_param(meta,
+			gst_structure_new("roi/vaapi", "delta-qp", G_TYPE_INT,
+					  delta_qp, NULL));
+	}
+}
+
+static void
+add_roi(struct GstAppContext *ctx, struct renderer *renderer,
+	GstBuffer *buffer)
+{
+	if (!ctx->roi)
+		return;
+
+	add_roi_region(ctx, renderer, buffer, &renderer->damage,
+		       "damage", ROI_DELTA_QP);
+	add_roi_region(ctx, renderer, buffer, &renderer->covered,
+		       "covered", ROI_COVERED_DELTA_QP);
+}
+
+/* how often the measured quality is logged */
+#define QUALITY_LOG_MS 5000
+/* a frame identical to the one pushed */
+#define QUALITY_PSNR_MAX 100.0
+
+/* keeps a pushed frame to compare with once it comes back decoded */
+static void
+quality_keep(struct GstAppContext *ctx, GstBuffer *buffer)
+{
+	GstBuffer *old;
+
+	g_mutex_lock(&ctx->quality_lock);
+	old = ctx->quality_ring[ctx->quality_head % QUALITY_RING];
+	ctx->quality_ring[ctx->quality_head++ % QUALITY_RING] =
+		gst_buffer_ref(buffer);
+	g_mutex_unlock(&ctx->quality_lock);
+
+	if (old)
+		gst_buffer_unref(old);
+}
+
+/* luma only, which I420 and NV12 lay out the same */
+static double
+frame_psnr(GstVideoFrame *a, GstVideoFrame *b)
+{
+	int width = MIN(GST_VIDEO_FRAME_WIDTH(a), GST_VIDEO_FRAME_WIDTH(b));
+	int height = MIN(GST_VIDEO_FRAME_HEIGHT(a), GST_VIDEO_FRAME_HEIGHT(b));
+	const uint8_t *pa, *pb;
+	uint64_t sse = 0;
+	int x, y, d;
+
+	for (y = 0; y < height; y++) {
+		pa = (const uint8_t *)GST_VIDEO_FRAME_PLANE_DATA(a, 0) +
+			y * GST_VIDEO_FRAME_PLANE_STRIDE(a, 0);
+		pb = (const uint8_t *)GST_VIDEO_FRAME_PLANE_DATA(b, 0) +
+			y * GST_VIDEO_FRAME_PLANE_STRIDE(b, 0);
+		for (x = 0; x < width; x++) {
+			d = pa[x] - pb[x];
+			sse += d * d;
+		}
+	}
+
+	if (!sse)
+		return QUALITY_PSNR_MAX;
+	return MIN(QUALITY_PSNR_MAX,
+		   10.0 * log10(255.0 * 255.0 * width * height / sse));
+}
+
+/*
+ * A frame out of the decoder of the "quality" branch, on its thread:
+ * compared with the one pushed with the same timestamp, if it is still
+ * kept, and added to the output's counters.
+ */
+static GstFlowReturn
+quality_sample(GstAppSink *sink, gpointer user_data)
+{
+	struct GstAppContext *ctx = user_data;
+	GstSample *sample = gst_app_sink_pull_sample(sink);
+	GstBuffer *decoded, *pushed = NULL;
+	GstVideoFrame a, b;
+	GstVideoInfo info;
+	GstClockTime pts;
+	unsigned int i;
+	double psnr;
+
+	if (!sample)
+		return GST_FLOW_OK;
+
+	decoded = gst_sample_get_buffer(sample);
+	pts = GST_BUFFER_PTS(decoded);
+
+	g_mutex_lock(&ctx->quality_lock);
+	for (i = 0; i < QUALITY_RING && GST_CLOCK_TIME_IS_VALID(pts); i++) {
+		if (ctx->quality_ring[i] &&
+		    GST_BUFFER_PTS(ctx->quality_ring[i]) == pts) {
+			pushed = gst_buffer_ref(ctx->quality_ring[i]);
+			break;
+		}
+	}
+	g_mutex_unlock(&ctx->quality_lock);
+
+	if (pushed &&
+	    gst_video_info_from_caps(&info, gst_sample_get_caps(sample)) &&
+	    gst_video_frame_map(&a, &info, decoded, GST_MAP_READ)) {
+		if (gst_video_frame_map(&b, &ctx->info, pushed, GST_MAP_READ)) {
+			psnr = frame_psnr(&a, &b);
+			transmitter_counter_add(&ctx->counters->psnr_cdb_sum,
+						(uint64_t)(psnr * 100 + 0.5));
+			transmitter_counter_add(&ctx->counters->frames_measured, 1);
+			gst_video_frame_unmap(&b);
+		}
+		gst_video_frame_unmap(&a);
+	}
+
+	if (pushed)
+		gst_buffer_unref(pushed);
+	gst_sample_unref(sample);
+	return GST_FLOW_OK;
+}
+
+/* the mean Y-PSNR since the line before, for benchmark/run-benchmark.sh */
+static void
+quality_log(struct GstAppContext *ctx)
+{
+	uint64_t now = wth_stream_now_us();
+	uint64_t sum, frames;
+
+	if (now - ctx->quality_logged < QUALITY_LOG_MS * 1000)
+		return;
+	ctx->quality_logged = now;
+
+	sum = atomic_load_explicit(&ctx->counters->psnr_cdb_sum,
+				   memory_order_relaxed);
+	frames = atomic_load_explicit(&ctx->counters->frames_measured,
+				      memory_order_relaxed);
+	if (frames > ctx->logged_frames)
+		weston_log("Stream Y-PSNR %.2f dB over %" PRIu64 " frames\n",
+			   (double)(sum - ctx->logged_sum) / 100 /
+			   (frames - ctx->logged_frames),
+			   frames - ctx->logged_frames);
+	ctx->logged_sum = sum;
+	ctx->logged_frames = frames;
+}
+
+/*
+ * Bitrate control from the RTCP receiver reports, AIMD: on more than 10%
+ * loss the bitrate drops by half the loss, below 2% loss it goes up by a
+ * twentieth of the maximum, unless the receiver's jitter is growing, which
+ * means queues are filling up before anything is lost.
+ *
+ * With mirrors every receiver has its own RTP session and its own idea of
+ * the bitrate; the encoder is shared, so it goes with the lowest.
+ */
+#define RATE_INTERVAL_MS WTH_STREAM_RTCP_INTERVAL_MS /* how often we look */
+#define RATE_LOSS_HIGH 26	/* fraction lost, in 1/256 */
+#define RATE_LOSS_LOW 5
+#define RATE_JITTER_RISE_US 2000
+
+static void
+encoder_set_bitrate(struct GstAppContext *ctx)
+{
+	GstStructure *controls;
+	int quality;
+
+	switch (ctx->enc->rate) {
+	case ENCODER_RATE_BITRATE:
+		g_object_set(ctx->encoder, "bitrate",
+			     (guint)(ctx->bitrate / ctx->enc->bitrate_div), NULL);
+		break;
+	case ENCODER_RATE_V4L2:
+		controls = gst_structure_new("controls", "video_bitrate",
+					     G_TYPE_INT, ctx->bitrate, NULL);
+		g_object_set(ctx->encoder, "extra-controls", controls, NULL);
+		gst_structure_free(controls);
+		break;
+	case ENCODER_RATE_QUALITY:
+		/* jpegenc's default quality at the maximum */
+		quality = 85;
+		if (ctx->max_bitrate > ctx->min_bitrate)
+			quality = 20 + 65 * (int64_t)(ctx->bitrate - ctx->min_bitrate) /
+				  (ctx->max_bitrate - ctx->min_bitrate);
+		g_object_set(ctx->encoder, "quality", quality, NULL);
+		break;
+	}
+}
+
+/* the last receiver report about our stream, false if there is none */
+static bool
+rate_control_report(GObject *session, guint *fraction_lost,
+		    guint *seq, guint *lsr, guint *jitter)
+{
+	GstStructure *stats = NULL;
+	const GValue *value;
+	GValueArray *sources;
+	const GstStructure *source;
+	gboolean internal, have_rb;
+	bool found = false;
+	guint i;
+
+	g_object_get(session, "stats", &stats, NULL);
+	if (!stats)
+		return false;
+
+	value = gst_structure_get_value(stats, "source-stats");
+	sources = value ? g_value_get_boxed(value) : NULL;
+
+G_GNUC_BEGIN_IGNORE_DEPRECATIONS
+	for (i = 0; sources && i < sources->n_values && !found; i++) {
+		source = gst_value_get_structure(
+			g_value_array_get_nth(sources, i));
+		internal = have_rb = FALSE;
+		gst_structure_get_boolean(source, "internal", &internal);
+		gst_structure_get_boolean(source, "have-rb", &have_rb);
+		if (!internal || !have_rb)
+			continue;
+
+		found = gst_structure_get_uint(source, "rb-fractionlost",
+					       fraction_lost) &&
+			gst_structure_get_uint(source, "rb-exthighestseq", seq) &&
+			gst_structure_get_uint(source, "rb-lsr", lsr) &&
+			gst_structure_get_uint(source, "rb-jitter", jitter);
+	}
+G_GNUC_END_IGNORE_DEPRECATIONS
+
+	gst_structure_free(stats);
+	return found;
+}
+
+/* the bitrate one receiver's last report allows */
+static void
+rate_control_session(struct GstAppContext *ctx, struct rate_session *rs)
+{
+	guint fraction_lost, seq, lsr, jitter;
+	uint32_t jitter_us;
+	int bitrate;
+
+	if (!rs->session ||
+	    !rate_control_report(rs->session, &fraction_lost, &seq, &lsr,
+				 &jitter) ||
+	    (seq == rs->rb_seq && lsr == rs->rb_lsr))
+		return;
+	rs->rb_seq = seq;
+	rs->rb_lsr = lsr;
+
+	/* in units of the 90 kHz RTP clock */
+	jitter_us = (uint64_t)jitter * 1000 / 90;
+
+	bitrate = rs->bitrate;
+	if (fraction_lost > RATE_LOSS_HIGH)
+		bitrate -= (int64_t)bitrate * fraction_lost / 512;
+	else if (fraction_lost < RATE_LOSS_LOW &&
+		 jitter_us < rs->jitter_us + RATE_JITTER_RISE_US)
+		bitrate += ctx->max_bitrate / 20;
+	rs->jitter_us = jitter_us;
+
+	if (bitrate < ctx->min_bitrate)
+		bitrate = ctx->min_bitrate;
+	if (bitrate > ctx->max_bitrate)
+		bitrate = ctx->max_bitrate;
+	rs->bitrate = bitrate;
+
+	atomic_store_explicit(&rs->counters->fraction_lost, fraction_lost,
+			      memory_order_relaxed);
+}
+
+/* called every frame, acts once per new receiver report */
+static void
+rate_control(struct GstAppContext *ctx)
+{
+	uint64_t now = wth_stream_now_us();
+	struct mirror_branch *branch;
+	int bitrate;
+
+	if (!ctx->rate.session || !ctx->enc ||
+	    now - ctx->rate_checked < RATE_INTERVAL_MS * 1000)
+		return;
+	ctx->rate_checked = now;
+
+	rate_control_session(ctx, &ctx->rate);
+	bitrate = ctx->rate.bitrate;
+	wl_list_for_each(branch, &ctx->mirrors, link) {
+		if (!g_atomic_int_get(&branch->active))
+			continue;
+		rate_control_session(ctx, &branch->rate);
+		bitrate = MIN(bitrate, branch->rate.bitrate);
+	}
+
+	if (bitrate == ctx->bitrate)
+		return;
+
+	ctx->bitrate = bitrate;
+	encoder_set_bitrate(ctx);
+	atomic_store_explicit(&ctx->counters->bitrate, bitrate,
+			      memory_order_relaxed);
+	wl_list_for_each(branch, &ctx->mirrors, link)
+		atomic_store_explicit(&branch->rate.counters->bitrate, bitrate,
+				      memory_order_relaxed);
+}
+
+/*
+ * Finds the encoder and the RTP session. Pipeline files may have them too:
+ * an encoder named "encoder" from the table above and an rtpbin named
+ * "rtpbin" taking receiver reports.
+ */
+static void
+rate_control_setup(struct GstAppContext *ctx, struct gst_settings *settings)
+{
+	GstElement *rtpbin;
+	GstElementFactory *factory;
+	unsigned int i;
+
+	ctx->bitrate = settings->bitrate;
+	ctx->min_bitrate = settings->min_bitrate;
+	ctx->max_bitrate = settings->max_bitrate;
+	ctx->rate.bitrate = settings->bitrate;
+	ctx->rate.counters = ctx->counters;
+
+	ctx->encoder = gst_bin_get_by_name(GST_BIN(ctx->pipeline), "encoder");
+	if (!ctx->encoder)
+		return;
+
+	factory = gst_element_get_factory(ctx->encoder);
+	for (i = 0; factory && i < ARRAY_LENGTH(encoders); i++) {
+		if (strcmp(GST_OBJECT_NAME(factory), encoders[i].element) == 0)
+			ctx->enc = &encoders[i];
+	}
+
+	rtpbin = gst_bin_get_by_name(GST_BIN(ctx->pipeline), "rtpbin");
+	if (!rtpbin)
+		return;
+
+	g_signal_emit_by_name(rtpbin, "get-internal-session", 0,
+			      &ctx->rate.session);
+	if (ctx->rate.session)
+		g_object_set(ctx->rate.session, "rtcp-min-interval",
+			     (guint64)WTH_STREAM_RTCP_INTERVAL_MS * GST_MSECOND,
+			     NULL);
+	gst_object_unref(rtpbin);
+
+	if (ctx->enc && ctx->rate.session)
+		atomic_store_explicit(&ctx->counters->bitrate, ctx->bitrate,
+				      memory_order_relaxed);
+}
+
+/*
+ * What is teed off to a mirror, counted as sent on its output, frames by
+ * the RTP marker bit. Dropped before the queue while it is not connected.
+ */
+static gboolean
+mirror_count(GstBuffer **buffer, guint idx, gpointer user_data)
+{
+	struct mirror_branch *branch = user_data;
+	GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+
+	if (gst_rtp_buffer_map(*buffer, GST_MAP_READ, &rtp)) {
+		if (gst_rtp_buffer_get_marker(&rtp))
+			transmitter_counter_add(&branch->rate.counters->frames_sent,
+						1);
+		gst_rtp_buffer_unmap(&rtp);
+	}
+
+	transmitter_counter_add(&branch->rate.counters->bytes_sent,
+				gst_buffer_get_size(*buffer));
+	return TRUE;
+}
+
+static GstPadProbeReturn
+mirror_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+	struct mirror_branch *branch = user_data;
+	GstBuffer *buffer;
+
+	if (!g_atomic_int_get(&branch->active))
+		return GST_PAD_PROBE_DROP;
+
+	if (info->type & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+		gst_buffer_list_foreach(GST_PAD_PROBE_INFO_BUFFER_LIST(info),
+					mirror_count, branch);
+	} else {
+		buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+		mirror_count(&buffer, 0, branch);
+	}
+
+	return GST_PAD_PROBE_OK;
+}
+
+/*
+ * Tees the payloaded stream off into an RTP session of its own, sending to
+ * the mirror and taking its receiver reports on the ports of its stream
+ * config, as the output's own session does for its remote.
+ */
+static int
+mirror_link(struct GstAppContext *ctx, struct mirror_branch *branch)
+{
+	struct weston_transmitter_remote *remote = branch->remote;
+	GstElement *rtpbin, *fanout, *queue, *rtcpsrc;
+	char rtp_sink[32], rtp_src[32], rtcp_src[32], rtcp_sink[32];
+	GstPad *pad;
+	guint id;
+	int ret = -1;
+
+	rtpbin = gst_bin_get_by_name(GST_BIN(ctx->pipeline), "rtpbin");
+	fanout = gst_bin_get_by_name(GST_BIN(ctx->pipeline), "fanout");
+	if (!rtpbin || !fanout) {
+		weston_log("Pipeline has no fanout, not mirrored to %s:%s\n",
+			   remote->addr, remote->port);
+		goto out;
+	}
+
+	queue = gst_element_factory_make("queue", NULL);
+	branch->sink = gst_element_factory_make("udpsink", NULL);
+	branch->rtcpsink = gst_element_factory_make("udpsink", NULL);
+	rtcpsrc = gst_element_factory_make("udpsrc", NULL);
+	if (!queue || !branch->sink || !branch->rtcpsink || !rtcpsrc) {
+		weston_log("Could not create the branch to %s:%s\n",
+			   remote->addr, remote->port);
+		g_clear_object(&queue);
+		g_clear_object(&branch->sink);
+		g_clear_object(&branch->rtcpsink);
+		g_clear_object(&rtcpsrc);
+		goto out;
+	}
+
+	g_object_set(branch->sink, "host", remote->addr,
+		     "port", (gint)remote->stream.port,
+		     "sync", FALSE, "async", FALSE, NULL);
+	g_object_set(branch->rtcpsink, "host", remote->addr,
+		     "port", (gint)WTH_STREAM_RTCP_PORT(remote->stream.port),
+		     "sync", FALSE, "async", FALSE, NULL);
+	g_object_set(rtcpsrc, "port", (gint)remote->stream.rtcp_port, NULL);
+	gst_bin_add_many(GST_BIN(ctx->pipeline), queue, branch->sink,
+			 branch->rtcpsink, rtcpsrc, NULL);
+
+	id = ++ctx->sessions;
+	snprintf(rtp_sink, sizeof rtp_sink, "send_rtp_sink_%u", id);
+	snprintf(rtp_src, sizeof rtp_src, "send_rtp_src_%u", id);
+	snprintf(rtcp_src, sizeof rtcp_src, "send_rtcp_src_%u", id);
+	snprintf(rtcp_sink, sizeof rtcp_sink, "recv_rtcp_sink_%u", id);
+	if (!gst_element_link_pads(queue, "src", rtpbin, rtp_sink) ||
+	    !gst_element_link_pads(rtpbin, rtp_src, branch->sink, "sink") ||
+	    !gst_element_link_pads(rtpbin, rtcp_src, branch->rtcpsink, "sink") ||
+	    !gst_element_link_pads(rtcpsrc, "src", rtpbin, rtcp_sink) ||
+	    !gst_element_link(fanout, queue)) {
+		weston_log("Could not link the branch to %s:%s\n",
+			   remote->addr, remote->port);
+		gst_bin_remove_many(GST_BIN(ctx->pipeline), queue, branch->sink,
+				    branch->rtcpsink, rtcpsrc, NULL);
+		branch->sink = branch->rtcpsink = NULL;
+		goto out;
+	}
+
+	pad = gst_element_get_static_pad(queue, "sink");
+	gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER |
+			  GST_PAD_PROBE_TYPE_BUFFER_LIST,
+			  mirror_probe, branch, NULL);
+	gst_object_unref(pad);
+
+	gst_element_sync_state_with_parent(rtcpsrc);
+	gst_element_sync_state_with_parent(branch->rtcpsink);
+	gst_element_sync_state_with_parent(branch->sink);
+	gst_element_sync_state_with_parent(queue);
+
+	g_signal_emit_by_name(rtpbin, "get-internal-session", id,
+			      &branch->rate.session);
+	if (branch->rate.session)
+		g_object_set(branch->rate.session, "rtcp-min-interval",
+			     (guint64)WTH_STREAM_RTCP_INTERVAL_MS * GST_MSECOND,
+			     NULL);
+	ret = 0;
+
+out:
+	if (rtpbin)
+		gst_object_unref(rtpbin);
+	if (fanout)
+		gst_object_unref(fanout);
+	return ret;
+}
+
+/*
+ * mirror-of: the stream goes to the remote as well, from the same encoder.
+ * A mirror that reconnects gets its branch back, the ports may have
+ * changed; the one for its reports stays bound.
+ */
+static int
+waltham_renderer_mirror_add(struct weston_transmitter_output *output,
+			    struct weston_transmitter_remote *remote)
+{
+	struct GstAppContext *ctx = output->renderer->ctx;
+	struct weston_transmitter_output *mirror;
+	struct mirror_branch *branch;
+
+	/* picked up when the pipeline is built, see gst_pipe_init() */
+	if (!ctx)
+		return 0;
+
+	/* it joined the group, there is nothing to tee off */
+	if (remote->stream.multicast)
+		return 0;
+
+	wl_list_for_each(branch, &ctx->mirrors, link) {
+		if (branch->remote != remote)
+			continue;
+
+		g_object_set(branch->sink, "host", remote->addr,
+			     "port", (gint)remote->stream.port, NULL);
+		g_object_set(branch->rtcpsink, "host", remote->addr,
+			     "port", (gint)WTH_STREAM_RTCP_PORT(remote->stream.port),
+			     NULL);
+		g_atomic_int_set(&branch->active, 1);
+		return 0;
+	}
+
+	if (wl_list_empty(&remote->output_list))
+		return -1;
+	mirror = wl_container_of(remote->output_list.next, mirror, link);
+
+	branch = zalloc(sizeof *branch);
+	if (!branch)
+		return -1;
+	branch->remote = remote;
+	branch->rate.bitrate = ctx->bitrate;
+	branch->rate.counters = &mirror->renderer->counters;
+	branch->active = 1;
+
+	if (mirror_link(ctx, branch) < 0) {
+		free(branch);
+		return -1;
+	}
+
+	if (ctx->enc && branch->rate.session)
+		atomic_store_explicit(&branch->rate.counters->bitrate,
+				      ctx->bitrate, memory_order_relaxed);
+	wl_list_insert(&ctx->mirrors, &branch->link);
+	weston_log("Stream of %s mirrored to %s:%s, port %u\n",
+		   output->base.name, remote->addr, remote->port,
+		   remote->stream.port);
+	return 0;
+}
+
+static void
+waltham_renderer_mirror_remove(struct weston_transmitter_output *output,
+			       struct weston_transmitter_remote *remote)
+{
+	struct GstAppContext *ctx = output->renderer->ctx;
+	struct mirror_branch *branch;
+
+	if (!ctx)
+		return;
+
+	wl_list_for_each(branch, &ctx->mirrors, link) {
+		if (branch->remote == remote)
+			g_atomic_int_set(&branch->active, 0);
+	}
+}
+
+/*
+ * Multicast streams keep the packets since the last key frame, so that a
+ * receiver joining the group gets them on its own instead of the encoder
+ * making a key frame for everyone, see waltham_renderer_replay(). The
+ * encoder flags key frames, the payloader keeps their timestamp on their
+ * packets: the first one with it starts the cache again. A GOP larger than
+ * GOP_CACHE_MAX is not kept, joining it takes a key frame of the encoder.
+ */
+#define GOP_CACHE_MAX (4 * 1024 * 1024)
+
+static GstPadProbeReturn
+gop_key_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+	struct GstAppContext *ctx = user_data;
+	GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+
+	if (GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT))
+		return GST_PAD_PROBE_OK;
+
+	g_mutex_lock(&ctx->gop_lock);
+	ctx->key_pts = GST_BUFFER_PTS(buffer);
+	g_mutex_unlock(&ctx->gop_lock);
+
+	return GST_PAD_PROBE_OK;
+}
+
+/* with gop_lock held */
+static gboolean
+gop_keep(GstBuffer **buffer, guint idx, gpointer user_data)
+{
+	struct GstAppContext *ctx = user_data;
+	GstClockTime pts = GST_BUFFER_PTS(*buffer);
+	gsize size = gst_buffer_get_size(*buffer);
+
+	if (GST_CLOCK_TIME_IS_VALID(pts) && pts == ctx->key_pts &&
+	    pts != ctx->gop_pts) {
+		g_ptr_array_set_size(ctx->gop_packets, 0);
+		ctx->gop_bytes = 0;
+		ctx->gop_pts = pts;
+		ctx->gop_full = false;
+	}
+
+	if (ctx->gop_full || !GST_CLOCK_TIME_IS_VALID(ctx->gop_pts))
+		return TRUE;
+
+	if (ctx->gop_bytes + size > GOP_CACHE_MAX) {
+		g_ptr_array_set_size(ctx->gop_packets, 0);
+		ctx->gop_bytes = 0;
+		ctx->gop_full = true;
+		return TRUE;
+	}
+
+	g_ptr_array_add(ctx->gop_packets, gst_buffer_ref(*buffer));
+	ctx->gop_bytes += size;
+	return TRUE;
+}
+
+/* after trace_probe(), the packets are kept as they are sent */
+static GstPadProbeReturn
+gop_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+	struct GstAppContext *ctx = user_data;
+	GstBuffer *buffer;
+
+	g_mutex_lock(&ctx->gop_lock);
+	if (info->type & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+		gst_buffer_list_foreach(GST_PAD_PROBE_INFO_BUFFER_LIST(info),
+					gop_keep, ctx);
+	} else {
+		buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+		gop_keep(&buffer, 0, ctx);
+	}
+	g_mutex_unlock(&ctx->gop_lock);
+
+	return GST_PAD_PROBE_OK;
+}
+
+static void
+gop_setup(struct GstAppContext *ctx)
+{
+	GstElement *pay;
+	GstPad *pad;
+
+	pay = gst_bin_get_by_name(GST_BIN(ctx->pipeline), "pay");
+	if (!pay || !ctx->encoder) {
+		weston_log("Pipeline has no payloader or encoder, "
+			   "joining the multicast group takes a key frame\n");
+		if (pay)
+			gst_object_unref(pay);
+		return;
+	}
+
+	g_mutex_init(&ctx->gop_lock);
+	ctx->gop_packets =
+		g_ptr_array_new_with_free_func((GDestroyNotify)gst_buffer_unref);
+	ctx->gop_pts = GST_CLOCK_TIME_NONE;
+	ctx->key_pts = GST_CLOCK_TIME_NONE;
+	ctx->gop = true;
+
+	pad = gst_element_get_static_pad(ctx->encoder, "src");
+	gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER,
+			  gop_key_probe, ctx, NULL);
+	gst_object_unref(pad);
+
+	pad = gst_element_get_static_pad(pay, "src");
+	gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER |
+			  GST_PAD_PROBE_TYPE_BUFFER_LIST,
+			  gop_probe, ctx, NULL);
+	gst_object_unref(pad);
+	gst_object_unref(pay);
+}
+
+/*
+ * A receiver joined the multicast group: the packets since the last key
+ * frame go to its join port, unicast, as fast as they can. They are older
+ * than the ones it has from the group by then; its jitter buffer puts them
+ * first. Returns -1 if nothing is kept, the caller then asks the encoder.
+ */
+static int
+waltham_renderer_replay(struct weston_transmitter_output *output,
+			struct weston_transmitter_remote *remote)
+{
+	struct GstAppContext *ctx = output->renderer->ctx;
+	struct weston_transmitter_output *joined;
+	struct sockaddr_in dest = { 0 };
+	GstBuffer **packets;
+	GstMapInfo map;
+	guint n, i, sent = 0;
+	gsize bytes = 0;
+
+	if (!ctx || !ctx->gop || !remote->stream.join_port)
+		return -1;
+
+	dest.sin_family = AF_INET;
+	dest.sin_port = htons(remote->stream.join_port);
+	if (inet_pton(AF_INET, remote->addr, &dest.sin_addr) != 1)
+		return -1;
+
+	if (ctx->gop_fd < 0)
+		ctx->gop_fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (ctx->gop_fd < 0) {
+		weston_log("Could not open a socket for the GOP cache: %s\n",
+			   strerror(errno));
+		return -1;
+	}
+
+	/* sent without the lock, the payloader goes on meanwhile */
+	g_mutex_lock(&ctx->gop_lock);
+	n = ctx->gop_full ? 0 : ctx->gop_packets->len;
+	packets = g_new(GstBuffer *, n ? n : 1);
+	for (i = 0; i < n; i++)
+		packets[i] = gst_buffer_ref(g_ptr_array_index(ctx->gop_packets, i));
+	g_mutex_unlock(&ctx->gop_lock);
+
+	for (i = 0; i < n; i++) {
+		if (gst_buffer_map(packets[i], &map, GST_MAP_READ)) {
+			if (sendto(ctx->gop_fd, map.data, map.size, 0,
+				   (struct sockaddr *)&dest, sizeof dest) >= 0) {
+				sent++;
+				bytes += map.size;
+			}
+			gst_buffer_unmap(packets[i], &map);
+		}
+		gst_buffer_unref(packets[i]);
+	}
+	g_free(packets);
+
+	if (!sent)
+		return -1;
+
+	if (!wl_list_empty(&remote->output_list)) {
+		joined = wl_container_of(remote->output_list.next, joined, link);
+		transmitter_counter_add(&joined->renderer->counters.bytes_sent,
+					bytes);
+	}
+	weston_log("%s:%s joined, sent the %u packets since the key frame "
+		   "to port %u\n", remote->addr, remote->port, sent,
+		   remote->stream.join_port);
+	return 0;
+}
+
+/*
+ * Sets up the renderer's own conversion to settings->convert, into pooled
+ * buffers. Returns the caps they have: the matrix is written out, it is
+ * the one GStreamer defaults to for the size except that it is never
+ * BT.2020.
+ */
+static GstCaps *
+convert_setup(struct GstAppContext *ctx, struct gst_settings *settings)
+{
+	GstStructure *config;
+	GstCaps *caps;
+	bool bt709;
+
+	ctx->width = settings->width;
+	ctx->height = settings->height;
+	ctx->crop_x = settings->crop_x;
+	ctx->crop_y = settings->crop_y;
+	ctx->crop_width = settings->crop_width;
+	ctx->crop_height = settings->crop_height;
+	if (settings->out_width != settings->crop_width ||
+	    settings->out_height != settings->crop_height) {
+		if (wth_scale_init(&ctx->scale, settings->crop_x, settings->crop_y,
+				   settings->crop_width, settings->crop_height,
+				   settings->out_width, settings->out_height) < 0 ||
+		    !(ctx->scaled = malloc((size_t)settings->out_width *
+					   settings->out_height * 4))) {
+			weston_log("Could not set up scaling.\n");
+			wth_scale_fini(&ctx->scale);
+			return NULL;
+		}
+		ctx->scaling = true;
+	}
+
+	gst_video_info_set_format(&ctx->info,
+				  gst_video_format_from_string(settings->convert),
+				  settings->out_width, settings->out_height);
+	bt709 = ctx->info.colorimetry.matrix != GST_VIDEO_COLOR_MATRIX_BT601;
+	ctx->info.colorimetry.matrix = bt709 ? GST_VIDEO_COLOR_MATRIX_BT709 :
+		GST_VIDEO_COLOR_MATRIX_BT601;
+	wth_convert_init(&ctx->convert, strcmp(settings->format, "RGBA") == 0,
+			 bt709, GST_VIDEO_INFO_FORMAT(&ctx->info) ==
+			 GST_VIDEO_FORMAT_NV12);
+
+	caps = gst_video_info_to_caps(&ctx->info);
+	ctx->pool = gst_video_buffer_pool_new();
+	config = gst_buffer_pool_get_config(ctx->pool);
+	gst_buffer_pool_config_set_params(config, caps,
+					  GST_VIDEO_INFO_SIZE(&ctx->info), 2, 0);
+	if (!gst_buffer_pool_set_config(ctx->pool, config) ||
+	    !gst_buffer_pool_set_active(ctx->pool, TRUE)) {
+		weston_log("Could not set up the conversion buffers.\n");
+		gst_object_unref(ctx->pool);
+		ctx->pool = NULL;
+		gst_caps_unref(caps);
+		return NULL;
+	}
+
+	weston_log("Converting %s to %s in the renderer\n",
+		   settings->format, settings->convert);
+	return caps;
+}
+
+static int
+gst_pipe_init(struct weston_transmitter_output *output, struct gst_settings *settings)
+{
+	struct weston_transmitter_remote *remote = output->remote;
+	struct weston_transmitter_remote *mirror;
+	struct GstAppContext *gstctx;
+	gstctx=zalloc(sizeof (*gstctx));
+	if(!gstctx){
+		weston_log("Enable to allocate memory\n");
+		return -1;
+	}
+	wl_list_init(&gstctx->mirrors);
+	gstctx->gop_fd = -1;
+	GstCaps *caps;
+	int ret = 0;
+	GError *gerror = NULL;
+	char * pipe = NULL;
+	GstElement *pay, *sink;
+	GstPad *pad;
+
+	/* create gstreamer pipeline */
+	gst_init(NULL, NULL);
+	gstctx->loop = g_main_loop_new(NULL, FALSE);
+
+	if (remote->stream.codec)
+		pipe = build_pipeline(&remote->stream, settings);
+	else
+		pipe = read_pipeline_file();
+	if (!pipe)
+		goto err;
+
 	weston_log("Parsing GST pipeline:%s",pipe);
 	gstctx->pipeline = gst_parse_launch(pipe, &gerror);
 	free(pipe);
-	if(!gstctx->pipeline)
-		weston_log("Could not create gstreamer pipeline.\n");
+	if(!gstctx->pipeline) {
+		weston_log("Could not create gstreamer pipeline: %s\n",
+			   gerror ? gerror->message : "unknown error");
+		g_clear_error(&gerror);
+		goto err;
+	}
+	g_clear_error(&gerror);
 
 	gstctx->bus = gst_pipeline_get_bus((GstPipeline*)((void*)gstctx->pipeline));
-	gst_bus_add_watch(gstctx->bus, bus_message, &gstctx);
+	gst_bus_add_watch(gstctx->bus, bus_message, gstctx);
 
 	gstctx->appsrc = (GstAppSrc*)
 		gst_bin_get_by_name(GST_BIN(gstctx->pipeline), "src");
-	if (!gstctx->appsrc)
-		return -1;
+	if (!gstctx->appsrc) {
+		weston_log("GST pipeline has no appsrc named \"src\".\n");
+		goto err;
+	}
 
-	caps = gst_caps_new_simple("video/x-raw",
-				   "format", G_TYPE_STRING, "BGRx",
-				   "width", G_TYPE_INT, settings->width,
-				   "height", G_TYPE_INT, settings->height,
-				   NULL);
+	/* see waltham_renderer_repaint_output */
+	if (settings->convert)
+		caps = convert_setup(gstctx, settings);
+	else
+		caps = gst_caps_new_simple("video/x-raw",
+					   "format", G_TYPE_STRING, settings->format,
+					   "width", G_TYPE_INT, settings->width,
+					   "height", G_TYPE_INT, settings->height,
+					   NULL);
 	if (!caps)
-		return -1;
+		goto err;
 
 	g_object_set(G_OBJECT(gstctx->appsrc),
 		     "caps", caps,
@@ -169,10 +1571,185 @@ gst_pipe_init(struct weston_transmitter_output *output, struct gst_settings *set
 		     NULL);
 	gst_caps_unref(caps);
 
+	/* pipeline files without a payloader named "pay" are not traced,
+	 * and only count frames pushed */
+	g_mutex_init(&gstctx->trace_lock);
+	gstctx->counters = &output->renderer->counters;
+	pay = gst_bin_get_by_name(GST_BIN(gstctx->pipeline), "pay");
+	if (pay) {
+		pad = gst_element_get_static_pad(pay, "src");
+		gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER |
+				  GST_PAD_PROBE_TYPE_BUFFER_LIST,
+				  trace_probe, gstctx, NULL);
+		gst_object_unref(pad);
+		gst_object_unref(pay);
+	}
+
+	rate_control_setup(gstctx, settings);
+
+	if (remote->stream.multicast)
+		gop_setup(gstctx);
+
+	/* encoders we know to ignore it go without */
+	gstctx->roi = settings->roi && (!gstctx->enc || gstctx->enc->roi);
+
+	sink = gst_bin_get_by_name(GST_BIN(gstctx->pipeline), "quality");
+	if (sink) {
+		GstAppSinkCallbacks callbacks = { .new_sample = quality_sample };
+
+		g_mutex_init(&gstctx->quality_lock);
+		gst_app_sink_set_callbacks(GST_APP_SINK(sink), &callbacks,
+					   gstctx, NULL);
+		gstctx->quality = true;
+		gst_object_unref(sink);
+	}
+
 	gst_element_set_state((GstElement*)((void*)gstctx->pipeline), GST_STATE_PLAYING);
 	output->renderer->ctx = gstctx;
 
+	/* mirrors that connected before the first frame */
+	wl_list_for_each(mirror, &remote->transmitter->remote_list, link) {
+		if (mirror->leader == remote && mirror->mirrored)
+			waltham_renderer_mirror_add(output, mirror);
+	}
+
 	return 0;
+
+err:
+	/* the output stays without a context, nothing is pushed */
+	if (gstctx->scaling) {
+		wth_scale_fini(&gstctx->scale);
+		free(gstctx->scaled);
+	}
+	if (gstctx->appsrc)
+		gst_object_unref(gstctx->appsrc);
+	if (gstctx->bus) {
+		gst_bus_remove_watch(gstctx->bus);
+		gst_object_unref(gstctx->bus);
+	}
+	if (gstctx->pipeline)
+		gst_object_unref(gstctx->pipeline);
+	g_main_loop_unref(gstctx->loop);
+	free(gstctx);
+	return -1;
+}
+
+/* the stream was negotiated again, gst_pipe_init() builds the new one */
+static void
+gst_pipe_destroy(struct renderer *renderer)
+{
+	struct GstAppContext *ctx = renderer->ctx;
+	struct mirror_branch *branch, *tmp;
+	unsigned int i;
+
+	if (!ctx)
+		return;
+	renderer->ctx = NULL;
+
+	/* no streaming thread runs the probes after this */
+	gst_element_set_state(ctx->pipeline, GST_STATE_NULL);
+
+	wl_list_for_each_safe(branch, tmp, &ctx->mirrors, link) {
+		if (branch->rate.session)
+			g_object_unref(branch->rate.session);
+		wl_list_remove(&branch->link);
+		free(branch);
+	}
+	if (ctx->rate.session)
+		g_object_unref(ctx->rate.session);
+	if (ctx->encoder)
+		gst_object_unref(ctx->encoder);
+
+	if (ctx->gop) {
+		g_ptr_array_unref(ctx->gop_packets);
+		g_mutex_clear(&ctx->gop_lock);
+	}
+	if (ctx->gop_fd >= 0)
+		close(ctx->gop_fd);
+
+	if (ctx->quality) {
+		for (i = 0; i < QUALITY_RING; i++)
+			if (ctx->quality_ring[i])
+				gst_buffer_unref(ctx->quality_ring[i]);
+		g_mutex_clear(&ctx->quality_lock);
+	}
+
+	if (ctx->pool) {
+		gst_buffer_pool_set_active(ctx->pool, FALSE);
+		gst_object_unref(ctx->pool);
+	}
+	if (ctx->scaling)
+		wth_scale_fini(&ctx->scale);
+	free(ctx->scaled);
+
+	g_mutex_clear(&ctx->trace_lock);
+	gst_object_unref(ctx->appsrc);
+	gst_bus_remove_watch(ctx->bus);
+	gst_object_unref(ctx->bus);
+	gst_object_unref(ctx->pipeline);
+	g_main_loop_unref(ctx->loop);
+	free(ctx);
+}
+
+/*
+ * What of the surface is encoded, at which size: all of it, unless it is
+ * larger than the receiver's display, then scaled down as weston.ini says.
+ * Never scaled up, sizes are even for the encoders. Pipeline files are
+ * left alone.
+ */
+static void
+scale_geometry(struct gst_settings *settings,
+	       struct weston_transmitter_remote *remote)
+{
+	int sw = settings->width, sh = settings->height;
+	int tw = remote->stream.width, th = remote->stream.height;
+	double f;
+
+	settings->crop_x = 0;
+	settings->crop_y = 0;
+	settings->crop_width = settings->out_width = sw;
+	settings->crop_height = settings->out_height = sh;
+
+	if (!remote->stream.codec || tw <= 0 || th <= 0 || (tw >= sw && th >= sh))
+		return;
+
+	/* the receiver lays the lossless tiles over the video 1:1 */
+	if (remote->stream.overlay) {
+		weston_log("Not scaling the video under the lossless layer\n");
+		return;
+	}
+
+	/* the receiver cuts the surfaces out of the frames at their size */
+	if (remote->stream.atlas) {
+		weston_log("Not scaling the atlas\n");
+		return;
+	}
+
+	switch (remote->scaling) {
+	case TRANSMITTER_SCALING_OFF:
+		return;
+	case TRANSMITTER_SCALING_STRETCH:
+		settings->out_width = MIN(tw, sw);
+		settings->out_height = MIN(th, sh);
+		break;
+	case TRANSMITTER_SCALING_FIT:
+		f = MIN((double)tw / sw, (double)th / sh);
+		settings->out_width = sw * f + 0.5;
+		settings->out_height = sh * f + 0.5;
+		break;
+	case TRANSMITTER_SCALING_FILL:
+		f = MIN(1.0, MAX((double)tw / sw, (double)th / sh));
+		settings->out_width = MIN(tw, (int)(sw * f + 0.5));
+		settings->out_height = MIN(th, (int)(sh * f + 0.5));
+		settings->crop_width = MIN(sw, (int)(settings->out_width / f + 0.5));
+		settings->crop_height = MIN(sh, (int)(settings->out_height / f + 0.5));
+		settings->crop_x = (sw - settings->crop_width) / 2;
+		settings->crop_y = (sh - settings->crop_height) / 2;
+		break;
+	}
+
+	settings->out_width = MAX(2, settings->out_width & ~1);
+	settings->out_height = MAX(2, settings->out_height & ~1);
 }
 
 static int
@@ -183,31 +1760,54 @@ recorder_enable(struct weston_transmitter_output *output)
 	struct weston_output* base = &output->base;
 	struct weston_compositor *compositor = base->compositor;
 	struct weston_transmitter_remote* remote = output->remote;
-
-	/*
-	 * Limitation:
-	 * Hard coding bitrate and crop params.
-	 * In case of gst-recorder case these were taken from weston.ini
-	 */
-	int32_t bitrate = 3000000;
+	struct weston_transmitter_remote *mirror;
 
 	settings = malloc(sizeof(* settings));
-	settings->ip = remote->addr;
+	/* see transmitter_remote_multicast() */
+	settings->ip = remote->stream.multicast ? remote->multicast : remote->addr;
 
-	settings->port = atoi(remote->port);
+	if (remote->stream.codec)
+		settings->port = remote->stream.port;
+	else
+		settings->port = atoi(remote->port);
 
-	settings->bitrate = bitrate;
+	/* from weston.ini, see transmitter_get_server_config() */
+	settings->bitrate = remote->bitrate;
+	settings->min_bitrate = remote->min_bitrate;
+	settings->max_bitrate = remote->max_bitrate;
 	settings->width = output->renderer->surface_width;
 	settings->height = output->renderer->surface_height;
+	/* see waltham_renderer_repaint_output */
+	settings->format = output->renderer->dmafd < 0 ? "RGBA" : "BGRx";
+	settings->encoder = remote->encoder;
+	settings->converter = remote->converter;
+	settings->convert = NULL;
+	settings->roi = remote->roi;
+	settings->quality = remote->quality;
+	settings->fanout = false;
+	wl_list_for_each(mirror, &remote->transmitter->remote_list, link) {
+		/* multicast mirrors join the group instead */
+		if (mirror->leader == remote && !remote->stream.multicast)
+			settings->fanout = true;
+	}
+	scale_geometry(settings, remote);
+	if (settings->out_width != settings->crop_width ||
+	    settings->out_height != settings->crop_height)
+		weston_log("Scaling %dx%d+%d+%d of the surface to %dx%d\n",
+			   settings->crop_width, settings->crop_height,
+			   settings->crop_x, settings->crop_y,
+			   settings->out_width, settings->out_height);
 
 	weston_log("gst-setting are :-->\n");
 	weston_log("ip = %s \n",settings->ip);
 	weston_log("port = %d \n",settings->port);
-	weston_log("bitrate = %d \n",settings->bitrate);
+	weston_log("bitrate = %d (%d - %d)\n", settings->bitrate,
+		   settings->min_bitrate, settings->max_bitrate);
 	weston_log("width = %d \n",settings->width);
 	weston_log("height = %d \n",settings->height);
 
-	gst_pipe_init(output, settings);
+	if (gst_pipe_init(output, settings) < 0)
+		goto err;
 
 	return 0;
 err:
@@ -218,6 +1818,179 @@ err:
 	return -1;
 }
 
+static void
+push_buffer(struct renderer *renderer, GstBuffer *gstbuffer)
+{
+	struct GstAppContext *ctx = renderer->ctx;
+
+	add_roi(ctx, renderer, gstbuffer);
+	if (ctx->quality)
+		quality_keep(ctx, gstbuffer);
+
+	if (gst_app_src_push_buffer(ctx->appsrc, gstbuffer) == GST_FLOW_OK)
+		transmitter_counter_add(&renderer->counters.frames_pushed, 1);
+	else
+		transmitter_counter_add(&renderer->counters.frames_dropped, 1);
+
+	rate_control(ctx);
+	if (ctx->quality)
+		quality_log(ctx);
+}
+
+/*
+ * A pooled buffer in the encoder's format, converted from the frame. The
+ * frame's memory is only read, once, so a dmabuf is mapped as it is.
+ */
+static GstBuffer *
+convert_frame(struct GstAppContext *ctx, const uint8_t *data, int stride)
+{
+	struct wth_convert_planes planes = { 0 };
+	GstVideoFrame frame;
+	GstBuffer *buffer;
+
+	if (gst_buffer_pool_acquire_buffer(ctx->pool, &buffer, NULL) != GST_FLOW_OK)
+		return NULL;
+
+	if (!gst_video_frame_map(&frame, &ctx->info, buffer, GST_MAP_WRITE)) {
+		gst_buffer_unref(buffer);
+		return NULL;
+	}
+
+	planes.y = GST_VIDEO_FRAME_PLANE_DATA(&frame, 0);
+	planes.y_stride = GST_VIDEO_FRAME_PLANE_STRIDE(&frame, 0);
+	planes.u = GST_VIDEO_FRAME_PLANE_DATA(&frame, 1);
+	planes.u_stride = GST_VIDEO_FRAME_PLANE_STRIDE(&frame, 1);
+	if (GST_VIDEO_FRAME_N_PLANES(&frame) > 2) {
+		planes.v = GST_VIDEO_FRAME_PLANE_DATA(&frame, 2);
+		planes.v_stride = GST_VIDEO_FRAME_PLANE_STRIDE(&frame, 2);
+	}
+	wth_convert_frame(&ctx->convert, data, stride,
+			  GST_VIDEO_FRAME_WIDTH(&frame),
+			  GST_VIDEO_FRAME_HEIGHT(&frame), &planes);
+	gst_video_frame_unmap(&frame);
+
+	return buffer;
+}
+
+/*
+ * The surface changed size: scale its new crop to the size the encoder
+ * has. Returns -1 if the new geometry does not end at that size.
+ */
+static int
+convert_resize(struct GstAppContext *ctx,
+	       struct weston_transmitter_output *output)
+{
+	struct gst_settings settings = { 0 };
+	bool scaling;
+
+	settings.width = output->renderer->surface_width;
+	settings.height = output->renderer->surface_height;
+	scale_geometry(&settings, output->remote);
+	if (settings.out_width != GST_VIDEO_INFO_WIDTH(&ctx->info) ||
+	    settings.out_height != GST_VIDEO_INFO_HEIGHT(&ctx->info))
+		return -1;
+
+	if (ctx->scaling)
+		wth_scale_fini(&ctx->scale);
+	ctx->scaling = false;
+
+	scaling = settings.out_width != settings.crop_width ||
+		settings.out_height != settings.crop_height;
+	if (scaling) {
+		if (!ctx->scaled)
+			ctx->scaled = malloc((size_t)settings.out_width *
+					     settings.out_height * 4);
+		if (!ctx->scaled ||
+		    wth_scale_init(&ctx->scale, settings.crop_x, settings.crop_y,
+				   settings.crop_width, settings.crop_height,
+				   settings.out_width, settings.out_height) < 0) {
+			/* no longer set up for any size */
+			ctx->width = ctx->height = 0;
+			return -1;
+		}
+		ctx->scaling = true;
+	}
+
+	ctx->width = settings.width;
+	ctx->height = settings.height;
+	ctx->crop_x = settings.crop_x;
+	ctx->crop_y = settings.crop_y;
+	ctx->crop_width = settings.crop_width;
+	ctx->crop_height = settings.crop_height;
+	return 0;
+}
+
+static void
+repaint_converted(struct weston_transmitter_output *output)
+{
+	struct renderer *renderer = output->renderer;
+	struct GstAppContext *ctx = renderer->ctx;
+	gsize size = renderer->buf_stride * renderer->surface_height;
+	const uint8_t *data = renderer->shm_data;
+	int stride = renderer->buf_stride;
+	GstAllocator *allocator = NULL;
+	GstMemory *mem = NULL;
+	GstBuffer *buffer;
+	GstMapInfo map;
+
+	/* the conversion reads the crop of the surface it was set up for:
+	 * a smaller surface, or another view on the output, would be read
+	 * past its end */
+	if ((renderer->surface_width != ctx->width ||
+	     renderer->surface_height != ctx->height) &&
+	    (renderer->surface_width != ctx->dropped_width ||
+	     renderer->surface_height != ctx->dropped_height) &&
+	    convert_resize(ctx, output) < 0) {
+		weston_log("%s: dropping %dx%d frames, they do not scale to "
+			   "%dx%d\n", output->base.name,
+			   renderer->surface_width, renderer->surface_height,
+			   GST_VIDEO_INFO_WIDTH(&ctx->info),
+			   GST_VIDEO_INFO_HEIGHT(&ctx->info));
+		ctx->dropped_width = renderer->surface_width;
+		ctx->dropped_height = renderer->surface_height;
+	}
+	if (renderer->surface_width != ctx->width ||
+	    renderer->surface_height != ctx->height ||
+	    stride < ctx->width * 4) {
+		/* the frame's dmabuf is ours, see transmitter_output_send() */
+		if (renderer->dmafd >= 0)
+			close(renderer->dmafd);
+		transmitter_counter_add(&renderer->counters.frames_dropped, 1);
+		return;
+	}
+
+	if (renderer->dmafd >= 0) {
+		allocator = gst_dmabuf_allocator_new();
+		mem = gst_dmabuf_allocator_alloc(allocator, renderer->dmafd, size);
+		gst_object_unref(allocator);
+		if (!gst_memory_map(mem, &map, GST_MAP_READ)) {
+			weston_log("Could not map the frame to convert it.\n");
+			gst_memory_unref(mem);
+			return;
+		}
+		data = map.data;
+	}
+
+	if (ctx->scaling) {
+		wth_scale_frame(&ctx->scale, data, stride, ctx->scaled,
+				ctx->scale.width * 4);
+		buffer = convert_frame(ctx, ctx->scaled, ctx->scale.width * 4);
+	} else {
+		buffer = convert_frame(ctx, data + ctx->crop_y * stride +
+				       ctx->crop_x * 4, stride);
+	}
+
+	if (mem) {
+		gst_memory_unmap(mem, &map);
+		gst_memory_unref(mem);
+	}
+	if (!buffer)
+		return;
+
+	trace_frame(ctx, renderer, buffer);
+	push_buffer(renderer, buffer);
+}
+
 static void waltham_renderer_repaint_output(struct weston_transmitter_output *output)
 {
 	GstBuffer *gstbuffer;
@@ -225,12 +1998,50 @@ static void waltham_renderer_repaint_output(struct weston_transmitter_output *ou
 	GstAllocator *allocator;
 	int stride = output->renderer->buf_stride;
 	gsize offset = 0;
+	struct waltham_renderer *wth_renderer =
+		wl_container_of(output->renderer, wth_renderer, base);
+
+	/* outputs outlive their connection: a receiver that reconnected
+	 * may have negotiated another stream, or one at all */
+	if (output->renderer->recorder_enabled &&
+	    memcmp(&wth_renderer->stream, &output->remote->stream,
+		   sizeof wth_renderer->stream) != 0) {
+		weston_log("%s: stream negotiated again, rebuilding the "
+			   "GST pipeline\n", output->base.name);
+		gst_pipe_destroy(output->renderer);
+		output->renderer->recorder_enabled = 0;
+	}
 
 	if(!output->renderer->recorder_enabled)
 	{
-		recorder_enable(&output->base);
+		wth_renderer->stream = output->remote->stream;
+		/* tried once, a pipeline that failed is not retried */
+		if (recorder_enable(&output->base) < 0)
+			weston_log("%s: not streaming, no GST pipeline\n",
+				   output->base.name);
 		output->renderer->recorder_enabled = 1;
 	}
+	if (!output->renderer->ctx) {
+		if (output->renderer->dmafd >= 0)
+			close(output->renderer->dmafd);
+		return;
+	}
+
+	if (output->renderer->ctx && output->renderer->ctx->pool) {
+		repaint_converted(output);
+		return;
+	}
+
+	/* no DRM backend: push the copy weston made for us */
+	if (output->renderer->dmafd < 0) {
+		gsize size = stride * output->renderer->surface_height;
+
+		gstbuffer = gst_buffer_new_wrapped(
+			g_memdup(output->renderer->shm_data, size), size);
+		trace_frame(output->renderer->ctx, output->renderer, gstbuffer);
+		push_buffer(output->renderer, gstbuffer);
+		return;
+	}
 
 	gstbuffer = gst_buffer_new();
 	allocator = gst_dmabuf_allocator_new();
@@ -246,10 +2057,47 @@ static void waltham_renderer_repaint_output(struct weston_transmitter_output *ou
 				       &offset,
 				       &stride);
 
-	gst_app_src_push_buffer(output->renderer->ctx->appsrc, gstbuffer);
+	trace_frame(output->renderer->ctx, output->renderer, gstbuffer);
+	push_buffer(output->renderer, gstbuffer);
 	gst_object_unref(allocator);
 }
 
+/*
+ * Asks the encoder for a key frame. The request goes up from its source
+ * pad, the way a downstream element would ask; encoders that cannot help
+ * it, jpegenc, simply drop it.
+ *
+ * With mirrors the receivers that lost the same packets all ask at once,
+ * one key frame answers them: requests closer than KEYFRAME_MERGE_MS to the
+ * one passed on are dropped.
+ */
+#define KEYFRAME_MERGE_MS 100
+
+static void
+waltham_renderer_request_keyframe(struct weston_transmitter_output *output)
+{
+	struct GstAppContext *ctx = output->renderer->ctx;
+	uint64_t now = wth_stream_now_us();
+	GstPad *pad;
+
+	if (!ctx || !ctx->encoder)
+		return;
+
+	if (ctx->keyframe_at && now - ctx->keyframe_at < KEYFRAME_MERGE_MS * 1000)
+		return;
+	ctx->keyframe_at = now;
+
+	pad = gst_element_get_static_pad(ctx->encoder, "src");
+	if (!pad)
+		return;
+
+	gst_pad_send_event(pad,
+		gst_video_event_new_upstream_force_key_unit(GST_CLOCK_TIME_NONE,
+							    TRUE,
+							    ++ctx->keyframes));
+	gst_object_unref(pad);
+}
+
 static int
 waltham_renderer_display_create(struct weston_transmitter_output *output)
 {
@@ -259,6 +2107,9 @@ waltham_renderer_display_create(struct weston_transmitter_output *output)
 	if (wth_renderer == NULL)
 		return -1;
 	wth_renderer->base.repaint_output = waltham_renderer_repaint_output;
+	wth_renderer->base.request_keyframe = waltham_renderer_request_keyframe;
+	pixman_region32_init(&wth_renderer->base.damage);
+	pixman_region32_init(&wth_renderer->base.covered);
 
 	output->renderer = &wth_renderer->base;
 
@@ -266,5 +2117,10 @@ waltham_renderer_display_create(struct weston_transmitter_output *output)
 }
 
 WL_EXPORT struct waltham_renderer_interface waltham_renderer_interface = {
-		.display_create = waltham_renderer_display_create
+		.display_create = waltham_renderer_display_create,
+		.stream_negotiate = waltham_renderer_stream_negotiate,
+		.probe = waltham_renderer_probe,
+		.mirror_add = waltham_renderer_mirror_add,
+		.mirror_remove = waltham_renderer_mirror_remove,
+		.replay = waltham_renderer_replay
 };
@@ -26,16 +26,77 @@
 #ifndef TRANSMITTER_WALTHAM_RENDERER_H_
 #define TRANSMITTER_WALTHAM_RENDERER_H_
 
+struct weston_transmitter_output;
+struct weston_transmitter_remote;
+struct wth_stream_config;
+
 struct waltham_renderer_interface {
 	int (*display_create)(struct weston_transmitter_output *output);
+
+	/** Pick the stream parameters for a remote
+	 *
+	 * \param remote The remote, with the receiver's caps filled in.
+	 * \param config Filled in with the codec the encoder will use.
+	 * \return 0 on success, -1 if no encoder matches the receiver.
+	 */
+	int (*stream_negotiate)(struct weston_transmitter_remote *remote,
+				struct wth_stream_config *config);
+
+	/** Look up the encoders and converters GStreamer has, once. */
+	void (*probe)(void);
+
+	/** Send the stream of an output to another remote as well
+	 *
+	 * See mirror-of in weston.ini. Before the output's first frame there
+	 * is no pipeline yet, it picks up the mirrors when it is built.
+	 *
+	 * \param output The output whose encoder is shared.
+	 * \param remote The mirror, with its stream config negotiated.
+	 * \return 0 on success, -1 if the pipeline cannot fan out.
+	 */
+	int (*mirror_add)(struct weston_transmitter_output *output,
+			  struct weston_transmitter_remote *remote);
+
+	/** Stop sending to a mirror, it disconnected. */
+	void (*mirror_remove)(struct weston_transmitter_output *output,
+			      struct weston_transmitter_remote *remote);
+
+	/**
+	 * Send a receiver that joined the multicast group the packets since
+	 * the last key frame, to its join port.
+	 *
+	 * \param output The output streaming to the group.
+	 * \param remote The receiver that joined.
+	 * \return 0 on success, -1 if nothing is cached.
+	 */
+	int (*replay)(struct weston_transmitter_output *output,
+		      struct weston_transmitter_remote *remote);
 };
 
 struct gst_settings {
 	int width;
 	int height;
 	int bitrate;
+	int min_bitrate;	/* range of the bitrate control, bps */
+	int max_bitrate;
 	char *ip;
 	int port;
+	const char *format;	/* what is pushed into appsrc */
+	const char *encoder;	/* from weston.ini, NULL: cheapest */
+	const char *converter;	/* same, NULL: the encoder's own */
+	const char *convert;	/* set if the renderer converts, to this */
+
+	/* the part of the surface encoded, and the size it is encoded at */
+	int crop_x;
+	int crop_y;
+	int crop_width;
+	int crop_height;
+	int out_width;
+	int out_height;
+
+	bool roi;		/* damage as regions of interest */
+	bool quality;		/* decode again and log the Y-PSNR */
+	bool fanout;		/* there are mirrors, tee after the payloader */
 };
 
 #endif /* TRANSMITTER_WALTHAM_RENDERER_H_ */
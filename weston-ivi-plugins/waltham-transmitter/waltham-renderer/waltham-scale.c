@@ -0,0 +1,237 @@
+/*
+ * Copyright (C) 2017 Advanced Driver Information Technology GmbH, Advanced Driver Information Technology Corporation, Robert Bosch GmbH, Robert Bosch Car Multimedia GmbH, DENSO Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h>
+
+#if defined(__x86_64__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "waltham-scale.h"
+
+/*
+ * Weights of the source pixels covered by each of n output pixels, from
+ * src_n source pixels. Lengths are in 1/n of a source pixel, so that the
+ * edges of the areas fall on whole units.
+ */
+static int
+axis_init(struct wth_scale_axis *axis, int src_n, int n)
+{
+	int i, j, t, a, b, left;
+
+	/* an area of src_n / n pixels touches at most this many */
+	axis->taps = (src_n + n - 1) / n + 1;
+	axis->first = calloc(n, sizeof *axis->first);
+	axis->weights = calloc((size_t)n * axis->taps, sizeof *axis->weights);
+	if (!axis->first || !axis->weights)
+		return -1;
+
+	for (i = 0; i < n; i++) {
+		uint16_t *w = axis->weights + (size_t)i * axis->taps;
+
+		/* output pixel i covers [a, b), each source pixel n units */
+		a = i * src_n;
+		b = a + src_n;
+		axis->first[i] = a / n;
+		left = 256;
+		for (t = 0, j = a / n; j * n < b && t < axis->taps; t++, j++) {
+			int lo = j * n > a ? j * n : a;
+			int hi = (j + 1) * n < b ? (j + 1) * n : b;
+
+			w[t] = (hi - lo) * 256 / src_n;
+			left -= w[t];
+		}
+		/* rounding leftovers go to the first tap, 256 in all */
+		w[0] += left;
+	}
+
+	return 0;
+}
+
+static void
+axis_fini(struct wth_scale_axis *axis)
+{
+	free(axis->first);
+	free(axis->weights);
+	axis->first = NULL;
+	axis->weights = NULL;
+}
+
+int
+wth_scale_init(struct wth_scale *sc, int src_x, int src_y,
+	       int src_width, int src_height, int width, int height)
+{
+	sc->src_x = src_x;
+	sc->src_y = src_y;
+	sc->src_width = src_width;
+	sc->src_height = src_height;
+	sc->width = width;
+	sc->height = height;
+	sc->h.first = sc->v.first = NULL;
+	sc->h.weights = sc->v.weights = NULL;
+	sc->row = NULL;
+
+	if (width <= 0 || height <= 0 ||
+	    width > src_width || height > src_height)
+		return -1;
+
+	sc->row = calloc((size_t)src_width * 4, sizeof *sc->row);
+	if (!sc->row ||
+	    axis_init(&sc->h, src_width, width) < 0 ||
+	    axis_init(&sc->v, src_height, height) < 0) {
+		wth_scale_fini(sc);
+		return -1;
+	}
+
+	return 0;
+}
+
+void
+wth_scale_fini(struct wth_scale *sc)
+{
+	axis_fini(&sc->h);
+	axis_fini(&sc->v);
+	free(sc->row);
+	sc->row = NULL;
+}
+
+/*
+ * row = w * src, or row += w * src; n bytes. With weights summing to 256
+ * no sum exceeds 16 bits. The bulk of the work, and vectorized.
+ */
+static void
+scale_rows(uint16_t *row, const uint8_t *src, int n, uint16_t w, int add)
+{
+	int i = 0;
+
+#if defined(__x86_64__)
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i vw = _mm_set1_epi16(w);
+
+	for (; i + 16 <= n; i += 16) {
+		__m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+		__m128i lo = _mm_mullo_epi16(_mm_unpacklo_epi8(s, zero), vw);
+		__m128i hi = _mm_mullo_epi16(_mm_unpackhi_epi8(s, zero), vw);
+
+		if (add) {
+			lo = _mm_add_epi16(lo, _mm_loadu_si128((__m128i *)(row + i)));
+			hi = _mm_add_epi16(hi, _mm_loadu_si128((__m128i *)(row + i + 8)));
+		}
+		_mm_storeu_si128((__m128i *)(row + i), lo);
+		_mm_storeu_si128((__m128i *)(row + i + 8), hi);
+	}
+#elif defined(__ARM_NEON)
+	const uint8x8_t vw = vdup_n_u8(w < 256 ? w : 255);
+
+	/* a weight of 256, a 1:1 row, does not fit the 8 bit multiply */
+	for (; w < 256 && i + 16 <= n; i += 16) {
+		uint8x16_t s = vld1q_u8(src + i);
+		uint16x8_t lo, hi;
+
+		if (add) {
+			lo = vmlal_u8(vld1q_u16(row + i), vget_low_u8(s), vw);
+			hi = vmlal_u8(vld1q_u16(row + i + 8), vget_high_u8(s), vw);
+		} else {
+			lo = vmull_u8(vget_low_u8(s), vw);
+			hi = vmull_u8(vget_high_u8(s), vw);
+		}
+		vst1q_u16(row + i, lo);
+		vst1q_u16(row + i + 8, hi);
+	}
+#endif
+
+	for (; i < n; i++)
+		row[i] = (add ? row[i] : 0) + src[i] * w;
+}
+
+/* one output pixel from its taps along the row, rounded */
+static inline void
+scale_pixel(const uint16_t *r, const uint16_t *w, int taps, uint8_t *d)
+{
+	int t;
+
+#if defined(__x86_64__)
+	__m128i sum = _mm_set1_epi32(1 << 15);
+
+	for (t = 0; t < taps && w[t]; t++, r += 4) {
+		__m128i px = _mm_loadl_epi64((const __m128i *)r);
+		__m128i vw = _mm_set1_epi16(w[t]);
+
+		/* 16 x 16 bits unsigned, low and high halves */
+		sum = _mm_add_epi32(sum, _mm_unpacklo_epi16(_mm_mullo_epi16(px, vw),
+							    _mm_mulhi_epu16(px, vw)));
+	}
+	sum = _mm_srli_epi32(sum, 16);
+	sum = _mm_packs_epi32(sum, sum);
+	*(uint32_t *)d = _mm_cvtsi128_si32(_mm_packus_epi16(sum, sum));
+#elif defined(__ARM_NEON)
+	uint32x4_t sum = vdupq_n_u32(1 << 15);
+
+	for (t = 0; t < taps && w[t]; t++, r += 4)
+		sum = vmlal_n_u16(sum, vld1_u16(r), w[t]);
+	vst1_lane_u32((uint32_t *)d,
+		      vreinterpret_u32_u8(vmovn_u16(vcombine_u16(vshrn_n_u32(sum, 16),
+								 vdup_n_u16(0)))),
+		      0);
+#else
+	uint32_t sum[4] = { 1 << 15, 1 << 15, 1 << 15, 1 << 15 };
+	int c;
+
+	for (t = 0; t < taps && w[t]; t++, r += 4)
+		for (c = 0; c < 4; c++)
+			sum[c] += w[t] * r[c];
+
+	for (c = 0; c < 4; c++)
+		d[c] = sum[c] >> 16;
+#endif
+}
+
+void
+wth_scale_frame(const struct wth_scale *sc,
+		const uint8_t *src, int src_stride,
+		uint8_t *dst, int dst_stride)
+{
+	const uint8_t *origin = src + (size_t)sc->src_y * src_stride +
+		sc->src_x * 4;
+	int x, y, t, n = sc->src_width * 4;
+
+	for (y = 0; y < sc->height; y++) {
+		const uint16_t *vw = sc->v.weights + (size_t)y * sc->v.taps;
+		const uint8_t *s = origin + (size_t)sc->v.first[y] * src_stride;
+		uint8_t *d = dst + (size_t)y * dst_stride;
+
+		/* rows first, the taps past the edge have no weight */
+		scale_rows(sc->row, s, n, vw[0], 0);
+		for (t = 1; t < sc->v.taps && vw[t]; t++)
+			scale_rows(sc->row, s + (size_t)t * src_stride, n, vw[t], 1);
+
+		for (x = 0; x < sc->width; x++)
+			scale_pixel(sc->row + sc->h.first[x] * 4,
+				    sc->h.weights + (size_t)x * sc->h.taps,
+				    sc->h.taps, d + x * 4);
+	}
+}
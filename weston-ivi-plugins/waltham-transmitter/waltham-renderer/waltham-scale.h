@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2017 Advanced Driver Information Technology GmbH, Advanced Driver Information Technology Corporation, Robert Bosch GmbH, Robert Bosch Car Multimedia GmbH, DENSO Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef TRANSMITTER_WALTHAM_SCALE_H_
+#define TRANSMITTER_WALTHAM_SCALE_H_
+
+#include <stdint.h>
+
+/*
+ * Box filter downscaling of 4 byte pixels, BGRx or RGBA alike: each
+ * output pixel is the average of the source area it covers. Separable,
+ * rows first, with 8 bit weights.
+ */
+struct wth_scale_axis {
+	int *first;		/* first source pixel of each output pixel */
+	uint16_t *weights;	/* taps per output pixel, summing to 256 */
+	int taps;
+};
+
+struct wth_scale {
+	int src_x, src_y;	/* source rectangle */
+	int src_width, src_height;
+	int width, height;	/* output */
+	struct wth_scale_axis h, v;
+	uint16_t *row;		/* source rectangle row, weighted sum */
+};
+
+/** Set up scaling a source rectangle down to width x height.
+ *
+ * \return 0 on success, -1 on allocation failure or if it would not
+ * be a downscale.
+ */
+int
+wth_scale_init(struct wth_scale *sc, int src_x, int src_y,
+	       int src_width, int src_height, int width, int height);
+
+void
+wth_scale_fini(struct wth_scale *sc);
+
+void
+wth_scale_frame(const struct wth_scale *sc,
+		const uint8_t *src, int src_stride,
+		uint8_t *dst, int dst_stride);
+
+#endif /* TRANSMITTER_WALTHAM_SCALE_H_ */
@@ -0,0 +1,716 @@
+/*
+ * Copyright (C) 2017 Advanced Driver Information Technology GmbH, Advanced Driver Information Technology Corporation, Robert Bosch GmbH, Robert Bosch Car Multimedia GmbH, DENSO Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef WALTHAM_STREAM_H_
+#define WALTHAM_STREAM_H_
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+/** \file
+ *
+ * Stream parameters shared by waltham-transmitter and waltham-receiver.
+ *
+ * The waltham protocol has no messages for the media stream, so both sides
+ * piggy-back on what is already there:
+ *
+ * - the receiver advertises what it can decode as extra globals on
+ *   wthp_registry, with the value packed into the global's version;
+ * - the transmitter answers with a wthp_blob_factory buffer whose format is
+ *   one of the WTH_STREAM_BLOB_* codes instead of a pixel format.
+ *
+ * Peers which do not know about these simply ignore them, and fall back to
+ * the static pipeline files.
+ */
+
+/** Codecs, used both as a single value and as a bitmask */
+enum wth_stream_codec {
+	WTH_STREAM_CODEC_NONE = 0,
+	WTH_STREAM_CODEC_JPEG = 1 << 0,
+	WTH_STREAM_CODEC_H264 = 1 << 1,
+	WTH_STREAM_CODEC_RAW  = 1 << 2,	/* WTH_STREAM_BLOB_RAW, no RTP */
+};
+
+/* RTP payload types used for each codec */
+#define WTH_STREAM_PAYLOAD_JPEG 26
+#define WTH_STREAM_PAYLOAD_H264 96
+
+/* RTCP: the receiver takes sender reports on the stream port + 1 and sends
+ * its receiver reports to wth_stream_config.rtcp_port on the transmitter */
+#define WTH_STREAM_RTCP_PORT(port) ((port) + 1)
+#define WTH_STREAM_RTCP_INTERVAL_MS 500	/* minimum, both ends */
+
+/* Receiver -> transmitter: registry globals, value in 'version' */
+#define WTH_STREAM_GLOBAL_CODECS  "wthp_stream_codecs"  /* codec bitmask */
+#define WTH_STREAM_GLOBAL_DISPLAY "wthp_stream_display" /* width << 16 | height */
+#define WTH_STREAM_GLOBAL_PORT    "wthp_stream_port"    /* UDP port */
+#define WTH_STREAM_GLOBAL_CLOCK   "wthp_stream_clock"   /* 1: answers pings */
+#define WTH_STREAM_GLOBAL_ATLAS   "wthp_stream_atlas"   /* 1: splits atlases */
+#define WTH_STREAM_GLOBAL_MULTICAST "wthp_stream_multicast" /* 1: joins groups */
+
+#define WTH_STREAM_DISPLAY_PACK(w, h) \
+	((((uint32_t)(w) & 0xffff) << 16) | ((uint32_t)(h) & 0xffff))
+#define WTH_STREAM_DISPLAY_WIDTH(v)  ((int32_t)(((v) >> 16) & 0xffff))
+#define WTH_STREAM_DISPLAY_HEIGHT(v) ((int32_t)((v) & 0xffff))
+
+/* Transmitter -> receiver: blob formats */
+#define WTH_STREAM_FOURCC(a, b, c, d) \
+	((uint32_t)(a) | ((uint32_t)(b) << 8) | \
+	 ((uint32_t)(c) << 16) | ((uint32_t)(d) << 24))
+
+#define WTH_STREAM_BLOB_CONFIG WTH_STREAM_FOURCC('W', 'S', 'C', 'F')
+#define WTH_STREAM_BLOB_PING   WTH_STREAM_FOURCC('W', 'S', 'P', 'G')
+#define WTH_STREAM_BLOB_ATLAS  WTH_STREAM_FOURCC('W', 'S', 'A', 'T')
+
+/** What the receiver can take, as advertised through the registry */
+struct wth_stream_caps {
+	uint32_t codecs;	/* enum wth_stream_codec bitmask */
+	int32_t width;		/* display size, 0 if unknown */
+	int32_t height;
+	uint32_t port;		/* UDP port for the media stream */
+	uint32_t clock;		/* answers WTH_STREAM_BLOB_PING */
+	uint32_t atlas;		/* takes wth_stream_config.atlas */
+	uint32_t multicast;	/* takes wth_stream_config.multicast */
+};
+
+/** What the transmitter will send, as chosen from wth_stream_caps */
+struct wth_stream_config {
+	uint32_t codec;		/* a single enum wth_stream_codec */
+	uint32_t payload;	/* RTP payload type */
+	uint32_t port;		/* UDP port for the media stream */
+	int32_t width;		/* size the stream is meant for */
+	int32_t height;
+	uint32_t rtcp_port;	/* where the transmitter takes RTCP receiver
+				 * reports, 0 if it does not use RTCP */
+	uint32_t overlay;	/* WTH_STREAM_CODEC_RAW: raw blobs of the
+				 * lossless tiles go over the stream, with
+				 * the others transparent; 0 if none */
+	uint32_t atlas;		/* 1: the frames are atlases of small
+				 * surfaces, see WTH_STREAM_BLOB_ATLAS */
+	uint32_t multicast;	/* IPv4 group the stream goes to, on port,
+				 * host byte order; 0 for unicast */
+	uint32_t join_port;	/* multicast: where the receiver takes the
+				 * packets since the last key frame when it
+				 * joins, unicast */
+};
+
+/* The blob is an array of 32-bit words in network byte order. The first
+ * word is the number of words, so that fields can be appended without
+ * breaking older peers: missing fields read as 0.
+ */
+#define WTH_STREAM_CONFIG_WORDS 11
+
+static inline void
+wth_stream_put_word(void *data, uint32_t i, uint32_t value)
+{
+	uint32_t w = htonl(value);
+
+	memcpy((uint8_t *)data + i * sizeof w, &w, sizeof w);
+}
+
+static inline uint32_t
+wth_stream_get_word(const void *data, uint32_t n, uint32_t i)
+{
+	uint32_t w;
+
+	if (i >= n)
+		return 0;
+
+	memcpy(&w, (const uint8_t *)data + i * sizeof w, sizeof w);
+	return ntohl(w);
+}
+
+static inline uint32_t
+wth_stream_config_pack(const struct wth_stream_config *cfg, void *data)
+{
+	wth_stream_put_word(data, 0, WTH_STREAM_CONFIG_WORDS);
+	wth_stream_put_word(data, 1, cfg->codec);
+	wth_stream_put_word(data, 2, cfg->payload);
+	wth_stream_put_word(data, 3, cfg->port);
+	wth_stream_put_word(data, 4, (uint32_t)cfg->width);
+	wth_stream_put_word(data, 5, (uint32_t)cfg->height);
+	wth_stream_put_word(data, 6, cfg->rtcp_port);
+	wth_stream_put_word(data, 7, cfg->overlay);
+	wth_stream_put_word(data, 8, cfg->atlas);
+	wth_stream_put_word(data, 9, cfg->multicast);
+	wth_stream_put_word(data, 10, cfg->join_port);
+
+	return WTH_STREAM_CONFIG_WORDS * sizeof(uint32_t);
+}
+
+static inline int
+wth_stream_config_unpack(struct wth_stream_config *cfg,
+			 const void *data, uint32_t size)
+{
+	uint32_t n;
+
+	memset(cfg, 0, sizeof *cfg);
+	if (!data || size < sizeof(uint32_t))
+		return -1;
+
+	n = wth_stream_get_word(data, 1, 0);
+	if (n == 0 || n > size / sizeof(uint32_t))
+		return -1;
+
+	cfg->codec = wth_stream_get_word(data, n, 1);
+	cfg->payload = wth_stream_get_word(data, n, 2);
+	cfg->port = wth_stream_get_word(data, n, 3);
+	cfg->width = (int32_t)wth_stream_get_word(data, n, 4);
+	cfg->height = (int32_t)wth_stream_get_word(data, n, 5);
+	cfg->rtcp_port = wth_stream_get_word(data, n, 6);
+	cfg->overlay = wth_stream_get_word(data, n, 7);
+	cfg->atlas = wth_stream_get_word(data, n, 8);
+	cfg->multicast = wth_stream_get_word(data, n, 9);
+	cfg->join_port = wth_stream_get_word(data, n, 10);
+
+	return 0;
+}
+
+/* Clock offset estimation, NTP style.
+ *
+ * The transmitter sends a WTH_STREAM_BLOB_PING blob with its send time t1,
+ * and its current estimate of the offset between the two clocks so that the
+ * receiver can use it as well. The receiver answers right away with a
+ * registry global event: the name is the ping's sequence number and the
+ * interface is WTH_STREAM_GLOBAL_PONG followed by t1, the time the ping was
+ * read (t2) and the time the answer was sent (t3), all in microseconds of
+ * CLOCK_MONOTONIC. Peers which do not know about it ignore the global.
+ */
+#define WTH_STREAM_GLOBAL_PONG "wthp_stream_pong"
+#define WTH_STREAM_PING_WORDS 7
+
+struct wth_stream_ping {
+	uint32_t seq;
+	uint64_t sent;		/* t1, on the transmitter's clock */
+	int64_t offset;		/* receiver clock - transmitter clock */
+	uint32_t valid;		/* whether offset is known yet */
+};
+
+static inline uint32_t
+wth_stream_ping_pack(const struct wth_stream_ping *ping, void *data)
+{
+	wth_stream_put_word(data, 0, WTH_STREAM_PING_WORDS);
+	wth_stream_put_word(data, 1, ping->seq);
+	wth_stream_put_word(data, 2, (uint32_t)(ping->sent >> 32));
+	wth_stream_put_word(data, 3, (uint32_t)ping->sent);
+	wth_stream_put_word(data, 4, (uint32_t)((uint64_t)ping->offset >> 32));
+	wth_stream_put_word(data, 5, (uint32_t)ping->offset);
+	wth_stream_put_word(data, 6, ping->valid);
+
+	return WTH_STREAM_PING_WORDS * sizeof(uint32_t);
+}
+
+static inline int
+wth_stream_ping_unpack(struct wth_stream_ping *ping,
+		       const void *data, uint32_t size)
+{
+	uint32_t n;
+
+	memset(ping, 0, sizeof *ping);
+	if (!data || size < sizeof(uint32_t))
+		return -1;
+
+	n = wth_stream_get_word(data, 1, 0);
+	if (n == 0 || n > size / sizeof(uint32_t))
+		return -1;
+
+	ping->seq = wth_stream_get_word(data, n, 1);
+	ping->sent = (uint64_t)wth_stream_get_word(data, n, 2) << 32 |
+		     wth_stream_get_word(data, n, 3);
+	ping->offset = (int64_t)((uint64_t)wth_stream_get_word(data, n, 4) << 32 |
+				 wth_stream_get_word(data, n, 5));
+	ping->valid = wth_stream_get_word(data, n, 6);
+
+	return 0;
+}
+
+/* Writes the interface string of a pong, returns its length */
+static inline int
+wth_stream_pong_format(char *buf, size_t size,
+		       uint64_t t1, uint64_t t2, uint64_t t3)
+{
+	return snprintf(buf, size, "%s %" PRIu64 " %" PRIu64 " %" PRIu64,
+			WTH_STREAM_GLOBAL_PONG, t1, t2, t3);
+}
+
+static inline int
+wth_stream_pong_parse(const char *interface,
+		      uint64_t *t1, uint64_t *t2, uint64_t *t3)
+{
+	size_t len = strlen(WTH_STREAM_GLOBAL_PONG);
+
+	if (strncmp(interface, WTH_STREAM_GLOBAL_PONG, len) != 0 ||
+	    interface[len] != ' ')
+		return -1;
+
+	if (sscanf(interface + len, " %" SCNu64 " %" SCNu64 " %" SCNu64,
+		   t1, t2, t3) != 3)
+		return -1;
+
+	return 0;
+}
+
+/* Receiver -> transmitter: a registry global event asking for a key frame
+ * right away, e.g. after packet loss or when the receiver joins a running
+ * stream. The name counts the requests, the version is 1.
+ */
+#define WTH_STREAM_GLOBAL_KEYFRAME "wthp_stream_keyframe"
+
+/* Per-frame trace, sent by the transmitter in an RTP one-byte header
+ * extension on every packet of the frame:
+ *
+ *   frame (32) | capture (64) | capture_dur (16) | encode_dur (16)
+ *
+ * in network byte order, durations in units of 10 us (saturating).
+ * Times are CLOCK_MONOTONIC in microseconds, on the transmitter's clock.
+ */
+#define WTH_STREAM_TRACE_EXT_ID 1
+#define WTH_STREAM_TRACE_SIZE 16
+#define WTH_STREAM_TRACE_UNIT 10
+
+struct wth_stream_trace {
+	uint32_t frame;		/* from 1, 0 when there is no trace */
+	uint64_t capture;	/* when the compositor handed out the frame */
+	uint32_t capture_dur;	/* until the pixels were in the encoder's queue */
+	uint32_t encode_dur;	/* until the first packet left the payloader */
+};
+
+static inline uint64_t
+wth_stream_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static inline uint16_t
+wth_stream_trace_dur(uint32_t us)
+{
+	us /= WTH_STREAM_TRACE_UNIT;
+	return us > 0xffff ? 0xffff : us;
+}
+
+static inline void
+wth_stream_trace_pack(const struct wth_stream_trace *trace, uint8_t *data)
+{
+	uint32_t w;
+	uint16_t h;
+
+	w = htonl(trace->frame);
+	memcpy(data, &w, 4);
+	w = htonl((uint32_t)(trace->capture >> 32));
+	memcpy(data + 4, &w, 4);
+	w = htonl((uint32_t)trace->capture);
+	memcpy(data + 8, &w, 4);
+	h = htons(wth_stream_trace_dur(trace->capture_dur));
+	memcpy(data + 12, &h, 2);
+	h = htons(wth_stream_trace_dur(trace->encode_dur));
+	memcpy(data + 14, &h, 2);
+}
+
+static inline int
+wth_stream_trace_unpack(struct wth_stream_trace *trace,
+			const uint8_t *data, unsigned int size)
+{
+	uint32_t hi, lo;
+	uint16_t h;
+
+	memset(trace, 0, sizeof *trace);
+	if (size < WTH_STREAM_TRACE_SIZE)
+		return -1;
+
+	memcpy(&lo, data, 4);
+	trace->frame = ntohl(lo);
+	memcpy(&hi, data + 4, 4);
+	memcpy(&lo, data + 8, 4);
+	trace->capture = (uint64_t)ntohl(hi) << 32 | ntohl(lo);
+	memcpy(&h, data + 12, 2);
+	trace->capture_dur = (uint32_t)ntohs(h) * WTH_STREAM_TRACE_UNIT;
+	memcpy(&h, data + 14, 2);
+	trace->encode_dur = (uint32_t)ntohs(h) * WTH_STREAM_TRACE_UNIT;
+
+	return 0;
+}
+
+/* Transmitter -> receiver, codec WTH_STREAM_CODEC_RAW: the damaged
+ * rectangles of a surface in a wthp_blob_factory buffer attached to the
+ * wthp_surface it belongs to. The blob is
+ *
+ *   header words | rect words for each rect | the rects' data, in order
+ *
+ * The header starts with its own length in words like the other blobs, and
+ * gives the number of words per rect; fields missing from either read as 0.
+ * The pixels are XRGB8888 in memory order B, G, R, X, and each rect's data
+ * is in one of the WTH_STREAM_RAW_* encodings below.
+ *
+ * The receiver keeps the whole surface and patches the rects into it, so
+ * the first blob, and the first after a resize, cover the whole surface.
+ * It answers every blob with wthp_buffer.complete once applied, which is
+ * what limits the blobs in flight on the transmitter.
+ */
+#define WTH_STREAM_BLOB_RAW WTH_STREAM_FOURCC('W', 'S', 'R', 'W')
+#define WTH_STREAM_RAW_WORDS 10
+#define WTH_STREAM_RAW_RECT_WORDS 6
+#define WTH_STREAM_RAW_MAX_RECTS 64
+#define WTH_STREAM_RAW_BPP 4
+
+enum wth_stream_raw_encoding {
+	/* LZ4 block of the rows, tightly packed; a size of width * height * 4
+	 * means stored as they are, they would not have compressed */
+	WTH_STREAM_RAW_LZ4 = 0,
+	/* XOR against the same rect of the surface as the receiver has it,
+	 * run-length encoded, see wth_stream_xor_rle_apply() */
+	WTH_STREAM_RAW_XOR_RLE = 1,
+};
+
+struct wth_stream_raw {
+	int32_t width;		/* of the surface */
+	int32_t height;
+	uint32_t rects;		/* up to WTH_STREAM_RAW_MAX_RECTS */
+	struct wth_stream_trace trace;	/* encode_dur: compression */
+};
+
+struct wth_stream_raw_rect {
+	int32_t x, y, width, height;
+	uint32_t size;		/* bytes of data */
+	uint32_t encoding;	/* enum wth_stream_raw_encoding */
+};
+
+static inline uint32_t
+wth_stream_raw_pack(const struct wth_stream_raw *raw, void *data)
+{
+	wth_stream_put_word(data, 0, WTH_STREAM_RAW_WORDS);
+	wth_stream_put_word(data, 1, (uint32_t)raw->width);
+	wth_stream_put_word(data, 2, (uint32_t)raw->height);
+	wth_stream_put_word(data, 3, raw->rects);
+	wth_stream_put_word(data, 4, raw->trace.frame);
+	wth_stream_put_word(data, 5, (uint32_t)(raw->trace.capture >> 32));
+	wth_stream_put_word(data, 6, (uint32_t)raw->trace.capture);
+	wth_stream_put_word(data, 7, raw->trace.capture_dur);
+	wth_stream_put_word(data, 8, raw->trace.encode_dur);
+	wth_stream_put_word(data, 9, WTH_STREAM_RAW_RECT_WORDS);
+
+	return WTH_STREAM_RAW_WORDS * sizeof(uint32_t);
+}
+
+/* rect i of a blob packed with wth_stream_raw_pack() */
+static inline void
+wth_stream_raw_rect_pack(const struct wth_stream_raw_rect *rect,
+			 void *data, uint32_t i)
+{
+	uint32_t w = WTH_STREAM_RAW_WORDS + i * WTH_STREAM_RAW_RECT_WORDS;
+
+	wth_stream_put_word(data, w, (uint32_t)rect->x);
+	wth_stream_put_word(data, w + 1, (uint32_t)rect->y);
+	wth_stream_put_word(data, w + 2, (uint32_t)rect->width);
+	wth_stream_put_word(data, w + 3, (uint32_t)rect->height);
+	wth_stream_put_word(data, w + 4, rect->size);
+	wth_stream_put_word(data, w + 5, rect->encoding);
+}
+
+/* bytes from the start of a blob we pack to the first rect's data */
+static inline uint32_t
+wth_stream_raw_data_offset(uint32_t rects)
+{
+	return (WTH_STREAM_RAW_WORDS + rects * WTH_STREAM_RAW_RECT_WORDS) *
+		sizeof(uint32_t);
+}
+
+/*
+ * Returns the offset of the first rect's data in bytes, 0 if the blob is
+ * not valid. The rects are checked against the surface, and their data
+ * against the blob size.
+ */
+static inline uint32_t
+wth_stream_raw_unpack(struct wth_stream_raw *raw,
+		      struct wth_stream_raw_rect *rects,
+		      const void *data, uint32_t size)
+{
+	uint32_t n, m, i, w, words, end;
+
+	memset(raw, 0, sizeof *raw);
+	if (!data || size < sizeof(uint32_t))
+		return 0;
+
+	n = wth_stream_get_word(data, 1, 0);
+	if (n < 4 || n > size / sizeof(uint32_t))
+		return 0;
+
+	raw->width = (int32_t)wth_stream_get_word(data, n, 1);
+	raw->height = (int32_t)wth_stream_get_word(data, n, 2);
+	raw->rects = wth_stream_get_word(data, n, 3);
+	raw->trace.frame = wth_stream_get_word(data, n, 4);
+	raw->trace.capture = (uint64_t)wth_stream_get_word(data, n, 5) << 32 |
+			     wth_stream_get_word(data, n, 6);
+	raw->trace.capture_dur = wth_stream_get_word(data, n, 7);
+	raw->trace.encode_dur = wth_stream_get_word(data, n, 8);
+	/* 0: blobs from before the encodings, 5 words without one */
+	m = wth_stream_get_word(data, n, 9);
+	if (!m)
+		m = 5;
+
+	if (raw->width <= 0 || raw->height <= 0 || m < 5 || m > 64 ||
+	    raw->rects > WTH_STREAM_RAW_MAX_RECTS)
+		return 0;
+
+	words = n + raw->rects * m;
+	if (words > size / sizeof(uint32_t))
+		return 0;
+	end = words * sizeof(uint32_t);
+
+	for (i = 0; i < raw->rects; i++) {
+		w = n + i * m;
+		rects[i].x = (int32_t)wth_stream_get_word(data, words, w);
+		rects[i].y = (int32_t)wth_stream_get_word(data, words, w + 1);
+		rects[i].width = (int32_t)wth_stream_get_word(data, words, w + 2);
+		rects[i].height = (int32_t)wth_stream_get_word(data, words, w + 3);
+		rects[i].size = wth_stream_get_word(data, words, w + 4);
+		rects[i].encoding = m > 5 ?
+			wth_stream_get_word(data, words, w + 5) : WTH_STREAM_RAW_LZ4;
+
+		if (rects[i].x < 0 || rects[i].y < 0 ||
+		    rects[i].width <= 0 || rects[i].height <= 0 ||
+		    rects[i].width > raw->width - rects[i].x ||
+		    rects[i].height > raw->height - rects[i].y ||
+		    rects[i].size > size - end)
+			return 0;
+		end += rects[i].size;
+	}
+
+	return words * sizeof(uint32_t);
+}
+
+/* WTH_STREAM_RAW_XOR_RLE: the rect's pixels XORed with what the receiver
+ * has, rows concatenated, as a sequence of runs. Each run is a token,
+ * count << 2 | kind as an LEB128 varint, followed by
+ *
+ *   SKIP:    nothing, count pixels are unchanged (XOR 0)
+ *   LITERAL: count 32-bit XOR values
+ *   REPEAT:  one 32-bit XOR value for count pixels
+ *
+ * The values are in the pixels' own byte order. Pixels after the last run
+ * are unchanged.
+ */
+#define WTH_STREAM_RLE_SKIP    0
+#define WTH_STREAM_RLE_LITERAL 1
+#define WTH_STREAM_RLE_REPEAT  2
+
+static inline int
+wth_stream_rle_get_varint(const uint8_t **p, const uint8_t *end,
+			  uint32_t *value)
+{
+	uint32_t v = 0;
+	int shift;
+
+	for (shift = 0; shift < 35 && *p < end; shift += 7) {
+		uint8_t b = *(*p)++;
+
+		v |= (uint32_t)(b & 0x7f) << shift;
+		if (!(b & 0x80)) {
+			*value = v;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+/*
+ * Applies a WTH_STREAM_RAW_XOR_RLE rect to the surface it was encoded
+ * against: dst is the rect's top left pixel, its rows stride bytes apart.
+ * Every count is checked against the pixels left and every value against
+ * the data left, so that no blob, however corrupt, writes outside the rect.
+ * Returns -1 if the data is not a valid encoding of the rect.
+ */
+static inline int
+wth_stream_xor_rle_apply(uint8_t *dst, size_t stride,
+			 uint32_t width, uint32_t height,
+			 const uint8_t *data, uint32_t size)
+{
+	const uint8_t *p = data, *end = data + size;
+	uint32_t left = width * height, x = 0;
+	uint32_t token, kind, count, n, i, value = 0, v;
+	uint8_t *row = dst;
+
+	while (p < end) {
+		if (wth_stream_rle_get_varint(&p, end, &token) < 0)
+			return -1;
+
+		kind = token & 3;
+		count = token >> 2;
+		if (count == 0 || count > left)
+			return -1;
+
+		switch (kind) {
+		case WTH_STREAM_RLE_SKIP:
+			break;
+		case WTH_STREAM_RLE_LITERAL:
+			if ((size_t)(end - p) / 4 < count)
+				return -1;
+			break;
+		case WTH_STREAM_RLE_REPEAT:
+			if (end - p < 4)
+				return -1;
+			memcpy(&value, p, 4);
+			p += 4;
+			break;
+		default:
+			return -1;
+		}
+		left -= count;
+
+		while (count) {
+			n = width - x < count ? width - x : count;
+			for (i = 0; kind != WTH_STREAM_RLE_SKIP && i < n; i++) {
+				if (kind == WTH_STREAM_RLE_LITERAL) {
+					memcpy(&value, p, 4);
+					p += 4;
+				}
+				memcpy(&v, row + (size_t)(x + i) * 4, 4);
+				v ^= value;
+				memcpy(row + (size_t)(x + i) * 4, &v, 4);
+			}
+			x += n;
+			count -= n;
+			if (x == width) {
+				x = 0;
+				row += stride;
+			}
+		}
+	}
+
+	return 0;
+}
+
+/* Transmitter -> receiver, with wth_stream_config.atlas set: where each
+ * surface is in the frames of the media stream. The blob is
+ *
+ *   header words | entry words for each entry
+ *
+ * the header giving its own length in words, the number of entries and
+ * the words per entry. An entry is the ivi id the surface was created with
+ * and its rectangle in the frame; surfaces without one are not in the
+ * atlas. The blob is sent again whenever the layout changes, and places
+ * only change when a surface comes, goes or is resized.
+ */
+#define WTH_STREAM_ATLAS_WORDS 3
+#define WTH_STREAM_ATLAS_ENTRY_WORDS 5
+#define WTH_STREAM_ATLAS_MAX_ENTRIES 64
+
+struct wth_stream_atlas_entry {
+	uint32_t ivi_id;
+	int32_t x, y, width, height;
+};
+
+static inline uint32_t
+wth_stream_atlas_pack(const struct wth_stream_atlas_entry *entries,
+		      uint32_t count, void *data)
+{
+	uint32_t i, w;
+
+	wth_stream_put_word(data, 0, WTH_STREAM_ATLAS_WORDS);
+	wth_stream_put_word(data, 1, count);
+	wth_stream_put_word(data, 2, WTH_STREAM_ATLAS_ENTRY_WORDS);
+
+	for (i = 0; i < count; i++) {
+		w = WTH_STREAM_ATLAS_WORDS + i * WTH_STREAM_ATLAS_ENTRY_WORDS;
+		wth_stream_put_word(data, w, entries[i].ivi_id);
+		wth_stream_put_word(data, w + 1, (uint32_t)entries[i].x);
+		wth_stream_put_word(data, w + 2, (uint32_t)entries[i].y);
+		wth_stream_put_word(data, w + 3, (uint32_t)entries[i].width);
+		wth_stream_put_word(data, w + 4, (uint32_t)entries[i].height);
+	}
+
+	return (WTH_STREAM_ATLAS_WORDS + count * WTH_STREAM_ATLAS_ENTRY_WORDS) *
+		sizeof(uint32_t);
+}
+
+/*
+ * Returns the number of entries, up to WTH_STREAM_ATLAS_MAX_ENTRIES, or -1
+ * if the blob is not valid. Empty rectangles and ones outside of
+ * 0..0xffff are not.
+ */
+static inline int
+wth_stream_atlas_unpack(struct wth_stream_atlas_entry *entries,
+			const void *data, uint32_t size)
+{
+	uint32_t n, m, count, i, w, words;
+	struct wth_stream_atlas_entry *e;
+
+	if (!data || size < sizeof(uint32_t))
+		return -1;
+
+	words = size / sizeof(uint32_t);
+	n = wth_stream_get_word(data, 1, 0);
+	if (n == 0 || n > words)
+		return -1;
+
+	count = wth_stream_get_word(data, n, 1);
+	m = wth_stream_get_word(data, n, 2);
+	/* entries have at least the 5 words read here, and a bounded
+	 * number more, so that n + count * m cannot wrap */
+	if (count > WTH_STREAM_ATLAS_MAX_ENTRIES ||
+	    (count && (m < 5 || m > 64)) ||
+	    (uint64_t)n + (uint64_t)count * m > words)
+		return -1;
+
+	for (i = 0; i < count; i++) {
+		w = n + i * m;
+		e = &entries[i];
+		e->ivi_id = wth_stream_get_word(data, w + m, w);
+		e->x = (int32_t)wth_stream_get_word(data, w + m, w + 1);
+		e->y = (int32_t)wth_stream_get_word(data, w + m, w + 2);
+		e->width = (int32_t)wth_stream_get_word(data, w + m, w + 3);
+		e->height = (int32_t)wth_stream_get_word(data, w + m, w + 4);
+		if (e->x < 0 || e->y < 0 || e->width <= 0 || e->height <= 0 ||
+		    e->x > 0xffff || e->y > 0xffff ||
+		    e->width > 0xffff - e->x || e->height > 0xffff - e->y)
+			return -1;
+	}
+
+	return (int)count;
+}
+
+static inline const char *
+wth_stream_codec_name(uint32_t codec)
+{
+	switch (codec) {
+	case WTH_STREAM_CODEC_JPEG:
+		return "jpeg";
+	case WTH_STREAM_CODEC_H264:
+		return "h264";
+	case WTH_STREAM_CODEC_RAW:
+		return "raw";
+	default:
+		return "none";
+	}
+}
+
+#endif /* WALTHAM_STREAM_H_ */